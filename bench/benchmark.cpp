@@ -0,0 +1,1134 @@
+// ================================================================================================
+// -*- C++ -*-
+// File:   benchmark.cpp
+// Brief:  Throughput, ratio and memory benchmark for the huffman, lz77, lzw, rice, rle and frame codecs
+//         and codec pipelines.
+// ================================================================================================
+//
+// Build from this directory, there are no build files:
+//
+//     g++ -std=c++11 -O2 -I.. benchmark.cpp -o benchmark -lpthread
+//
+// Usage:
+//
+//     ./benchmark [--json] [--iterations N] [--size BYTES] [--slice BYTES] [--codec NAME] [files...]
+//
+// Every codec runs over each file given on the command line (the Silesia and Canterbury
+// corpora or enwik8, say), or over a set of synthetic inputs if there are none. Files
+// larger than --slice are cut down to their first --slice bytes, so a slice of enwik8
+// can be benchmarked on its own. --codec keeps only the codecs whose name contains NAME.
+//
+// Every run is decoded and compared against the input. The exit status is non-zero if
+// any round trip fails, or if a decoder fed corrupt input fails to report an error.
+//
+// Reported figures:
+//  - Ratio is input size over compressed size, so bigger is better.
+//  - MB/s are uncompressed bytes per second, from the best of the timed iterations.
+//  - Cycles per byte come from the time stamp counter, which on most x86 parts ticks at
+//    the nominal clock rate whatever the actual core clock is. Not available elsewhere.
+//  - Peak memory is the most heap the codec held at once across an encode and a decode,
+//    counted through the *_MALLOC/*_MFREE hooks. rle is allocation-free, so it always
+//    reports zero. The benchmark's own input and output buffers aren't counted.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define BENCH_HAVE_RDTSC 1
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define BENCH_HAVE_RDTSC 1
+#else
+#define BENCH_HAVE_RDTSC 0
+#endif
+
+// ========================================================
+// Counting allocator:
+// ========================================================
+
+// Every block gets a small header holding its size, so the free side knows what to take off.
+static constexpr std::size_t AllocHeaderSize = 16;
+
+static std::atomic<std::size_t> heapInUse(0);
+static std::atomic<std::size_t> heapPeak(0);
+
+static void *countingMalloc(const std::size_t sizeBytes)
+{
+    auto *block = static_cast<std::uint8_t *>(std::malloc(sizeBytes + AllocHeaderSize));
+    if (block == nullptr)
+    {
+        std::fprintf(stderr, "benchmark: Out of memory!\n");
+        std::abort();
+    }
+    std::memcpy(block, &sizeBytes, sizeof(sizeBytes));
+
+    const std::size_t inUse = heapInUse.fetch_add(sizeBytes) + sizeBytes;
+    std::size_t peak = heapPeak.load();
+    while (inUse > peak && !heapPeak.compare_exchange_weak(peak, inUse))
+    {
+    }
+    return block + AllocHeaderSize;
+}
+
+static void countingFree(void *ptr)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    auto *block = static_cast<std::uint8_t *>(ptr) - AllocHeaderSize;
+    std::size_t sizeBytes;
+    std::memcpy(&sizeBytes, block, sizeof(sizeBytes));
+    heapInUse.fetch_sub(sizeBytes);
+    std::free(block);
+}
+
+#define HUFFMAN_MALLOC countingMalloc
+#define HUFFMAN_MFREE countingFree
+#define LZ77_MALLOC countingMalloc
+#define LZ77_MFREE countingFree
+#define LZW_MALLOC countingMalloc
+#define LZW_MFREE countingFree
+#define RICE_MALLOC countingMalloc
+#define RICE_MFREE countingFree
+#define FRAME_MALLOC countingMalloc
+#define FRAME_MFREE countingFree
+#define PIPELINE_MALLOC countingMalloc
+#define PIPELINE_MFREE countingFree
+
+#define HUFFMAN_IMPLEMENTATION
+#define LZ77_IMPLEMENTATION
+#define LZW_IMPLEMENTATION
+#define RICE_IMPLEMENTATION
+#define RLE_IMPLEMENTATION
+#define FRAME_IMPLEMENTATION
+#include "frame.hpp"
+#define PIPELINE_IMPLEMENTATION
+#include "pipeline.hpp"
+
+// ========================================================
+// Codec wrappers:
+// ========================================================
+
+// One compressed result. Codecs with a heap easyEncode() hand over their buffer,
+// the rest write to one owned by the benchmark.
+struct Packed
+{
+    std::uint8_t *data = nullptr;
+    std::size_t sizeBytes = 0;
+    int sizeBits = 0;
+    bool onCodecHeap = false;
+};
+
+static void releasePacked(Packed &packed)
+{
+    if (packed.onCodecHeap)
+    {
+        countingFree(packed.data);
+        packed.data = nullptr;
+    }
+}
+
+// Huffman table shared by the table-coded runs, built once per input outside the timed loop.
+static huffman::Table sharedTable;
+constexpr int TableSampleSize = 1 << 16;
+
+// Scratch for the typed Rice runs, which need the input as 16-bit values.
+static std::vector<std::uint16_t> valueScratch;
+
+// Scratch output for the codecs that only write to a caller buffer.
+static std::vector<std::uint8_t> encodeScratch;
+
+static std::uint8_t *scratchOutput(const std::size_t sizeBytes)
+{
+    if (encodeScratch.size() < sizeBytes)
+    {
+        encodeScratch.resize(sizeBytes);
+    }
+    return encodeScratch.data();
+}
+
+struct Codec
+{
+    const char *name;
+    bool (*accepts)(std::size_t inputSizeBytes);
+    bool (*encode)(const std::uint8_t *input, std::size_t inputSizeBytes, Packed *packed);
+    bool (*decode)(const Packed &packed, std::uint8_t *output, std::size_t outputSizeBytes);
+};
+
+static bool anySize(std::size_t)
+{
+    return true;
+}
+
+static bool evenSize(const std::size_t inputSizeBytes)
+{
+    return (inputSizeBytes % 2) == 0;
+}
+
+static bool takeHeapOutput(std::uint8_t *data, const int sizeBytes, const int sizeBits, Packed *packed)
+{
+    packed->data = data;
+    packed->sizeBytes = static_cast<std::size_t>(sizeBytes);
+    packed->sizeBits = sizeBits;
+    packed->onCodecHeap = true;
+    return true;
+}
+
+template<huffman::Format F>
+static bool huffmanEncode(const std::uint8_t *input, const std::size_t inputSizeBytes, Packed *packed)
+{
+    std::uint8_t *data;
+    int sizeBytes, sizeBits;
+    huffman::easyEncode(input, static_cast<int>(inputSizeBytes), &data, &sizeBytes, &sizeBits, F);
+    return takeHeapOutput(data, sizeBytes, sizeBits, packed);
+}
+
+static bool huffmanDecode(const Packed &packed, std::uint8_t *output, const std::size_t outputSizeBytes)
+{
+    const int size = static_cast<int>(outputSizeBytes);
+    return huffman::easyDecode(packed.data, static_cast<int>(packed.sizeBytes), packed.sizeBits, output, size) == size;
+}
+
+static bool huffmanTableEncode(const std::uint8_t *input, const std::size_t inputSizeBytes, Packed *packed)
+{
+    std::uint8_t *data;
+    int sizeBytes, sizeBits;
+    huffman::easyEncode(sharedTable, input, static_cast<int>(inputSizeBytes), &data, &sizeBytes, &sizeBits);
+    return takeHeapOutput(data, sizeBytes, sizeBits, packed);
+}
+
+static bool huffmanTableDecode(const Packed &packed, std::uint8_t *output, const std::size_t outputSizeBytes)
+{
+    const int size = static_cast<int>(outputSizeBytes);
+    return huffman::easyDecode(sharedTable, packed.data, static_cast<int>(packed.sizeBytes),
+                               packed.sizeBits, output, size) == size;
+}
+
+template<int Level, lz77::Entropy E>
+static bool lz77Encode(const std::uint8_t *input, const std::size_t inputSizeBytes, Packed *packed)
+{
+    std::uint8_t *data;
+    int sizeBytes, sizeBits;
+    lz77::easyEncode(input, static_cast<int>(inputSizeBytes), &data, &sizeBytes, &sizeBits,
+                     Level, lz77::DefaultWindowBits, E);
+    return takeHeapOutput(data, sizeBytes, sizeBits, packed);
+}
+
+static bool lz77Decode(const Packed &packed, std::uint8_t *output, const std::size_t outputSizeBytes)
+{
+    const int size = static_cast<int>(outputSizeBytes);
+    return lz77::easyDecode(packed.data, static_cast<int>(packed.sizeBytes), packed.sizeBits, output, size) == size;
+}
+
+template<int MaxBits, lzw::ResetPolicy P>
+static bool lzwEncode(const std::uint8_t *input, const std::size_t inputSizeBytes, Packed *packed)
+{
+    std::uint8_t *data;
+    int sizeBytes, sizeBits;
+    lzw::easyEncode(input, static_cast<int>(inputSizeBytes), &data, &sizeBytes, &sizeBits, MaxBits, P);
+    return takeHeapOutput(data, sizeBytes, sizeBits, packed);
+}
+
+static bool lzwDecode(const Packed &packed, std::uint8_t *output, const std::size_t outputSizeBytes)
+{
+    const int size = static_cast<int>(outputSizeBytes);
+    return lzw::easyDecode(packed.data, static_cast<int>(packed.sizeBytes), packed.sizeBits, output, size) == size;
+}
+
+template<int BlockSize, bool Zigzag, bool Delta>
+static bool riceEncode(const std::uint8_t *input, const std::size_t inputSizeBytes, Packed *packed)
+{
+    std::uint8_t *data;
+    int sizeBytes, sizeBits;
+    rice::easyEncode(input, static_cast<int>(inputSizeBytes), &data, &sizeBytes, &sizeBits, BlockSize, Zigzag, Delta);
+    return takeHeapOutput(data, sizeBytes, sizeBits, packed);
+}
+
+static bool riceDecode(const Packed &packed, std::uint8_t *output, const std::size_t outputSizeBytes)
+{
+    const int size = static_cast<int>(outputSizeBytes);
+    return rice::easyDecode(packed.data, static_cast<int>(packed.sizeBytes), packed.sizeBits, output, size) == size;
+}
+
+// Little-endian 16-bit samples, delta coded.
+static bool riceValuesEncode(const std::uint8_t *input, const std::size_t inputSizeBytes, Packed *packed)
+{
+    const int valueCount = static_cast<int>(inputSizeBytes / 2);
+    valueScratch.resize(valueCount);
+    for (int i = 0; i < valueCount; ++i)
+    {
+        valueScratch[i] = static_cast<std::uint16_t>(input[i * 2] | (input[i * 2 + 1] << 8));
+    }
+
+    std::uint8_t *data;
+    int sizeBytes, sizeBits;
+    rice::easyEncodeValues(valueScratch.data(), valueCount, &data, &sizeBytes, &sizeBits, 256, true, true);
+    return takeHeapOutput(data, sizeBytes, sizeBits, packed);
+}
+
+static bool riceValuesDecode(const Packed &packed, std::uint8_t *output, const std::size_t outputSizeBytes)
+{
+    const int valueCount = static_cast<int>(outputSizeBytes / 2);
+    valueScratch.resize(valueCount);
+    if (rice::easyDecodeValues(packed.data, static_cast<int>(packed.sizeBytes), packed.sizeBits,
+                               valueScratch.data(), valueCount) != valueCount)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < valueCount; ++i)
+    {
+        output[i * 2] = static_cast<std::uint8_t>(valueScratch[i]);
+        output[i * 2 + 1] = static_cast<std::uint8_t>(valueScratch[i] >> 8);
+    }
+    return true;
+}
+
+template<rle::Format F>
+static bool rleEncode(const std::uint8_t *input, const std::size_t inputSizeBytes, Packed *packed)
+{
+    const int capacity = rle::maxCompressedSize(static_cast<int>(inputSizeBytes), F);
+    packed->data = scratchOutput(capacity);
+    const int sizeBytes = rle::easyEncode(input, static_cast<int>(inputSizeBytes), packed->data, capacity, F);
+    packed->sizeBytes = static_cast<std::size_t>(sizeBytes);
+    packed->sizeBits = sizeBytes * 8;
+    packed->onCodecHeap = false;
+    return sizeBytes >= 0;
+}
+
+template<rle::Format F>
+static bool rleDecode(const Packed &packed, std::uint8_t *output, const std::size_t outputSizeBytes)
+{
+    const int size = static_cast<int>(outputSizeBytes);
+    return rle::easyDecode(packed.data, static_cast<int>(packed.sizeBytes), output, size, F) == size;
+}
+
+static bool rleTaggedEncode(const std::uint8_t *input, const std::size_t inputSizeBytes, Packed *packed)
+{
+    const int capacity = rle::maxCompressedSizeTagged(static_cast<int>(inputSizeBytes));
+    packed->data = scratchOutput(capacity);
+    const int sizeBytes = rle::easyEncodeTagged(input, static_cast<int>(inputSizeBytes), packed->data, capacity);
+    packed->sizeBytes = static_cast<std::size_t>(sizeBytes);
+    packed->sizeBits = sizeBytes * 8;
+    packed->onCodecHeap = false;
+    return sizeBytes >= 0;
+}
+
+static bool rleTaggedDecode(const Packed &packed, std::uint8_t *output, const std::size_t outputSizeBytes)
+{
+    const int size = static_cast<int>(outputSizeBytes);
+    return rle::easyDecodeTagged(packed.data, static_cast<int>(packed.sizeBytes), output, size) == size;
+}
+
+template<frame::Codec C>
+static bool frameEncode(const std::uint8_t *input, const std::size_t inputSizeBytes, Packed *packed)
+{
+    std::uint8_t *data;
+    std::size_t sizeBytes;
+    if (!frame::compress(input, inputSizeBytes, &data, &sizeBytes, C))
+    {
+        return false;
+    }
+    packed->data = data;
+    packed->sizeBytes = sizeBytes;
+    packed->sizeBits = 0;
+    packed->onCodecHeap = true;
+    return true;
+}
+
+static bool frameDecode(const Packed &packed, std::uint8_t *output, const std::size_t outputSizeBytes)
+{
+    return frame::decompress(packed.data, packed.sizeBytes, output, outputSizeBytes) == outputSizeBytes;
+}
+
+// Runs a whole input through a pipeline into the scratch output, growing it as needed.
+static bool pipelineEncode(pipeline::Pipeline &chain, const std::uint8_t *input, const std::size_t inputSizeBytes,
+                           Packed *packed)
+{
+    std::size_t capacity = inputSizeBytes + 1024;
+    chain.nextIn = input;
+    chain.availIn = inputSizeBytes;
+    for (;;)
+    {
+        std::uint8_t *data = scratchOutput(capacity);
+        chain.nextOut = data + chain.totalOut;
+        chain.availOut = capacity - chain.totalOut;
+
+        const pipeline::Status status = chain.run(true);
+        if (status == pipeline::Status::StreamEnd)
+        {
+            packed->data = data;
+            packed->sizeBytes = static_cast<std::size_t>(chain.totalOut);
+            packed->sizeBits = static_cast<int>(packed->sizeBytes * 8);
+            packed->onCodecHeap = false;
+            return true;
+        }
+        if (status == pipeline::Status::Error)
+        {
+            return false;
+        }
+        capacity *= 2;
+    }
+}
+
+static bool pipelineDecode(pipeline::Pipeline &chain, const Packed &packed, std::uint8_t *output,
+                           const std::size_t outputSizeBytes)
+{
+    chain.nextIn = packed.data;
+    chain.availIn = packed.sizeBytes;
+    chain.nextOut = output;
+    chain.availOut = outputSizeBytes;
+    return chain.run(true) == pipeline::Status::StreamEnd && chain.totalOut == outputSizeBytes;
+}
+
+static bool rleHuffmanPipeEncode(const std::uint8_t *input, const std::size_t inputSizeBytes, Packed *packed)
+{
+    rle::StreamEncoder rleEncoder;
+    huffman::StreamEncoder huffmanEncoder;
+    pipeline::EncodeStage<rle::StreamEncoder> rleStage(rleEncoder);
+    pipeline::EncodeStage<huffman::StreamEncoder> huffmanStage(huffmanEncoder);
+
+    pipeline::Pipeline chain;
+    chain.add(rleStage);
+    chain.add(huffmanStage);
+    return pipelineEncode(chain, input, inputSizeBytes, packed);
+}
+
+static bool rleHuffmanPipeDecode(const Packed &packed, std::uint8_t *output, const std::size_t outputSizeBytes)
+{
+    huffman::StreamDecoder huffmanDecoder;
+    rle::StreamDecoder rleDecoder;
+    pipeline::DecodeStage<huffman::StreamDecoder> huffmanStage(huffmanDecoder);
+    pipeline::DecodeStage<rle::StreamDecoder> rleStage(rleDecoder);
+
+    pipeline::Pipeline chain;
+    chain.add(huffmanStage);
+    chain.add(rleStage);
+    return pipelineDecode(chain, packed, output, outputSizeBytes);
+}
+
+// Rice streams take one K up front, picked here from the deltas of a sample at the
+// start of the input. Unlike easyEncode()'s blocks there is no escape code, so a
+// delta far from the sample's costs (delta >> K) + 1 + K bits: outliers still blow up.
+constexpr std::size_t PipeRiceSampleSize = 1 << 16;
+static std::vector<std::uint8_t> deltaSample;
+
+static int pipeRiceKBits(const std::uint8_t *input, const std::size_t inputSizeBytes)
+{
+    deltaSample.resize(std::min(inputSizeBytes, PipeRiceSampleSize));
+    if (deltaSample.empty())
+    {
+        return 0;
+    }
+
+    pipeline::DeltaEncoder delta(2, true);
+    pipeline::StreamBuffers buffers;
+    buffers.nextIn = input;
+    buffers.availIn = deltaSample.size();
+    buffers.nextOut = deltaSample.data();
+    buffers.availOut = deltaSample.size();
+    delta.process(buffers, true);
+
+    int sizeBits;
+    return rice::Encoder::findBestKBits(deltaSample.data(), static_cast<int>(deltaSample.size()), 8, &sizeBits);
+}
+
+static bool deltaRicePipeEncode(const std::uint8_t *input, const std::size_t inputSizeBytes, Packed *packed)
+{
+    pipeline::DeltaEncoder delta(2, true);
+    rice::StreamEncoder riceEncoder(pipeRiceKBits(input, inputSizeBytes));
+    pipeline::EncodeStage<rice::StreamEncoder> riceStage(riceEncoder);
+
+    pipeline::Pipeline chain;
+    chain.add(delta);
+    chain.add(riceStage);
+    return pipelineEncode(chain, input, inputSizeBytes, packed);
+}
+
+static bool deltaRicePipeDecode(const Packed &packed, std::uint8_t *output, const std::size_t outputSizeBytes)
+{
+    rice::StreamDecoder riceDecoder(outputSizeBytes); // K is in the stream.
+    pipeline::DecodeStage<rice::StreamDecoder> riceStage(riceDecoder);
+    pipeline::DeltaDecoder delta(2, true);
+
+    pipeline::Pipeline chain;
+    chain.add(riceStage);
+    chain.add(delta);
+    return pipelineDecode(chain, packed, output, outputSizeBytes);
+}
+
+static const Codec allCodecs[] = {
+    { "huffman",           anySize,  huffmanEncode<huffman::Format::Legacy>,    huffmanDecode      },
+    { "huffman-canonical", anySize,  huffmanEncode<huffman::Format::Canonical>, huffmanDecode      },
+    { "huffman-4x",        anySize,  huffmanEncode<huffman::Format::Interleaved>, huffmanDecode    },
+    { "huffman-table",     anySize,  huffmanTableEncode,                        huffmanTableDecode },
+    { "lz77-fast",         anySize,  lz77Encode<lz77::MinLevel, lz77::Entropy::None>,        lz77Decode },
+    { "lz77",              anySize,  lz77Encode<lz77::DefaultLevel, lz77::Entropy::None>,    lz77Decode },
+    { "lz77-huffman",      anySize,  lz77Encode<lz77::DefaultLevel, lz77::Entropy::Huffman>, lz77Decode },
+    { "lz77-max-huffman",  anySize,  lz77Encode<lz77::MaxLevel, lz77::Entropy::Huffman>,     lz77Decode },
+    { "lzw",               anySize,  lzwEncode<lzw::MaxDictBits, lzw::ResetPolicy::WhenFull>,       lzwDecode },
+    { "lzw-16-ratio",      anySize,  lzwEncode<lzw::MaxDictBitsLimit, lzw::ResetPolicy::OnRatioDrop>, lzwDecode },
+    { "rice",              anySize,  riceEncode<0, false, false>,     riceDecode       },
+    { "rice-blocks",       anySize,  riceEncode<256, false, false>,   riceDecode       },
+    { "rice-blocks-64",    anySize,  riceEncode<64, false, false>,    riceDecode       },
+    { "rice-delta",        anySize,  riceEncode<256, true, true>,     riceDecode       },
+    { "rice-u16-delta",    evenSize, riceValuesEncode,                riceValuesDecode },
+    { "rle",               anySize,  rleEncode<rle::Format::Legacy>,   rleDecode<rle::Format::Legacy>   },
+    { "rle-packbits",      anySize,  rleEncode<rle::Format::PackBits>, rleDecode<rle::Format::PackBits> },
+    { "rle-tagged",        anySize,  rleTaggedEncode,                  rleTaggedDecode                  },
+    { "frame-huffman",     anySize,  frameEncode<frame::Codec::Huffman>, frameDecode },
+    { "frame-lz77",        anySize,  frameEncode<frame::Codec::Lz77>,    frameDecode },
+    { "frame-lzw",         anySize,  frameEncode<frame::Codec::Lzw>,     frameDecode },
+    { "frame-rle",         anySize,  frameEncode<frame::Codec::Rle>,     frameDecode },
+    { "frame-auto",        anySize,  frameEncode<frame::Codec::Auto>,    frameDecode },
+    { "pipe-rle-huffman",  anySize,  rleHuffmanPipeEncode, rleHuffmanPipeDecode },
+    { "pipe-delta-rice",   anySize,  deltaRicePipeEncode,  deltaRicePipeDecode  },
+};
+
+// ========================================================
+// Inputs:
+// ========================================================
+
+struct Input
+{
+    std::string name;
+    std::vector<std::uint8_t> data;
+};
+
+// Every codec takes int sizes, and the worst-case output of some is several times the input.
+constexpr std::size_t MaxInputSize = std::size_t(1) << 28;
+
+// xorshift64*, so the synthetic inputs come out the same on every run and platform.
+struct Random
+{
+    std::uint64_t state = 0x9E3779B97F4A7C15ull;
+
+    std::uint32_t next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return static_cast<std::uint32_t>((state * 0x2545F4914F6CDD1Dull) >> 32);
+    }
+
+    // Uniform in [0, 1).
+    double unit() { return next() * (1.0 / 4294967296.0); }
+};
+
+static void makeSyntheticInputs(const std::size_t sizeBytes, std::vector<Input> *inputs)
+{
+    Random random;
+    Input input;
+
+    // Words picked with a Zipf-like skew, for something text shaped.
+    static const char *const words[] = {
+        "the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was", "with", "be",
+        "by", "on", "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have",
+        "an", "had", "they", "you", "were", "their", "one", "all", "we", "can", "her", "has",
+        "there", "been", "if", "more", "when", "will", "would", "who", "so", "no", "compression"
+    };
+    constexpr int wordCount = sizeof(words) / sizeof(words[0]);
+    input.name = "text";
+    while (input.data.size() < sizeBytes)
+    {
+        const int index = static_cast<int>(wordCount * random.unit() * random.unit());
+        for (const char *c = words[index]; *c != '\0'; ++c)
+        {
+            input.data.push_back(static_cast<std::uint8_t>(*c));
+        }
+        input.data.push_back((random.next() % 12) == 0 ? '\n' : ' ');
+    }
+    input.data.resize(sizeBytes);
+    inputs->push_back(input);
+
+    input.name = "random";
+    input.data.resize(sizeBytes);
+    for (auto &byte : input.data)
+    {
+        byte = static_cast<std::uint8_t>(random.next());
+    }
+    inputs->push_back(input);
+
+    // Geometric small values, the kind Rice codes are made for.
+    input.name = "geometric";
+    for (auto &byte : input.data)
+    {
+        const double value = -std::log(1.0 - random.unit()) * 6.0;
+        byte = static_cast<std::uint8_t>(std::min(value, 255.0));
+    }
+    inputs->push_back(input);
+
+    // Mostly zeros, with a random byte here and there.
+    input.name = "sparse";
+    for (auto &byte : input.data)
+    {
+        byte = (random.next() % 20) == 0 ? static_cast<std::uint8_t>(random.next()) : 0;
+    }
+    inputs->push_back(input);
+
+    // Runs of 1 to 64 bytes from a small alphabet.
+    input.name = "runs";
+    for (std::size_t i = 0; i < sizeBytes;)
+    {
+        const std::uint8_t value = static_cast<std::uint8_t>('A' + random.next() % 8);
+        const std::size_t runEnd = std::min(sizeBytes, i + 1 + random.next() % 64);
+        while (i < runEnd)
+        {
+            input.data[i++] = value;
+        }
+    }
+    inputs->push_back(input);
+
+    // Slow 16-bit waveform plus noise, stored little-endian.
+    input.name = "signal16";
+    for (std::size_t i = 0; i + 1 < sizeBytes; i += 2)
+    {
+        const double t = static_cast<double>(i / 2);
+        const double wave = std::sin(t * 0.01) * 12000.0 + std::sin(t * 0.047) * 3000.0;
+        const int sample = static_cast<int>(wave) + static_cast<int>(random.next() % 64) - 32;
+        input.data[i] = static_cast<std::uint8_t>(sample);
+        input.data[i + 1] = static_cast<std::uint8_t>(sample >> 8);
+    }
+    inputs->push_back(input);
+}
+
+static bool readInputFile(const char *path, const std::size_t sliceBytes, Input *input)
+{
+    std::FILE *file = std::fopen(path, "rb");
+    if (file == nullptr)
+    {
+        std::fprintf(stderr, "benchmark: Can't open '%s'\n", path);
+        return false;
+    }
+
+    std::uint8_t chunk[1 << 16];
+    std::size_t got;
+    while (input->data.size() < sliceBytes && (got = std::fread(chunk, 1, sizeof(chunk), file)) != 0)
+    {
+        input->data.insert(input->data.end(), chunk, chunk + got);
+    }
+    std::fclose(file);
+
+    input->name = path;
+    if (input->data.size() > sliceBytes)
+    {
+        input->data.resize(sliceBytes);
+        input->name += "[0:" + std::to_string(sliceBytes) + "]";
+    }
+    return true;
+}
+
+// ========================================================
+// Measurement:
+// ========================================================
+
+struct Timer
+{
+    std::chrono::steady_clock::time_point start;
+    std::uint64_t startTicks;
+
+    void begin()
+    {
+        start = std::chrono::steady_clock::now();
+        startTicks = readTicks();
+    }
+
+    static std::uint64_t readTicks()
+    {
+    #if BENCH_HAVE_RDTSC
+        return __rdtsc();
+    #else
+        return 0;
+    #endif
+    }
+};
+
+struct Sample
+{
+    double seconds;
+    std::uint64_t ticks;
+};
+
+static Sample endTimer(const Timer &timer)
+{
+    const std::uint64_t ticks = Timer::readTicks();
+    const auto now = std::chrono::steady_clock::now();
+    return { std::chrono::duration<double>(now - timer.start).count(), ticks - timer.startTicks };
+}
+
+struct Result
+{
+    std::string input;
+    const char *codec;
+    std::size_t inputSizeBytes;
+    std::size_t compressedSizeBytes;
+    Sample encode;
+    Sample decode;
+    std::size_t peakHeapBytes;
+    bool roundTrip;
+};
+
+// Smallest sample of each, since noise only ever adds time.
+static void keepBest(const Sample &sample, Sample *best)
+{
+    if (sample.seconds < best->seconds)
+    {
+        *best = sample;
+    }
+}
+
+static Result runCodec(const Codec &codec, const Input &input, const int iterations,
+                       std::vector<std::uint8_t> *decodeBuffer)
+{
+    Result result;
+    result.input = input.name;
+    result.codec = codec.name;
+    result.inputSizeBytes = input.data.size();
+    result.compressedSizeBytes = 0;
+    result.encode = { 1e30, 0 };
+    result.decode = { 1e30, 0 };
+    result.peakHeapBytes = 0;
+    result.roundTrip = true;
+
+    const std::size_t size = input.data.size();
+    decodeBuffer->assign(size + 1, 0);
+
+    for (int i = 0; i < iterations && result.roundTrip; ++i)
+    {
+        const std::size_t baseline = heapInUse.load();
+        heapPeak.store(baseline);
+
+        Packed packed;
+        Timer timer;
+        timer.begin();
+        const bool encoded = codec.encode(input.data.data(), size, &packed);
+        keepBest(endTimer(timer), &result.encode);
+
+        // Dirty the output, so a decoder that writes nothing can't pass.
+        std::fill(decodeBuffer->begin(), decodeBuffer->end(), std::uint8_t(0xA5));
+        timer.begin();
+        const bool decoded = encoded && codec.decode(packed, decodeBuffer->data(), size);
+        keepBest(endTimer(timer), &result.decode);
+
+        result.compressedSizeBytes = packed.sizeBytes;
+        result.peakHeapBytes = std::max(result.peakHeapBytes, heapPeak.load() - baseline);
+        result.roundTrip = decoded && std::equal(input.data.begin(), input.data.end(), decodeBuffer->begin());
+        releasePacked(packed);
+    }
+    return result;
+}
+
+static double megabytesPerSecond(const std::size_t sizeBytes, const Sample &sample)
+{
+    return sample.seconds > 0.0 ? (sizeBytes / 1e6) / sample.seconds : 0.0;
+}
+
+static double cyclesPerByte(const std::size_t sizeBytes, const Sample &sample)
+{
+    return sizeBytes != 0 ? static_cast<double>(sample.ticks) / sizeBytes : 0.0;
+}
+
+static double ratio(const Result &result)
+{
+    return result.compressedSizeBytes != 0
+        ? static_cast<double>(result.inputSizeBytes) / result.compressedSizeBytes : 0.0;
+}
+
+// ========================================================
+// Reporting:
+// ========================================================
+
+static void printTableHeader()
+{
+    std::printf("%-24s %-18s %10s %10s %7s %9s %9s %8s %8s %10s %s\n",
+                "input", "codec", "size", "packed", "ratio", "enc MB/s", "dec MB/s",
+                "enc c/B", "dec c/B", "peak KB", "check");
+}
+
+static void printTableRow(const Result &result)
+{
+    char encodeCycles[32] = "-";
+    char decodeCycles[32] = "-";
+    if (BENCH_HAVE_RDTSC)
+    {
+        std::snprintf(encodeCycles, sizeof(encodeCycles), "%.1f", cyclesPerByte(result.inputSizeBytes, result.encode));
+        std::snprintf(decodeCycles, sizeof(decodeCycles), "%.1f", cyclesPerByte(result.inputSizeBytes, result.decode));
+    }
+
+    std::printf("%-24s %-18s %10zu %10zu %7.3f %9.1f %9.1f %8s %8s %10.1f %s\n",
+                result.input.c_str(), result.codec, result.inputSizeBytes, result.compressedSizeBytes,
+                ratio(result), megabytesPerSecond(result.inputSizeBytes, result.encode),
+                megabytesPerSecond(result.inputSizeBytes, result.decode), encodeCycles, decodeCycles,
+                result.peakHeapBytes / 1024.0, result.roundTrip ? "ok" : "FAILED");
+}
+
+static std::string jsonString(const std::string &text)
+{
+    std::string quoted = "\"";
+    for (const char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        }
+        else
+        {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+static void printJson(const std::vector<Result> &results)
+{
+    std::printf("{\n  \"cyclesSource\": %s,\n  \"results\": [\n", BENCH_HAVE_RDTSC ? "\"rdtsc\"" : "null");
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        const Result &result = results[i];
+        std::printf("    {\"input\": %s, \"codec\": %s, \"inputBytes\": %zu, \"compressedBytes\": %zu, "
+                    "\"ratio\": %.4f, \"encodeMBps\": %.2f, \"decodeMBps\": %.2f, ",
+                    jsonString(result.input).c_str(), jsonString(result.codec).c_str(), result.inputSizeBytes,
+                    result.compressedSizeBytes, ratio(result), megabytesPerSecond(result.inputSizeBytes, result.encode),
+                    megabytesPerSecond(result.inputSizeBytes, result.decode));
+        if (BENCH_HAVE_RDTSC)
+        {
+            std::printf("\"encodeCyclesPerByte\": %.2f, \"decodeCyclesPerByte\": %.2f, ",
+                        cyclesPerByte(result.inputSizeBytes, result.encode),
+                        cyclesPerByte(result.inputSizeBytes, result.decode));
+        }
+        else
+        {
+            std::printf("\"encodeCyclesPerByte\": null, \"decodeCyclesPerByte\": null, ");
+        }
+        std::printf("\"peakHeapBytes\": %zu, \"roundTrip\": %s}%s\n", result.peakHeapBytes,
+                    result.roundTrip ? "true" : "false", (i + 1 < results.size()) ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+}
+
+// ========================================================
+// Corrupt input checks:
+// ========================================================
+
+// Malformed input must come back as an error from the decoders meant for untrusted
+// data, never reach the aborting default *_ERROR() handlers. Run once, untimed.
+
+// Fixed input with some structure, so every block has a real code tree.
+static std::vector<std::uint8_t> makeCheckInput(const std::size_t sizeBytes)
+{
+    Random random;
+    std::vector<std::uint8_t> data(sizeBytes);
+    for (auto &byte : data)
+    {
+        byte = static_cast<std::uint8_t>('a' + random.next() % 16);
+    }
+    return data;
+}
+
+// Whole input in, with room for all of the output, in one call.
+template<typename StreamT>
+static void setStreamBuffers(StreamT &stream, const std::vector<std::uint8_t> &input, std::vector<std::uint8_t> *output)
+{
+    output->resize(input.size() * 2 + 4096);
+    stream.nextIn = input.data();
+    stream.availIn = input.size();
+    stream.nextOut = output->data();
+    stream.availOut = output->size();
+}
+
+template<typename EncoderT>
+static auto encodeStream(EncoderT &encoder, const std::vector<std::uint8_t> &input, std::vector<std::uint8_t> *output)
+    -> decltype(encoder.encode(true))
+{
+    setStreamBuffers(encoder, input, output);
+    const auto status = encoder.encode(true);
+    output->resize(static_cast<std::size_t>(encoder.totalOut));
+    return status;
+}
+
+template<typename DecoderT>
+static auto decodeStream(DecoderT &decoder, const std::vector<std::uint8_t> &input, std::vector<std::uint8_t> *output)
+    -> decltype(decoder.decode(true))
+{
+    setStreamBuffers(decoder, input, output);
+    const auto status = decoder.decode(true);
+    output->resize(static_cast<std::size_t>(decoder.totalOut));
+    return status;
+}
+
+static bool checkHuffmanStream()
+{
+    const std::vector<std::uint8_t> input = makeCheckInput(3 * 4096 + 100);
+    std::vector<std::uint8_t> packed;
+    std::vector<std::uint8_t> output;
+
+    huffman::StreamEncoder encoder(4096);
+    if (encodeStream(encoder, input, &packed) != huffman::StreamStatus::StreamEnd)
+    {
+        return false;
+    }
+
+    // Cut the first block down to its format tag, so its code tree can't be read.
+    std::vector<std::uint8_t> corrupt = packed;
+    corrupt[4] = 16;
+    corrupt[5] = corrupt[6] = corrupt[7] = 0;
+    huffman::StreamDecoder decoder;
+    if (decodeStream(decoder, corrupt, &output) != huffman::StreamStatus::Error)
+    {
+        return false;
+    }
+
+    // Random damage anywhere may or may not decode, but it must return.
+    Random random;
+    for (int i = 0; i < 500; ++i)
+    {
+        corrupt = packed;
+        corrupt[random.next() % corrupt.size()] ^= static_cast<std::uint8_t>(1 + random.next() % 255);
+        huffman::StreamDecoder damagedDecoder;
+        decodeStream(damagedDecoder, corrupt, &output);
+    }
+    return true;
+}
+
+static bool checkLz77Decode()
+{
+    const std::vector<std::uint8_t> input = makeCheckInput(32 * 1024);
+    std::uint8_t *packed;
+    int packedBytes, packedBits;
+    lz77::easyEncode(input.data(), static_cast<int>(input.size()), &packed, &packedBytes, &packedBits,
+                     lz77::DefaultLevel, lz77::DefaultWindowBits, lz77::Entropy::Huffman);
+
+    // Cut short inside the Huffman coded streams.
+    std::vector<std::uint8_t> output(input.size());
+    int bytesDecoded = 0;
+    bool passed = lz77::safeDecode(packed, packedBytes / 2, packedBits / 2, output.data(), static_cast<int>(output.size()),
+                                   &bytesDecoded) != lz77::DecodeStatus::Ok;
+
+    // Random damage anywhere may or may not decode, but it must return.
+    Random random;
+    std::vector<std::uint8_t> corrupt;
+    for (int i = 0; passed && i < 500; ++i)
+    {
+        corrupt.assign(packed, packed + packedBytes);
+        corrupt[random.next() % corrupt.size()] ^= static_cast<std::uint8_t>(1 + random.next() % 255);
+        lz77::safeDecode(corrupt.data(), packedBytes, packedBits, output.data(), static_cast<int>(output.size()), &bytesDecoded);
+    }
+    lz77::defaultAllocator().deallocate(nullptr, packed);
+    return passed;
+}
+
+// K = 3 and a quotient of 40: (40 << 3) doesn't fit in a byte, so no encoder wrote it.
+static bool checkRiceQuotient()
+{
+    std::vector<std::uint8_t> corrupt(8, 0);
+    int bitCount = 0;
+    const auto putBit = [&](const int bit) { corrupt[bitCount / 8] |= static_cast<std::uint8_t>(bit << (bitCount % 8)); ++bitCount; };
+    for (int i = 0; i < 4; ++i)
+    {
+        putBit((3 >> i) & 1);
+    }
+    for (int i = 0; i < 40; ++i)
+    {
+        putBit(1);
+    }
+    bitCount += 1 + 3; // Terminating 0 and a zero remainder.
+
+    std::uint8_t output[1];
+    int bytesDecoded = 0;
+    if (rice::safeDecode(corrupt.data(), static_cast<int>(corrupt.size()), bitCount, output, 1, &bytesDecoded) !=
+        rice::DecodeStatus::CorruptData)
+    {
+        return false;
+    }
+
+    std::vector<std::uint8_t> streamOutput;
+    rice::StreamDecoder decoder(1);
+    return decodeStream(decoder, corrupt, &streamOutput) == rice::StreamStatus::Error;
+}
+
+static bool checkCorruptInputs()
+{
+    struct Check
+    {
+        const char *name;
+        bool (*run)();
+    };
+    static const Check checks[] = {
+        { "huffman stream", checkHuffmanStream },
+        { "lz77 stream", checkLz77Decode },
+        { "rice quotient", checkRiceQuotient },
+    };
+
+    bool allPassed = true;
+    for (const Check &check : checks)
+    {
+        if (!check.run())
+        {
+            std::fprintf(stderr, "benchmark: Corrupt %s not rejected!\n", check.name);
+            allPassed = false;
+        }
+    }
+    return allPassed;
+}
+
+// ========================================================
+// main():
+// ========================================================
+
+static void printUsage()
+{
+    std::fprintf(stderr,
+                 "usage: benchmark [--json] [--iterations N] [--size BYTES] [--slice BYTES] [--codec NAME] [files...]\n"
+                 "  --json           Print the results as JSON instead of a table.\n"
+                 "  --iterations N   Timed runs per codec and input, the best one is kept (default 5).\n"
+                 "  --size BYTES     Size of each synthetic input (default 1 MB).\n"
+                 "  --slice BYTES    Only use the first BYTES of each file (default and max 256 MB).\n"
+                 "  --codec NAME     Only run codecs with NAME in their name. Can be repeated.\n");
+}
+
+static bool parseSize(const char *text, std::size_t *value)
+{
+    char *end;
+    const unsigned long long parsed = std::strtoull(text, &end, 10);
+    if (end == text || *end != '\0' || parsed == 0)
+    {
+        return false;
+    }
+    *value = static_cast<std::size_t>(parsed);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    std::size_t iterations = 5;
+    std::size_t syntheticSize = 1 << 20;
+    std::size_t sliceBytes = MaxInputSize;
+    std::vector<std::string> codecFilters;
+    std::vector<const char *> files;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = (i + 1 < argc);
+        if (arg == "--json")
+        {
+            json = true;
+        }
+        else if (arg == "--iterations" && hasValue && parseSize(argv[i + 1], &iterations))
+        {
+            ++i;
+        }
+        else if (arg == "--size" && hasValue && parseSize(argv[i + 1], &syntheticSize))
+        {
+            ++i;
+        }
+        else if (arg == "--slice" && hasValue && parseSize(argv[i + 1], &sliceBytes))
+        {
+            ++i;
+        }
+        else if (arg == "--codec" && hasValue)
+        {
+            codecFilters.push_back(argv[++i]);
+        }
+        else if (!arg.empty() && arg[0] != '-')
+        {
+            files.push_back(argv[i]);
+        }
+        else
+        {
+            printUsage();
+            return 2;
+        }
+    }
+
+    syntheticSize = std::min(syntheticSize, MaxInputSize);
+    sliceBytes = std::min(sliceBytes, MaxInputSize);
+    iterations = std::min(iterations, std::size_t(1000000));
+
+    std::vector<Input> inputs;
+    if (files.empty())
+    {
+        makeSyntheticInputs(syntheticSize, &inputs);
+    }
+    for (const char *path : files)
+    {
+        Input input;
+        if (!readInputFile(path, sliceBytes, &input))
+        {
+            return 2;
+        }
+        if (input.data.empty())
+        {
+            // The easy APIs reject empty inputs.
+            std::fprintf(stderr, "benchmark: Skipping empty file '%s'\n", path);
+            continue;
+        }
+        inputs.push_back(std::move(input));
+    }
+
+    if (!json)
+    {
+        printTableHeader();
+    }
+
+    std::vector<Result> results;
+    std::vector<std::uint8_t> decodeBuffer;
+    const bool checksPassed = checkCorruptInputs();
+    bool allPassed = true;
+
+    for (const Input &input : inputs)
+    {
+        const int sampleSize = static_cast<int>(std::min<std::size_t>(input.data.size(), TableSampleSize));
+        sharedTable.buildFromSample(input.data.data(), sampleSize);
+
+        for (const Codec &codec : allCodecs)
+        {
+            bool selected = codecFilters.empty();
+            for (const std::string &filter : codecFilters)
+            {
+                selected = selected || (std::strstr(codec.name, filter.c_str()) != nullptr);
+            }
+            if (!selected || !codec.accepts(input.data.size()))
+            {
+                continue;
+            }
+
+            results.push_back(runCodec(codec, input, static_cast<int>(iterations), &decodeBuffer));
+            allPassed = allPassed && results.back().roundTrip;
+            if (!json)
+            {
+                printTableRow(results.back());
+                std::fflush(stdout);
+            }
+        }
+    }
+
+    if (json)
+    {
+        printJson(results);
+    }
+    if (!allPassed)
+    {
+        std::fprintf(stderr, "benchmark: Round trip FAILED for at least one codec!\n");
+    }
+    return (allPassed && checksPassed) ? 0 : 1;
+}
@@ -0,0 +1,1546 @@
+#ifndef FRAME_HPP
+#define FRAME_HPP
+// -------
+//  SETUP
+// -------
+// #define FRAME_IMPLEMENTATION in one source file before including
+// this file, then use frame.hpp as a normal header file elsewhere.
+//
+// frame.hpp includes huffman.hpp, lz77.hpp, lzw.hpp, rice.hpp and rle.hpp
+// itself. Their implementations are needed as well, so either also define
+// HUFFMAN_IMPLEMENTATION, LZ77_IMPLEMENTATION, LZW_IMPLEMENTATION,
+// RICE_IMPLEMENTATION and RLE_IMPLEMENTATION before including frame.hpp, or
+// have another source file implement them. Don't include the codec headers again after that
+// in the same file, since the implementations have no include guards.
+//
+// ----------
+//  OVERVIEW
+// ----------
+// Block-parallel container for the huffman, lz77, lzw, rice and rle codecs.
+//
+// The input is split into independent fixed-size blocks (the last one may be
+// shorter), which are compressed on a pool of threads and then stored back to
+// back after a small frame header. Each block starts with its own header giving
+// the codec used and its sizes, so decompression can locate every block with a
+// quick scan of the headers and then decode them all in parallel too.
+//
+// A block that doesn't get any smaller is stored as-is (Codec::Stored), so
+// a frame is never more than the headers larger than the input.
+//
+// Frame layout, all words little-endian:
+//
+// +-----------+----------------+----------------------+---------+---------+-----
+// | u32 Magic | u32 block size | u64 total input size | block 0 | block 1 | ...
+// +-----------+----------------+----------------------+---------+---------+-----
+//
+// Block layout:
+//
+// +-----------+----------------------+--------------------+---------------------+------
+// | u32 codec | u32 uncompressed len | u32 compressed len | u32 compressed bits | data
+// +-----------+----------------------+--------------------+---------------------+------
+//
+// The codec word only uses its low byte for now; the rest must be zero. New
+// codecs or formats get a new codec id, so frames written before still decode.
+//
+// Blocks are also the seek points for random access: a frame::SeekTable maps
+// each block to where it starts in the frame, and decodeRange() decodes only
+// the blocks overlapping the bytes asked for. The smaller the blocks, the less
+// a small read has to decode, for a somewhat worse ratio.
+//
+// compressFile()/decompressFile() do the same between files, for inputs of any
+// size. The input is memory mapped rather than read into a heap buffer, and
+// compression streams the blocks to the output file a batch at a time, so only
+// a few blocks are ever held in memory. Decompression maps the output file and
+// decodes straight into it. Where mmap() isn't available, or with FRAME_NO_MMAP
+// defined, the files are read and written whole through stdio instead.
+//
+// FRAME_ERROR() and the codecs' own error macros can be called from the worker
+// threads, so an error handler that throws would terminate the process.
+//
+// A malformed block is reported with FRAME_ERROR() and a short output count.
+// Huffman, LZW, Rice and LZ77 blocks are decoded with the codecs' safeDecode(),
+// and RLE never reports errors, so malformed blocks never reach the codecs' own
+// error macros.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#include "lz77.hpp" // Includes huffman.hpp.
+#include "lzw.hpp"
+#include "rice.hpp"
+#include "rle.hpp"
+
+// If you provide a custom malloc(), you must also provide a custom free().
+// Note: We never check FRAME_MALLOC's return for null. A custom implementation
+// should just abort with a fatal error if the program runs out of memory.
+#ifndef FRAME_MALLOC
+#define FRAME_MALLOC std::malloc
+#define FRAME_MFREE std::free
+#endif // FRAME_MALLOC
+
+namespace frame {
+
+// ========================================================
+
+// The default fatalError() function writes to stderr and aborts.
+#ifndef FRAME_ERROR
+
+    void fatalError(const char *message);
+
+#define FRAME_USING_DEFAULT_ERROR_HANDLER
+#define FRAME_ERROR(message) ::frame::fatalError(message)
+#endif // FRAME_ERROR
+
+    // ========================================================
+    // Frame constants:
+    // ========================================================
+
+    // Codec a block was compressed with.
+    enum class Codec : std::uint8_t {
+        Stored    = 0, // Raw copy of the input. Used when a codec doesn't help.
+        Huffman   = 1, // Canonical Huffman codes, in four interleaved streams.
+        Lzw       = 2,
+        Rice      = 3,
+        RleLegacy = 4, // rle::Format::Legacy pairs, as older frames stored Rle blocks.
+        Lz77      = 5, // Default level and window, Huffman coded sequences.
+        Rle       = 6, // rle::Format::PackBits, which can't blow up on run-free data.
+
+        // Only passed to compress(), never stored: each block is compressed
+        // with whatever chooseCodec() picks for it.
+        Auto      = 255
+    };
+
+    constexpr std::uint32_t Magic = 0x314D5246; // "FRM1"
+    constexpr std::uint32_t SeekTableMagic = 0x314B5346; // "FSK1"
+
+    constexpr int FrameHeaderSize = 16;
+    constexpr int BlockHeaderSize = 16;
+
+    constexpr int MinBlockSize = 1 << 12; // 4 KB
+    constexpr int MaxBlockSize = 1 << 26; // 64 MB
+    constexpr int DefaultBlockSize = 1 << 20;
+
+    // ========================================================
+    // compress() / decompress():
+    // ========================================================
+
+    // Picks a codec for a block from a sample of it: Stored if it looks incompressible, else
+    // the fastest codec expected to give a worthwhile ratio. RLE for runs, LZ77 for data with
+    // repeats, then Rice or Huffman. LZW isn't picked, LZ77 does better on the same data.
+    Codec chooseCodec(const std::uint8_t *data, int dataSizeBytes);
+
+    // Splits the input into blockSize chunks and compresses them with the given codec,
+    // using up to threadCount threads (zero for one per hardware thread). The frame is
+    // heap allocated with FRAME_MALLOC() and should be later freed with FRAME_MFREE().
+    bool compress(const std::uint8_t *input, std::size_t inputSizeBytes,
+                  std::uint8_t **frame, std::size_t *frameSizeBytes,
+                  Codec codec, int blockSize = DefaultBlockSize, int threadCount = 0);
+
+    // Total uncompressed size recorded in the frame header,
+    // or zero if the data doesn't start with a frame header.
+    std::uint64_t decompressedSize(const std::uint8_t *frame, std::size_t frameSizeBytes);
+
+    // Decompresses a whole frame back, using up to threadCount threads. The output
+    // buffer must hold at least decompressedSize() bytes. Returns the number of bytes
+    // written, which is less than decompressedSize() if the frame is malformed.
+    std::size_t decompress(const std::uint8_t *frame, std::size_t frameSizeBytes,
+                           std::uint8_t *output, std::size_t outputSizeBytes, int threadCount = 0);
+
+    // ========================================================
+    // class SeekTable:
+    // ========================================================
+
+    // Where each block of a frame starts, for decodeRange(). Block i holds the
+    // uncompressed bytes from i * getBlockSize() on, so any offset maps straight
+    // to its block, and the block to the start of its header in the frame.
+    class SeekTable final {
+    public:
+        // No copy/assignment.
+        SeekTable(const SeekTable &) = delete;
+
+        SeekTable &operator=(const SeekTable &) = delete;
+
+        SeekTable();
+
+        ~SeekTable();
+
+        // Indexes a frame with one pass over its block headers, decoding nothing.
+        // Returns false if it isn't a frame or a block header is bad.
+        bool build(const std::uint8_t *frame, std::size_t frameSizeBytes);
+
+        // The table can be stored next to its frame, so readers don't have to
+        // scan the headers again. Returns the bytes written, 0 if they didn't fit.
+        std::size_t serializedSize() const;
+
+        std::size_t serialize(std::uint8_t *output, std::size_t outputSizeBytes) const;
+
+        bool deserialize(const std::uint8_t *data, std::size_t dataSizeBytes);
+
+        bool isValid() const { return blockSize != 0; }
+
+        int getBlockSize() const { return blockSize; }
+
+        std::size_t getBlockCount() const { return blockCount; }
+
+        std::uint64_t getDecompressedSize() const { return totalSize; }
+
+        // Offset of the header of a block from the start of the frame.
+        std::uint64_t getBlockOffset(const std::size_t block) const { return offsets[block]; }
+
+    private:
+        void clear();
+
+        std::uint64_t *offsets; // FRAME_MALLOC memory, one per block.
+        std::size_t blockCount;
+        std::uint64_t totalSize;
+        int blockSize;
+    };
+
+    // Decompresses length bytes from the uncompressed offset on, out of the frame the
+    // table was built for. Only the blocks overlapping the range are decoded, on up to
+    // threadCount threads (one by default, as point reads only touch a block or two).
+    // Returns the bytes written, less than length if the range runs past the end of
+    // the data or the frame is malformed.
+    std::size_t decodeRange(const std::uint8_t *frame, std::size_t frameSizeBytes, const SeekTable &seekTable,
+                            std::uint64_t offset, std::size_t length, std::uint8_t *output, int threadCount = 1);
+
+    // ========================================================
+    // compressFile() / decompressFile():
+    // ========================================================
+
+    // compress() from one file into another, which is created or overwritten.
+    // Sizes are 64-bit throughout, so files over 2 GB are fine. Returns false
+    // if a file couldn't be opened, read or written.
+    bool compressFile(const char *inputPath, const char *outputPath,
+                      Codec codec, int blockSize = DefaultBlockSize, int threadCount = 0);
+
+    // decompress() a file written by compressFile() (or a saved compress() frame)
+    // into another file. Returns false on I/O errors or if the frame is malformed.
+    // The frame and block headers are checked before the output file is created,
+    // and an output file that couldn't be fully decoded or written is removed.
+    bool decompressFile(const char *inputPath, const char *outputPath, int threadCount = 0);
+
+    // ========================================================
+    // histogram():
+    // ========================================================
+
+    // huffman::histogram() for big buffers, counting DefaultBlockSize pieces on up to
+    // threadCount threads. Adds to counts, an array of huffman::MaxSymbols entries.
+    void histogram(const std::uint8_t *data, std::size_t dataSizeBytes, std::uint64_t *counts, int threadCount = 0);
+
+} // namespace frame {}
+
+// ================== End of header file ==================
+#endif // FRAME_HPP
+// ================== End of header file ==================
+
+// ================================================================================================
+//
+//                                     Frame Implementation
+//
+// ================================================================================================
+
+#ifdef FRAME_IMPLEMENTATION
+
+#ifdef FRAME_USING_DEFAULT_ERROR_HANDLER
+#include <cstdio> // For the default error handler
+#endif            // FRAME_USING_DEFAULT_ERROR_HANDLER
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if !defined(FRAME_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define FRAME_USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // FRAME_NO_MMAP
+
+namespace frame
+{
+
+    // ========================================================
+
+#ifdef FRAME_USING_DEFAULT_ERROR_HANDLER
+
+    // Prints a fatal error to stderr and aborts the process.
+    // This is the default method used by FRAME_ERROR(), but
+    // you can override the macro to use other error handling
+    // mechanisms, such as C++ exceptions.
+    void fatalError(const char *const message)
+    {
+        std::fprintf(stderr, "Frame error: %s\n", message);
+        std::abort();
+    }
+
+#endif // FRAME_USING_DEFAULT_ERROR_HANDLER
+
+    // ========================================================
+    // Local helpers:
+    // ========================================================
+
+    static void storeU32(std::uint8_t *ptr, const std::uint32_t word)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            ptr[i] = static_cast<std::uint8_t>(word >> (i * 8));
+        }
+    }
+
+    static std::uint32_t loadU32(const std::uint8_t *ptr)
+    {
+        std::uint32_t word = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            word |= std::uint32_t(ptr[i]) << (i * 8);
+        }
+        return word;
+    }
+
+    static void storeU64(std::uint8_t *ptr, const std::uint64_t word)
+    {
+        storeU32(ptr, static_cast<std::uint32_t>(word));
+        storeU32(ptr + 4, static_cast<std::uint32_t>(word >> 32));
+    }
+
+    static std::uint64_t loadU64(const std::uint8_t *ptr)
+    {
+        return loadU32(ptr) | (std::uint64_t(loadU32(ptr + 4)) << 32);
+    }
+
+    // Runs func(0) .. func(count - 1) on up to threadCount threads, the calling one
+    // included. Workers pull the next index from a shared counter, so uneven blocks
+    // still keep every thread busy.
+    template <typename Func>
+    static void parallelFor(const std::size_t count, int threadCount, const Func &func)
+    {
+        if (threadCount <= 0)
+        {
+            threadCount = static_cast<int>(std::thread::hardware_concurrency());
+        }
+        if (static_cast<std::size_t>(threadCount) > count)
+        {
+            threadCount = static_cast<int>(count);
+        }
+
+        if (threadCount <= 1)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                func(i);
+            }
+            return;
+        }
+
+        std::atomic<std::size_t> nextIndex(0);
+        auto worker = [&]()
+        {
+            for (std::size_t i = nextIndex++; i < count; i = nextIndex++)
+            {
+                func(i);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(threadCount - 1);
+        for (int t = 1; t < threadCount; ++t)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    // Highest codec id a block header can hold.
+    constexpr Codec LastCodec = Codec::Rle;
+
+    // A compressed block before it's copied into the frame.
+    struct EncodedBlock {
+        std::uint8_t *data; // Owned, freed with FRAME_MFREE. Unused for Codec::Stored.
+        Codec codec;
+        int sizeBytes;
+        int sizeBits;
+    };
+
+    static void freeBlockData(const EncodedBlock &block)
+    {
+        if (block.data != nullptr)
+        {
+            FRAME_MFREE(block.data);
+        }
+    }
+
+    static EncodedBlock encodeBlock(const std::uint8_t *input, const int inputSizeBytes, Codec codec)
+    {
+        if (codec == Codec::Auto)
+        {
+            codec = chooseCodec(input, inputSizeBytes);
+        }
+
+        EncodedBlock block = { nullptr, codec, 0, 0 };
+        if (codec == Codec::Stored)
+        {
+            block.sizeBytes = inputSizeBytes;
+            block.sizeBits = inputSizeBytes * 8;
+            return block;
+        }
+
+        // Anything past the input size is stored instead, so a buffer that size
+        // will do. The codecs fail once their output doesn't fit in it.
+        block.data = static_cast<std::uint8_t *>(FRAME_MALLOC(inputSizeBytes));
+
+        bool encoded = false;
+        switch (codec)
+        {
+        case Codec::Huffman :
+            encoded = huffman::easyEncode(input, inputSizeBytes, block.data, inputSizeBytes,
+                                          &block.sizeBytes, &block.sizeBits, huffman::Format::Interleaved);
+            break;
+        case Codec::Lzw :
+            encoded = lzw::easyEncode(input, inputSizeBytes, block.data, inputSizeBytes,
+                                      &block.sizeBytes, &block.sizeBits);
+            break;
+        case Codec::Rice :
+            encoded = rice::easyEncode(input, inputSizeBytes, block.data, inputSizeBytes,
+                                       &block.sizeBytes, &block.sizeBits);
+            break;
+        case Codec::Rle :
+        case Codec::RleLegacy :
+            block.sizeBytes = rle::easyEncode(input, inputSizeBytes, block.data, inputSizeBytes,
+                                              (codec == Codec::Rle) ? rle::Format::PackBits : rle::Format::Legacy);
+            block.sizeBits = block.sizeBytes * 8;
+            encoded = (block.sizeBytes >= 0);
+            break;
+        case Codec::Lz77 :
+            encoded = lz77::easyEncode(input, inputSizeBytes, block.data, inputSizeBytes,
+                                       &block.sizeBytes, &block.sizeBits, lz77::DefaultLevel,
+                                       lz77::DefaultWindowBits, lz77::Entropy::Huffman);
+            break;
+        default :
+            break;
+        }
+
+        // Store the block if the codec didn't help.
+        if (!encoded || block.sizeBytes >= inputSizeBytes)
+        {
+            freeBlockData(block);
+            block.data = nullptr;
+            block.codec = Codec::Stored;
+            block.sizeBytes = inputSizeBytes;
+            block.sizeBits = inputSizeBytes * 8;
+        }
+        return block;
+    }
+
+    static void storeBlockHeader(std::uint8_t *header, const EncodedBlock &block, const int size)
+    {
+        storeU32(header, static_cast<std::uint32_t>(block.codec));
+        storeU32(header + 4, static_cast<std::uint32_t>(size));
+        storeU32(header + 8, static_cast<std::uint32_t>(block.sizeBytes));
+        storeU32(header + 12, static_cast<std::uint32_t>(block.sizeBits));
+    }
+
+    static void storeFrameHeader(std::uint8_t *header, const int blockSize, const std::uint64_t inputSizeBytes)
+    {
+        storeU32(header, Magic);
+        storeU32(header + 4, static_cast<std::uint32_t>(blockSize));
+        storeU64(header + 8, inputSizeBytes);
+    }
+
+    static bool decodeBlock(const std::uint8_t *data, const int sizeBytes, const int sizeBits, const Codec codec,
+                            std::uint8_t *output, const int outputSizeBytes)
+    {
+        int bytesDecoded = 0;
+        switch (codec)
+        {
+        case Codec::Stored :
+            if (sizeBytes != outputSizeBytes)
+            {
+                return false;
+            }
+            std::memcpy(output, data, sizeBytes);
+            return true;
+        // Blocks come from untrusted frames, so a malformed one must fail the
+        // block, not reach the codec's error handler.
+        case Codec::Huffman :
+            return huffman::safeDecode(data, sizeBytes, sizeBits, output, outputSizeBytes, &bytesDecoded) ==
+                   huffman::DecodeStatus::Ok && bytesDecoded == outputSizeBytes;
+        case Codec::Lzw :
+            return lzw::safeDecode(data, sizeBytes, sizeBits, output, outputSizeBytes, &bytesDecoded) ==
+                   lzw::DecodeStatus::Ok && bytesDecoded == outputSizeBytes;
+        case Codec::Rice :
+            return rice::safeDecode(data, sizeBytes, sizeBits, output, outputSizeBytes, &bytesDecoded) ==
+                   rice::DecodeStatus::Ok && bytesDecoded == outputSizeBytes;
+        case Codec::Lz77 :
+            return lz77::safeDecode(data, sizeBytes, sizeBits, output, outputSizeBytes, &bytesDecoded) ==
+                   lz77::DecodeStatus::Ok && bytesDecoded == outputSizeBytes;
+        case Codec::Rle :
+            bytesDecoded = rle::easyDecode(data, sizeBytes, output, outputSizeBytes, rle::Format::PackBits);
+            break;
+        case Codec::RleLegacy :
+            bytesDecoded = rle::easyDecode(data, sizeBytes, output, outputSizeBytes, rle::Format::Legacy);
+            break;
+        default :
+            return false;
+        }
+        return bytesDecoded == outputSizeBytes;
+    }
+
+    // ========================================================
+    // chooseCodec() implementation:
+    // ========================================================
+
+    // Auto selection samples SampleChunks evenly spread chunks of each block.
+    // Chunks rather than scattered bytes, so runs and repeats show up.
+    constexpr int SampleChunks = 4;
+    constexpr int SampleChunkSize = 4096;
+
+    // Share of sampled bytes that repeat the byte before, from which RLE is used.
+    constexpr double RleRunFraction = 0.6;
+
+    // Share of sampled positions whose next 4 bytes were seen before, from which
+    // LZ77 is used. Below the second one LZ77 still wins over storing the block.
+    constexpr double Lz77MatchFraction = 0.25;
+    constexpr double Lz77MinMatchFraction = 0.1;
+
+    // An order-0 coder has to get the block below this share of its size to be used.
+    constexpr double WorthwhileRatio = 0.92;
+
+    // Rough canonical Huffman prefix cost, in bits, for the estimate.
+    constexpr int HuffmanPrefixBits = 800;
+
+    constexpr int MatchHashBits = 12;
+
+    struct SampleStats {
+        std::uint32_t counts[huffman::MaxSymbols];
+        int sampledBytes;
+        int runBytes;       // Bytes equal to the one before.
+        int matchPositions; // Positions starting 4 bytes seen before in the sample.
+        int riceBits;       // rice::easyEncode() output size for the sample, header aside.
+    };
+
+    static void sampleChunk(const std::uint8_t *chunk, const int chunkSize, std::uint32_t *matchTable,
+                            SampleStats &stats)
+    {
+        huffman::histogram(chunk, chunkSize, stats.counts);
+        stats.sampledBytes += chunkSize;
+
+        for (int i = 1; i < chunkSize; ++i)
+        {
+            stats.runBytes += (chunk[i] == chunk[i - 1]);
+        }
+
+        // The table keeps the last 4-byte word per hash, so a hit is a real repeat.
+        for (int i = 0; i + 4 <= chunkSize; ++i)
+        {
+            const std::uint32_t word = loadU32(chunk + i);
+            const std::uint32_t slot = (word * 2654435761u) >> (32 - MatchHashBits);
+            stats.matchPositions += (matchTable[slot] == word);
+            matchTable[slot] = word;
+        }
+
+        int riceBits = 0;
+        rice::Encoder::findBestKBits(chunk, chunkSize, 8, &riceBits);
+        stats.riceBits += riceBits;
+    }
+
+    Codec chooseCodec(const std::uint8_t *data, const int dataSizeBytes)
+    {
+        if (data == nullptr || dataSizeBytes <= 0)
+        {
+            return Codec::Stored;
+        }
+
+        SampleStats stats = {};
+        std::vector<std::uint32_t> matchTable(std::size_t(1) << MatchHashBits, 0);
+
+        if (dataSizeBytes <= SampleChunks * SampleChunkSize)
+        {
+            sampleChunk(data, dataSizeBytes, matchTable.data(), stats);
+        }
+        else
+        {
+            const int stride = (dataSizeBytes - SampleChunkSize) / (SampleChunks - 1);
+            for (int c = 0; c < SampleChunks; ++c)
+            {
+                sampleChunk(data + c * stride, SampleChunkSize, matchTable.data(), stats);
+            }
+        }
+
+        const double sampled = stats.sampledBytes;
+        const double runFraction = stats.runBytes / sampled;
+        const double matchFraction = stats.matchPositions / sampled;
+
+        // Fastest first: RLE, then LZ77 for repetitive data.
+        if (runFraction >= RleRunFraction)
+        {
+            return Codec::Rle;
+        }
+        if (matchFraction >= Lz77MatchFraction)
+        {
+            return Codec::Lz77;
+        }
+
+        // Then the order-0 coders, from the entropy and Rice's own size estimate.
+        double entropyBits = 0.0;
+        for (int s = 0; s < huffman::MaxSymbols; ++s)
+        {
+            if (stats.counts[s] != 0)
+            {
+                entropyBits += stats.counts[s] * std::log2(sampled / stats.counts[s]);
+            }
+        }
+
+        const double huffmanBits = entropyBits + HuffmanPrefixBits;
+        const double riceBits = stats.riceBits;
+        const double bestBits = (riceBits < huffmanBits) ? riceBits : huffmanBits;
+        if (bestBits > sampled * 8 * WorthwhileRatio)
+        {
+            return (matchFraction >= Lz77MinMatchFraction) ? Codec::Lz77 : Codec::Stored;
+        }
+        return (riceBits <= huffmanBits) ? Codec::Rice : Codec::Huffman;
+    }
+
+    // ========================================================
+    // compress() implementation:
+    // ========================================================
+
+    bool compress(const std::uint8_t *input, const std::size_t inputSizeBytes,
+                  std::uint8_t **frame, std::size_t *frameSizeBytes,
+                  const Codec codec, const int blockSize, const int threadCount)
+    {
+        if ((input == nullptr && inputSizeBytes != 0) || frame == nullptr || frameSizeBytes == nullptr)
+        {
+            FRAME_ERROR("frame::compress(): Null data pointer(s)!");
+            return false;
+        }
+
+        if (blockSize < MinBlockSize || blockSize > MaxBlockSize)
+        {
+            FRAME_ERROR("frame::compress(): Block size out of range!");
+            return false;
+        }
+
+        if (static_cast<int>(codec) > static_cast<int>(LastCodec) && codec != Codec::Auto)
+        {
+            FRAME_ERROR("frame::compress(): Unknown codec!");
+            return false;
+        }
+
+        // Compress all the blocks first, in parallel:
+        const std::size_t blockCount = (inputSizeBytes + blockSize - 1) / blockSize;
+        std::vector<EncodedBlock> blocks(blockCount);
+
+        parallelFor(blockCount, threadCount, [&](const std::size_t i)
+        {
+            const std::size_t offset = i * blockSize;
+            const std::size_t remaining = inputSizeBytes - offset;
+            const int size = (remaining < static_cast<std::size_t>(blockSize)) ? static_cast<int>(remaining) : blockSize;
+            blocks[i] = encodeBlock(input + offset, size, codec);
+        });
+
+        // Then lay them out after the frame header:
+        std::size_t totalSize = FrameHeaderSize;
+        for (const EncodedBlock &block : blocks)
+        {
+            totalSize += BlockHeaderSize + block.sizeBytes;
+        }
+
+        std::uint8_t *output = static_cast<std::uint8_t *>(FRAME_MALLOC(totalSize));
+        storeFrameHeader(output, blockSize, inputSizeBytes);
+
+        std::uint8_t *blockPtr = output + FrameHeaderSize;
+        for (std::size_t i = 0; i < blockCount; ++i)
+        {
+            const EncodedBlock &block = blocks[i];
+            const std::size_t offset = i * blockSize;
+            const std::size_t remaining = inputSizeBytes - offset;
+            const int size = (remaining < static_cast<std::size_t>(blockSize)) ? static_cast<int>(remaining) : blockSize;
+
+            storeBlockHeader(blockPtr, block, size);
+            blockPtr += BlockHeaderSize;
+
+            std::memcpy(blockPtr, (block.codec == Codec::Stored) ? input + offset : block.data, block.sizeBytes);
+            blockPtr += block.sizeBytes;
+            freeBlockData(block);
+        }
+
+        *frame = output;
+        *frameSizeBytes = totalSize;
+        return true;
+    }
+
+    // ========================================================
+    // decompress() implementation:
+    // ========================================================
+
+    enum class BlockScan {
+        Ok,
+        Truncated,
+        BadHeader
+    };
+
+    // Checks the block count promised by a frame header whose block size is already
+    // known to be good. Every block takes at least a header, so the count can't be
+    // more than the frame has room for, whatever the total size in the header says.
+    static bool isBlockCountValid(const std::uint8_t *frame, const std::size_t frameSizeBytes)
+    {
+        const std::uint32_t blockSize = loadU32(frame + 4);
+        const std::uint64_t totalSize = loadU64(frame + 8);
+        const std::uint64_t count = totalSize / blockSize + ((totalSize % blockSize) != 0);
+        return count <= (frameSizeBytes - FrameHeaderSize) / BlockHeaderSize;
+    }
+
+    // Checks a block header against the frame: the codec, the size the block must
+    // have to start at outputPos, and its data fitting in what's left of the frame.
+    static bool isBlockHeaderValid(const std::uint8_t *frame, const std::size_t frameSizeBytes, const std::size_t framePos,
+                                   const std::uint64_t outputPos)
+    {
+        const std::uint8_t *header = frame + framePos;
+        const std::uint32_t blockSize = loadU32(frame + 4);
+        const std::uint64_t totalSize = loadU64(frame + 8);
+        const std::uint32_t codecWord = loadU32(header);
+        const std::uint32_t size = loadU32(header + 4);
+        const std::uint32_t sizeBytes = loadU32(header + 8);
+        const std::uint32_t sizeBits = loadU32(header + 12);
+
+        // Every block but the last is exactly blockSize long.
+        const std::uint64_t expectedSize = (totalSize - outputPos < blockSize) ? (totalSize - outputPos) : blockSize;
+        return codecWord <= static_cast<std::uint32_t>(LastCodec) && size == expectedSize &&
+               sizeBytes != 0 && sizeBits <= std::uint64_t(sizeBytes) * 8 &&
+               sizeBytes <= frameSizeBytes - framePos - BlockHeaderSize;
+    }
+
+    // Walks the block headers of a frame whose frame header was already checked,
+    // calling onBlock(header offset, uncompressed offset) for every good one.
+    // Stops at the first one that's bad or cut short.
+    template <typename OnBlock>
+    static BlockScan scanBlocks(const std::uint8_t *frame, const std::size_t frameSizeBytes, const OnBlock &onBlock)
+    {
+        const std::uint64_t totalSize = loadU64(frame + 8);
+        std::size_t framePos = FrameHeaderSize;
+        std::uint64_t outputPos = 0;
+        while (outputPos < totalSize)
+        {
+            if (frameSizeBytes - framePos < static_cast<std::size_t>(BlockHeaderSize))
+            {
+                return BlockScan::Truncated;
+            }
+            if (!isBlockHeaderValid(frame, frameSizeBytes, framePos, outputPos))
+            {
+                return BlockScan::BadHeader;
+            }
+
+            onBlock(framePos, outputPos);
+            const std::uint8_t *header = frame + framePos;
+            framePos += BlockHeaderSize + loadU32(header + 8);
+            outputPos += loadU32(header + 4);
+        }
+        return BlockScan::Ok;
+    }
+
+    std::uint64_t decompressedSize(const std::uint8_t *frame, const std::size_t frameSizeBytes)
+    {
+        if (frame == nullptr || frameSizeBytes < static_cast<std::size_t>(FrameHeaderSize) || loadU32(frame) != Magic)
+        {
+            return 0;
+        }
+        return loadU64(frame + 8);
+    }
+
+    std::size_t decompress(const std::uint8_t *frame, const std::size_t frameSizeBytes,
+                           std::uint8_t *output, const std::size_t outputSizeBytes, const int threadCount)
+    {
+        if (frame == nullptr || output == nullptr)
+        {
+            FRAME_ERROR("frame::decompress(): Null data pointer(s)!");
+            return 0;
+        }
+
+        if (frameSizeBytes < static_cast<std::size_t>(FrameHeaderSize) || loadU32(frame) != Magic)
+        {
+            FRAME_ERROR("frame::decompress(): Not a frame!");
+            return 0;
+        }
+
+        const std::uint32_t blockSize = loadU32(frame + 4);
+        const std::uint64_t totalSize = loadU64(frame + 8);
+        if (blockSize < static_cast<std::uint32_t>(MinBlockSize) || blockSize > static_cast<std::uint32_t>(MaxBlockSize))
+        {
+            FRAME_ERROR("frame::decompress(): Bad block size in frame header!");
+            return 0;
+        }
+
+        if (totalSize > outputSizeBytes)
+        {
+            FRAME_ERROR("frame::decompress(): Output buffer too small!");
+            return 0;
+        }
+
+        // Before sizing anything from the header.
+        if (!isBlockCountValid(frame, frameSizeBytes))
+        {
+            FRAME_ERROR("frame::decompress(): Frame is truncated!");
+            return 0;
+        }
+
+        // Find where every block starts with a quick pass over the headers,
+        // checking them as we go. Only whole blocks are decoded.
+        struct BlockRef {
+            const std::uint8_t *header;
+            std::size_t outputOffset;
+        };
+
+        std::vector<BlockRef> blocks;
+        blocks.reserve(static_cast<std::size_t>((totalSize + blockSize - 1) / blockSize));
+
+        const BlockScan scan = scanBlocks(frame, frameSizeBytes, [&](const std::size_t framePos, const std::uint64_t outputPos)
+        {
+            blocks.push_back({ frame + framePos, static_cast<std::size_t>(outputPos) });
+        });
+        if (scan == BlockScan::Truncated)
+        {
+            FRAME_ERROR("frame::decompress(): Frame is truncated!");
+        }
+        else if (scan == BlockScan::BadHeader)
+        {
+            FRAME_ERROR("frame::decompress(): Bad block header!");
+        }
+
+        // Decode them all in parallel, each into its own slice of the output:
+        std::vector<char> decoded(blocks.size(), 0);
+        parallelFor(blocks.size(), threadCount, [&](const std::size_t i)
+        {
+            const std::uint8_t *header = blocks[i].header;
+            decoded[i] = decodeBlock(header + BlockHeaderSize,
+                                     static_cast<int>(loadU32(header + 8)),
+                                     static_cast<int>(loadU32(header + 12)),
+                                     static_cast<Codec>(loadU32(header)),
+                                     output + blocks[i].outputOffset,
+                                     static_cast<int>(loadU32(header + 4)));
+        });
+
+        // Report the output up to the first bad block.
+        std::size_t bytesDecoded = 0;
+        for (std::size_t i = 0; i < blocks.size(); ++i)
+        {
+            if (!decoded[i])
+            {
+                FRAME_ERROR("frame::decompress(): Failed to decode block!");
+                break;
+            }
+            bytesDecoded += loadU32(blocks[i].header + 4);
+        }
+        return bytesDecoded;
+    }
+
+    // ========================================================
+    // class SeekTable:
+    // ========================================================
+
+    // Serialized table layout, all words little-endian:
+    //
+    // +--------------------+----------------+----------------------+------------------+-----
+    // | u32 SeekTableMagic | u32 block size | u64 total input size | u64 block 0 pos  | ...
+    // +--------------------+----------------+----------------------+------------------+-----
+    //
+    // One position per block, the offset of its header in the frame.
+    constexpr int SeekTableHeaderSize = 16;
+
+    SeekTable::SeekTable()
+        : offsets(nullptr), blockCount(0), totalSize(0), blockSize(0)
+    {
+    }
+
+    SeekTable::~SeekTable()
+    {
+        clear();
+    }
+
+    void SeekTable::clear()
+    {
+        if (offsets != nullptr)
+        {
+            FRAME_MFREE(offsets);
+        }
+        offsets = nullptr;
+        blockCount = 0;
+        totalSize = 0;
+        blockSize = 0;
+    }
+
+    bool SeekTable::build(const std::uint8_t *frame, const std::size_t frameSizeBytes)
+    {
+        clear();
+
+        if (frame == nullptr)
+        {
+            FRAME_ERROR("frame::SeekTable: Null frame pointer!");
+            return false;
+        }
+
+        if (frameSizeBytes < static_cast<std::size_t>(FrameHeaderSize) || loadU32(frame) != Magic)
+        {
+            FRAME_ERROR("frame::SeekTable: Not a frame!");
+            return false;
+        }
+
+        const std::uint32_t frameBlockSize = loadU32(frame + 4);
+        const std::uint64_t frameTotalSize = loadU64(frame + 8);
+        if (frameBlockSize < static_cast<std::uint32_t>(MinBlockSize) || frameBlockSize > static_cast<std::uint32_t>(MaxBlockSize))
+        {
+            FRAME_ERROR("frame::SeekTable: Bad block size in frame header!");
+            return false;
+        }
+
+        if (!isBlockCountValid(frame, frameSizeBytes))
+        {
+            FRAME_ERROR("frame::SeekTable: Frame is truncated!");
+            return false;
+        }
+        const std::uint64_t count = frameTotalSize / frameBlockSize + ((frameTotalSize % frameBlockSize) != 0);
+
+        offsets = static_cast<std::uint64_t *>(FRAME_MALLOC((count != 0 ? count : 1) * sizeof(std::uint64_t)));
+        std::size_t found = 0;
+        const BlockScan scan = scanBlocks(frame, frameSizeBytes, [&](const std::size_t framePos, std::uint64_t)
+        {
+            offsets[found++] = framePos;
+        });
+        if (scan != BlockScan::Ok)
+        {
+            FRAME_ERROR(scan == BlockScan::Truncated ? "frame::SeekTable: Frame is truncated!" :
+                                                       "frame::SeekTable: Bad block header!");
+            clear();
+            return false;
+        }
+
+        blockCount = found;
+        totalSize = frameTotalSize;
+        blockSize = static_cast<int>(frameBlockSize);
+        return true;
+    }
+
+    std::size_t SeekTable::serializedSize() const
+    {
+        return isValid() ? SeekTableHeaderSize + blockCount * sizeof(std::uint64_t) : 0;
+    }
+
+    std::size_t SeekTable::serialize(std::uint8_t *output, const std::size_t outputSizeBytes) const
+    {
+        if (!isValid())
+        {
+            FRAME_ERROR("frame::SeekTable: Serializing an empty table!");
+            return 0;
+        }
+
+        const std::size_t sizeBytes = serializedSize();
+        if (output == nullptr || outputSizeBytes < sizeBytes)
+        {
+            return 0;
+        }
+
+        storeU32(output, SeekTableMagic);
+        storeU32(output + 4, static_cast<std::uint32_t>(blockSize));
+        storeU64(output + 8, totalSize);
+        for (std::size_t i = 0; i < blockCount; ++i)
+        {
+            storeU64(output + SeekTableHeaderSize + i * 8, offsets[i]);
+        }
+        return sizeBytes;
+    }
+
+    bool SeekTable::deserialize(const std::uint8_t *data, const std::size_t dataSizeBytes)
+    {
+        clear();
+
+        if (data == nullptr || dataSizeBytes < static_cast<std::size_t>(SeekTableHeaderSize) ||
+            loadU32(data) != SeekTableMagic)
+        {
+            FRAME_ERROR("frame::SeekTable: Not a serialized seek table!");
+            return false;
+        }
+
+        const std::uint32_t tableBlockSize = loadU32(data + 4);
+        const std::uint64_t tableTotalSize = loadU64(data + 8);
+        if (tableBlockSize < static_cast<std::uint32_t>(MinBlockSize) || tableBlockSize > static_cast<std::uint32_t>(MaxBlockSize))
+        {
+            FRAME_ERROR("frame::SeekTable: Bad block size in seek table!");
+            return false;
+        }
+
+        const std::uint64_t count = (tableTotalSize + tableBlockSize - 1) / tableBlockSize;
+        if (count != (dataSizeBytes - SeekTableHeaderSize) / 8 || (dataSizeBytes - SeekTableHeaderSize) % 8 != 0)
+        {
+            FRAME_ERROR("frame::SeekTable: Seek table size doesn't match its block count!");
+            return false;
+        }
+
+        // Blocks follow each other, each at least a header and a byte long.
+        offsets = static_cast<std::uint64_t *>(FRAME_MALLOC((count != 0 ? count : 1) * sizeof(std::uint64_t)));
+        std::uint64_t nextMin = FrameHeaderSize;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            offsets[i] = loadU64(data + SeekTableHeaderSize + i * 8);
+            if ((i == 0) ? (offsets[i] != nextMin) : (offsets[i] < nextMin))
+            {
+                FRAME_ERROR("frame::SeekTable: Bad block position in seek table!");
+                clear();
+                return false;
+            }
+            nextMin = offsets[i] + BlockHeaderSize + 1;
+        }
+
+        blockCount = static_cast<std::size_t>(count);
+        totalSize = tableTotalSize;
+        blockSize = static_cast<int>(tableBlockSize);
+        return true;
+    }
+
+    // ========================================================
+    // decodeRange() implementation:
+    // ========================================================
+
+    std::size_t decodeRange(const std::uint8_t *frame, const std::size_t frameSizeBytes, const SeekTable &seekTable,
+                            const std::uint64_t offset, const std::size_t length, std::uint8_t *output, const int threadCount)
+    {
+        if (frame == nullptr || output == nullptr)
+        {
+            FRAME_ERROR("frame::decodeRange(): Null data pointer(s)!");
+            return 0;
+        }
+
+        if (!seekTable.isValid())
+        {
+            FRAME_ERROR("frame::decodeRange(): Seek table not built!");
+            return 0;
+        }
+
+        const std::uint64_t totalSize = seekTable.getDecompressedSize();
+        const std::uint32_t blockSize = static_cast<std::uint32_t>(seekTable.getBlockSize());
+        if (frameSizeBytes < static_cast<std::size_t>(FrameHeaderSize) || loadU32(frame) != Magic ||
+            loadU32(frame + 4) != blockSize || loadU64(frame + 8) != totalSize)
+        {
+            FRAME_ERROR("frame::decodeRange(): Seek table doesn't match the frame!");
+            return 0;
+        }
+
+        if (offset >= totalSize || length == 0)
+        {
+            return 0;
+        }
+        const std::uint64_t end = (length < totalSize - offset) ? offset + length : totalSize;
+
+        // Blocks overlapping [offset, end), each decoded on its own. Whole blocks go
+        // straight to the output, the partial ones at the ends through a scratch block.
+        enum : char { BadHeader, DecodeFailed, Decoded };
+        const std::size_t firstBlock = static_cast<std::size_t>(offset / blockSize);
+        const std::size_t lastBlock = static_cast<std::size_t>((end - 1) / blockSize);
+        std::vector<char> results(lastBlock - firstBlock + 1, BadHeader);
+
+        parallelFor(results.size(), threadCount, [&](const std::size_t i)
+        {
+            const std::size_t block = firstBlock + i;
+            const std::uint64_t blockStart = std::uint64_t(block) * blockSize;
+            const std::uint64_t framePos = seekTable.getBlockOffset(block);
+            if (framePos > frameSizeBytes || frameSizeBytes - framePos < static_cast<std::size_t>(BlockHeaderSize) ||
+                !isBlockHeaderValid(frame, frameSizeBytes, static_cast<std::size_t>(framePos), blockStart))
+            {
+                return;
+            }
+
+            const std::uint8_t *header = frame + framePos;
+            const Codec codec = static_cast<Codec>(loadU32(header));
+            const int size = static_cast<int>(loadU32(header + 4));
+            const int sizeBytes = static_cast<int>(loadU32(header + 8));
+            const int sizeBits = static_cast<int>(loadU32(header + 12));
+            const std::uint8_t *data = header + BlockHeaderSize;
+
+            const std::uint64_t sliceStart = (offset > blockStart) ? offset : blockStart;
+            const std::uint64_t sliceEnd = (end < blockStart + size) ? end : blockStart + size;
+            const std::size_t sliceSize = static_cast<std::size_t>(sliceEnd - sliceStart);
+            const std::size_t blockPos = static_cast<std::size_t>(sliceStart - blockStart);
+            std::uint8_t *sliceOutput = output + static_cast<std::size_t>(sliceStart - offset);
+
+            bool ok;
+            if (sliceSize == static_cast<std::size_t>(size))
+            {
+                ok = decodeBlock(data, sizeBytes, sizeBits, codec, sliceOutput, size);
+            }
+            else if (codec == Codec::Stored)
+            {
+                ok = (sizeBytes == size);
+                if (ok)
+                {
+                    std::memcpy(sliceOutput, data + blockPos, sliceSize);
+                }
+            }
+            else
+            {
+                auto *scratch = static_cast<std::uint8_t *>(FRAME_MALLOC(size));
+                ok = decodeBlock(data, sizeBytes, sizeBits, codec, scratch, size);
+                if (ok)
+                {
+                    std::memcpy(sliceOutput, scratch + blockPos, sliceSize);
+                }
+                FRAME_MFREE(scratch);
+            }
+            results[i] = ok ? Decoded : DecodeFailed;
+        });
+
+        // Report the output up to the first bad block.
+        std::size_t bytesDecoded = 0;
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            if (results[i] != Decoded)
+            {
+                FRAME_ERROR(results[i] == BadHeader ? "frame::decodeRange(): Bad block header!" :
+                                                      "frame::decodeRange(): Failed to decode block!");
+                break;
+            }
+
+            const std::uint64_t blockStart = std::uint64_t(firstBlock + i) * blockSize;
+            const std::uint64_t blockEnd = blockStart + blockSize;
+            const std::uint64_t sliceStart = (offset > blockStart) ? offset : blockStart;
+            const std::uint64_t sliceEnd = (end < blockEnd) ? end : blockEnd;
+            bytesDecoded += static_cast<std::size_t>(sliceEnd - sliceStart);
+        }
+        return bytesDecoded;
+    }
+
+    // ========================================================
+    // compressFile() / decompressFile() implementation:
+    // ========================================================
+
+    // A whole file to read from. Memory mapped with FRAME_USE_MMAP, else read into FRAME_MALLOC memory.
+    class InputFile final {
+    public:
+        InputFile(const InputFile &) = delete;
+
+        InputFile &operator=(const InputFile &) = delete;
+
+        InputFile() = default;
+
+        ~InputFile();
+
+        bool open(const char *path);
+
+        const std::uint8_t *getData() const { return data; }
+
+        std::size_t getSize() const { return size; }
+
+    private:
+        std::uint8_t *data = nullptr; // Null for an empty file.
+        std::size_t size = 0;
+    };
+
+    // A file to write of a size known up front. Mapped with FRAME_USE_MMAP, so the
+    // data is written straight into the page cache, else written out by close().
+    class OutputFile final {
+    public:
+        OutputFile(const OutputFile &) = delete;
+
+        OutputFile &operator=(const OutputFile &) = delete;
+
+        OutputFile() = default;
+
+        ~OutputFile() { close(); }
+
+        bool create(const char *path, std::size_t sizeBytes);
+
+        // Returns false if the data couldn't be written out.
+        bool close();
+
+        std::uint8_t *getData() const { return data; }
+
+    private:
+        std::uint8_t *data = nullptr;
+        std::size_t size = 0;
+#ifdef FRAME_USE_MMAP
+        int fd = -1;
+#else // !FRAME_USE_MMAP
+        std::FILE *file = nullptr;
+#endif // FRAME_USE_MMAP
+    };
+
+#ifdef FRAME_USE_MMAP
+
+    InputFile::~InputFile()
+    {
+        if (data != nullptr)
+        {
+            ::munmap(data, size);
+        }
+    }
+
+    bool InputFile::open(const char *const path)
+    {
+        const int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat status;
+        if (::fstat(fd, &status) != 0 || std::uint64_t(status.st_size) > std::uint64_t(SIZE_MAX))
+        {
+            ::close(fd);
+            return false;
+        }
+
+        size = static_cast<std::size_t>(status.st_size);
+        if (size != 0)
+        {
+            void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED)
+            {
+                ::close(fd);
+                return false;
+            }
+
+            // Read front to back once, so ask for aggressive read-ahead.
+            data = static_cast<std::uint8_t *>(mapping);
+            ::madvise(mapping, size, MADV_SEQUENTIAL);
+        }
+
+        // The mapping keeps the file alive.
+        ::close(fd);
+        return true;
+    }
+
+    bool OutputFile::create(const char *const path, const std::size_t sizeBytes)
+    {
+        fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        if (::ftruncate(fd, static_cast<off_t>(sizeBytes)) != 0)
+        {
+            return false;
+        }
+
+        size = sizeBytes;
+        if (size != 0)
+        {
+            void *mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mapping == MAP_FAILED)
+            {
+                return false;
+            }
+            data = static_cast<std::uint8_t *>(mapping);
+        }
+        return true;
+    }
+
+    bool OutputFile::close()
+    {
+        bool written = true;
+        if (data != nullptr)
+        {
+            written = (::munmap(data, size) == 0);
+            data = nullptr;
+        }
+        if (fd >= 0)
+        {
+            written = (::close(fd) == 0) && written;
+            fd = -1;
+        }
+        return written;
+    }
+
+#else // !FRAME_USE_MMAP
+
+    InputFile::~InputFile()
+    {
+        if (data != nullptr)
+        {
+            FRAME_MFREE(data);
+        }
+    }
+
+    bool InputFile::open(const char *const path)
+    {
+        std::FILE *file = std::fopen(path, "rb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        // Read in growing chunks; ftell() can't be trusted past 2 GB everywhere.
+        std::size_t capacity = 0;
+        for (;;)
+        {
+            if (size == capacity)
+            {
+                const std::size_t newCapacity = (capacity != 0) ? capacity * 2 : DefaultBlockSize;
+                auto *newData = static_cast<std::uint8_t *>(FRAME_MALLOC(newCapacity));
+                if (data != nullptr)
+                {
+                    std::memcpy(newData, data, size);
+                    FRAME_MFREE(data);
+                }
+                data = newData;
+                capacity = newCapacity;
+            }
+
+            const std::size_t bytesRead = std::fread(data + size, 1, capacity - size, file);
+            size += bytesRead;
+            if (bytesRead == 0)
+            {
+                break;
+            }
+        }
+
+        const bool readAll = (std::ferror(file) == 0);
+        std::fclose(file);
+        return readAll;
+    }
+
+    bool OutputFile::create(const char *const path, const std::size_t sizeBytes)
+    {
+        file = std::fopen(path, "wb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        size = sizeBytes;
+        if (size != 0)
+        {
+            data = static_cast<std::uint8_t *>(FRAME_MALLOC(size));
+        }
+        return true;
+    }
+
+    bool OutputFile::close()
+    {
+        bool written = true;
+        if (file != nullptr)
+        {
+            written = (size == 0 || std::fwrite(data, 1, size, file) == size);
+            written = (std::fclose(file) == 0) && written;
+            file = nullptr;
+        }
+        if (data != nullptr)
+        {
+            FRAME_MFREE(data);
+            data = nullptr;
+        }
+        return written;
+    }
+
+#endif // FRAME_USE_MMAP
+
+    bool compressFile(const char *const inputPath, const char *const outputPath,
+                      const Codec codec, const int blockSize, int threadCount)
+    {
+        if (inputPath == nullptr || outputPath == nullptr)
+        {
+            FRAME_ERROR("frame::compressFile(): Null file path(s)!");
+            return false;
+        }
+
+        if (blockSize < MinBlockSize || blockSize > MaxBlockSize)
+        {
+            FRAME_ERROR("frame::compressFile(): Block size out of range!");
+            return false;
+        }
+
+        if (static_cast<int>(codec) > static_cast<int>(LastCodec) && codec != Codec::Auto)
+        {
+            FRAME_ERROR("frame::compressFile(): Unknown codec!");
+            return false;
+        }
+
+        InputFile input;
+        if (!input.open(inputPath))
+        {
+            FRAME_ERROR("frame::compressFile(): Can't read the input file!");
+            return false;
+        }
+
+        std::FILE *output = std::fopen(outputPath, "wb");
+        if (output == nullptr)
+        {
+            FRAME_ERROR("frame::compressFile(): Can't create the output file!");
+            return false;
+        }
+
+        std::uint8_t header[FrameHeaderSize];
+        storeFrameHeader(header, blockSize, input.getSize());
+        bool written = (std::fwrite(header, 1, FrameHeaderSize, output) == FrameHeaderSize);
+
+        // A few blocks per thread at a time, written out in order before the next batch.
+        if (threadCount <= 0)
+        {
+            threadCount = static_cast<int>(std::thread::hardware_concurrency());
+        }
+        const std::size_t batchSize = (threadCount > 0) ? std::size_t(threadCount) * 4 : 4;
+        const std::size_t blockCount = (input.getSize() + blockSize - 1) / blockSize;
+        std::vector<EncodedBlock> blocks(batchSize);
+
+        for (std::size_t first = 0; written && first < blockCount; first += batchSize)
+        {
+            const std::size_t count = (blockCount - first < batchSize) ? (blockCount - first) : batchSize;
+            auto blockInput = [&](const std::size_t i, int &size)
+            {
+                const std::size_t offset = (first + i) * blockSize;
+                const std::size_t remaining = input.getSize() - offset;
+                size = (remaining < static_cast<std::size_t>(blockSize)) ? static_cast<int>(remaining) : blockSize;
+                return input.getData() + offset;
+            };
+
+            parallelFor(count, threadCount, [&](const std::size_t i)
+            {
+                int size;
+                const std::uint8_t *data = blockInput(i, size);
+                blocks[i] = encodeBlock(data, size, codec);
+            });
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                int size;
+                const std::uint8_t *data = blockInput(i, size);
+                const EncodedBlock &block = blocks[i];
+
+                std::uint8_t blockHeader[BlockHeaderSize];
+                storeBlockHeader(blockHeader, block, size);
+                const std::uint8_t *blockData = (block.codec == Codec::Stored) ? data : block.data;
+                written = written &&
+                          std::fwrite(blockHeader, 1, BlockHeaderSize, output) == BlockHeaderSize &&
+                          std::fwrite(blockData, 1, block.sizeBytes, output) == static_cast<std::size_t>(block.sizeBytes);
+                freeBlockData(block);
+            }
+        }
+
+        written = (std::fclose(output) == 0) && written;
+        if (!written)
+        {
+            FRAME_ERROR("frame::compressFile(): Failed to write the output file!");
+        }
+        return written;
+    }
+
+    bool decompressFile(const char *const inputPath, const char *const outputPath, const int threadCount)
+    {
+        if (inputPath == nullptr || outputPath == nullptr)
+        {
+            FRAME_ERROR("frame::decompressFile(): Null file path(s)!");
+            return false;
+        }
+
+        InputFile input;
+        if (!input.open(inputPath))
+        {
+            FRAME_ERROR("frame::decompressFile(): Can't read the input file!");
+            return false;
+        }
+
+        const std::uint8_t *const frame = input.getData();
+        const std::size_t frameSizeBytes = input.getSize();
+        if (frameSizeBytes < static_cast<std::size_t>(FrameHeaderSize) || loadU32(frame) != Magic)
+        {
+            FRAME_ERROR("frame::decompressFile(): Not a frame!");
+            return false;
+        }
+
+        const std::uint32_t blockSize = loadU32(frame + 4);
+        if (blockSize < static_cast<std::uint32_t>(MinBlockSize) || blockSize > static_cast<std::uint32_t>(MaxBlockSize))
+        {
+            FRAME_ERROR("frame::decompressFile(): Bad block size in frame header!");
+            return false;
+        }
+
+        // The output file is sized from the header, so check every block header
+        // adds up to it first. A bad one must not get a huge sparse file made.
+        if (!isBlockCountValid(frame, frameSizeBytes) ||
+            scanBlocks(frame, frameSizeBytes, [](std::size_t, std::uint64_t) {}) != BlockScan::Ok)
+        {
+            FRAME_ERROR("frame::decompressFile(): Bad or truncated frame!");
+            return false;
+        }
+
+        const std::uint64_t totalSize = loadU64(frame + 8);
+        if (totalSize > std::uint64_t(SIZE_MAX))
+        {
+            FRAME_ERROR("frame::decompressFile(): Frame too big for this platform!");
+            return false;
+        }
+
+        OutputFile output;
+        if (!output.create(outputPath, static_cast<std::size_t>(totalSize)))
+        {
+            output.close();
+            std::remove(outputPath);
+            FRAME_ERROR("frame::decompressFile(): Can't create the output file!");
+            return false;
+        }
+
+        std::size_t bytesDecoded = 0;
+        if (totalSize != 0)
+        {
+            bytesDecoded = decompress(frame, frameSizeBytes, output.getData(),
+                                      static_cast<std::size_t>(totalSize), threadCount);
+        }
+
+        // Don't leave a partly decoded file behind.
+        const bool written = output.close();
+        if (!written || bytesDecoded != totalSize)
+        {
+            std::remove(outputPath);
+        }
+        if (!written)
+        {
+            FRAME_ERROR("frame::decompressFile(): Failed to write the output file!");
+            return false;
+        }
+        return bytesDecoded == totalSize;
+    }
+
+    // ========================================================
+    // histogram() implementation:
+    // ========================================================
+
+    void histogram(const std::uint8_t *data, const std::size_t dataSizeBytes, std::uint64_t *counts,
+                   const int threadCount)
+    {
+        if (data == nullptr || counts == nullptr)
+        {
+            FRAME_ERROR("frame::histogram(): Null data pointer(s)!");
+            return;
+        }
+
+        const std::size_t pieceCount = (dataSizeBytes + DefaultBlockSize - 1) / DefaultBlockSize;
+        std::vector<std::uint32_t> pieceCounts(pieceCount * huffman::MaxSymbols, 0);
+
+        parallelFor(pieceCount, threadCount, [&](const std::size_t i)
+        {
+            const std::size_t start = i * DefaultBlockSize;
+            const std::size_t size = (dataSizeBytes - start < DefaultBlockSize) ? (dataSizeBytes - start) : DefaultBlockSize;
+            huffman::histogram(data + start, static_cast<int>(size), &pieceCounts[i * huffman::MaxSymbols]);
+        });
+
+        for (std::size_t i = 0; i < pieceCount; ++i)
+        {
+            for (int s = 0; s < huffman::MaxSymbols; ++s)
+            {
+                counts[s] += pieceCounts[i * huffman::MaxSymbols + s];
+            }
+        }
+    }
+
+} // namespace frame {}
+
+// ================ End of implementation =================
+#endif // FRAME_IMPLEMENTATION
+// ================ End of implementation =================
@@ -31,38 +31,72 @@
 //
 // easyEncode()/easyDecode() functions are provided
 // for quick-n'-easy compression/decompression of raw data
-// buffers.
+// buffers. huffman::StreamEncoder/StreamDecoder do the same
+// for data supplied in chunks, coding it in blocks.
+//
+// Decoding is table driven: the Decoder turns the codes read
+// from the stream prefix into a huffman::DecodeTable, so each
+// symbol is resolved with one lookup per table level rather
+// than by matching the code one bit at a time.
+//
+// The tree prefix comes in two formats (see huffman::Format).
+// The legacy one stores every code in full, while the canonical
+// one only stores run-length coded code lengths, from which
+// both sides generate the same canonical codes. The decoder
+// accepts either.
+//
+// Format::Interleaved is canonical too, but splits the data in
+// four and codes each quarter into its own bit stream, behind a
+// small jump table, like zstd's Huff0. Codes are limited to
+// InterleavedMaxCodeLength bits, so one lookup in a flat table
+// resolves any symbol, and the decoder runs the four streams in
+// the same loop, where the CPU overlaps their lookups instead of
+// waiting on one long chain of dependent shifts.
 //
 // The size of a Huffman code is limited to 64 bits (to fit
-// inside a uint64) and no additional handing is done if this
-// size is overflowed. It will just log an error and ignore
-// further bits.
+// inside a uint64). The Encoder also takes a smaller maximum
+// code length. When the Huffman tree is deeper than allowed,
+// optimal length-limited code lengths are computed with the
+// package-merge algorithm instead. Codes no longer than
+// DecodeTable::MaxPrimaryBits decode with a single table level.
 //
 // Symbols are byte-sized so that we can limit the number of leaf
-// nodes to 256. There is an extra of 512 nodes for inner nodes,
-// but again if that size is exceeded we just log an error and
-// ignore.
+// nodes to 256. A tree over them has at most 255 inner nodes, which
+// follow the leaves in the same fixed-size array. The tree is built
+// with the two-queue method over the leaves sorted by frequency, so
+// there's no priority queue, and code lengths and codes are assigned
+// by walking the inner nodes backwards rather than recursing.
+//
+// Defining HUFFMAN_STATS adds per-thread counters and phase
+// timings (see huffman::Stats), for finding out where the time
+// goes. Without it the hooks compile to nothing.
 //
 // You can override the HUFFMAN_ERROR() macro to supply your
 // own error handling strategy. The default simply writes to
-// stderr and calls std::abort().
+// stderr and calls std::abort(). For untrusted input, such as
+// on a server, safeDecode() never calls it and returns a
+// huffman::DecodeStatus instead. Either way the decoding loops
+// check the stream and output bounds once per 57-bit window
+// rather than once per code, falling back to checked reads
+// only for the last few codes.
 //
-// Memory allocated explicitly by the bit streams will be sourced
-// from HUFFMAN_MALLOC/HUFFMAN_MFREE, so you can override the macros
-// to add custom memory management. Current that's all the memory
-// we allocate directly, but we also use std::priority_queue<> to
-// build the Huffman tree and the queue will allocate memory from
-// the global heap, so you won't be able to catch that, unfortunately.
+// For many small messages with a shared distribution, a
+// huffman::Table holds codes built once, from a sample or from
+// accumulated counts, and easyEncode()/easyDecode() overloads
+// taking it skip the per-call tree build and tree prefix.
 //
-// The huffman::Node struct is not very optimized for size.
-// We use full signed integers for the value and child indexes,
-// while the 32-bits range is not strictly needed. All we need
-// is the ability to set them to -1 (used as a sentinel value),
-// so a signed short would do for the value and child links.
-// If you're interested in optimizing for memory usage/size,
-// start from there.
+// Memory allocated by the bit streams and decode tables is sourced
+// from HUFFMAN_MALLOC/HUFFMAN_MFREE by default, so you can override the
+// macros to add custom memory management. A huffman::Allocator can also
+// be passed to the encoder, decoder and easy functions to route their
+// allocations through an arena or pool instead, and easyEncode() can
+// write to a caller buffer sized with maxCompressedSize(). The tree is
+// built in fixed-size arrays, so that's all the memory we allocate.
 //
-// The same could also probably be done for huffman::Code.
+// The huffman::Node struct stores the value and child indexes as
+// signed shorts, that's all the range they need, with -1 used as
+// a sentinel value. huffman::Code could probably be made smaller
+// too, if you're interested in optimizing for memory usage/size.
 // If you're sure you'll never need more than 32 bits for
 // a code, you could replace the code long-word by a uint32.
 // The accompanying code length is an int, which is also overkill,
@@ -70,10 +104,10 @@
 // saving space in the structure members, you might replace it
 // with a byte or short and pack the structure.
 
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <array>
-#include <queue>
 #include <vector>
 
 // Disable the bit stream => std::string dumping methods.
@@ -104,6 +138,58 @@ namespace huffman {
 #define HUFFMAN_ERROR(message) ::huffman::fatalError(message)
 #endif // HUFFMAN_ERROR
 
+    // ========================================================
+    // struct Allocator:
+    // ========================================================
+
+    // Source of all the memory the library allocates. Objects keep a pointer
+    // to it, so it must outlive them. Memory handed to the user (e.g. by
+    // BitStreamWriter::release()) has to be freed with the same allocator.
+    struct Allocator {
+        void *(*allocate)(void *context, std::size_t sizeBytes);
+        void (*deallocate)(void *context, void *ptr);
+        void *context;
+    };
+
+    // Goes through HUFFMAN_MALLOC/HUFFMAN_MFREE.
+    const Allocator &defaultAllocator();
+
+#ifdef HUFFMAN_STATS
+
+    // ========================================================
+    // struct Stats:
+    // ========================================================
+
+    // Counters and phase times (in nanoseconds) of the calling thread.
+    // They add up over every encoder and decoder run, streaming ones
+    // included, until resetStats(). Only there with HUFFMAN_STATS defined.
+    struct Stats {
+        std::uint64_t encodeCalls;          // Encoders run, one per easyEncode() or stream block.
+        std::uint64_t encodedBytesIn;       // Uncompressed bytes encoded.
+        std::uint64_t encodedBytesOut;      // Compressed bytes produced, tree prefixes included.
+        std::uint64_t decodeCalls;
+        std::uint64_t decodedBytesIn;
+        std::uint64_t decodedBytesOut;
+
+        std::uint64_t countNanos;           // Encoder::countFrequencies().
+        std::uint64_t buildNanos;           // Tree build and code assignment.
+        std::uint64_t treeWriteNanos;       // Encoder::writeTreeBitStream().
+        std::uint64_t dataWriteNanos;       // Writing the data codes.
+        std::uint64_t prefixReadNanos;      // Reading the tree prefix and building the DecodeTable.
+        std::uint64_t decodeNanos;          // Decoding the data codes.
+
+        std::uint64_t lengthLimitedBuilds;  // Trees too deep for the max code length, redone with package-merge.
+        std::uint64_t bufferAllocations;    // BitStreamWriter buffers allocated, first or regrown.
+        std::uint64_t bufferGrowths;        // Of those, the ones that copied an old buffer over.
+        std::uint64_t bufferBytesAllocated;
+    };
+
+    const Stats &stats();
+
+    void resetStats();
+
+#endif // HUFFMAN_STATS
+
     // ========================================================
     // class Code:
     // ========================================================
@@ -190,6 +276,12 @@ namespace huffman {
 
         explicit BitStreamWriter(int initialSizeInBits, int growthGranularity = 2);
 
+        explicit BitStreamWriter(const Allocator &allocator, int initialSizeInBits = 8192, int growthGranularity = 2);
+
+        // Writes to a fixed-size external buffer, which is never grown or freed.
+        // Bits that don't fit are dropped and isOverflowed() becomes true.
+        BitStreamWriter(std::uint8_t *buffer, int bufferSizeBytes);
+
         void allocate(int bitsWanted);
 
         void setGranularity(int growthGranularity);
@@ -202,6 +294,10 @@ namespace huffman {
 
         void appendCode(Code code);
 
+        // Adds byteCount bytes to a byte-aligned stream, for the caller to fill in
+        // whole, and returns where they start. Null if an external buffer is full.
+        std::uint8_t *appendBytes(int byteCount);
+
 #ifndef HUFFMAN_NO_STD_STRING
 
         std::string toBitString() const; // Useful for debugging.
@@ -215,19 +311,27 @@ namespace huffman {
 
         const std::uint8_t *getBitStream() const;
 
+        bool isOverflowed() const { return overflowed; }
+
         ~BitStreamWriter();
 
     private:
         void internalInit();
 
-        static std::uint8_t *allocBytes(int bytesWanted, std::uint8_t *oldPtr, int oldSize);
+        bool reserveWord();
+
+        std::uint8_t *allocBytes(int bytesWanted, std::uint8_t *oldPtr, int oldSize) const;
 
-        std::uint8_t *stream; // Growable buffer to store our bits. Heap allocated & owned by the class instance.
-        int bytesAllocated;   // Current size of heap-allocated stream buffer *in bytes*.
-        int granularity;      // Amount bytesAllocated multiplies by when auto-resizing in appendBit().
-        int currBytePos;      // Current byte being written to, from 0 to bytesAllocated-1.
-        int nextBitPos;       // Bit position within the current byte to access next. 0 to 7.
-        int numBitsWritten;   // Number of bits in use from the stream buffer, not including byte-rounding padding.
+        const Allocator *allocator;
+        std::uint8_t *stream;    // Growable buffer to store our bits. Heap allocated & owned by the class instance, unless external.
+        std::uint64_t bitBuffer; // Bits from currBytePos onwards. Always mirrored to the stream with one 64-bit store.
+        bool external;           // Stream is a fixed-size user buffer.
+        bool overflowed;         // Ran out of room in the external buffer.
+        int bytesAllocated;      // Current size of heap-allocated stream buffer *in bytes*.
+        int granularity;         // Amount bytesAllocated multiplies by when auto-resizing in appendBit().
+        int currBytePos;         // Current byte being written to, from 0 to bytesAllocated-8.
+        int nextBitPos;          // Bit position within the current byte to access next. 0 to 7.
+        int numBitsWritten;      // Number of bits in use from the stream buffer, not including byte-rounding padding.
     };
 
     // ========================================================
@@ -251,6 +355,14 @@ namespace huffman {
 
         std::uint64_t readBitsU64(int bitCount);
 
+        // Look at the next bitCount bits (up to 57) without consuming them.
+        // Bits past the end of the stream read as zeros.
+        std::uint64_t peekBitsU64(int bitCount) const;
+
+        void skipBits(int bitCount);
+
+        int getBitsLeft() const { return sizeInBits - numBitsRead; }
+
         // Basic stream info:
         int getByteCount() const { return sizeInBytes; }
 
@@ -266,6 +378,8 @@ namespace huffman {
         int getCodeLength() const { return currCode.getLength(); }
 
     private:
+        std::uint64_t loadWindow() const;
+
         const std::uint8_t *stream; // Pointer to the external bit stream. Not owned by the reader.
         const int sizeInBytes;      // Size of the stream *in bytes*. Might include padding.
         const int sizeInBits;       // Size of the stream *in bits*, padding *not* include.
@@ -281,24 +395,88 @@ namespace huffman {
 
     constexpr int Nil = -1;
     constexpr int MaxSymbols = 256;
-    constexpr int MaxNodes = MaxSymbols + 512;
+    constexpr int MaxNodes = MaxSymbols * 2 - 1;
 
     struct Node final {
-        int frequency = Nil;  // Occurrence count; Nil if not in use.
-        int leftChild = Nil;  // Left  gets code 0 assigned to it; Nil initially
-        int rightChild = Nil; // Right gets code 1 assigned to it; Nil initially.
-        int value = Nil;      // Symbol value of this node. Interpreted as a byte.
-        Code code;            // Huffman code that will be assigned to this node.
+        int frequency = Nil;           // Occurrence count; Nil if not in use.
+        std::int16_t leftChild = Nil;  // Left  gets code 0 assigned to it; Nil initially
+        std::int16_t rightChild = Nil; // Right gets code 1 assigned to it; Nil initially.
+        std::int16_t value = Nil;      // Symbol value of this node. Interpreted as a byte.
+        Code code;                     // Huffman code that will be assigned to this node.
 
         bool isValid() const { return frequency != Nil; }
 
         bool isLeaf() const { return leftChild == Nil && rightChild == Nil; }
     };
 
+    // ========================================================
+    // Tree prefix formats:
+    // ========================================================
+
+    // How the tree prefix is stored in the bit stream. The Decoder detects
+    // the format from the first 16 bits, so older streams remain readable.
+    enum class Format : std::uint8_t {
+        // The original layout: a 16-bit code count (always 256) followed by every
+        // symbol's code length and full code bits. Codes include the root bit.
+        Legacy = 0,
+
+        // Canonical Huffman codes. Only the code lengths are stored, run-length
+        // coded like DEFLATE's code length alphabet, and both sides regenerate
+        // the codes from them. Much smaller prefix for short inputs.
+        Canonical = 1,
+
+        // Canonical prefix, then the data cut into four equal parts, the last one
+        // possibly shorter, each coded into a stream of its own:
+        //
+        // +-----------+-----------+-----------+-----------+----------+-----+----------+
+        // | u32 bytes | u32 size0 | u32 size1 | u32 size2 | stream 0 | ... | stream 3 |
+        // +-----------+-----------+-----------+-----------+----------+-----+----------+
+        //
+        // The first word is the uncompressed size, then the byte sizes of the first
+        // three streams; the last one takes the rest. Each stream is padded to a byte.
+        // Much faster to decode, for 16 more bytes. Codes are limited to
+        // InterleavedMaxCodeLength bits; a larger maxCodeLength is lowered to that.
+        Interleaved = 2
+    };
+
+    // Non-legacy streams start with FormatTag | Format in the first 16 bits,
+    // where legacy streams store their code count (MaxSymbols).
+    constexpr int FormatTag = 0xFF00;
+
+    // Longest code of a Format::Interleaved stream, same as DecodeTable::MaxPrimaryBits,
+    // so each symbol is one lookup in the primary table.
+    constexpr int InterleavedMaxCodeLength = 11;
+
+    // Streams of a Format::Interleaved stream.
+    constexpr int InterleavedStreams = 4;
+
+    // ========================================================
+    // Decode status:
+    // ========================================================
+
+    // What went wrong decoding a stream, for safeDecode() and Decoder::getStatus().
+    enum class DecodeStatus : std::uint8_t {
+        Ok,            // The whole stream decoded fine.
+        BadArguments,  // Null pointers or sizes out of range.
+        BadHeader,     // Unknown format tag, or a malformed tree prefix.
+        CorruptData,   // Invalid code, or a stream ending in the middle of one.
+        OutputTooSmall // The data didn't fit in the output buffer.
+    };
+
+    // ========================================================
+    // histogram():
+    // ========================================================
+
+    // Adds the number of times each byte value occurs in data to counts,
+    // an array of MaxSymbols entries, so it can be run over several buffers.
+    void histogram(const std::uint8_t *data, int dataSizeBytes, std::uint32_t *counts);
+
     // ========================================================
     // Huffman encoder class:
     // ========================================================
 
+    class Table;
+
     class Encoder final {
     public:
         // No copy/assignment.
@@ -309,7 +487,18 @@ namespace huffman {
         // Constructor will start the encoding process,
         // building the Huffman tree and creating the output stream.
         // Call getBitStreamWriter() to fetch the results.
-        Encoder(const std::uint8_t *data, int dataSizeBytes, bool prependTreeToBitStream);
+        // The format selects the tree prefix layout and, for Format::Canonical,
+        // also replaces the tree codes with canonical codes of the same lengths.
+        // No code will be longer than maxCodeLength bits (1 to Code::MaxBits).
+        Encoder(const std::uint8_t *data, int dataSizeBytes, bool prependTreeToBitStream,
+                Format format = Format::Legacy, int maxCodeLength = Code::MaxBits,
+                const Allocator &allocator = defaultAllocator());
+
+        // Same, but the bit stream is written to a fixed-size user buffer. Check
+        // getBitStreamWriter().isOverflowed() to see if it didn't fit.
+        Encoder(const std::uint8_t *data, int dataSizeBytes, bool prependTreeToBitStream,
+                std::uint8_t *output, int outputSizeBytes,
+                Format format = Format::Legacy, int maxCodeLength = Code::MaxBits);
 
         // Find node can be used by a decoder to reconstruct
         // the original data from a bit stream of Huffman codes.
@@ -328,43 +517,106 @@ namespace huffman {
         int getTreePrefixBits() const;
 
     private:
-        // Priority queue comparator.
-        // Places nodes with lower frequency first.
-        struct NodeCmp {
-            bool operator()(const Node *a, const Node *b) const {
-                return a->frequency > b->frequency;
-            }
-        };
-
-        // Queue stores pointers into the nodes[] array below.
-        using PQueue = std::priority_queue<Node *, std::vector<Node *>, NodeCmp>;
-
         // Internal helpers:
+        void encode(const std::uint8_t *data, int dataSizeBytes, bool prependTreeToBitStream, int maxCodeLength);
+
         void buildHuffmanTree();
 
         void writeTreeBitStream();
 
+        void writeLegacyTree();
+
+        void writeCanonicalTree();
+
+        void assignCodes(int maxCodeLength);
+
+        void findDepths(int *depths) const;
+
         void writeDataBitStream(const std::uint8_t *data, int dataSizeBytes);
 
+        void writeInterleavedStreams(const std::uint8_t *data, int dataSizeBytes);
+
         void countFrequencies(const std::uint8_t *data, int dataSizeBytes);
 
-        void recursiveAssignCodes(Node *node, const Node *parent, int bit);
+        void assignTreeCodes();
 
-        const Node *recursiveFindLeaf(const Node *node, Code code) const;
+        // Only builds the codes, for a Table. No stream is written.
+        friend class Table;
 
-        Node *addInnerNode(int frequency, int child0, int child1);
+        Encoder(const std::uint32_t *frequencies, int maxCodeLength);
 
     private:
         // Output bit stream (will allocate some heap memory).
         BitStreamWriter bitStream;
 
         Node *treeRoot;
+        int innerNodeCount; // Inner nodes are nodes[MaxSymbols] up to this many, root last.
         int treePrefixBits;
+        Format format;
 
         // Fixed-size pool of nodes. We don't explicitly allocate memory in the encoder.
         std::array <Node, MaxNodes> nodes;
     };
 
+    // ========================================================
+    // class DecodeTable:
+    // ========================================================
+
+    // Multi-level lookup table built from an array of leaf codes, one code
+    // per symbol (zero-length codes are unused symbols). The primary table is
+    // indexed by the next PrimaryBits of the stream; codes longer than that
+    // continue into secondary tables, so each symbol costs one lookup per level
+    // instead of one code comparison per bit. Codes must be prefix-free.
+    class DecodeTable final {
+    public:
+        static constexpr int MaxPrimaryBits = 11;
+        static constexpr int MaxSecondaryBits = 8;
+
+        enum EntryKind : std::uint8_t {
+            Invalid, // No code maps to this index.
+            Leaf,    // A whole code ends within this table.
+            Link     // The code continues into a secondary table.
+        };
+
+        struct Entry {
+            std::uint16_t value; // Symbol for Leaf entries, index of the secondary table for Link entries.
+            std::uint8_t bits;   // Leaf: code bits consumed at this level. Link: index width of the secondary table.
+            std::uint8_t kind;   // One of the EntryKind constants.
+        };
+
+        // No copy/assignment.
+        DecodeTable(const DecodeTable &) = delete;
+
+        DecodeTable &operator=(const DecodeTable &) = delete;
+
+        explicit DecodeTable(const Allocator &allocator = defaultAllocator());
+
+        ~DecodeTable();
+
+        // Rebuilds the table from codeCount codes (the symbol is the index into the array).
+        // Returns false if the codes don't form a valid prefix code.
+        bool build(const Code *codes, int codeCount);
+
+        // Index width of the primary table. Zero if not built.
+        int getPrimaryBits() const { return primaryBits; }
+
+        // Length of the longest code in the table.
+        int getMaxCodeLength() const { return maxCodeLength; }
+
+        const Entry &getEntry(const int index) const { return entries[index]; }
+
+    private:
+        int countEntries(const Code *codes, int codeCount, int usedBits, std::uint64_t prefix, int tableBits) const;
+
+        bool fillTable(const Code *codes, int codeCount, int usedBits, std::uint64_t prefix, int tableBits, int tableStart);
+
+        const Allocator *allocator;
+        Entry *entries;   // Primary table followed by all secondary tables.
+        int entryCount;   // Entries in use, including secondary tables.
+        int primaryBits;  // Width of the primary table index.
+        int maxCodeLength;
+    };
+
     // ========================================================
     // Huffman decoder class:
     // ========================================================
@@ -377,29 +629,111 @@ namespace huffman {
         Decoder &operator=(const Decoder &) = delete;
 
         // Start the decoder from a bit stream:
-        explicit Decoder(const BitStreamWriter &encodedBitStream);
+        explicit Decoder(const BitStreamWriter &encodedBitStream, const Allocator &allocator = defaultAllocator());
+
+        Decoder(const std::uint8_t *encodedData, int encodedSizeBytes, int encodedSizeBits,
+                const Allocator &allocator = defaultAllocator());
 
-        Decoder(const std::uint8_t *encodedData, int encodedSizeBytes, int encodedSizeBits);
+        // With reportErrors false, problems are only recorded in getStatus(),
+        // HUFFMAN_ERROR() is never called. For untrusted input, see safeDecode().
+        Decoder(const std::uint8_t *encodedData, int encodedSizeBytes, int encodedSizeBits,
+                bool reportErrors, const Allocator &allocator = defaultAllocator());
 
         // Runs the decoding loop, writing to the user buffer.
         // Returns the number of *bytes* decoded, which might differ
         // from dataSizeBytes if there is an error or size mismatch.
         int decode(std::uint8_t *data, int dataSizeBytes);
 
+        // First problem found reading the prefix or decoding, if any.
+        DecodeStatus getStatus() const { return status; }
+
     private:
         // Internal helpers:
+        void fail(DecodeStatus problem, const char *message);
+
         void readPrefixData();
 
-        int findMatchingCode(const Code code) const;
+        bool readLegacyTree(int &treePrefixBits);
+
+        bool readCanonicalTree(int &treePrefixBits);
+
+        int decodeInterleaved(std::uint8_t *data, int dataSizeBytes);
 
         // Helps us manipulate the external raw buffer.
         BitStreamReader bitStream;
 
+        // Format::Interleaved stream; the data is four streams after the prefix.
+        bool interleaved;
+
+        bool reportErrors;
+        DecodeStatus status;
+
         // Assume the output is only storing the leaf nodes.
         // We also don't need to store a full Node here, just
         // its code, since the value/symbol is implicit by the
         // position within the array.
         std::array <Code, MaxSymbols> codes;
+
+        // Lookup table built from the codes above by readPrefixData().
+        DecodeTable decodeTable;
+    };
+
+    // ========================================================
+    // class Table:
+    // ========================================================
+
+    // Canonical code table built once and then shared by any number of
+    // easyEncode()/easyDecode() calls, for many small messages with the
+    // same distribution. Those calls skip the tree build, and the output
+    // has no tree prefix, so the table has to be known to both sides,
+    // e.g. sent once out-of-band with serialize().
+    class Table final {
+    public:
+        // Longest serialize() output, a canonical prefix of 256 literal lengths.
+        static constexpr int MaxSerializedBytes = (16 + 3 + MaxSymbols * 7 + 7) / 8;
+
+        // No copy/assignment.
+        Table(const Table &) = delete;
+
+        Table &operator=(const Table &) = delete;
+
+        // An empty table, until built or deserialized.
+        explicit Table(const Allocator &allocator = defaultAllocator());
+
+        // Codes for the given MaxSymbols symbol counts. Symbols with a count of 0 get
+        // no code and can't be encoded. Very large counts are scaled down to fit.
+        bool build(const std::uint32_t *frequencies, int maxCodeLength = Code::MaxBits);
+
+        // Counts the sample and builds from that. Counts start at 1, so
+        // bytes missing from the sample still get a (long) code.
+        bool buildFromSample(const std::uint8_t *sample, int sampleSizeBytes, int maxCodeLength = Code::MaxBits);
+
+        // Same layout as the tree prefix of a Format::Canonical stream. Returns
+        // the bytes written, or 0 if it didn't fit in outputSizeBytes.
+        int serialize(std::uint8_t *output, int outputSizeBytes) const;
+
+        // Reads a serialize() output. Returns false without calling HUFFMAN_ERROR()
+        // if the bytes aren't a valid table, since they usually come from outside.
+        // A failed call may leave the table empty (isValid() is false).
+        bool deserialize(const std::uint8_t *data, int dataSizeBytes);
+
+        bool isValid() const { return decodeTable.getPrimaryBits() != 0; }
+
+        // Stream order, like Encoder codes. Zero length for symbols without a code.
+        const Code &getCode(const int symbol) const { return codes[symbol]; }
+
+        int getMaxCodeLength() const { return maxCodeLength; }
+
+        const DecodeTable &getDecodeTable() const { return decodeTable; }
+
+    private:
+        // Quietly returns false for lengths that don't form a prefix code.
+        bool setCodeLengths(const std::uint8_t *lengths);
+
+        std::array<Code, MaxSymbols> codes;
+        std::array<std::uint8_t, MaxSymbols> codeLengths;
+        int maxCodeLength;
+        DecodeTable decodeTable;
     };
 
     // ========================================================
@@ -407,17 +741,169 @@ namespace huffman {
     // ========================================================
 
     // Quick Huffman data compression.
-    // Output compressed data is heap allocated with HUFFMAN_MALLOC()
-    // and should be later freed with HUFFMAN_MFREE().
+    // Output compressed data is heap allocated from the given allocator
+    // and should be later freed with its deallocate(), which for the
+    // default allocator is HUFFMAN_MFREE().
+    // Format::Canonical gives a smaller output, but can only be
+    // read back by a decoder that knows about the format tag.
+    // Format::Interleaved decodes several times faster.
     void easyEncode(const std::uint8_t *uncompressed, int uncompressedSizeBytes,
-                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits);
+                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits,
+                    Format format = Format::Legacy, int maxCodeLength = Code::MaxBits,
+                    const Allocator &allocator = defaultAllocator());
+
+    // Same as above, but writes to a caller-provided buffer instead, making no allocations.
+    // A buffer of maxCompressedSize() bytes always fits. Returns false if it didn't fit.
+    bool easyEncode(const std::uint8_t *uncompressed, int uncompressedSizeBytes,
+                    std::uint8_t *compressed, int compressedCapacityBytes,
+                    int *compressedSizeBytes, int *compressedSizeBits,
+                    Format format = Format::Legacy, int maxCodeLength = Code::MaxBits);
+
+    // Worst-case easyEncode() output size for any input of the given size.
+    int maxCompressedSize(int uncompressedSizeBytes);
 
     // Decompress back the output of easyEncode().
     // The uncompressed output buffer is assumed to be big enough to hold the uncompressed data,
     // if it happens to be smaller, the decoder will return a partial output and the return value
     // of this function will be less than uncompressedSizeBytes.
     int easyDecode(const std::uint8_t *compressed, int compressedSizeBytes, int compressedSizeBits,
-                   std::uint8_t *uncompressed, int uncompressedSizeBytes);
+                   std::uint8_t *uncompressed, int uncompressedSizeBytes,
+                   const Allocator &allocator = defaultAllocator());
+
+    // Same as the above, but coded with a shared Table. The output is just the codes,
+    // with no tree prefix, so it can only be decoded with the same table. Inputs
+    // holding a symbol the table has no code for fail with an error.
+    void easyEncode(const Table &table, const std::uint8_t *uncompressed, int uncompressedSizeBytes,
+                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits,
+                    const Allocator &allocator = defaultAllocator());
+
+    // The table overloads below make no allocations at all, the table already
+    // holds all the memory they need, from the allocator it was created with.
+    bool easyEncode(const Table &table, const std::uint8_t *uncompressed, int uncompressedSizeBytes,
+                    std::uint8_t *compressed, int compressedCapacityBytes,
+                    int *compressedSizeBytes, int *compressedSizeBits);
+
+    int maxCompressedSize(const Table &table, int uncompressedSizeBytes);
+
+    int easyDecode(const Table &table, const std::uint8_t *compressed, int compressedSizeBytes,
+                   int compressedSizeBits, std::uint8_t *uncompressed, int uncompressedSizeBytes);
+
+    // Same as easyDecode(), but for untrusted input: HUFFMAN_ERROR() is never called,
+    // whatever the stream holds. Problems are returned instead, and *bytesDecoded
+    // gets the bytes written to uncompressed either way. A stream that doesn't end
+    // right after its last code is CorruptData, which easyDecode() lets pass.
+    DecodeStatus safeDecode(const std::uint8_t *compressed, int compressedSizeBytes, int compressedSizeBits,
+                            std::uint8_t *uncompressed, int uncompressedSizeBytes, int *bytesDecoded,
+                            const Allocator &allocator = defaultAllocator());
+
+    DecodeStatus safeDecode(const Table &table, const std::uint8_t *compressed, int compressedSizeBytes,
+                            int compressedSizeBits, std::uint8_t *uncompressed, int uncompressedSizeBytes,
+                            int *bytesDecoded);
+
+    // ========================================================
+    // Streaming API:
+    // ========================================================
+
+    // For inputs too big to hold in memory at once. Set nextIn/availIn and
+    // nextOut/availOut, then call encode()/decode() until the input is used up,
+    // refilling the buffers in between, same as zlib's z_stream. The calls
+    // advance the pointers and counters by however much they consumed/produced.
+    struct StreamBuffers {
+        const std::uint8_t *nextIn = nullptr; // Next input byte.
+        std::size_t availIn = 0;              // Number of bytes available at nextIn.
+        std::uint64_t totalIn = 0;            // Total input bytes consumed so far.
+
+        std::uint8_t *nextOut = nullptr;      // Next output byte goes here.
+        std::size_t availOut = 0;             // Remaining free space at nextOut.
+        std::uint64_t totalOut = 0;           // Total output bytes produced so far.
+    };
+
+    enum class StreamStatus : std::uint8_t {
+        Ok,        // Progress made, or needs more input/output space to make any.
+        StreamEnd, // Finished; all the output has been written out.
+        Error      // Malformed input. The stream can't continue.
+    };
+
+    // A Huffman tree is built from the whole input, so streams are cut into
+    // blocks that are each coded on their own, as easyEncode() would, with:
+    //
+    // +-------------------+-------------------+---------------------------+
+    // | u32 size in bytes | u32 size in bits  | easyEncode() output bytes |
+    // +-------------------+-------------------+---------------------------+
+    //
+    // Sizes are little-endian; the first is uncompressed, the second compressed.
+    // A block of size zero (just the first word) marks the end of the stream.
+    constexpr int DefaultStreamBlockSize = 1 << 16;
+
+    // Larger blocks are rejected, so a bad header can't make the decoder allocate without bound.
+    constexpr int MaxStreamBlockSize = 1 << 24;
+
+    class StreamEncoder final : public StreamBuffers {
+    public:
+        // No copy/assignment.
+        StreamEncoder(const StreamEncoder &) = delete;
+
+        StreamEncoder &operator=(const StreamEncoder &) = delete;
+
+        explicit StreamEncoder(int blockSizeBytes = DefaultStreamBlockSize,
+                               Format format = Format::Canonical, int maxCodeLength = Code::MaxBits,
+                               const Allocator &allocator = defaultAllocator());
+
+        ~StreamEncoder();
+
+        // Pass finish = true once the last of the input has been supplied.
+        // Keep calling with more output space until it returns StreamEnd.
+        StreamStatus encode(bool finish);
+
+    private:
+        void encodeBlock();
+
+        const Allocator *allocator;
+        std::uint8_t *block;   // Input gathered for the next block.
+        int blockSize;
+        int blockUsed;
+        std::uint8_t *pending; // Encoded block, or end marker, while it's written out.
+        int pendingSize;
+        int pendingPos;
+        Format format;
+        int maxCodeLength;
+        bool finished;         // End marker queued.
+    };
+
+    class StreamDecoder final : public StreamBuffers {
+    public:
+        // No copy/assignment.
+        StreamDecoder(const StreamDecoder &) = delete;
+
+        StreamDecoder &operator=(const StreamDecoder &) = delete;
+
+        explicit StreamDecoder(const Allocator &allocator = defaultAllocator());
+
+        ~StreamDecoder();
+
+        // Pass finish = true once the last of the input has been supplied.
+        // Decoded blocks are written out as output space allows, across calls.
+        StreamStatus decode(bool finish);
+
+    private:
+        bool decodeBlock();
+
+        const Allocator *allocator;
+        std::uint8_t header[8];    // Block header, might straddle input chunks.
+        int headerBytes;
+        int blockSize;             // Uncompressed size of the last decoded block.
+        int nextBlockSize;         // Uncompressed size of the block being gathered.
+        int compressedBits;
+        int compressedSize;        // Bytes of the current block; compressedUsed of them gathered so far.
+        int compressedUsed;
+        std::uint8_t *compressed;
+        int compressedCapacity;
+        std::uint8_t *block;       // Last decoded block, blockPos bytes of it written out.
+        int blockCapacity;
+        int blockPos;
+        bool finished;             // Got the end marker.
+        bool failed;
+    };
 
 } // namespace huffman {}
 
@@ -437,12 +923,66 @@ namespace huffman {
 #include <cstdio> // For the default error handler
 #endif            // HUFFMAN_USING_DEFAULT_ERROR_HANDLER
 
+#include <algorithm>
+#include <climits>
 #include <cassert>
 #include <cstring>
 
+#ifdef HUFFMAN_STATS
+#include <chrono>
+#endif // HUFFMAN_STATS
+
 namespace huffman
 {
 
+    // ========================================================
+    // Stats:
+    // ========================================================
+
+#ifdef HUFFMAN_STATS
+
+    static thread_local Stats threadStats;
+
+    const Stats &stats()
+    {
+        return threadStats;
+    }
+
+    void resetStats()
+    {
+        threadStats = Stats();
+    }
+
+    // Adds the time until the end of its scope to a Stats field.
+    class StatTimer final
+    {
+    public:
+        explicit StatTimer(std::uint64_t &totalNanos)
+            : totalNanos(totalNanos), start(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~StatTimer()
+        {
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            totalNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        }
+
+    private:
+        std::uint64_t &totalNanos;
+        std::chrono::steady_clock::time_point start;
+    };
+
+#define HUFFMAN_STAT_ADD(field, amount) (threadStats.field += static_cast<std::uint64_t>(amount))
+#define HUFFMAN_STAT_TIMER(field) StatTimer field##Timer(threadStats.field)
+
+#else // !HUFFMAN_STATS
+
+#define HUFFMAN_STAT_ADD(field, amount) ((void)0)
+#define HUFFMAN_STAT_TIMER(field) ((void)0)
+
+#endif // HUFFMAN_STATS
+
     // ========================================================
     // Local helpers:
     // ========================================================
@@ -460,6 +1000,38 @@ namespace huffman
 
     // ========================================================
 
+    // Unaligned little-endian 64-bit memory access. The bit streams are
+    // LSB first, so on little-endian machines a word is just a memcpy.
+    static std::uint64_t loadU64(const std::uint8_t *ptr)
+    {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        std::uint64_t word = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            word |= std::uint64_t(ptr[i]) << (i * 8);
+        }
+        return word;
+#else
+        std::uint64_t word;
+        std::memcpy(&word, ptr, sizeof(word));
+        return word;
+#endif
+    }
+
+    static void storeU64(std::uint8_t *ptr, const std::uint64_t word)
+    {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        for (int i = 0; i < 8; ++i)
+        {
+            ptr[i] = static_cast<std::uint8_t>(word >> (i * 8));
+        }
+#else
+        std::memcpy(ptr, &word, sizeof(word));
+#endif
+    }
+
+    // ========================================================
+
     // Count the minimum number of bits required to
     // represent the integer 'num', AKA its log2.
     static int bitsForInteger(int num)
@@ -475,689 +1047,2704 @@ namespace huffman
 
     // ========================================================
 
-#ifdef HUFFMAN_USING_DEFAULT_ERROR_HANDLER
-
-    // Prints a fatal error to stderr and aborts the process.
-    // This is the default method used by HUFFMAN_ERROR(), but
-    // you can override the macro to use other error handling
-    // mechanisms, such as C++ exceptions.
-    void fatalError(const char *const message)
+    // Mirror the lowest bitCount bits of num, e.g. 0b0011 (4 bits) => 0b1100
+    static std::uint64_t reverseBits(std::uint64_t num, const int bitCount)
     {
-        std::fprintf(stderr, "Huffman encoder/decoder error: %s\n", message);
-        std::abort();
+        std::uint64_t reversed = 0;
+        for (int b = 0; b < bitCount; ++b)
+        {
+            reversed = (reversed << 1) | (num & 1);
+            num >>= 1;
+        }
+        return reversed;
     }
 
-#endif // HUFFMAN_USING_DEFAULT_ERROR_HANDLER
-
-    // ========================================================
-    // class BitStreamWriter:
     // ========================================================
 
-    BitStreamWriter::BitStreamWriter()
-    {
-        // 8192 bits for a start (1024 bytes). It will resize if needed.
-        // Default granularity is 2.
-        internalInit();
-        allocate(8192);
-    }
-
-    BitStreamWriter::BitStreamWriter(const int initialSizeInBits, const int growthGranularity)
-    {
-        internalInit();
-        setGranularity(growthGranularity);
-        allocate(initialSizeInBits);
-    }
-
-    BitStreamWriter::~BitStreamWriter()
+    // Generate canonical Huffman codes from a set of code lengths, DEFLATE
+    // style: shorter codes first, symbols of equal length in increasing order.
+    // Canonical codes are defined MSB first, so they are stored bit-reversed
+    // to match the order in which BitStreamReader appends bits to a Code.
+    // Returns false if the lengths over-subscribe the code space.
+    static bool makeCanonicalCodes(const std::uint8_t *codeLengths, Code *codes)
     {
-        if (stream != nullptr)
+        int lengthCounts[Code::MaxBits + 1] = {};
+        for (int s = 0; s < MaxSymbols; ++s)
         {
-            HUFFMAN_MFREE(stream);
+            if (codeLengths[s] > Code::MaxBits)
+            {
+                return false;
+            }
+            ++lengthCounts[codeLengths[s]];
         }
-    }
-
-    void BitStreamWriter::internalInit()
-    {
-        stream = nullptr;
-        bytesAllocated = 0;
-        granularity = 2;
-        currBytePos = 0;
-        nextBitPos = 0;
-        numBitsWritten = 0;
-    }
+        lengthCounts[0] = 0;
 
-    void BitStreamWriter::allocate(int bitsWanted)
-    {
-        // Require at least a byte.
-        if (bitsWanted <= 0)
+        // Check the Kraft inequality. Once more than MaxSymbols codes are left
+        // over the count can never go negative again, so clamp it to avoid overflow.
+        int codesLeft = 1;
+        for (int len = 1; len <= Code::MaxBits; ++len)
         {
-            bitsWanted = 8;
+            codesLeft = (codesLeft << 1) - lengthCounts[len];
+            if (codesLeft < 0)
+            {
+                return false;
+            }
+            if (codesLeft > MaxSymbols)
+            {
+                codesLeft = MaxSymbols + 1;
+            }
         }
 
-        // Round upwards if needed:
-        if ((bitsWanted % 8) != 0)
+        std::uint64_t nextCode[Code::MaxBits + 1] = {};
+        std::uint64_t code = 0;
+        for (int len = 1; len <= Code::MaxBits; ++len)
         {
-            bitsWanted = nextPowerOfTwo(bitsWanted);
+            code = (code + lengthCounts[len - 1]) << 1;
+            nextCode[len] = code;
         }
 
-        // We might already have the required count.
-        const int sizeInBytes = bitsWanted / 8;
-        if (sizeInBytes <= bytesAllocated)
+        for (int s = 0; s < MaxSymbols; ++s)
         {
-            return;
+            const int len = codeLengths[s];
+            codes[s].clear();
+            if (len != 0)
+            {
+                codes[s].setAsU64(reverseBits(nextCode[len]++, len));
+                codes[s].setLength(len);
+            }
         }
-
-        stream = allocBytes(sizeInBytes, stream, bytesAllocated);
-        bytesAllocated = sizeInBytes;
+        return true;
     }
 
-    void BitStreamWriter::appendBit(const int bit)
+    // ========================================================
+
+    // Optimal code lengths no longer than maxLength bits for the symbols with a
+    // non-zero frequency, using the package-merge algorithm (Larmore & Hirschberg).
+    //
+    // Level 1 is the list of symbols sorted by frequency. Each following level
+    // merges those symbols with "packages" made by pairing adjacent items of the
+    // previous level. Picking the 2n-2 cheapest items of the last level gives
+    // the optimal lengths: a symbol's code length is the number of levels where
+    // it got picked. Since the picked items of each level are a prefix of that
+    // level's list, we only need to remember which items were packages.
+    static void packageMergeLengths(const int *frequencies, const int maxLength, std::uint8_t *codeLengths)
     {
-        const std::uint32_t mask = std::uint32_t(1) << nextBitPos;
-        stream[currBytePos] = (stream[currBytePos] & ~mask) | (-bit & mask);
-        ++numBitsWritten;
+        constexpr int MaxItems = 2 * MaxSymbols;
 
-        if (++nextBitPos == 8)
+        int sorted[MaxSymbols];
+        int symbolCount = 0;
+        for (int s = 0; s < MaxSymbols; ++s)
         {
-            nextBitPos = 0;
-            if (++currBytePos == bytesAllocated)
+            codeLengths[s] = 0;
+            if (frequencies[s] > 0)
             {
-                allocate(bytesAllocated * granularity * 8);
+                sorted[symbolCount++] = s;
             }
         }
-    }
-
-    void BitStreamWriter::appendBitsU64(const std::uint64_t num, const int bitCount)
+        if (symbolCount <= 2)
+        {
+            for (int i = 0; i < symbolCount; ++i)
+            {
+                codeLengths[sorted[i]] = 1;
+            }
+            return;
+        }
+
+        // Insertion sort by frequency; stable, so equal frequencies keep symbol order.
+        for (int i = 1; i < symbolCount; ++i)
+        {
+            const int symbol = sorted[i];
+            int j = i;
+            for (; j > 0 && frequencies[sorted[j - 1]] > frequencies[symbol]; --j)
+            {
+                sorted[j] = sorted[j - 1];
+            }
+            sorted[j] = symbol;
+        }
+
+        // Item weights of the previous and current levels, and one
+        // "is a package" bit per item for every level.
+        std::uint64_t weights[2][MaxItems];
+        std::uint64_t isPackage[Code::MaxBits][MaxItems / 64] = {};
+        int itemCount = symbolCount;
+
+        for (int i = 0; i < symbolCount; ++i)
+        {
+            weights[0][i] = static_cast<std::uint64_t>(frequencies[sorted[i]]);
+        }
+
+        for (int level = 1; level < maxLength; ++level)
+        {
+            const std::uint64_t *prev = weights[(level - 1) & 1];
+            std::uint64_t *curr = weights[level & 1];
+
+            const int packageCount = itemCount / 2;
+            int leaf = 0;
+            int package = 0;
+            int count = 0;
+            while (leaf < symbolCount || package < packageCount)
+            {
+                const std::uint64_t leafWeight = (leaf < symbolCount) ? frequencies[sorted[leaf]] : ~std::uint64_t(0);
+                const std::uint64_t packageWeight = (package < packageCount) ? prev[2 * package] + prev[2 * package + 1] : ~std::uint64_t(0);
+                if (leaf < symbolCount && leafWeight <= packageWeight)
+                {
+                    curr[count++] = leafWeight;
+                    ++leaf;
+                }
+                else
+                {
+                    isPackage[level][count / 64] |= std::uint64_t(1) << (count % 64);
+                    curr[count++] = packageWeight;
+                    ++package;
+                }
+            }
+            itemCount = count;
+        }
+
+        // Walk back from the last level, counting the symbols picked at each.
+        int picked = 2 * symbolCount - 2;
+        for (int level = maxLength - 1; level >= 0; --level)
+        {
+            int packages = 0;
+            for (int i = 0; i < picked; ++i)
+            {
+                packages += static_cast<int>((isPackage[level][i / 64] >> (i % 64)) & 1);
+            }
+            const int leaves = picked - packages;
+            for (int i = 0; i < leaves; ++i)
+            {
+                ++codeLengths[sorted[i]];
+            }
+            picked = 2 * packages;
+        }
+    }
+
+    // ========================================================
+
+    // Canonical tree prefix: a 3-bit width W, then a run of W-bit symbols
+    // describing the code lengths of all MaxSymbols symbols. Symbols up to
+    // (1 << W) - 4 are literal lengths; the top three values are repeat
+    // codes with extra bits, modeled after DEFLATE's code length alphabet.
+    static constexpr int RepeatPrevious = 1; // Repeat previous length 3-6 times (2 extra bits).
+    static constexpr int RepeatZeros = 2;    // Repeat zero length 3-10 times (3 extra bits).
+    static constexpr int RepeatZerosLong = 3; // Repeat zero length 11-138 times (7 extra bits).
+
+    static int codeLengthSymbolWidth(const int maxCodeLength)
+    {
+        return bitsForInteger(maxCodeLength + 3);
+    }
+
+    // Writes the canonical tree prefix for the given code lengths, tag of the
+    // format included. Returns its size in bits, before the byte padding.
+    static int writeCodeLengths(BitStreamWriter &bitStream, const std::uint8_t *codeLengths,
+                                const Format format = Format::Canonical)
+    {
+        //
+        // Only code lengths are stored. A fixed-width symbol
+        // alphabet is used, where the top three values are
+        // repeat codes followed by a few extra bits:
+        //
+        // +--------------+---------------------------------+
+        // | width (3 bit)| length symbols (width bits) ... |
+        // +--------------+---------------------------------+
+        //
+        int maxCodeLength = 0;
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            if (codeLengths[s] > maxCodeLength)
+            {
+                maxCodeLength = codeLengths[s];
+            }
+        }
+
+        const int symbolWidth = codeLengthSymbolWidth(maxCodeLength);
+        const int symbolLimit = (1 << symbolWidth);
+
+        bitStream.appendBitsU64(FormatTag | static_cast<int>(format), 16);
+        bitStream.appendBitsU64(symbolWidth, 3);
+        int prefixBits = 16 + 3;
+
+        int s = 0;
+        while (s < MaxSymbols)
+        {
+            const int len = codeLengths[s];
+            int run = 1;
+            while ((s + run) < MaxSymbols && codeLengths[s + run] == len)
+            {
+                ++run;
+            }
+
+            if (len == 0 && run >= 3)
+            {
+                const int count = (run < 138) ? run : 138;
+                if (count >= 11)
+                {
+                    bitStream.appendBitsU64(symbolLimit - RepeatZerosLong, symbolWidth);
+                    bitStream.appendBitsU64(count - 11, 7);
+                    prefixBits += symbolWidth + 7;
+                }
+                else
+                {
+                    bitStream.appendBitsU64(symbolLimit - RepeatZeros, symbolWidth);
+                    bitStream.appendBitsU64(count - 3, 3);
+                    prefixBits += symbolWidth + 3;
+                }
+                s += count;
+                continue;
+            }
+
+            // A literal length, optionally followed by repeats of it:
+            bitStream.appendBitsU64(len, symbolWidth);
+            prefixBits += symbolWidth;
+            ++s;
+            --run;
+
+            while (len != 0 && run >= 3)
+            {
+                const int count = (run < 6) ? run : 6;
+                bitStream.appendBitsU64(symbolLimit - RepeatPrevious, symbolWidth);
+                bitStream.appendBitsU64(count - 3, 2);
+                prefixBits += symbolWidth + 2;
+                s += count;
+                run -= count;
+            }
+        }
+
+        return prefixBits;
+    }
+
+    // Records the first decoding problem in status, and reports it with
+    // HUFFMAN_ERROR() too, unless decoding quietly for safeDecode().
+    static void decodeError(DecodeStatus &status, const bool reportErrors, const DecodeStatus problem, const char *const message)
+    {
+        if (status == DecodeStatus::Ok)
+        {
+            status = problem;
+        }
+        if (reportErrors)
+        {
+            HUFFMAN_ERROR(message);
+        }
+    }
+
+    // Reads the code lengths of a Format::Canonical tree prefix, after its tag.
+    // Adds the bits read to prefixBits. Returns false if they are malformed.
+    static bool readCodeLengths(BitStreamReader &bitStream, std::uint8_t *codeLengths, int &prefixBits,
+                                DecodeStatus &status, const bool reportErrors)
+    {
+        if (bitStream.getBitsLeft() < 3)
+        {
+            decodeError(status, reportErrors, DecodeStatus::BadHeader, "Failed to read code lengths from stream! Unexpected end.");
+            return false;
+        }
+        const int symbolWidth = static_cast<int>(bitStream.readBitsU64(3));
+        const int symbolLimit = (1 << symbolWidth);
+        prefixBits += 3;
+
+        // Expand the run-length coded code lengths (see writeCodeLengths()):
+        std::fill(codeLengths, codeLengths + MaxSymbols, std::uint8_t(0));
+        int s = 0;
+        while (s < MaxSymbols)
+        {
+            if (bitStream.getBitsLeft() < symbolWidth)
+            {
+                decodeError(status, reportErrors, DecodeStatus::BadHeader, "Failed to read code lengths from stream! Unexpected end.");
+                return false;
+            }
+
+            const int symbol = static_cast<int>(bitStream.readBitsU64(symbolWidth));
+            prefixBits += symbolWidth;
+
+            int count;
+            int len;
+            int extraBits;
+            if (symbol == symbolLimit - RepeatPrevious)
+            {
+                if (s == 0)
+                {
+                    decodeError(status, reportErrors, DecodeStatus::BadHeader, "Code length repeat without a previous length!");
+                    return false;
+                }
+                count = 3;
+                len = codeLengths[s - 1];
+                extraBits = 2;
+            }
+            else if (symbol == symbolLimit - RepeatZeros)
+            {
+                count = 3;
+                len = 0;
+                extraBits = 3;
+            }
+            else if (symbol == symbolLimit - RepeatZerosLong)
+            {
+                count = 11;
+                len = 0;
+                extraBits = 7;
+            }
+            else
+            {
+                count = 1;
+                len = symbol;
+                extraBits = 0;
+            }
+
+            if (bitStream.getBitsLeft() < extraBits)
+            {
+                decodeError(status, reportErrors, DecodeStatus::BadHeader, "Failed to read code lengths from stream! Unexpected end.");
+                return false;
+            }
+            count += static_cast<int>(bitStream.readBitsU64(extraBits));
+            prefixBits += extraBits;
+
+            if (s + count > MaxSymbols || len > Code::MaxBits)
+            {
+                decodeError(status, reportErrors, DecodeStatus::BadHeader, "Invalid code lengths in input bit stream!");
+                return false;
+            }
+            for (; count > 0; --count)
+            {
+                codeLengths[s++] = static_cast<std::uint8_t>(len);
+            }
+        }
+
+        return true;
+    }
+
+    // The decoding loop proper, shared by Decoder and the Table functions.
+    // Decodes until the stream runs out, into at most dataSizeBytes.
+    static int decodeSymbols(BitStreamReader &bitStream, const DecodeTable &decodeTable,
+                             std::uint8_t *data, const int dataSizeBytes,
+                             DecodeStatus &status, const bool reportErrors)
+    {
+        HUFFMAN_STAT_TIMER(decodeNanos);
+
+        // No table means it wasn't built, or failed to.
+        const int primaryBits = decodeTable.getPrimaryBits();
+        if (primaryBits == 0)
+        {
+            return 0;
+        }
+
+        int bytesDecoded = 0;
+
+        // Fast loop: one window of 57 bits per refill, good for as many codes as
+        // surely fit in it. It only runs while the stream has the whole window left
+        // and the output has room for all the codes, so those are checked once per
+        // refill rather than once per code. An invalid code drops the batch and
+        // leaves it to the checked loop below, which stops right at it.
+        const int maxCodeLength = decodeTable.getMaxCodeLength();
+        const int codesPerRefill = 57 / maxCodeLength;
+        const DecodeTable::Entry *const table = &decodeTable.getEntry(0);
+        const std::uint64_t primaryMask = (std::uint64_t(1) << primaryBits) - 1;
+
+        while (codesPerRefill != 0 && bitStream.getBitsLeft() >= 57 && dataSizeBytes - bytesDecoded >= codesPerRefill)
+        {
+            std::uint64_t window = bitStream.peekBitsU64(57);
+            int windowBits = 0;
+            int entryKinds = DecodeTable::Leaf; // ANDed with every entry used; Invalid is zero.
+
+            for (int c = 0; c < codesPerRefill; ++c)
+            {
+                const DecodeTable::Entry *entry = &table[window & primaryMask];
+                int tableBits = primaryBits;
+                while (entry->kind == DecodeTable::Link)
+                {
+                    window >>= tableBits;
+                    windowBits += tableBits;
+                    tableBits = entry->bits;
+                    entry = &table[entry->value + static_cast<int>(window & ((std::uint64_t(1) << tableBits) - 1))];
+                }
+                data[c] = static_cast<std::uint8_t>(entry->value);
+                entryKinds &= entry->kind;
+                window >>= entry->bits;
+                windowBits += entry->bits;
+            }
+
+            if (entryKinds != DecodeTable::Leaf)
+            {
+                break;
+            }
+            bitStream.skipBits(windowBits);
+            data += codesPerRefill;
+            bytesDecoded += codesPerRefill;
+        }
+
+        // Checked loop, for the end of the stream and the output.
+        while (bitStream.getBitsLeft() > 0)
+        {
+            // Walk down the table levels until we hit a leaf entry.
+            // Each secondary table consumes the bits of the level above it.
+            int tableStart = 0;
+            int tableBits = primaryBits;
+            const DecodeTable::Entry *entry;
+            for (;;)
+            {
+                const int index = static_cast<int>(bitStream.peekBitsU64(tableBits));
+                entry = &decodeTable.getEntry(tableStart + index);
+                if (entry->kind != DecodeTable::Link)
+                {
+                    break;
+                }
+                if (bitStream.getBitsLeft() < tableBits)
+                {
+                    // Truncated code at the end.
+                    decodeError(status, false, DecodeStatus::CorruptData, nullptr);
+                    return bytesDecoded;
+                }
+                bitStream.skipBits(tableBits);
+                tableStart = entry->value;
+                tableBits = entry->bits;
+            }
+
+            if (entry->kind == DecodeTable::Invalid)
+            {
+                decodeError(status, reportErrors, DecodeStatus::CorruptData, "Invalid Huffman code in bit stream!");
+                break;
+            }
+            if (bitStream.getBitsLeft() < entry->bits)
+            {
+                // Truncated code at the end.
+                decodeError(status, false, DecodeStatus::CorruptData, nullptr);
+                break;
+            }
+
+            if (bytesDecoded == dataSizeBytes)
+            {
+                decodeError(status, reportErrors, DecodeStatus::OutputTooSmall, "Decoder output buffer too small!");
+                break;
+            }
+
+            *data++ = static_cast<std::uint8_t>(entry->value);
+            ++bytesDecoded;
+
+            bitStream.skipBits(entry->bits);
+        }
+
+        return bytesDecoded;
+    }
+
+    // ========================================================
+
+#ifdef HUFFMAN_USING_DEFAULT_ERROR_HANDLER
+
+    // Prints a fatal error to stderr and aborts the process.
+    // This is the default method used by HUFFMAN_ERROR(), but
+    // you can override the macro to use other error handling
+    // mechanisms, such as C++ exceptions.
+    void fatalError(const char *const message)
+    {
+        std::fprintf(stderr, "Huffman encoder/decoder error: %s\n", message);
+        std::abort();
+    }
+
+#endif // HUFFMAN_USING_DEFAULT_ERROR_HANDLER
+
+    // ========================================================
+    // Default allocator:
+    // ========================================================
+
+    static void *defaultAllocate(void *, const std::size_t sizeBytes)
+    {
+        return HUFFMAN_MALLOC(sizeBytes);
+    }
+
+    static void defaultDeallocate(void *, void *ptr)
+    {
+        HUFFMAN_MFREE(ptr);
+    }
+
+    const Allocator &defaultAllocator()
+    {
+        static const Allocator allocator = {&defaultAllocate, &defaultDeallocate, nullptr};
+        return allocator;
+    }
+
+    // ========================================================
+    // class BitStreamWriter:
+    // ========================================================
+
+    BitStreamWriter::BitStreamWriter()
+        : allocator(&defaultAllocator())
+    {
+        // 8192 bits for a start (1024 bytes). It will resize if needed.
+        // Default granularity is 2.
+        internalInit();
+        allocate(8192);
+    }
+
+    BitStreamWriter::BitStreamWriter(const int initialSizeInBits, const int growthGranularity)
+        : allocator(&defaultAllocator())
+    {
+        internalInit();
+        setGranularity(growthGranularity);
+        allocate(initialSizeInBits);
+    }
+
+    BitStreamWriter::BitStreamWriter(const Allocator &allocator, const int initialSizeInBits, const int growthGranularity)
+        : allocator(&allocator)
+    {
+        internalInit();
+        setGranularity(growthGranularity);
+        allocate(initialSizeInBits);
+    }
+
+    BitStreamWriter::BitStreamWriter(std::uint8_t *buffer, const int bufferSizeBytes)
+        : allocator(&defaultAllocator())
+    {
+        internalInit();
+        stream = buffer;
+        bytesAllocated = (bufferSizeBytes > 0) ? bufferSizeBytes : 0;
+        external = true;
+    }
+
+    BitStreamWriter::~BitStreamWriter()
+    {
+        if (stream != nullptr && !external)
+        {
+            allocator->deallocate(allocator->context, stream);
+        }
+    }
+
+    void BitStreamWriter::internalInit()
+    {
+        stream = nullptr;
+        bitBuffer = 0;
+        external = false;
+        overflowed = false;
+        bytesAllocated = 0;
+        granularity = 2;
+        currBytePos = 0;
+        nextBitPos = 0;
+        numBitsWritten = 0;
+    }
+
+    void BitStreamWriter::allocate(int bitsWanted)
+    {
+        // Require at least a byte.
+        if (bitsWanted <= 0)
+        {
+            bitsWanted = 8;
+        }
+
+        // Round upwards if needed:
+        if ((bitsWanted % 8) != 0)
+        {
+            bitsWanted = nextPowerOfTwo(bitsWanted);
+        }
+
+        // We might already have the required count. External buffers never grow.
+        const int sizeInBytes = bitsWanted / 8;
+        if (sizeInBytes <= bytesAllocated || external)
+        {
+            return;
+        }
+
+        stream = allocBytes(sizeInBytes, stream, bytesAllocated);
+        bytesAllocated = sizeInBytes;
+    }
+
+    bool BitStreamWriter::reserveWord()
+    {
+        // Every write stores a whole 64-bit word at currBytePos,
+        // so keep at least 8 bytes of room past it.
+        if (currBytePos + 8 > bytesAllocated)
+        {
+            if (external)
+            {
+                return false;
+            }
+            int bytesWanted = bytesAllocated * granularity;
+            if (bytesWanted < currBytePos + 8)
+            {
+                bytesWanted = currBytePos + 8;
+            }
+            allocate(bytesWanted * 8);
+        }
+        return true;
+    }
+
+    void BitStreamWriter::appendBit(const int bit)
+    {
+        appendBitsU64(static_cast<std::uint64_t>(bit & 1), 1);
+    }
+
+    void BitStreamWriter::appendBitsU64(std::uint64_t num, int bitCount)
+    {
+        assert(bitCount <= 64);
+
+        // A single word holds up to 7 bits of the current byte plus 56 new ones.
+        if (bitCount > 56)
+        {
+            appendBitsU64(num, 32);
+            num >>= 32;
+            bitCount -= 32;
+        }
+        if (bitCount <= 0)
+        {
+            return;
+        }
+
+        num &= (std::uint64_t(1) << bitCount) - 1;
+        if (reserveWord())
+        {
+            bitBuffer |= num << nextBitPos;
+            storeU64(stream + currBytePos, bitBuffer);
+        }
+        else
+        {
+            // Near the end of an external buffer; store only the bytes touched.
+            const int bytesTouched = (nextBitPos + bitCount + 7) / 8;
+            if (overflowed || currBytePos + bytesTouched > bytesAllocated)
+            {
+                overflowed = true;
+                return;
+            }
+            bitBuffer |= num << nextBitPos;
+            for (int i = 0; i < bytesTouched; ++i)
+            {
+                stream[currBytePos + i] = static_cast<std::uint8_t>(bitBuffer >> (i * 8));
+            }
+        }
+
+        // Move past the completed bytes:
+        nextBitPos += bitCount;
+        numBitsWritten += bitCount;
+        const int bytesDone = nextBitPos / 8;
+        currBytePos += bytesDone;
+        nextBitPos %= 8;
+        bitBuffer >>= (bytesDone * 8);
+    }
+
+    void BitStreamWriter::appendCode(const Code code)
+    {
+        appendBitsU64(code.getAsU64(), code.getLength());
+    }
+
+    std::uint8_t *BitStreamWriter::appendBytes(const int byteCount)
+    {
+        assert(nextBitPos == 0);
+        assert(byteCount >= 0);
+
+        // Keep the usual word of room past the end, for the next append.
+        if (!external)
+        {
+            if (currBytePos + byteCount + 8 > bytesAllocated)
+            {
+                allocate((currBytePos + byteCount + 8) * 8);
+            }
+        }
+        else if (overflowed || currBytePos + byteCount > bytesAllocated)
+        {
+            overflowed = true;
+            return nullptr;
+        }
+
+        std::uint8_t *bytes = stream + currBytePos;
+        currBytePos += byteCount;
+        numBitsWritten += byteCount * 8;
+        bitBuffer = 0;
+        return bytes;
+    }
+
+#ifndef HUFFMAN_NO_STD_STRING
+
+    void BitStreamWriter::appendBitString(const std::string &bitStr)
+    {
+        for (std::size_t i = 0; i < bitStr.length(); ++i)
+        {
+            appendBit(bitStr[i] == '0' ? 0 : 1);
+        }
+    }
+
+    std::string BitStreamWriter::toBitString() const
+    {
+        std::string bitString;
+
+        int usedBytes = numBitsWritten / 8;
+        int leftovers = numBitsWritten % 8;
+        if (leftovers != 0)
+        {
+            ++usedBytes;
+        }
+        assert(usedBytes <= bytesAllocated);
+
+        for (int i = 0; i < usedBytes; ++i)
+        {
+            const int nBits = (leftovers == 0) ? 8 : (i == usedBytes - 1) ? leftovers
+                                                                          : 8;
+            for (int j = 0; j < nBits; ++j)
+            {
+                bitString += (stream[i] & (1 << j) ? '1' : '0');
+            }
+        }
+
+        return bitString;
+    }
+
+#endif // HUFFMAN_NO_STD_STRING
+
+    std::uint8_t *BitStreamWriter::release()
+    {
+        std::uint8_t *oldPtr = stream;
+        internalInit();
+        return oldPtr;
+    }
+
+    void BitStreamWriter::setGranularity(const int growthGranularity)
+    {
+        granularity = (growthGranularity >= 2) ? growthGranularity : 2;
+    }
+
+    int BitStreamWriter::getByteCount() const
+    {
+        int usedBytes = numBitsWritten / 8;
+        int leftovers = numBitsWritten % 8;
+        if (leftovers != 0)
+        {
+            ++usedBytes;
+        }
+        assert(usedBytes <= bytesAllocated);
+        return usedBytes;
+    }
+
+    int BitStreamWriter::getBitCount() const
+    {
+        return numBitsWritten;
+    }
+
+    const std::uint8_t *BitStreamWriter::getBitStream() const
+    {
+        return stream;
+    }
+
+    std::uint8_t *BitStreamWriter::allocBytes(const int bytesWanted, std::uint8_t *oldPtr, const int oldSize) const
+    {
+        HUFFMAN_STAT_ADD(bufferAllocations, 1);
+        HUFFMAN_STAT_ADD(bufferGrowths, oldPtr != nullptr);
+        HUFFMAN_STAT_ADD(bufferBytesAllocated, bytesWanted);
+
+        std::uint8_t *newMemory = static_cast<std::uint8_t *>(allocator->allocate(allocator->context, bytesWanted));
+        std::memset(newMemory, 0, bytesWanted);
+
+        if (oldPtr != nullptr)
+        {
+            std::memcpy(newMemory, oldPtr, oldSize);
+            allocator->deallocate(allocator->context, oldPtr);
+        }
+
+        return newMemory;
+    }
+
+    // ========================================================
+    // class BitStreamReader:
+    // ========================================================
+
+    BitStreamReader::BitStreamReader(const BitStreamWriter &bitStreamWriter)
+        : stream(bitStreamWriter.getBitStream()), sizeInBytes(bitStreamWriter.getByteCount()), sizeInBits(bitStreamWriter.getBitCount())
+    {
+        reset();
+    }
+
+    BitStreamReader::BitStreamReader(const std::uint8_t *bitStream, const int byteCount, const int bitCount)
+        : stream(bitStream), sizeInBytes(byteCount), sizeInBits(bitCount)
+    {
+        reset();
+    }
+
+    bool BitStreamReader::readNextBit()
+    {
+        if (numBitsRead >= sizeInBits)
+        {
+            return false; // We are done.
+        }
+
+        const std::uint32_t mask = std::uint32_t(1) << nextBitPos;
+        const int bit = !!(stream[currBytePos] & mask);
+        ++numBitsRead;
+
+        if (++nextBitPos == 8)
+        {
+            nextBitPos = 0;
+            ++currBytePos;
+        }
+
+        currCode.appendBit(bit);
+        return true;
+    }
+
+    std::uint64_t BitStreamReader::readBitsU64(int bitCount)
+    {
+        assert(bitCount <= 64);
+
+        if (bitCount > getBitsLeft())
+        {
+            HUFFMAN_ERROR("Failed to read bits from stream! Unexpected end.");
+            bitCount = getBitsLeft();
+        }
+        if (bitCount <= 0)
+        {
+            return 0;
+        }
+
+        // A window covers 57 bits past the current bit position.
+        if (bitCount > 56)
+        {
+            const std::uint64_t low = peekBitsU64(32);
+            skipBits(32);
+            const std::uint64_t high = peekBitsU64(bitCount - 32);
+            skipBits(bitCount - 32);
+            return low | (high << 32);
+        }
+
+        const std::uint64_t num = peekBitsU64(bitCount);
+        skipBits(bitCount);
+        return num;
+    }
+
+    std::uint64_t BitStreamReader::peekBitsU64(const int bitCount) const
+    {
+        assert(bitCount <= 57);
+
+        // Anything past the end of the stream reads as zero.
+        const int bitsLeft = getBitsLeft();
+        const int validBits = (bitsLeft < bitCount) ? bitsLeft : bitCount;
+        if (validBits <= 0)
+        {
+            return 0;
+        }
+
+        // After dropping the bits already consumed from
+        // the first byte the window still has >= 57 bits.
+        const std::uint64_t window = loadWindow() >> nextBitPos;
+        return window & ((std::uint64_t(1) << validBits) - 1);
+    }
+
+    std::uint64_t BitStreamReader::loadWindow() const
+    {
+        // Next 8 bytes starting at the current byte. Near the
+        // end gather what's left, with zeros for the rest.
+        if (currBytePos + 8 <= sizeInBytes)
+        {
+            return loadU64(stream + currBytePos);
+        }
+
+        std::uint64_t window = 0;
+        for (int i = 0; currBytePos + i < sizeInBytes; ++i)
+        {
+            window |= std::uint64_t(stream[currBytePos + i]) << (i * 8);
+        }
+        return window;
+    }
+
+    void BitStreamReader::skipBits(const int bitCount)
+    {
+        numBitsRead += bitCount;
+        nextBitPos += bitCount;
+        currBytePos += nextBitPos / 8;
+        nextBitPos %= 8;
+    }
+
+    void BitStreamReader::reset()
+    {
+        currBytePos = 0;
+        nextBitPos = 0;
+        numBitsRead = 0;
+        currCode.clear();
+    }
+
+    // ========================================================
+    // histogram() implementation:
+    // ========================================================
+
+    void histogram(const std::uint8_t *data, const int dataSizeBytes, std::uint32_t *counts)
+    {
+        assert(counts != nullptr);
+
+        // Not worth setting up the sub-histograms for a few bytes.
+        if (dataSizeBytes < 1024)
+        {
+            for (int i = 0; i < dataSizeBytes; ++i)
+            {
+                ++counts[data[i]];
+            }
+            return;
+        }
+
+        // Four sub-histograms interleaved by byte position, so a run of the same
+        // byte doesn't make each increment wait on the one before it. Eight bytes
+        // are loaded at a time and split up with shifts.
+        std::uint32_t partial[4][MaxSymbols] = {};
+        int i = 0;
+        for (; i + 8 <= dataSizeBytes; i += 8)
+        {
+            std::uint64_t word;
+            std::memcpy(&word, data + i, sizeof(word));
+            ++partial[0][word & 0xFF];
+            ++partial[1][(word >> 8) & 0xFF];
+            ++partial[2][(word >> 16) & 0xFF];
+            ++partial[3][(word >> 24) & 0xFF];
+            ++partial[0][(word >> 32) & 0xFF];
+            ++partial[1][(word >> 40) & 0xFF];
+            ++partial[2][(word >> 48) & 0xFF];
+            ++partial[3][word >> 56];
+        }
+        for (; i < dataSizeBytes; ++i)
+        {
+            ++partial[0][data[i]];
+        }
+
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            counts[s] += partial[0][s] + partial[1][s] + partial[2][s] + partial[3][s];
+        }
+    }
+
+    // ========================================================
+    // class Encoder:
+    // ========================================================
+
+    Encoder::Encoder(const std::uint8_t *data, const int dataSizeBytes, const bool prependTreeToBitStream,
+                     const Format format, const int maxCodeLength, const Allocator &allocator)
+        : bitStream(allocator), treeRoot(nullptr), innerNodeCount(0), treePrefixBits(0), format(format)
+    {
+        encode(data, dataSizeBytes, prependTreeToBitStream, maxCodeLength);
+    }
+
+    Encoder::Encoder(const std::uint8_t *data, const int dataSizeBytes, const bool prependTreeToBitStream,
+                     std::uint8_t *output, const int outputSizeBytes, const Format format, const int maxCodeLength)
+        : bitStream(output, outputSizeBytes), treeRoot(nullptr), innerNodeCount(0), treePrefixBits(0), format(format)
+    {
+        encode(data, dataSizeBytes, prependTreeToBitStream, maxCodeLength);
+    }
+
+    Encoder::Encoder(const std::uint32_t *frequencies, const int maxCodeLength)
+        : bitStream(nullptr, 0), treeRoot(nullptr), innerNodeCount(0), treePrefixBits(0), format(Format::Canonical)
+    {
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            if (frequencies[s] != 0)
+            {
+                nodes[s].frequency = static_cast<int>(frequencies[s]);
+                nodes[s].value = static_cast<std::int16_t>(s);
+            }
+        }
+
+        buildHuffmanTree();
+        assignCodes(maxCodeLength);
+    }
+
+    void Encoder::encode(const std::uint8_t *data, const int dataSizeBytes, const bool prependTreeToBitStream,
+                         const int maxCodeLength)
+    {
+        countFrequencies(data, dataSizeBytes);
+        buildHuffmanTree();
+        assignCodes((format == Format::Interleaved && maxCodeLength > InterleavedMaxCodeLength) ?
+                    InterleavedMaxCodeLength : maxCodeLength);
+
+        if (prependTreeToBitStream)
+        {
+            writeTreeBitStream();
+        }
+
+        writeDataBitStream(data, dataSizeBytes);
+
+        HUFFMAN_STAT_ADD(encodeCalls, 1);
+        HUFFMAN_STAT_ADD(encodedBytesIn, dataSizeBytes);
+        HUFFMAN_STAT_ADD(encodedBytesOut, bitStream.getByteCount());
+    }
+
+    void Encoder::buildHuffmanTree()
+    {
+        HUFFMAN_STAT_TIMER(buildNanos);
+
+        // Symbols in use, least frequent first. Ties go by symbol value.
+        std::array<std::int16_t, MaxSymbols> leaves;
+        int leafCount = 0;
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            if (nodes[s].isValid())
+            {
+                leaves[leafCount++] = static_cast<std::int16_t>(s);
+            }
+        }
+        std::sort(leaves.begin(), leaves.begin() + leafCount, [this](const int a, const int b)
+        {
+            return nodes[a].frequency < nodes[b].frequency || (nodes[a].frequency == nodes[b].frequency && a < b);
+        });
+
+        // Build the tree using the two-queue algorithm:
+        //
+        // While there is more than one node left in the two queues:
+        //   - Take the two nodes of lowest frequency from the fronts of the queues;
+        //   - Create a new internal node with these two nodes as children
+        //     and with frequency equal to the sum of the two nodes' frequencies;
+        //   - Add the new node to the back of the inner node queue;
+        // Repeat;
+        //
+        // The sums never decrease, so the inner nodes come out already sorted,
+        // and appending them after the leaves in nodes[] is all the queue they
+        // need. The last one made is the root. On equal frequencies the leaf
+        // goes first, which keeps the tree shallower.
+        //
+        assert(leafCount > 0);
+        int nextLeaf = 0;
+        int nextInner = MaxSymbols;
+        int innerEnd = MaxSymbols;
+
+        const auto takeLowest = [&]() -> int
+        {
+            if (nextLeaf < leafCount &&
+                (nextInner == innerEnd || nodes[leaves[nextLeaf]].frequency <= nodes[nextInner].frequency))
+            {
+                return leaves[nextLeaf++];
+            }
+            return nextInner++;
+        };
+
+        for (int merges = leafCount - 1; merges > 0; --merges)
+        {
+            const int child0 = takeLowest();
+            const int child1 = takeLowest();
+
+            Node &inner = nodes[innerEnd];
+            inner.frequency = nodes[child0].frequency + nodes[child1].frequency;
+            inner.leftChild = static_cast<std::int16_t>(child0);
+            inner.rightChild = static_cast<std::int16_t>(child1);
+            inner.value = static_cast<std::int16_t>(innerEnd);
+            ++innerEnd;
+        }
+
+        // The remaining node is the root; codes are assigned by assignCodes().
+        innerNodeCount = innerEnd - MaxSymbols;
+        treeRoot = (innerNodeCount > 0) ? &nodes[innerEnd - 1] : &nodes[leaves[0]];
+    }
+
+    void Encoder::assignTreeCodes()
+    {
+        // Codes start with a bit for the root. Children always come before their
+        // parent in nodes[], so going backwards from the root, every node's code
+        // is done by the time its children inherit it.
+        treeRoot->code.clear();
+        treeRoot->code.appendBit(0);
+
+        for (int n = MaxSymbols + innerNodeCount - 1; n >= MaxSymbols; --n)
+        {
+            const Node &node = nodes[n];
+
+            // Bit zero to the left, one to the right.
+            nodes[node.leftChild].code = node.code;
+            nodes[node.leftChild].code.appendBit(0);
+            nodes[node.rightChild].code = node.code;
+            nodes[node.rightChild].code.appendBit(1);
+        }
+    }
+
+    void Encoder::countFrequencies(const std::uint8_t *data, const int dataSizeBytes)
+    {
+        HUFFMAN_STAT_TIMER(countNanos);
+
+        std::uint32_t counts[MaxSymbols] = {};
+        histogram(data, dataSizeBytes, counts);
+
+        // We'll use the value of each byte as the symbol index, since our table has 256+ entries.
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            if (counts[s] != 0)
+            {
+                nodes[s].frequency = static_cast<int>(counts[s]);
+                nodes[s].value = static_cast<std::int16_t>(s);
+            }
+        }
+    }
+
+    void Encoder::writeDataBitStream(const std::uint8_t *data, int dataSizeBytes)
+    {
+        if (format == Format::Interleaved)
+        {
+            writeInterleavedStreams(data, dataSizeBytes);
+            return;
+        }
+
+        HUFFMAN_STAT_TIMER(dataWriteNanos);
+
+        for (; dataSizeBytes > 0; --dataSizeBytes, ++data)
+        {
+            // We can index the nodes directly from each byte of data
+            // since the first 256 slots are reserved for the symbols,
+            // so Node::value is the same as its index in th array for
+            // the first 256 leaf nodes.
+            const int nodeIndex = *data;
+            bitStream.appendCode(nodes[nodeIndex].code);
+        }
+    }
+
+    // Bits of one of the Format::Interleaved streams, gathered in a word and
+    // stored a few bytes at a time. Stores stay within the stream's own bytes,
+    // so the four can be written side by side.
+    struct InterleavedWriter {
+        std::uint8_t *next;
+        std::uint8_t *end;
+        std::uint64_t bitBuffer;
+        int bitCount;
+
+        void append(const std::uint32_t bits, const int length)
+        {
+            bitBuffer |= std::uint64_t(bits) << bitCount;
+            bitCount += length;
+        }
+
+        // Stores the whole bytes. Room for at least 4 more codes afterwards.
+        void flush()
+        {
+            const int bytes = bitCount / 8;
+            if (end - next >= 8)
+            {
+                storeU64(next, bitBuffer);
+            }
+            else
+            {
+                for (int i = 0; i < bytes; ++i)
+                {
+                    next[i] = static_cast<std::uint8_t>(bitBuffer >> (i * 8));
+                }
+            }
+            next += bytes;
+            bitBuffer >>= bytes * 8;
+            bitCount -= bytes * 8;
+        }
+
+        void finish()
+        {
+            flush();
+            if (bitCount != 0)
+            {
+                *next++ = static_cast<std::uint8_t>(bitBuffer);
+            }
+            assert(next == end);
+        }
+    };
+
+    // Start of each quarter of the data coded to its own stream, and the end.
+    static void interleavedBounds(const int dataSizeBytes, int *bounds)
+    {
+        const int quarter = dataSizeBytes / InterleavedStreams + (dataSizeBytes % InterleavedStreams != 0);
+        for (int i = 0; i < InterleavedStreams; ++i)
+        {
+            bounds[i] = (quarter * i < dataSizeBytes) ? quarter * i : dataSizeBytes;
+        }
+        bounds[InterleavedStreams] = dataSizeBytes;
+    }
+
+    void Encoder::writeInterleavedStreams(const std::uint8_t *data, const int dataSizeBytes)
+    {
+        HUFFMAN_STAT_TIMER(dataWriteNanos);
+
+        // A flat (bits, length) table is all the loops touch, 1 KB that stays in L1.
+        struct FlatCode {
+            std::uint32_t bits;
+            std::uint32_t length;
+        };
+        FlatCode codes[MaxSymbols];
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            codes[s].bits = static_cast<std::uint32_t>(nodes[s].code.getAsU64());
+            codes[s].length = static_cast<std::uint32_t>(nodes[s].code.getLength());
+        }
+
+        int bounds[InterleavedStreams + 1];
+        interleavedBounds(dataSizeBytes, bounds);
+
+        // Size every stream first, for the jump table and so they can be written at once.
+        int streamBytes[InterleavedStreams];
+        int totalBytes = 0;
+        for (int i = 0; i < InterleavedStreams; ++i)
+        {
+            std::uint64_t bits = 0;
+            for (int n = bounds[i]; n < bounds[i + 1]; ++n)
+            {
+                bits += codes[data[n]].length;
+            }
+            streamBytes[i] = static_cast<int>((bits + 7) / 8);
+            totalBytes += streamBytes[i];
+        }
+
+        bitStream.appendBitsU64(static_cast<std::uint32_t>(dataSizeBytes), 32);
+        for (int i = 0; i < InterleavedStreams - 1; ++i)
+        {
+            bitStream.appendBitsU64(static_cast<std::uint32_t>(streamBytes[i]), 32);
+        }
+
+        std::uint8_t *output = bitStream.appendBytes(totalBytes);
+        if (output == nullptr)
+        {
+            return; // Overflowed the user buffer.
+        }
+
+        InterleavedWriter writers[InterleavedStreams];
+        for (int i = 0; i < InterleavedStreams; ++i)
+        {
+            writers[i].next = output;
+            writers[i].end = output + streamBytes[i];
+            writers[i].bitBuffer = 0;
+            writers[i].bitCount = 0;
+            output += streamBytes[i];
+        }
+
+        // All four streams in step, up to the shortest, flushing every 4 codes.
+        // With codes up to InterleavedMaxCodeLength bits the word never fills up.
+        int shortest = bounds[1] - bounds[0];
+        for (int i = 1; i < InterleavedStreams; ++i)
+        {
+            shortest = std::min(shortest, bounds[i + 1] - bounds[i]);
+        }
+
+        int n = 0;
+        for (; n + 4 <= shortest; n += 4)
+        {
+            for (int i = 0; i < InterleavedStreams; ++i)
+            {
+                const std::uint8_t *symbols = data + bounds[i] + n;
+                for (int j = 0; j < 4; ++j)
+                {
+                    writers[i].append(codes[symbols[j]].bits, codes[symbols[j]].length);
+                }
+                writers[i].flush();
+            }
+        }
+
+        for (int i = 0; i < InterleavedStreams; ++i)
+        {
+            for (int m = bounds[i] + n; m < bounds[i + 1]; ++m)
+            {
+                writers[i].append(codes[data[m]].bits, codes[data[m]].length);
+                writers[i].flush();
+            }
+            writers[i].finish();
+        }
+    }
+
+    void Encoder::writeTreeBitStream()
+    {
+        HUFFMAN_STAT_TIMER(treeWriteNanos);
+
+        assert(treeRoot != nullptr);
+
+        if (format != Format::Legacy)
+        {
+            writeCanonicalTree();
+        }
+        else
+        {
+            writeLegacyTree();
+        }
+
+        // Pad to a full byte if needed:
+        while ((treePrefixBits % 8) != 0)
+        {
+            bitStream.appendBit(0);
+            ++treePrefixBits;
+        }
+    }
+
+    void Encoder::writeLegacyTree()
+    {
+        //
+        // The length used for the codes will be the shortest one possible.
+        // We only write the leaf nodes, that's enough to reconstruct
+        // the data later, so we will output 256 codes (MaxSymbols). The
+        // index of each code is the implicit value/symbol of that node.
+        //
+        // The stream will be prefixed with two 16-bits words, the
+        // number of codes (always 256/MaxSymbols for now) and the
+        // width in bits of the code_length field that prefixes
+        // every code. 256 code instances follow in the format:
+        //
+        // +-------------+---------------+
+        // | code_length | code_bits ... |
+        // +-------------+---------------+
+        //   ^-- Fixed     ^-- Varying width
+        //       width         (code_length bits)
+        //
+
+        // Find the longest code so we know the max number
+        // of bits we will need to represent that value.
+        int maxCodeLengthInBits = 0;
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            if (nodes[s].isValid() && nodes[s].code.getLength() > maxCodeLengthInBits)
+            {
+                maxCodeLengthInBits = nodes[s].code.getLength();
+            }
+        }
+
+        // Code length is currently limited to uint64!
+        if (maxCodeLengthInBits <= 0 || maxCodeLengthInBits > Code::MaxBits)
+        {
+            HUFFMAN_ERROR("Unexpected code length! Should be <= Code::MaxBits.");
+            return;
+        }
+
+        // Write the counts:
+        const int numberOfCodes = MaxSymbols;
+        const int codeLengthWidth = bitsForInteger(maxCodeLengthInBits);
+        bitStream.appendBitsU64(numberOfCodes, 16);
+        bitStream.appendBitsU64(codeLengthWidth, 16);
+        treePrefixBits = 32; // 16 bits each.
+
+        // Output the 256 nodes, in order:
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            // Write the length of the code using a fixed bit-width:
+            const int codeLen = nodes[s].code.getLength();
+            bitStream.appendBitsU64(codeLen, codeLengthWidth);
+
+            // Write the code bits themselves, using a varying bit-width:
+            const std::uint64_t codeNum = nodes[s].code.getAsU64();
+            bitStream.appendBitsU64(codeNum, codeLen);
+
+            // Keep track of the number of bits written so far for later padding.
+            treePrefixBits += (codeLengthWidth + codeLen);
+        }
+    }
+
+    void Encoder::assignCodes(int maxCodeLength)
+    {
+        HUFFMAN_STAT_TIMER(buildNanos);
+
+        if (maxCodeLength < 1 || maxCodeLength > Code::MaxBits)
+        {
+            HUFFMAN_ERROR("Max code length must be between 1 and Code::MaxBits!");
+            maxCodeLength = Code::MaxBits;
+        }
+
+        // Legacy codes carry an extra leading bit for the root
+        // node, so they have one bit less to work with.
+        const int rootBits = (format == Format::Legacy) ? 1 : 0;
+        int maxLength = maxCodeLength - rootBits;
+
+        int depths[MaxSymbols] = {};
+        findDepths(depths);
+
+        int frequencies[MaxSymbols] = {};
+        int symbolCount = 0;
+        int maxDepth = 0;
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            if (nodes[s].isValid())
+            {
+                frequencies[s] = nodes[s].frequency;
+                maxDepth = (depths[s] > maxDepth) ? depths[s] : maxDepth;
+                ++symbolCount;
+            }
+        }
+
+        // Legacy codes straight from the tree if they fit, which is
+        // what this encoder has always produced for those streams:
+        if (rootBits != 0 && maxDepth <= maxLength)
+        {
+            assignTreeCodes();
+            return;
+        }
+
+        std::uint8_t codeLengths[MaxSymbols] = {};
+        if (maxDepth <= maxLength)
+        {
+            for (int s = 0; s < MaxSymbols; ++s)
+            {
+                if (nodes[s].isValid())
+                {
+                    // A lone symbol still needs a code of at least one bit.
+                    codeLengths[s] = static_cast<std::uint8_t>((depths[s] > 0) ? depths[s] : 1);
+                }
+            }
+        }
+        else
+        {
+            if (maxLength < 1 || (std::uint64_t(1) << maxLength) < static_cast<std::uint64_t>(symbolCount))
+            {
+                HUFFMAN_ERROR("Max code length is too short for the number of symbols!");
+                maxLength = bitsForInteger(symbolCount - 1);
+            }
+            packageMergeLengths(frequencies, maxLength, codeLengths);
+            HUFFMAN_STAT_ADD(lengthLimitedBuilds, 1);
+        }
+
+        Code codes[MaxSymbols];
+        if (!makeCanonicalCodes(codeLengths, codes))
+        {
+            HUFFMAN_ERROR("Failed to generate canonical codes!");
+            return;
+        }
+
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            nodes[s].code.clear();
+            if (codes[s].getLength() != 0)
+            {
+                // Stream order, so the root bit goes first (bit 0).
+                nodes[s].code.setAsU64(codes[s].getAsU64() << rootBits);
+                nodes[s].code.setLength(codes[s].getLength() + rootBits);
+            }
+        }
+    }
+
+    void Encoder::findDepths(int *depths) const
+    {
+        // Same backwards walk as assignTreeCodes(). The root is at depth 0.
+        std::uint8_t nodeDepths[MaxNodes] = {};
+        for (int n = MaxSymbols + innerNodeCount - 1; n >= MaxSymbols; --n)
+        {
+            const std::uint8_t depth = static_cast<std::uint8_t>(nodeDepths[n] + 1);
+            nodeDepths[nodes[n].leftChild] = depth;
+            nodeDepths[nodes[n].rightChild] = depth;
+        }
+
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            depths[s] = nodeDepths[s];
+        }
+    }
+
+    void Encoder::writeCanonicalTree()
+    {
+        std::uint8_t codeLengths[MaxSymbols] = {};
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            codeLengths[s] = static_cast<std::uint8_t>(nodes[s].code.getLength());
+        }
+        treePrefixBits = writeCodeLengths(bitStream, codeLengths, format);
+    }
+
+    const Node *Encoder::findNodeForCode(const Code code) const
+    {
+        // Leaf codes are unique, and the leaves are the first MaxSymbols nodes.
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            if (nodes[s].isValid() && nodes[s].code == code)
+            {
+                return &nodes[s];
+            }
+        }
+        return nullptr;
+    }
+
+    const BitStreamWriter &Encoder::getBitStreamWriter() const
+    {
+        return bitStream;
+    }
+
+    BitStreamWriter &Encoder::getBitStreamWriter()
+    {
+        return bitStream;
+    }
+
+    int Encoder::getTreePrefixBits() const
+    {
+        return treePrefixBits;
+    }
+
+    // ========================================================
+    // class DecodeTable:
+    // ========================================================
+
+    DecodeTable::DecodeTable(const Allocator &allocator)
+        : allocator(&allocator), entries(nullptr), entryCount(0), primaryBits(0), maxCodeLength(0)
+    {
+    }
+
+    DecodeTable::~DecodeTable()
+    {
+        if (entries != nullptr)
+        {
+            allocator->deallocate(allocator->context, entries);
+        }
+    }
+
+    bool DecodeTable::build(const Code *codes, const int codeCount)
+    {
+        if (entries != nullptr)
+        {
+            allocator->deallocate(allocator->context, entries);
+            entries = nullptr;
+        }
+        entryCount = 0;
+        primaryBits = 0;
+        maxCodeLength = 0;
+
+        for (int c = 0; c < codeCount; ++c)
+        {
+            if (codes[c].getLength() > maxCodeLength)
+            {
+                maxCodeLength = codes[c].getLength();
+            }
+        }
+        if (maxCodeLength == 0)
+        {
+            return false; // No symbols.
+        }
+
+        // Short code sets get a smaller primary table, which is quicker to build.
+        const int tableBits = (maxCodeLength < MaxPrimaryBits) ? maxCodeLength : MaxPrimaryBits;
+
+        // Size everything first so we only allocate once.
+        // Link entries store the secondary table index in 16 bits.
+        const int totalEntries = countEntries(codes, codeCount, 0, 0, tableBits);
+        if (totalEntries > 0xFFFF)
+        {
+            return false;
+        }
+
+        entries = static_cast<Entry *>(allocator->allocate(allocator->context, totalEntries * sizeof(Entry)));
+        entryCount = (1 << tableBits);
+
+        if (!fillTable(codes, codeCount, 0, 0, tableBits, 0))
+        {
+            allocator->deallocate(allocator->context, entries);
+            entries = nullptr;
+            entryCount = 0;
+            return false;
+        }
+
+        assert(entryCount == totalEntries);
+        primaryBits = tableBits;
+        return true;
+    }
+
+    int DecodeTable::countEntries(const Code *codes, const int codeCount, const int usedBits,
+                                  const std::uint64_t prefix, const int tableBits) const
+    {
+        // Longest code continuing past this table, for each index. Zero if none.
+        std::uint8_t groupMaxLength[1 << MaxPrimaryBits] = {};
+
+        const int lastBit = usedBits + tableBits;
+        const std::uint64_t prefixMask = (std::uint64_t(1) << usedBits) - 1;
+        const std::uint64_t indexMask = (std::uint64_t(1) << tableBits) - 1;
+
+        for (int c = 0; c < codeCount; ++c)
+        {
+            const int length = codes[c].getLength();
+            const std::uint64_t bits = codes[c].getAsU64();
+            if (length > lastBit && (bits & prefixMask) == prefix)
+            {
+                const int index = static_cast<int>((bits >> usedBits) & indexMask);
+                if (length > groupMaxLength[index])
+                {
+                    groupMaxLength[index] = static_cast<std::uint8_t>(length);
+                }
+            }
+        }
+
+        int total = (1 << tableBits);
+        for (int i = 0; i < (1 << tableBits); ++i)
+        {
+            if (groupMaxLength[i] != 0)
+            {
+                const int remaining = groupMaxLength[i] - lastBit;
+                const int subTableBits = (remaining < MaxSecondaryBits) ? remaining : MaxSecondaryBits;
+                total += countEntries(codes, codeCount, lastBit, prefix | (std::uint64_t(i) << usedBits), subTableBits);
+            }
+        }
+        return total;
+    }
+
+    bool DecodeTable::fillTable(const Code *codes, const int codeCount, const int usedBits,
+                                const std::uint64_t prefix, const int tableBits, const int tableStart)
+    {
+        std::uint8_t groupMaxLength[1 << MaxPrimaryBits] = {};
+
+        const int tableSize = (1 << tableBits);
+        const int lastBit = usedBits + tableBits;
+        const std::uint64_t prefixMask = (std::uint64_t(1) << usedBits) - 1;
+        const std::uint64_t indexMask = (std::uint64_t(1) << tableBits) - 1;
+
+        Entry *table = entries + tableStart;
+        for (int i = 0; i < tableSize; ++i)
+        {
+            table[i].value = 0;
+            table[i].bits = 0;
+            table[i].kind = Invalid;
+        }
+
+        for (int c = 0; c < codeCount; ++c)
+        {
+            const int length = codes[c].getLength();
+            const std::uint64_t bits = codes[c].getAsU64();
+            if (length <= usedBits || (bits & prefixMask) != prefix)
+            {
+                continue;
+            }
+
+            const std::uint64_t rest = bits >> usedBits;
+            if (length > lastBit)
+            {
+                const int index = static_cast<int>(rest & indexMask);
+                if (length > groupMaxLength[index])
+                {
+                    groupMaxLength[index] = static_cast<std::uint8_t>(length);
+                }
+                continue;
+            }
+
+            // The code ends here: replicate it over every index sharing its low bits.
+            const int leafBits = length - usedBits;
+            for (int i = static_cast<int>(rest); i < tableSize; i += (1 << leafBits))
+            {
+                if (table[i].kind != Invalid)
+                {
+                    return false; // Duplicate code or a code prefixing another.
+                }
+                table[i].value = static_cast<std::uint16_t>(c);
+                table[i].bits = static_cast<std::uint8_t>(leafBits);
+                table[i].kind = Leaf;
+            }
+        }
+
+        for (int i = 0; i < tableSize; ++i)
+        {
+            if (groupMaxLength[i] == 0)
+            {
+                continue;
+            }
+            if (table[i].kind != Invalid)
+            {
+                return false; // A shorter code is a prefix of this group.
+            }
+
+            const int remaining = groupMaxLength[i] - lastBit;
+            const int subTableBits = (remaining < MaxSecondaryBits) ? remaining : MaxSecondaryBits;
+            const int subTableStart = entryCount;
+            entryCount += (1 << subTableBits);
+
+            table[i].value = static_cast<std::uint16_t>(subTableStart);
+            table[i].bits = static_cast<std::uint8_t>(subTableBits);
+            table[i].kind = Link;
+
+            if (!fillTable(codes, codeCount, lastBit, prefix | (std::uint64_t(i) << usedBits), subTableBits, subTableStart))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // ========================================================
+    // class Decoder:
+    // ========================================================
+
+    Decoder::Decoder(const BitStreamWriter &encodedBitStream, const Allocator &allocator)
+        : bitStream(encodedBitStream), interleaved(false), reportErrors(true), status(DecodeStatus::Ok), decodeTable(allocator)
+    {
+        readPrefixData();
+    }
+
+    Decoder::Decoder(const std::uint8_t *encodedData, const int encodedSizeBytes, const int encodedSizeBits,
+                     const Allocator &allocator)
+        : bitStream(encodedData, encodedSizeBytes, encodedSizeBits), interleaved(false), reportErrors(true),
+          status(DecodeStatus::Ok), decodeTable(allocator)
+    {
+        readPrefixData();
+    }
+
+    Decoder::Decoder(const std::uint8_t *encodedData, const int encodedSizeBytes, const int encodedSizeBits,
+                     const bool reportErrors, const Allocator &allocator)
+        : bitStream(encodedData, encodedSizeBytes, encodedSizeBits), interleaved(false), reportErrors(reportErrors),
+          status(DecodeStatus::Ok), decodeTable(allocator)
+    {
+        readPrefixData();
+    }
+
+    void Decoder::fail(const DecodeStatus problem, const char *const message)
+    {
+        decodeError(status, reportErrors, problem, message);
+    }
+
+    void Decoder::readPrefixData()
+    {
+        HUFFMAN_STAT_TIMER(prefixReadNanos);
+        HUFFMAN_STAT_ADD(decodeCalls, 1);
+        HUFFMAN_STAT_ADD(decodedBytesIn, bitStream.getByteCount());
+
+        // The first 16-bits word in the stream is either
+        // the number of codes of a legacy stream, which
+        // must be 256, or FormatTag plus the format.
+        if (bitStream.getBitsLeft() < 16)
+        {
+            fail(DecodeStatus::BadHeader, "Failed to read bits from stream! Unexpected end.");
+            return;
+        }
+        const std::uint64_t formatWord = bitStream.readBitsU64(16);
+        int treePrefixBits = 16;
+
+        bool prefixOk;
+        if (formatWord == MaxSymbols)
+        {
+            prefixOk = readLegacyTree(treePrefixBits);
+        }
+        else if (formatWord == (FormatTag | static_cast<int>(Format::Canonical)))
+        {
+            prefixOk = readCanonicalTree(treePrefixBits);
+        }
+        else if (formatWord == (FormatTag | static_cast<int>(Format::Interleaved)))
+        {
+            prefixOk = readCanonicalTree(treePrefixBits);
+            interleaved = true;
+        }
+        else
+        {
+            fail(DecodeStatus::BadHeader, "Unexpected code count or format tag in input bit stream!");
+            return;
+        }
+
+        if (!prefixOk)
+        {
+            return;
+        }
+
+        // There might be some padding left that must be skipped:
+        if ((treePrefixBits % 8) != 0)
+        {
+            bitStream.skipBits(8 - (treePrefixBits % 8));
+        }
+
+        if (!decodeTable.build(codes.data(), MaxSymbols))
+        {
+            fail(DecodeStatus::BadHeader, "Invalid Huffman code table in bit stream! Codes are not prefix-free.");
+            return;
+        }
+
+        // Interleaved decoding only does single-level lookups.
+        for (int s = 0; interleaved && s < MaxSymbols; ++s)
+        {
+            if (codes[s].getLength() > InterleavedMaxCodeLength)
+            {
+                fail(DecodeStatus::BadHeader, "Interleaved Huffman code longer than InterleavedMaxCodeLength!");
+                interleaved = false;
+                decodeTable.build(nullptr, 0); // No table, decodes nothing.
+                return;
+            }
+        }
+    }
+
+    bool Decoder::readLegacyTree(int &treePrefixBits)
     {
-        assert(bitCount <= 64);
-        for (int b = 0; b < bitCount; ++b)
+        // Second 16-bits word is the width
+        // in bits of each code_length field.
+        if (bitStream.getBitsLeft() < 16)
+        {
+            fail(DecodeStatus::BadHeader, "Failed to read bits from stream! Unexpected end.");
+            return false;
+        }
+        const std::uint64_t codeLengthWidth = bitStream.readBitsU64(16);
+        treePrefixBits += 16;
+
+        if (codeLengthWidth == 0 || codeLengthWidth > 16)
+        {
+            fail(DecodeStatus::BadHeader, "Unexpected code length width in input bit stream!");
+            return false;
+        }
+
+        // 256/MaxSymbols codes follow:
+        for (int c = 0; c < MaxSymbols; ++c)
         {
-            const std::uint64_t mask = std::uint64_t(1) << b;
-            const int bit = !!(num & mask);
-            appendBit(bit);
+            // Read the code_length field, fixed bit-width:
+            if (bitStream.getBitsLeft() < static_cast<int>(codeLengthWidth))
+            {
+                fail(DecodeStatus::BadHeader, "Failed to read code length from stream! Unexpected end.");
+                return false;
+            }
+            const std::uint64_t codeBitsWidth = bitStream.readBitsU64(static_cast<int>(codeLengthWidth));
+            treePrefixBits += static_cast<int>(codeLengthWidth);
+
+            if (codeBitsWidth > Code::MaxBits)
+            {
+                fail(DecodeStatus::BadHeader, "Unexpected code length in input bit stream! Should be <= Code::MaxBits.");
+                return false;
+            }
+
+            // Now read the code bits using the just acquired length:
+            if (bitStream.getBitsLeft() < static_cast<int>(codeBitsWidth))
+            {
+                fail(DecodeStatus::BadHeader, "Failed to read code bits from stream! Unexpected end.");
+                return false;
+            }
+            codes[c].setAsU64(bitStream.readBitsU64(static_cast<int>(codeBitsWidth)));
+            codes[c].setLength(static_cast<int>(codeBitsWidth));
+            treePrefixBits += static_cast<int>(codeBitsWidth);
         }
+        return true;
     }
 
-    void BitStreamWriter::appendCode(const Code code)
+    bool Decoder::readCanonicalTree(int &treePrefixBits)
     {
-        for (int b = 0; b < code.getLength(); ++b)
+        std::uint8_t codeLengths[MaxSymbols];
+        if (!readCodeLengths(bitStream, codeLengths, treePrefixBits, status, reportErrors))
+        {
+            return false;
+        }
+
+        if (!makeCanonicalCodes(codeLengths, codes.data()))
         {
-            appendBit(code.getBit(b));
+            fail(DecodeStatus::BadHeader, "Invalid code lengths in input bit stream! Over-subscribed.");
+            return false;
         }
+        return true;
     }
 
-#ifndef HUFFMAN_NO_STD_STRING
+    int Decoder::decode(std::uint8_t *data, const int dataSizeBytes)
+    {
+        assert(data != nullptr);
+        assert(dataSizeBytes != 0);
 
-    void BitStreamWriter::appendBitString(const std::string &bitStr)
+        if (status != DecodeStatus::Ok)
+        {
+            return 0; // Bad prefix, already reported.
+        }
+
+        const int bytesDecoded = interleaved ? decodeInterleaved(data, dataSizeBytes) :
+                                 decodeSymbols(bitStream, decodeTable, data, dataSizeBytes, status, reportErrors);
+        HUFFMAN_STAT_ADD(decodedBytesOut, bytesDecoded);
+        return bytesDecoded;
+    }
+
+    // Reads the next 57 bits of a Format::Interleaved stream, as decodeInterleaved() goes.
+    static std::uint64_t interleavedWindow(const std::uint8_t *stream, const int sizeBytes, const std::size_t bitPos)
     {
-        for (std::size_t i = 0; i < bitStr.length(); ++i)
+        const std::size_t bytePos = bitPos / 8;
+        std::uint64_t window = 0;
+        if (bytePos + 8 <= static_cast<std::size_t>(sizeBytes))
         {
-            appendBit(bitStr[i] == '0' ? 0 : 1);
+            window = loadU64(stream + bytePos);
+        }
+        else
+        {
+            // Near the end gather what's left, with zeros for the rest.
+            for (std::size_t i = 0; bytePos + i < static_cast<std::size_t>(sizeBytes); ++i)
+            {
+                window |= std::uint64_t(stream[bytePos + i]) << (i * 8);
+            }
         }
+        return window >> (bitPos % 8);
     }
 
-    std::string BitStreamWriter::toBitString() const
+    int Decoder::decodeInterleaved(std::uint8_t *data, const int dataSizeBytes)
     {
-        std::string bitString;
+        HUFFMAN_STAT_TIMER(decodeNanos);
 
-        int usedBytes = numBitsWritten / 8;
-        int leftovers = numBitsWritten % 8;
-        if (leftovers != 0)
+        const int primaryBits = decodeTable.getPrimaryBits();
+        if (primaryBits == 0)
         {
-            ++usedBytes;
+            return 0;
         }
-        assert(usedBytes <= bytesAllocated);
 
-        for (int i = 0; i < usedBytes; ++i)
+        // The jump table and streams start at the byte after the prefix.
+        constexpr int JumpTableBytes = 4 * InterleavedStreams;
+        const int prefixBytes = (bitStream.getBitCount() - bitStream.getBitsLeft()) / 8;
+        const std::uint8_t *input = bitStream.getBitStream() + prefixBytes;
+        int inputBytes = bitStream.getByteCount() - prefixBytes;
+        if (inputBytes < JumpTableBytes)
         {
-            const int nBits = (leftovers == 0) ? 8 : (i == usedBytes - 1) ? leftovers
-                                                                          : 8;
-            for (int j = 0; j < nBits; ++j)
+            fail(DecodeStatus::CorruptData, "Failed to read the interleaved jump table! Unexpected end.");
+            return 0;
+        }
+
+        std::uint32_t jumpTable[InterleavedStreams];
+        for (int i = 0; i < InterleavedStreams; ++i)
+        {
+            jumpTable[i] = static_cast<std::uint32_t>(input[i * 4]) | (static_cast<std::uint32_t>(input[i * 4 + 1]) << 8) |
+                           (static_cast<std::uint32_t>(input[i * 4 + 2]) << 16) | (static_cast<std::uint32_t>(input[i * 4 + 3]) << 24);
+        }
+        input += JumpTableBytes;
+        inputBytes -= JumpTableBytes;
+
+        const std::uint32_t symbolCount = jumpTable[0];
+        if (symbolCount > static_cast<std::uint32_t>(dataSizeBytes))
+        {
+            fail(DecodeStatus::OutputTooSmall, "Decoder output buffer too small!");
+            return 0;
+        }
+
+        // Where each stream and its quarter of the output start:
+        const std::uint8_t *streams[InterleavedStreams];
+        int streamBytes[InterleavedStreams];
+        std::size_t bitPos[InterleavedStreams] = {};
+        std::uint8_t *outputs[InterleavedStreams];
+        std::uint8_t *outputEnds[InterleavedStreams];
+        int bounds[InterleavedStreams + 1];
+        interleavedBounds(static_cast<int>(symbolCount), bounds);
+
+        for (int i = 0; i < InterleavedStreams; ++i)
+        {
+            const std::uint32_t size = (i < InterleavedStreams - 1) ? jumpTable[i + 1] : static_cast<std::uint32_t>(inputBytes);
+            if (size > static_cast<std::uint32_t>(inputBytes))
             {
-                bitString += (stream[i] & (1 << j) ? '1' : '0');
+                fail(DecodeStatus::CorruptData, "Interleaved stream sizes exceed the input!");
+                return 0;
             }
+            streams[i] = input;
+            streamBytes[i] = static_cast<int>(size);
+            input += size;
+            inputBytes -= static_cast<int>(size);
+            outputs[i] = data + bounds[i];
+            outputEnds[i] = data + bounds[i + 1];
         }
 
-        return bitString;
-    }
+        const DecodeTable::Entry *const table = &decodeTable.getEntry(0);
+        const std::uint64_t mask = (std::uint64_t(1) << primaryBits) - 1;
+        int entryKinds = DecodeTable::Leaf; // ANDed with every entry used; Invalid is zero.
 
-#endif // HUFFMAN_NO_STD_STRING
+        // Fast loop: each step refills one window per stream, good for 5 codes,
+        // as 5 * InterleavedMaxCodeLength fits in 57 bits. The four streams don't
+        // depend on each other, so their lookups overlap. Bounds are checked once
+        // per batch of steps, sized so no window can be loaded past a stream's
+        // end nor a code written past its quarter of the output.
+        constexpr int CodesPerRefill = 5;
+        constexpr int MaxBitsPerRefill = CodesPerRefill * InterleavedMaxCodeLength;
+        static_assert(MaxBitsPerRefill <= 57, "Window too short for the codes per refill!");
 
-    std::uint8_t *BitStreamWriter::release()
-    {
-        std::uint8_t *oldPtr = stream;
-        internalInit();
-        return oldPtr;
-    }
+        for (;;)
+        {
+            std::size_t steps = ~std::size_t(0);
+            for (int i = 0; i < InterleavedStreams; ++i)
+            {
+                const std::size_t lastWindowBit = (streamBytes[i] >= 8) ? std::size_t(streamBytes[i] - 8) * 8 : 0;
+                const std::size_t streamSteps = (streamBytes[i] >= 8 && bitPos[i] <= lastWindowBit) ?
+                                                (lastWindowBit - bitPos[i]) / MaxBitsPerRefill + 1 : 0;
+                const std::size_t outputSteps = static_cast<std::size_t>(outputEnds[i] - outputs[i]) / CodesPerRefill;
+                steps = std::min(steps, std::min(streamSteps, outputSteps));
+            }
+            if (steps == 0)
+            {
+                break;
+            }
 
-    void BitStreamWriter::setGranularity(const int growthGranularity)
-    {
-        granularity = (growthGranularity >= 2) ? growthGranularity : 2;
-    }
+            for (; steps != 0; --steps)
+            {
+                for (int i = 0; i < InterleavedStreams; ++i)
+                {
+                    std::uint64_t window = loadU64(streams[i] + bitPos[i] / 8) >> (bitPos[i] % 8);
+                    std::size_t pos = bitPos[i];
+                    std::uint8_t *output = outputs[i];
+                    for (int c = 0; c < CodesPerRefill; ++c)
+                    {
+                        const DecodeTable::Entry entry = table[window & mask];
+                        output[c] = static_cast<std::uint8_t>(entry.value);
+                        entryKinds &= entry.kind;
+                        window >>= entry.bits;
+                        pos += entry.bits;
+                    }
+                    bitPos[i] = pos;
+                    outputs[i] = output + CodesPerRefill;
+                }
+            }
+        }
 
-    int BitStreamWriter::getByteCount() const
-    {
-        int usedBytes = numBitsWritten / 8;
-        int leftovers = numBitsWritten % 8;
-        if (leftovers != 0)
+        // Whatever's left of each stream, one code per checked window.
+        for (int i = 0; i < InterleavedStreams; ++i)
         {
-            ++usedBytes;
+            for (std::uint8_t *output = outputs[i]; output != outputEnds[i]; ++output)
+            {
+                const DecodeTable::Entry entry = table[interleavedWindow(streams[i], streamBytes[i], bitPos[i]) & mask];
+                *output = static_cast<std::uint8_t>(entry.value);
+                entryKinds &= entry.kind;
+                bitPos[i] += entry.bits;
+            }
         }
-        assert(usedBytes <= bytesAllocated);
-        return usedBytes;
-    }
 
-    int BitStreamWriter::getBitCount() const
-    {
-        return numBitsWritten;
+        if (entryKinds != DecodeTable::Leaf)
+        {
+            fail(DecodeStatus::CorruptData, "Invalid Huffman code in bit stream!");
+            return 0;
+        }
+
+        // Every stream must have ended within its last byte.
+        for (int i = 0; i < InterleavedStreams; ++i)
+        {
+            const std::size_t streamBits = static_cast<std::size_t>(streamBytes[i]) * 8;
+            if (bitPos[i] > streamBits || streamBits - bitPos[i] >= 8)
+            {
+                fail(DecodeStatus::CorruptData, "Interleaved stream size doesn't match its codes!");
+                return 0;
+            }
+        }
+
+        return static_cast<int>(symbolCount);
     }
 
-    const std::uint8_t *BitStreamWriter::getBitStream() const
+    // ========================================================
+    // class Table:
+    // ========================================================
+
+    Table::Table(const Allocator &allocator)
+        : codeLengths(), maxCodeLength(0), decodeTable(allocator)
     {
-        return stream;
     }
 
-    std::uint8_t *BitStreamWriter::allocBytes(const int bytesWanted, std::uint8_t *oldPtr, const int oldSize)
+    bool Table::build(const std::uint32_t *frequencies, const int maxCodeLength)
     {
-        std::uint8_t *newMemory = static_cast<std::uint8_t *>(HUFFMAN_MALLOC(bytesWanted));
-        std::memset(newMemory, 0, bytesWanted);
+        assert(frequencies != nullptr);
 
-        if (oldPtr != nullptr)
+        // The tree sums the counts in an int, so keep the total
+        // well under that, but without losing any symbol.
+        std::uint32_t counts[MaxSymbols];
+        std::uint64_t total = 0;
+        for (int s = 0; s < MaxSymbols; ++s)
         {
-            std::memcpy(newMemory, oldPtr, oldSize);
-            HUFFMAN_MFREE(oldPtr);
+            counts[s] = frequencies[s];
+            total += counts[s];
+        }
+        if (total == 0)
+        {
+            HUFFMAN_ERROR("huffman::Table: No symbols to build codes for!");
+            return false;
+        }
+        while (total >= (std::uint64_t(1) << 30))
+        {
+            total = 0;
+            for (int s = 0; s < MaxSymbols; ++s)
+            {
+                counts[s] = (counts[s] != 0) ? ((counts[s] >> 1) | 1) : 0;
+                total += counts[s];
+            }
         }
 
-        return newMemory;
-    }
+        const Encoder encoder(counts, maxCodeLength);
 
-    // ========================================================
-    // class BitStreamReader:
-    // ========================================================
+        std::uint8_t lengths[MaxSymbols];
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            lengths[s] = static_cast<std::uint8_t>(encoder.nodes[s].code.getLength());
+        }
+        if (!setCodeLengths(lengths))
+        {
+            HUFFMAN_ERROR("huffman::Table: Invalid code lengths!");
+            return false;
+        }
+        return true;
+    }
 
-    BitStreamReader::BitStreamReader(const BitStreamWriter &bitStreamWriter)
-        : stream(bitStreamWriter.getBitStream()), sizeInBytes(bitStreamWriter.getByteCount()), sizeInBits(bitStreamWriter.getBitCount())
+    bool Table::buildFromSample(const std::uint8_t *sample, const int sampleSizeBytes, const int maxCodeLength)
     {
-        reset();
+        std::uint32_t frequencies[MaxSymbols];
+        std::fill(frequencies, frequencies + MaxSymbols, std::uint32_t(1));
+        histogram(sample, sampleSizeBytes, frequencies);
+        return build(frequencies, maxCodeLength);
     }
 
-    BitStreamReader::BitStreamReader(const std::uint8_t *bitStream, const int byteCount, const int bitCount)
-        : stream(bitStream), sizeInBytes(byteCount), sizeInBits(bitCount)
+    int Table::serialize(std::uint8_t *output, const int outputSizeBytes) const
     {
-        reset();
+        if (!isValid())
+        {
+            HUFFMAN_ERROR("huffman::Table: Serializing an empty table!");
+            return 0;
+        }
+
+        BitStreamWriter bitStream(output, outputSizeBytes);
+        writeCodeLengths(bitStream, codeLengths.data());
+        return bitStream.isOverflowed() ? 0 : bitStream.getByteCount();
     }
 
-    bool BitStreamReader::readNextBit()
+    bool Table::deserialize(const std::uint8_t *data, const int dataSizeBytes)
     {
-        if (numBitsRead >= sizeInBits)
+        if (data == nullptr || dataSizeBytes < 0)
         {
-            return false; // We are done.
+            HUFFMAN_ERROR("huffman::Table: Null or negative-sized input!");
+            return false;
         }
 
-        const std::uint32_t mask = std::uint32_t(1) << nextBitPos;
-        const int bit = !!(stream[currBytePos] & mask);
-        ++numBitsRead;
+        // Bad table bytes are just bad input, so no HUFFMAN_ERROR() from here on.
+        BitStreamReader bitStream(data, dataSizeBytes, dataSizeBytes * 8);
+        int prefixBits = 16;
 
-        if (++nextBitPos == 8)
+        std::uint8_t lengths[MaxSymbols];
+        DecodeStatus status = DecodeStatus::Ok;
+        if (dataSizeBytes < 3 || bitStream.readBitsU64(16) != (FormatTag | static_cast<int>(Format::Canonical)) ||
+            !readCodeLengths(bitStream, lengths, prefixBits, status, false))
         {
-            nextBitPos = 0;
-            ++currBytePos;
+            return false;
+        }
+        return setCodeLengths(lengths);
+    }
+
+    bool Table::setCodeLengths(const std::uint8_t *lengths)
+    {
+        // Build into a copy so bad lengths leave the current codes alone.
+        std::array<Code, MaxSymbols> newCodes;
+        if (!makeCanonicalCodes(lengths, newCodes.data()) || !decodeTable.build(newCodes.data(), MaxSymbols))
+        {
+            return false;
         }
 
-        currCode.appendBit(bit);
+        codes = newCodes;
+
+        maxCodeLength = 0;
+        for (int s = 0; s < MaxSymbols; ++s)
+        {
+            codeLengths[s] = lengths[s];
+            maxCodeLength = (lengths[s] > maxCodeLength) ? lengths[s] : maxCodeLength;
+        }
         return true;
     }
 
-    std::uint64_t BitStreamReader::readBitsU64(const int bitCount)
+    // Output size in bits, or -1 if a symbol has no code.
+    static int tableEncodedBits(const Table &table, const std::uint8_t *data, const int dataSizeBytes)
     {
-        assert(bitCount <= 64);
+        std::uint64_t bits = 0;
+        int missing = 0;
+        for (int i = 0; i < dataSizeBytes; ++i)
+        {
+            const int length = table.getCode(data[i]).getLength();
+            bits += length;
+            missing |= (length == 0);
+        }
 
-        // We can reuse the Code reading infrastructure for this.
-        // This is arguably a little hackish, but gets the job done...
-        currCode.clear();
-        for (int b = 0; b < bitCount; ++b)
+        if (missing != 0 || bits > static_cast<std::uint64_t>(INT_MAX))
         {
-            if (!readNextBit())
-            {
-                HUFFMAN_ERROR("Failed to read bits from stream! Unexpected end.");
-                break;
-            }
+            HUFFMAN_ERROR("huffman::easyEncode(): Symbol without a code in the table!");
+            return -1;
         }
-        return currCode.getAsU64();
+        return static_cast<int>(bits);
     }
 
-    void BitStreamReader::reset()
+    // The data codes of the Table easyEncode() overloads.
+    static void writeTableCodes(const Table &table, const std::uint8_t *data, const int dataSizeBytes,
+                                BitStreamWriter &bitStream)
     {
-        currBytePos = 0;
-        nextBitPos = 0;
-        numBitsRead = 0;
-        currCode.clear();
+        HUFFMAN_STAT_TIMER(dataWriteNanos);
+        for (int i = 0; i < dataSizeBytes; ++i)
+        {
+            bitStream.appendCode(table.getCode(data[i]));
+        }
+
+        HUFFMAN_STAT_ADD(encodeCalls, 1);
+        HUFFMAN_STAT_ADD(encodedBytesIn, dataSizeBytes);
+        HUFFMAN_STAT_ADD(encodedBytesOut, bitStream.getByteCount());
     }
 
     // ========================================================
-    // class Encoder:
+    // easyEncode() implementation:
     // ========================================================
 
-    Encoder::Encoder(const std::uint8_t *data, const int dataSizeBytes, const bool prependTreeToBitStream)
-        : treeRoot(nullptr), treePrefixBits(0)
+    void easyEncode(const std::uint8_t *uncompressed, const int uncompressedSizeBytes,
+                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits,
+                    const Format format, const int maxCodeLength, const Allocator &allocator)
     {
-        countFrequencies(data, dataSizeBytes);
-        buildHuffmanTree();
+        if (uncompressed == nullptr || compressed == nullptr)
+        {
+            HUFFMAN_ERROR("huffman::easyEncode(): Null data pointer(s)!");
+            return;
+        }
 
-        if (prependTreeToBitStream)
+        if (uncompressedSizeBytes <= 0 || compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
         {
-            writeTreeBitStream();
+            HUFFMAN_ERROR("huffman::easyEncode(): Bad in/out sizes!");
+            return;
         }
 
-        writeDataBitStream(data, dataSizeBytes);
+        Encoder encoder(uncompressed, uncompressedSizeBytes, /* prependTreeToBitStream = */ true,
+                        format, maxCodeLength, allocator);
+        auto &bitStream = encoder.getBitStreamWriter();
+
+        // Pass ownership of the compressed data buffer to the user pointer:
+        *compressedSizeBytes = bitStream.getByteCount();
+        *compressedSizeBits = bitStream.getBitCount();
+        *compressed = bitStream.release();
     }
 
-    void Encoder::buildHuffmanTree()
+    bool easyEncode(const std::uint8_t *uncompressed, const int uncompressedSizeBytes,
+                    std::uint8_t *compressed, const int compressedCapacityBytes,
+                    int *compressedSizeBytes, int *compressedSizeBits,
+                    const Format format, const int maxCodeLength)
     {
-        PQueue pQueue;
-
-        // Put each symbol node into a priority queue:
-        for (int s = 0; s < MaxSymbols; ++s)
+        if (uncompressed == nullptr || compressed == nullptr)
         {
-            if (nodes[s].isValid())
-            {
-                pQueue.push(&nodes[s]);
-            }
+            HUFFMAN_ERROR("huffman::easyEncode(): Null data pointer(s)!");
+            return false;
         }
 
-        // Build the tree using the following algorithm:
-        //
-        // While there is more than one node in the queue:
-        //   - Remove the two nodes of highest priority (lowest frequency) from the queue;
-        //   - Create a new internal node with these two nodes as children
-        //     and with frequency equal to the sum of the two nodes' frequencies;
-        //   - Add the new node to the queue;
-        // Repeat;
-        //
-        // The remaining node is the root node and the tree is complete.
-        //
-        while (pQueue.size() > 1)
+        if (uncompressedSizeBytes <= 0 || compressedCapacityBytes <= 0 ||
+            compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
         {
-            const auto child0 = pQueue.top();
-            pQueue.pop();
-
-            const auto child1 = pQueue.top();
-            pQueue.pop();
+            HUFFMAN_ERROR("huffman::easyEncode(): Bad in/out sizes!");
+            return false;
+        }
 
-            pQueue.push(addInnerNode(child0->frequency + child1->frequency, child0->value, child1->value));
+        Encoder encoder(uncompressed, uncompressedSizeBytes, /* prependTreeToBitStream = */ true,
+                        compressed, compressedCapacityBytes, format, maxCodeLength);
+        const auto &bitStream = encoder.getBitStreamWriter();
+        if (bitStream.isOverflowed())
+        {
+            return false;
         }
 
-        // Now we can assign the binary codes, starting from 0 at the root:
-        assert(!pQueue.empty());
-        treeRoot = pQueue.top();
-        recursiveAssignCodes(treeRoot, nullptr, 0);
+        *compressedSizeBytes = bitStream.getByteCount();
+        *compressedSizeBits = bitStream.getBitCount();
+        return true;
+    }
+
+    int maxCompressedSize(const int uncompressedSizeBytes)
+    {
+        // The largest prefix is a legacy tree: two 16-bit words, then 256
+        // code lengths of up to 7 bits, each followed by up to 64 code bits.
+        constexpr int MaxPrefixBytes = (32 + MaxSymbols * (7 + Code::MaxBits) + 7) / 8;
+
+        // An optimal code never costs more than a fixed 8-bit code, and
+        // legacy codes add one bit for the root, so 9 bits per byte tops.
+        const int n = (uncompressedSizeBytes > 0) ? uncompressedSizeBytes : 0;
+        return MaxPrefixBytes + n + (n + 7) / 8;
     }
 
-    Node *Encoder::addInnerNode(const int frequency, const int leftChild, const int rightChild)
+    void easyEncode(const Table &table, const std::uint8_t *uncompressed, const int uncompressedSizeBytes,
+                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits,
+                    const Allocator &allocator)
     {
-        // Find a free slot:
-        // First 256 nodes are reserved for the data symbols,
-        // (leaf nodes) with the inner nodes following.
-        for (int n = MaxSymbols; n < MaxNodes; ++n)
+        if (uncompressed == nullptr || compressed == nullptr)
         {
-            if (!nodes[n].isValid())
-            {
-                nodes[n].frequency = frequency;
-                nodes[n].leftChild = leftChild;
-                nodes[n].rightChild = rightChild;
-                nodes[n].value = n;
-                return &nodes[n];
-            }
+            HUFFMAN_ERROR("huffman::easyEncode(): Null data pointer(s)!");
+            return;
+        }
+
+        if (uncompressedSizeBytes <= 0 || compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
+        {
+            HUFFMAN_ERROR("huffman::easyEncode(): Bad in/out sizes!");
+            return;
+        }
+
+        const int outputBits = tableEncodedBits(table, uncompressed, uncompressedSizeBytes);
+        if (outputBits < 0)
+        {
+            return;
         }
 
-        HUFFMAN_ERROR("No more free node slots!");
-        return &nodes[MaxNodes - 1];
+        BitStreamWriter bitStream(allocator, outputBits);
+        writeTableCodes(table, uncompressed, uncompressedSizeBytes, bitStream);
+
+        *compressedSizeBytes = bitStream.getByteCount();
+        *compressedSizeBits = bitStream.getBitCount();
+        *compressed = bitStream.release();
     }
 
-    void Encoder::recursiveAssignCodes(Node *node, const Node *parent, const int bit)
+    bool easyEncode(const Table &table, const std::uint8_t *uncompressed, const int uncompressedSizeBytes,
+                    std::uint8_t *compressed, const int compressedCapacityBytes,
+                    int *compressedSizeBytes, int *compressedSizeBits)
     {
-        // Inherit the parent code if not the root:
-        if (parent != nullptr)
+        if (uncompressed == nullptr || compressed == nullptr)
         {
-            node->code.appendCode(parent->code);
+            HUFFMAN_ERROR("huffman::easyEncode(): Null data pointer(s)!");
+            return false;
         }
 
-        // Add the bit for this node:
-        node->code.appendBit(bit);
-
-        // And continue with it's children:
-        if (node->leftChild != Nil)
+        if (uncompressedSizeBytes <= 0 || compressedCapacityBytes <= 0 ||
+            compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
         {
-            // Bit zero to the left.
-            recursiveAssignCodes(&nodes[node->leftChild], node, 0);
+            HUFFMAN_ERROR("huffman::easyEncode(): Bad in/out sizes!");
+            return false;
         }
-        if (node->rightChild != Nil)
+
+        // The exact size is known upfront.
+        const int outputBits = tableEncodedBits(table, uncompressed, uncompressedSizeBytes);
+        if (outputBits < 0 || outputBits > compressedCapacityBytes * 8)
         {
-            // Bit one to the right.
-            recursiveAssignCodes(&nodes[node->rightChild], node, 1);
+            return false;
         }
-    }
 
-    void Encoder::countFrequencies(const std::uint8_t *data, int dataSizeBytes)
-    {
-        for (; dataSizeBytes > 0; --dataSizeBytes, ++data)
-        {
-            // We'll use the value of each byte as the symbol index, since our table has 256+ entries.
-            const int nodeIndex = *data;
+        BitStreamWriter bitStream(compressed, compressedCapacityBytes);
+        writeTableCodes(table, uncompressed, uncompressedSizeBytes, bitStream);
+        assert(!bitStream.isOverflowed());
 
-            // First occurrence?
-            if (!nodes[nodeIndex].isValid())
-            {
-                nodes[nodeIndex].frequency = 1;
-                nodes[nodeIndex].value = *data;
-            }
-            else // Recurrent symbol:
-            {
-                nodes[nodeIndex].frequency++;
-            }
-        }
+        *compressedSizeBytes = bitStream.getByteCount();
+        *compressedSizeBits = bitStream.getBitCount();
+        return true;
     }
 
-    void Encoder::writeDataBitStream(const std::uint8_t *data, int dataSizeBytes)
+    int maxCompressedSize(const Table &table, const int uncompressedSizeBytes)
     {
-        for (; dataSizeBytes > 0; --dataSizeBytes, ++data)
-        {
-            // We can index the nodes directly from each byte of data
-            // since the first 256 slots are reserved for the symbols,
-            // so Node::value is the same as its index in th array for
-            // the first 256 leaf nodes.
-            const int nodeIndex = *data;
-            bitStream.appendCode(nodes[nodeIndex].code);
-        }
+        const std::uint64_t n = (uncompressedSizeBytes > 0) ? uncompressedSizeBytes : 0;
+        return static_cast<int>((n * table.getMaxCodeLength() + 7) / 8);
     }
 
-    void Encoder::writeTreeBitStream()
-    {
-        assert(treeRoot != nullptr);
-
-        //
-        // The length used for the codes will be the shortest one possible.
-        // We only write the leaf nodes, that's enough to reconstruct
-        // the data later, so we will output 256 codes (MaxSymbols). The
-        // index of each code is the implicit value/symbol of that node.
-        //
-        // The stream will be prefixed with two 16-bits words, the
-        // number of codes (always 256/MaxSymbols for now) and the
-        // width in bits of the code_length field that prefixes
-        // every code. 256 code instances follow in the format:
-        //
-        // +-------------+---------------+
-        // | code_length | code_bits ... |
-        // +-------------+---------------+
-        //   ^-- Fixed     ^-- Varying width
-        //       width         (code_length bits)
-        //
+    // ========================================================
+    // easyDecode() implementation:
+    // ========================================================
 
-        // Find the longest code so we know the max number
-        // of bits we will need to represent that value.
-        int maxCodeLengthInBits = 0;
-        for (int s = 0; s < MaxSymbols; ++s)
+    int easyDecode(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
+                   std::uint8_t *uncompressed, const int uncompressedSizeBytes, const Allocator &allocator)
+    {
+        if (compressed == nullptr || uncompressed == nullptr)
         {
-            if (nodes[s].isValid() && nodes[s].code.getLength() > maxCodeLengthInBits)
-            {
-                maxCodeLengthInBits = nodes[s].code.getLength();
-            }
+            HUFFMAN_ERROR("huffman::easyDecode(): Null data pointer(s)!");
+            return 0;
         }
 
-        // Code length is currently limited to uint64!
-        if (maxCodeLengthInBits <= 0 || maxCodeLengthInBits > Code::MaxBits)
+        if (compressedSizeBytes <= 0 || compressedSizeBits <= 0 || uncompressedSizeBytes <= 0)
         {
-            HUFFMAN_ERROR("Unexpected code length! Should be <= Code::MaxBits.");
-            return;
+            HUFFMAN_ERROR("huffman::easyDecode(): Bad in/out sizes!");
+            return 0;
         }
 
-        // Write the counts:
-        const int numberOfCodes = MaxSymbols;
-        const int codeLengthWidth = bitsForInteger(maxCodeLengthInBits);
-        bitStream.appendBitsU64(numberOfCodes, 16);
-        bitStream.appendBitsU64(codeLengthWidth, 16);
-        treePrefixBits = 32; // 16 bits each.
+        Decoder decoder(compressed, compressedSizeBytes, compressedSizeBits, allocator);
+        return decoder.decode(uncompressed, uncompressedSizeBytes);
+    }
 
-        // Output the 256 nodes, in order:
-        for (int s = 0; s < MaxSymbols; ++s)
+    int easyDecode(const Table &table, const std::uint8_t *compressed, const int compressedSizeBytes,
+                   const int compressedSizeBits, std::uint8_t *uncompressed, const int uncompressedSizeBytes)
+    {
+        if (compressed == nullptr || uncompressed == nullptr)
         {
-            // Write the length of the code using a fixed bit-width:
-            const int codeLen = nodes[s].code.getLength();
-            bitStream.appendBitsU64(codeLen, codeLengthWidth);
-
-            // Write the code bits themselves, using a varying bit-width:
-            const std::uint64_t codeNum = nodes[s].code.getAsU64();
-            bitStream.appendBitsU64(codeNum, codeLen);
-
-            // Keep track of the number of bits written so far for later padding.
-            treePrefixBits += (codeLengthWidth + codeLen);
+            HUFFMAN_ERROR("huffman::easyDecode(): Null data pointer(s)!");
+            return 0;
         }
 
-        // Pad to a full byte if needed:
-        while ((treePrefixBits % 8) != 0)
+        if (compressedSizeBytes <= 0 || compressedSizeBits <= 0 || uncompressedSizeBytes <= 0)
         {
-            bitStream.appendBit(0);
-            ++treePrefixBits;
+            HUFFMAN_ERROR("huffman::easyDecode(): Bad in/out sizes!");
+            return 0;
         }
+
+        HUFFMAN_STAT_ADD(decodeCalls, 1);
+        HUFFMAN_STAT_ADD(decodedBytesIn, compressedSizeBytes);
+
+        BitStreamReader bitStream(compressed, compressedSizeBytes, compressedSizeBits);
+        DecodeStatus status = DecodeStatus::Ok;
+        const int bytesDecoded = decodeSymbols(bitStream, table.getDecodeTable(), uncompressed, uncompressedSizeBytes,
+                                               status, true);
+        HUFFMAN_STAT_ADD(decodedBytesOut, bytesDecoded);
+        return bytesDecoded;
     }
 
-    const Node *Encoder::recursiveFindLeaf(const Node *node, const Code code) const
+    // ========================================================
+    // safeDecode() implementation:
+    // ========================================================
+
+    // Sizes in bits and bytes must agree, so the bit reader never goes past the buffer.
+    static bool safeSizesOk(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
+                            const std::uint8_t *uncompressed, const int uncompressedSizeBytes, const int *bytesDecoded)
     {
-        const Node *result = nullptr;
+        return compressed != nullptr && uncompressed != nullptr && bytesDecoded != nullptr &&
+               compressedSizeBytes > 0 && compressedSizeBits > 0 && uncompressedSizeBytes > 0 &&
+               (compressedSizeBits + 7) / 8 <= compressedSizeBytes;
+    }
 
-        if (node->leftChild != Nil)
+    DecodeStatus safeDecode(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
+                            std::uint8_t *uncompressed, const int uncompressedSizeBytes, int *bytesDecoded,
+                            const Allocator &allocator)
+    {
+        if (bytesDecoded != nullptr)
         {
-            result = recursiveFindLeaf(&nodes[node->leftChild], code);
-            if (result != nullptr)
-            {
-                return result;
-            }
+            *bytesDecoded = 0;
         }
-        if (node->rightChild != Nil)
+        if (!safeSizesOk(compressed, compressedSizeBytes, compressedSizeBits, uncompressed, uncompressedSizeBytes, bytesDecoded))
         {
-            result = recursiveFindLeaf(&nodes[node->rightChild], code);
-            if (result != nullptr)
-            {
-                return result;
-            }
+            return DecodeStatus::BadArguments;
         }
 
-        if (node->isLeaf() && node->code == code)
-        {
-            result = node;
-        }
-        return result;
+        Decoder decoder(compressed, compressedSizeBytes, compressedSizeBits, false, allocator);
+        *bytesDecoded = decoder.decode(uncompressed, uncompressedSizeBytes);
+        return decoder.getStatus();
     }
 
-    const Node *Encoder::findNodeForCode(const Code code) const
+    DecodeStatus safeDecode(const Table &table, const std::uint8_t *compressed, const int compressedSizeBytes,
+                            const int compressedSizeBits, std::uint8_t *uncompressed, const int uncompressedSizeBytes,
+                            int *bytesDecoded)
     {
-        return recursiveFindLeaf(treeRoot, code);
-    }
+        if (bytesDecoded != nullptr)
+        {
+            *bytesDecoded = 0;
+        }
+        if (!safeSizesOk(compressed, compressedSizeBytes, compressedSizeBits, uncompressed, uncompressedSizeBytes, bytesDecoded) ||
+            !table.isValid())
+        {
+            return DecodeStatus::BadArguments;
+        }
 
-    const BitStreamWriter &Encoder::getBitStreamWriter() const
-    {
-        return bitStream;
+        HUFFMAN_STAT_ADD(decodeCalls, 1);
+        HUFFMAN_STAT_ADD(decodedBytesIn, compressedSizeBytes);
+
+        BitStreamReader bitStream(compressed, compressedSizeBytes, compressedSizeBits);
+        DecodeStatus status = DecodeStatus::Ok;
+        *bytesDecoded = decodeSymbols(bitStream, table.getDecodeTable(), uncompressed, uncompressedSizeBytes, status, false);
+        HUFFMAN_STAT_ADD(decodedBytesOut, *bytesDecoded);
+        return status;
     }
 
-    BitStreamWriter &Encoder::getBitStreamWriter()
+    // ========================================================
+    // Stream block header helpers:
+    // ========================================================
+
+    static void storeU32(std::uint8_t *ptr, const std::uint32_t word)
     {
-        return bitStream;
+        for (int i = 0; i < 4; ++i)
+        {
+            ptr[i] = static_cast<std::uint8_t>(word >> (i * 8));
+        }
     }
 
-    int Encoder::getTreePrefixBits() const
+    static std::uint32_t loadU32(const std::uint8_t *ptr)
     {
-        return treePrefixBits;
+        std::uint32_t word = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            word |= std::uint32_t(ptr[i]) << (i * 8);
+        }
+        return word;
     }
 
     // ========================================================
-    // class Decoder:
+    // class StreamEncoder:
     // ========================================================
 
-    Decoder::Decoder(const BitStreamWriter &encodedBitStream)
-        : bitStream(encodedBitStream)
+    StreamEncoder::StreamEncoder(const int blockSizeBytes, const Format format, const int maxCodeLength,
+                                 const Allocator &allocator)
+        : allocator(&allocator), block(nullptr), blockSize(blockSizeBytes), blockUsed(0), pending(nullptr),
+          pendingSize(0), pendingPos(0), format(format), maxCodeLength(maxCodeLength), finished(false)
     {
-        readPrefixData();
+        if (blockSize <= 0 || blockSize > MaxStreamBlockSize)
+        {
+            HUFFMAN_ERROR("huffman::StreamEncoder: Bad block size!");
+            blockSize = DefaultStreamBlockSize;
+        }
+
+        // Blocks are encoded straight after their header, so both
+        // buffers are allocated once for the lifetime of the stream.
+        block = static_cast<std::uint8_t *>(allocator.allocate(allocator.context, blockSize));
+        pending = static_cast<std::uint8_t *>(allocator.allocate(allocator.context, 8 + maxCompressedSize(blockSize)));
     }
 
-    Decoder::Decoder(const std::uint8_t *encodedData, const int encodedSizeBytes, const int encodedSizeBits)
-        : bitStream(encodedData, encodedSizeBytes, encodedSizeBits)
+    StreamEncoder::~StreamEncoder()
     {
-        readPrefixData();
+        allocator->deallocate(allocator->context, block);
+        allocator->deallocate(allocator->context, pending);
     }
 
-    void Decoder::readPrefixData()
+    void StreamEncoder::encodeBlock()
     {
-        // First two 16-bits words in the stream are
-        // the number of codes, which must be 256, and
-        // the width in bits of each code_length field.
-        const std::uint64_t numberOfCodes = bitStream.readBitsU64(16);
-        const std::uint64_t codeLengthWidth = bitStream.readBitsU64(16);
-        int treePrefixBits = 32; // The 16 bits read above.
+        assert(pendingPos == pendingSize);
 
-        if (numberOfCodes != MaxSymbols)
+        // Empty block is the end marker.
+        if (blockUsed == 0)
         {
-            HUFFMAN_ERROR("Unexpected code count in input bit stream! Should be 256.");
+            pendingSize = 4;
+            storeU32(pending, 0);
+            pendingPos = 0;
             return;
         }
 
-        // 256/MaxSymbols codes follow:
-        for (std::uint64_t c = 0; c < numberOfCodes; ++c)
+        Encoder encoder(block, blockUsed, /* prependTreeToBitStream = */ true,
+                        pending + 8, maxCompressedSize(blockSize), format, maxCodeLength);
+        const auto &bitStream = encoder.getBitStreamWriter();
+        assert(!bitStream.isOverflowed());
+
+        pendingSize = 8 + bitStream.getByteCount();
+        storeU32(pending, static_cast<std::uint32_t>(blockUsed));
+        storeU32(pending + 4, static_cast<std::uint32_t>(bitStream.getBitCount()));
+        pendingPos = 0;
+        blockUsed = 0;
+    }
+
+    StreamStatus StreamEncoder::encode(const bool finish)
+    {
+        for (;;)
         {
-            //
-            // Read the code_length field, fixed bit-width:
-            //
-            bitStream.clearCode();
-            for (std::uint64_t l = 0; l < codeLengthWidth; ++l)
+            // Write out the last encoded block:
+            if (pendingPos != pendingSize)
             {
-                if (!bitStream.readNextBit())
+                const std::size_t left = pendingSize - pendingPos;
+                const std::size_t count = (left < availOut) ? left : availOut;
+                std::memcpy(nextOut, pending + pendingPos, count);
+                nextOut += count;
+                availOut -= count;
+                totalOut += count;
+                pendingPos += static_cast<int>(count);
+                if (pendingPos != pendingSize)
                 {
-                    HUFFMAN_ERROR("Failed to read code length from stream! Unexpected end.");
-                    return;
+                    return StreamStatus::Ok; // Output buffer full.
                 }
             }
-            treePrefixBits += codeLengthWidth;
-            const std::uint64_t codeBitsWidth = bitStream.getCode().getAsU64();
-            assert(codeBitsWidth <= Code::MaxBits);
 
-            //
-            // Now read the code bits using the just acquired length:
-            //
-            bitStream.clearCode();
-            for (std::uint64_t l = 0; l < codeBitsWidth; ++l)
+            if (finished)
             {
-                if (!bitStream.readNextBit())
-                {
-                    HUFFMAN_ERROR("Failed to read code bits from stream! Unexpected end.");
-                    return;
-                }
+                return StreamStatus::StreamEnd;
             }
-            treePrefixBits += codeBitsWidth;
 
-            // Store the new code:
-            codes[c] = bitStream.getCode();
+            // Gather input for the next block:
+            const std::size_t room = blockSize - blockUsed;
+            const std::size_t count = (room < availIn) ? room : availIn;
+            std::memcpy(block + blockUsed, nextIn, count);
+            nextIn += count;
+            availIn -= count;
+            totalIn += count;
+            blockUsed += static_cast<int>(count);
+
+            if (blockUsed == blockSize || (finish && availIn == 0))
+            {
+                // Last partial block, if any, then the end marker.
+                finished = (blockUsed == 0);
+                encodeBlock();
+            }
+            else if (availIn == 0)
+            {
+                return StreamStatus::Ok; // Needs more input.
+            }
         }
+    }
 
-        // There might be some padding left that must be skipped:
-        bitStream.clearCode();
-        while ((treePrefixBits % 8) != 0)
+    // ========================================================
+    // class StreamDecoder:
+    // ========================================================
+
+    StreamDecoder::StreamDecoder(const Allocator &allocator)
+        : allocator(&allocator), headerBytes(0), blockSize(0), nextBlockSize(0), compressedBits(0), compressedSize(0), compressedUsed(0),
+          compressed(nullptr), compressedCapacity(0), block(nullptr), blockCapacity(0), blockPos(0),
+          finished(false), failed(false)
+    {
+    }
+
+    StreamDecoder::~StreamDecoder()
+    {
+        if (compressed != nullptr)
         {
-            bitStream.readNextBit();
-            ++treePrefixBits;
+            allocator->deallocate(allocator->context, compressed);
+        }
+        if (block != nullptr)
+        {
+            allocator->deallocate(allocator->context, block);
         }
-        bitStream.clearCode();
     }
 
-    int Decoder::findMatchingCode(const Code code) const
+    bool StreamDecoder::decodeBlock()
     {
-        for (int c = 0; c < MaxSymbols; ++c)
+        if (blockCapacity < blockSize)
         {
-            if (code == codes[c])
+            if (block != nullptr)
             {
-                return c;
+                allocator->deallocate(allocator->context, block);
             }
+            block = static_cast<std::uint8_t *>(allocator->allocate(allocator->context, blockSize));
+            blockCapacity = blockSize;
         }
-        return Nil; // Not found.
+
+        // A malformed block fails the stream, it doesn't go to HUFFMAN_ERROR().
+        Decoder decoder(compressed, compressedSize, compressedBits, false, *allocator);
+        if (decoder.decode(block, blockSize) != blockSize || decoder.getStatus() != DecodeStatus::Ok)
+        {
+            return false;
+        }
+        blockPos = 0;
+        return true;
     }
 
-    int Decoder::decode(std::uint8_t *data, const int dataSizeBytes)
+    StreamStatus StreamDecoder::decode(const bool finish)
     {
-        assert(data != nullptr);
-        assert(dataSizeBytes != 0);
+        if (failed)
+        {
+            return StreamStatus::Error;
+        }
 
-        int bytesDecoded = 0;
-        while (bitStream.readNextBit())
+        for (;;)
         {
-            // See if the current code is valid:
-            const int codeIndex = findMatchingCode(bitStream.getCode());
-            if (codeIndex == Nil)
+            // Write out the last decoded block:
+            if (blockPos != blockSize)
             {
-                continue;
+                const std::size_t left = blockSize - blockPos;
+                const std::size_t count = (left < availOut) ? left : availOut;
+                std::memcpy(nextOut, block + blockPos, count);
+                nextOut += count;
+                availOut -= count;
+                totalOut += count;
+                blockPos += static_cast<int>(count);
+                if (blockPos != blockSize)
+                {
+                    return StreamStatus::Ok; // Output buffer full.
+                }
             }
 
-            if (bytesDecoded == dataSizeBytes)
+            if (finished)
             {
-                HUFFMAN_ERROR("Decoder output buffer too small!");
-                break;
+                return StreamStatus::StreamEnd;
             }
 
-            *data++ = static_cast<std::uint8_t>(codeIndex);
-            ++bytesDecoded;
-
-            bitStream.clearCode();
-        }
-
-        return bytesDecoded;
-    }
-
-    // ========================================================
-    // easyEncode() implementation:
-    // ========================================================
+            if (availIn == 0)
+            {
+                // Stream cut short, there's always an end marker.
+                failed = finish;
+                return finish ? StreamStatus::Error : StreamStatus::Ok;
+            }
 
-    void easyEncode(const std::uint8_t *uncompressed, const int uncompressedSizeBytes,
-                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits)
-    {
-        if (uncompressed == nullptr || compressed == nullptr)
-        {
-            HUFFMAN_ERROR("huffman::easyEncode(): Null data pointer(s)!");
-            return;
-        }
+            // Block header. The end marker is only the first word.
+            if (compressedSize == 0)
+            {
+                const int wanted = (headerBytes < 4) ? 4 : 8;
+                while (headerBytes < wanted && availIn != 0)
+                {
+                    header[headerBytes++] = *nextIn++;
+                    --availIn;
+                    ++totalIn;
+                }
+                if (headerBytes < wanted)
+                {
+                    continue;
+                }
 
-        if (uncompressedSizeBytes <= 0 || compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
-        {
-            HUFFMAN_ERROR("huffman::easyEncode(): Bad in/out sizes!");
-            return;
-        }
+                const std::uint32_t size = loadU32(header);
+                if (size == 0)
+                {
+                    finished = true;
+                    blockSize = blockPos = 0;
+                    continue;
+                }
+                if (headerBytes < 8)
+                {
+                    continue;
+                }
 
-        Encoder encoder(uncompressed, uncompressedSizeBytes, /* prependTreeToBitStream = */ true);
-        auto &bitStream = encoder.getBitStreamWriter();
+                const std::uint32_t bits = loadU32(header + 4);
+                headerBytes = 0;
 
-        // Pass ownership of the compressed data buffer to the user pointer:
-        *compressedSizeBytes = bitStream.getByteCount();
-        *compressedSizeBits = bitStream.getBitCount();
-        *compressed = bitStream.release();
-    }
+                // Can't take more than 64 bits a symbol, plus the tree prefix.
+                if (size > static_cast<std::uint32_t>(MaxStreamBlockSize) || bits == 0 ||
+                    bits / 8 > size * 8 + 4096)
+                {
+                    failed = true;
+                    return StreamStatus::Error;
+                }
 
-    // ========================================================
-    // easyDecode() implementation:
-    // ========================================================
+                nextBlockSize = static_cast<int>(size);
+                compressedBits = static_cast<int>(bits);
+                compressedSize = static_cast<int>((bits + 7) / 8);
+                compressedUsed = 0;
+                if (compressedCapacity < compressedSize)
+                {
+                    if (compressed != nullptr)
+                    {
+                        allocator->deallocate(allocator->context, compressed);
+                    }
+                    compressed = static_cast<std::uint8_t *>(allocator->allocate(allocator->context, compressedSize));
+                    compressedCapacity = compressedSize;
+                }
+                continue;
+            }
 
-    int easyDecode(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
-                   std::uint8_t *uncompressed, const int uncompressedSizeBytes)
-    {
-        if (compressed == nullptr || uncompressed == nullptr)
-        {
-            HUFFMAN_ERROR("huffman::easyDecode(): Null data pointer(s)!");
-            return 0;
-        }
+            // Block data:
+            const std::size_t left = compressedSize - compressedUsed;
+            const std::size_t count = (left < availIn) ? left : availIn;
+            std::memcpy(compressed + compressedUsed, nextIn, count);
+            nextIn += count;
+            availIn -= count;
+            totalIn += count;
+            compressedUsed += static_cast<int>(count);
 
-        if (compressedSizeBytes <= 0 || compressedSizeBits <= 0 || uncompressedSizeBytes <= 0)
-        {
-            HUFFMAN_ERROR("huffman::easyDecode(): Bad in/out sizes!");
-            return 0;
+            if (compressedUsed == compressedSize)
+            {
+                blockSize = nextBlockSize;
+                const bool decoded = decodeBlock();
+                compressedSize = 0;
+                if (!decoded)
+                {
+                    failed = true;
+                    blockSize = blockPos = 0;
+                    return StreamStatus::Error;
+                }
+            }
         }
-
-        Decoder decoder(compressed, compressedSizeBytes, compressedSizeBits);
-        return decoder.decode(uncompressed, uncompressedSizeBytes);
     }
 
 } // namespace huffman {}
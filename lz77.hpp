@@ -0,0 +1,1163 @@
+#ifndef LZ77_HPP
+#define LZ77_HPP
+// -------
+//  SETUP
+// -------
+// #define LZ77_IMPLEMENTATION in one source file before including
+// this file, then use lz77.hpp as a normal header file elsewhere.
+//
+// lz77.hpp includes huffman.hpp for its entropy stage, so the Huffman
+// implementation is needed as well. Either also define HUFFMAN_IMPLEMENTATION
+// before including lz77.hpp, or have another source file implement it.
+// Don't include huffman.hpp again after that in the same file, since the
+// implementation has no include guards.
+//
+// ----------
+//  OVERVIEW
+// ----------
+// LZ77 encoder/decoder, in the LZSS flavour: the input is coded as a series of
+// sequences, each a run of literal bytes followed by a match, which is a copy
+// of at least MinMatch bytes from up to a window size back in the output.
+//
+// Matches are found with a hash chain. The first MinMatch bytes at every position
+// are hashed into a table holding the last position they were seen at, and each
+// position links to the previous one with the same hash, within the window. The
+// level sets how many of those links are followed per position and how long a
+// match has to be to stop looking for a better one. Levels below LazyLevel take
+// the first good match found (greedy parsing). From LazyLevel up, a match is
+// only taken if the next position doesn't start a longer one (lazy matching),
+// which costs a second search per match but gives noticeably smaller output.
+//
+// The sequences are split into byte streams: the literals, the literal and
+// match lengths, and one stream per byte of the match offsets. Lengths are
+// coded as a byte each, with 255 meaning "add the next byte too", so they
+// stay byte-sized and short runs cost a single byte.
+//
+// With Entropy::Huffman, each stream is then coded on its own with canonical
+// Huffman codes from huffman.hpp, if that makes it any smaller. Keeping the
+// streams apart gives each its own code table, which is what makes this
+// competitive with DEFLATE, since the literals, lengths and offset bytes have
+// nothing in common statistically.
+//
+// Stream layout, all words little-endian:
+//
+// +-----------+-----------------+----------------------+-------------------+----------+-----
+// | u8 method | u8 window bits  | u32 uncompressed len | u32 sequence count| stream 0 | ...
+// +-----------+-----------------+----------------------+-------------------+----------+-----
+//
+// Method::Stored is followed by the input as-is, with a window bits and a
+// sequence count of zero. Method::Sequences is followed by the literals, the
+// lengths, then the offset streams, low byte first, each laid out as:
+//
+// +-----------+-----------------+-----------------------------------+------
+// | u8 coding | u32 raw length  | u32 coded bits (Entropy::Huffman) | data
+// +-----------+-----------------+-----------------------------------+------
+//
+// The last sequence has no match, so it only stores a literal length and
+// the offset streams have one entry less than the sequence count.
+//
+// LZ77_ERROR() aborts by default. For untrusted input, such as on a server,
+// safeDecode() never calls it and returns an lz77::DecodeStatus instead. The
+// Huffman coded streams then go through huffman::safeDecode(), so
+// HUFFMAN_ERROR() isn't called either.
+//
+// Memory for the match finder, the easyEncode() output and the decoder's
+// Huffman scratch is sourced from LZ77_MALLOC/LZ77_MFREE by default, so you
+// can override the macros to add custom memory management, or pass an
+// lz77::Allocator to the functions taking one.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#include "huffman.hpp"
+
+// If you provide a custom malloc(), you must also provide a custom free().
+// Note: We never check LZ77_MALLOC's return for null. A custom implementation
+// should just abort with a fatal error if the program runs out of memory.
+#ifndef LZ77_MALLOC
+#define LZ77_MALLOC std::malloc
+#define LZ77_MFREE std::free
+#endif // LZ77_MALLOC
+
+namespace lz77 {
+
+// ========================================================
+
+// The default fatalError() function writes to stderr and aborts.
+#ifndef LZ77_ERROR
+
+    void fatalError(const char *message);
+
+#define LZ77_USING_DEFAULT_ERROR_HANDLER
+#define LZ77_ERROR(message) ::lz77::fatalError(message)
+#endif // LZ77_ERROR
+
+    // ========================================================
+    // struct Allocator:
+    // ========================================================
+
+    // Source of the match finder tables, decoder scratch memory and easyEncode()
+    // output. Memory handed to the user has to be freed with the same allocator.
+    struct Allocator {
+        void *(*allocate)(void *context, std::size_t sizeBytes);
+        void (*deallocate)(void *context, void *ptr);
+        void *context;
+    };
+
+    // Goes through LZ77_MALLOC/LZ77_MFREE.
+    const Allocator &defaultAllocator();
+
+    // ========================================================
+    // LZ77 constants:
+    // ========================================================
+
+    // Shortest match that is coded as one. Also the number of bytes hashed.
+    constexpr int MinMatch = 4;
+
+    // Matches reach back up to (1 << windowBits) - 1 bytes.
+    constexpr int MinWindowBits = 10;
+    constexpr int MaxWindowBits = 24;
+    constexpr int DefaultWindowBits = 16;
+
+    // Levels trade speed for ratio. Levels from LazyLevel up use lazy matching.
+    constexpr int MinLevel = 1;
+    constexpr int MaxLevel = 9;
+    constexpr int LazyLevel = 4;
+    constexpr int DefaultLevel = 6;
+
+    constexpr int HeaderSize = 10;
+
+    enum class Method : std::uint8_t {
+        Stored    = 0, // Raw copy of the input, when sequences didn't make it smaller.
+        Sequences = 1
+    };
+
+    // How the sequence streams are stored.
+    enum class Entropy : std::uint8_t {
+        None    = 0, // Raw bytes. Fastest to decode.
+        Huffman = 1  // Canonical Huffman codes per stream, for streams they make smaller.
+    };
+
+    // ========================================================
+    // easyEncode() / easyDecode():
+    // ========================================================
+
+    // Quick LZ77 data compression. Output compressed data is heap allocated from
+    // the given allocator and should be later freed with its deallocate(), which
+    // for the default allocator is LZ77_MFREE().
+    // The output is whole bytes, compressedSizeBits is just 8 times the bytes.
+    void easyEncode(const std::uint8_t *uncompressed, int uncompressedSizeBytes,
+                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits,
+                    int level = DefaultLevel, int windowBits = DefaultWindowBits,
+                    Entropy entropy = Entropy::None, const Allocator &allocator = defaultAllocator());
+
+    // Same as above, but writes to a caller-provided buffer instead. The match finder
+    // and sequence scratch are the only allocations left. A buffer of maxCompressedSize()
+    // bytes always fits.
+    // Returns false if it didn't fit.
+    bool easyEncode(const std::uint8_t *uncompressed, int uncompressedSizeBytes,
+                    std::uint8_t *compressed, int compressedCapacityBytes,
+                    int *compressedSizeBytes, int *compressedSizeBits,
+                    int level = DefaultLevel, int windowBits = DefaultWindowBits,
+                    Entropy entropy = Entropy::None, const Allocator &allocator = defaultAllocator());
+
+    // Worst-case easyEncode() output size for any input of the given size.
+    int maxCompressedSize(int uncompressedSizeBytes);
+
+    // Decompress back the output of easyEncode().
+    // The uncompressed output buffer is assumed to be big enough to hold the uncompressed data,
+    // if it happens to be smaller, the decoder will return a partial output and the return value
+    // of this function will be less than uncompressedSizeBytes.
+    int easyDecode(const std::uint8_t *compressed, int compressedSizeBytes, int compressedSizeBits,
+                   std::uint8_t *uncompressed, int uncompressedSizeBytes,
+                   const Allocator &allocator = defaultAllocator());
+
+    // What went wrong decoding a stream, for safeDecode().
+    enum class DecodeStatus : std::uint8_t {
+        Ok,            // The whole stream decoded fine.
+        BadArguments,  // Null pointers or sizes out of range.
+        BadHeader,     // Unknown method or window bits, or a stream header out of range.
+        CorruptData,   // Bad Huffman coded stream, bad sequence, or a stream cut short.
+        OutputTooSmall // The data didn't fit in the output buffer.
+    };
+
+    // Same as easyDecode(), but for untrusted input: LZ77_ERROR() and HUFFMAN_ERROR()
+    // are never called, whatever the stream holds. Problems are returned instead, and
+    // *bytesDecoded gets the bytes written to uncompressed either way.
+    DecodeStatus safeDecode(const std::uint8_t *compressed, int compressedSizeBytes, int compressedSizeBits,
+                            std::uint8_t *uncompressed, int uncompressedSizeBytes, int *bytesDecoded,
+                            const Allocator &allocator = defaultAllocator());
+
+} // namespace lz77 {}
+
+// ================== End of header file ==================
+#endif // LZ77_HPP
+// ================== End of header file ==================
+
+// ================================================================================================
+//
+//                                     LZ77 Implementation
+//
+// ================================================================================================
+
+#ifdef LZ77_IMPLEMENTATION
+
+#ifdef LZ77_USING_DEFAULT_ERROR_HANDLER
+#include <cstdio> // For the default error handler
+#endif            // LZ77_USING_DEFAULT_ERROR_HANDLER
+
+#include <cassert>
+#include <cstring>
+
+namespace lz77
+{
+
+    // ========================================================
+
+#ifdef LZ77_USING_DEFAULT_ERROR_HANDLER
+
+    // Prints a fatal error to stderr and aborts the process.
+    // This is the default method used by LZ77_ERROR(), but
+    // you can override the macro to use other error handling
+    // mechanisms, such as C++ exceptions.
+    void fatalError(const char *const message)
+    {
+        std::fprintf(stderr, "LZ77 encoder/decoder error: %s\n", message);
+        std::abort();
+    }
+
+#endif // LZ77_USING_DEFAULT_ERROR_HANDLER
+
+    // ========================================================
+    // Default allocator:
+    // ========================================================
+
+    static void *defaultAllocate(void *, const std::size_t sizeBytes)
+    {
+        return LZ77_MALLOC(sizeBytes);
+    }
+
+    static void defaultDeallocate(void *, void *ptr)
+    {
+        LZ77_MFREE(ptr);
+    }
+
+    const Allocator &defaultAllocator()
+    {
+        static const Allocator allocator = {&defaultAllocate, &defaultDeallocate, nullptr};
+        return allocator;
+    }
+
+    // ========================================================
+    // Local helpers:
+    // ========================================================
+
+    // Streams after the header: literals, lengths, then up to 3 offset bytes.
+    constexpr int MaxStreams = 5;
+    constexpr int StreamHeaderSize = 5;
+    constexpr int HuffmanStreamHeaderSize = StreamHeaderSize + 4;
+
+    // Streams shorter than this aren't worth a Huffman tree prefix.
+    constexpr int MinEntropyStreamSize = 64;
+
+    constexpr int MaxHashBits = 16;
+
+    static int offsetBytesForWindow(const int windowBits)
+    {
+        return (windowBits + 7) / 8;
+    }
+
+    static void storeU32(std::uint8_t *ptr, const std::uint32_t word)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            ptr[i] = static_cast<std::uint8_t>(word >> (i * 8));
+        }
+    }
+
+    static std::uint32_t loadU32(const std::uint8_t *ptr)
+    {
+        std::uint32_t word = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            word |= std::uint32_t(ptr[i]) << (i * 8);
+        }
+        return word;
+    }
+
+    // Plain unaligned load, only ever compared against another one, so byte order doesn't matter.
+    static std::uint64_t loadNativeU64(const std::uint8_t *ptr)
+    {
+        std::uint64_t word;
+        std::memcpy(&word, ptr, sizeof(word));
+        return word;
+    }
+
+    static int countTrailingZeros(std::uint64_t num)
+    {
+        assert(num != 0);
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(num);
+#else
+        int count = 0;
+        for (; (num & 1) == 0; num >>= 1)
+        {
+            ++count;
+        }
+        return count;
+#endif
+    }
+
+    // Number of equal bytes at a and b, up to maxLength. Compares 8 bytes at a time.
+    static int matchLength(const std::uint8_t *a, const std::uint8_t *b, const int maxLength)
+    {
+        int length = 0;
+        while (length + 8 <= maxLength)
+        {
+            const std::uint64_t diff = loadNativeU64(a + length) ^ loadNativeU64(b + length);
+            if (diff != 0)
+            {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+                for (; a[length] == b[length]; ++length)
+                {
+                }
+                return length;
+#else
+                return length + countTrailingZeros(diff) / 8;
+#endif
+            }
+            length += 8;
+        }
+        for (; length < maxLength && a[length] == b[length]; ++length)
+        {
+        }
+        return length;
+    }
+
+    // ========================================================
+    // Encoder levels:
+    // ========================================================
+
+    struct LevelParams {
+        int maxChain;   // Hash chain links followed per search.
+        int niceLength; // A match this long ends the search, and skips the lazy check.
+    };
+
+    static const LevelParams levelParams[MaxLevel + 1] = {
+        {    0,     0 }, // Unused.
+        {    1,    16 },
+        {    4,    32 },
+        {    8,    64 },
+        {    8,    32 }, // LazyLevel
+        {   16,    64 },
+        {   32,   128 },
+        {   64,   256 },
+        {  256,  1024 },
+        { 4096, 65536 }
+    };
+
+    // ========================================================
+    // class MatchFinder:
+    // ========================================================
+
+    struct Match {
+        int length;
+        int distance;
+    };
+
+    // Hash chains over the input. Every position is inserted exactly once, in order.
+    class MatchFinder final {
+    public:
+        MatchFinder(const MatchFinder &) = delete;
+
+        MatchFinder &operator=(const MatchFinder &) = delete;
+
+        MatchFinder(const std::uint8_t *data, int dataSizeBytes, int windowBits,
+                    const LevelParams &params, const Allocator &allocator);
+
+        ~MatchFinder();
+
+        // Inserts pos, which must be the next position not inserted yet,
+        // and returns the longest match found for it (length 0 for none).
+        Match findAndInsert(int pos);
+
+        // Inserts every position before end that isn't yet.
+        void insertUpTo(int end);
+
+    private:
+        int hash(const int pos) const
+        {
+            return static_cast<int>((loadU32(data + pos) * 2654435761u) >> (32 - hashBits));
+        }
+
+        void insert(int pos);
+
+        const Allocator *allocator;
+        const std::uint8_t *data;
+        int dataSize;
+        int lastPos;       // Last position with MinMatch bytes left to hash.
+        int windowSize;
+        int chainMask;     // The chain holds the last chainMask + 1 positions.
+        int hashBits;
+        int maxChain;
+        int niceLength;
+        int nextInsert;
+        std::int32_t *head;  // Last position per hash, -1 if none.
+        std::int32_t *chain; // Previous position with the same hash, per position & chainMask.
+    };
+
+    MatchFinder::MatchFinder(const std::uint8_t *data, const int dataSizeBytes, const int windowBits,
+                             const LevelParams &params, const Allocator &allocator)
+        : allocator(&allocator)
+        , data(data)
+        , dataSize(dataSizeBytes)
+        , lastPos(dataSizeBytes - MinMatch)
+        , windowSize(1 << windowBits)
+        , maxChain(params.maxChain)
+        , niceLength(params.niceLength)
+        , nextInsert(0)
+    {
+        // No need for a chain longer than the input, nor for more hash slots than positions.
+        int chainSize = 1 << MinWindowBits;
+        while (chainSize < windowSize && chainSize < dataSizeBytes)
+        {
+            chainSize <<= 1;
+        }
+        chainMask = chainSize - 1;
+
+        hashBits = MinWindowBits;
+        while (hashBits < MaxHashBits && (1 << hashBits) < chainSize)
+        {
+            ++hashBits;
+        }
+
+        const std::size_t headBytes = (std::size_t(1) << hashBits) * sizeof(std::int32_t);
+        head = static_cast<std::int32_t *>(allocator.allocate(allocator.context, headBytes));
+        chain = static_cast<std::int32_t *>(allocator.allocate(allocator.context, chainSize * sizeof(std::int32_t)));
+        std::memset(head, 0xFF, headBytes);
+    }
+
+    MatchFinder::~MatchFinder()
+    {
+        allocator->deallocate(allocator->context, head);
+        allocator->deallocate(allocator->context, chain);
+    }
+
+    void MatchFinder::insert(const int pos)
+    {
+        const int h = hash(pos);
+        chain[pos & chainMask] = head[h];
+        head[h] = pos;
+    }
+
+    void MatchFinder::insertUpTo(int end)
+    {
+        if (end > lastPos + 1)
+        {
+            end = lastPos + 1;
+        }
+        for (; nextInsert < end; ++nextInsert)
+        {
+            insert(nextInsert);
+        }
+    }
+
+    Match MatchFinder::findAndInsert(const int pos)
+    {
+        assert(pos == nextInsert && pos <= lastPos);
+
+        const int h = hash(pos);
+        int candidate = head[h];
+        chain[pos & chainMask] = candidate;
+        head[h] = pos;
+        ++nextInsert;
+
+        Match best = { 0, 0 };
+        const int maxLength = dataSize - pos;
+        const int nice = (niceLength < maxLength) ? niceLength : maxLength;
+        const int oldest = (pos >= windowSize) ? pos - windowSize + 1 : 0;
+        const std::uint8_t *const current = data + pos;
+        const std::uint32_t first = loadU32(current);
+
+        for (int links = maxChain; candidate >= oldest && links > 0; --links)
+        {
+            const std::uint8_t *const previous = data + candidate;
+
+            // Cheap rejects first: the byte that would make it longer than the best, then the hashed bytes.
+            if ((best.length == 0 || previous[best.length] == current[best.length]) && loadU32(previous) == first)
+            {
+                const int length = MinMatch + matchLength(previous + MinMatch, current + MinMatch, maxLength - MinMatch);
+                if (length > best.length)
+                {
+                    best.length = length;
+                    best.distance = pos - candidate;
+                    if (length >= nice)
+                    {
+                        break;
+                    }
+                }
+            }
+            candidate = chain[candidate & chainMask];
+        }
+        return best;
+    }
+
+    // ========================================================
+    // Sequence streams:
+    // ========================================================
+
+    // Where the encoder puts the sequences, all in one allocation.
+    struct SequenceStreams {
+        std::uint8_t *streams[MaxStreams];
+        int sizes[MaxStreams];
+        int streamCount;
+        int sequenceCount;
+
+        void appendLength(int length)
+        {
+            std::uint8_t *const lengths = streams[1];
+            for (; length >= 255; length -= 255)
+            {
+                lengths[sizes[1]++] = 255;
+            }
+            lengths[sizes[1]++] = static_cast<std::uint8_t>(length);
+        }
+
+        void appendSequence(const std::uint8_t *literals, const int literalCount, const Match match)
+        {
+            std::memcpy(streams[0] + sizes[0], literals, literalCount);
+            sizes[0] += literalCount;
+            appendLength(literalCount);
+            appendLength(match.length - MinMatch);
+            for (int i = 2; i < streamCount; ++i)
+            {
+                streams[i][sizes[i]++] = static_cast<std::uint8_t>(match.distance >> ((i - 2) * 8));
+            }
+            ++sequenceCount;
+        }
+
+        void appendLastLiterals(const std::uint8_t *literals, const int literalCount)
+        {
+            std::memcpy(streams[0] + sizes[0], literals, literalCount);
+            sizes[0] += literalCount;
+            appendLength(literalCount);
+            ++sequenceCount;
+        }
+    };
+
+    // Parses the input into sequences, greedily or lazily depending on the level.
+    static void findSequences(const std::uint8_t *data, const int dataSizeBytes, const int level,
+                              const int windowBits, const Allocator &allocator, SequenceStreams &out)
+    {
+        const LevelParams &params = levelParams[level];
+        const bool lazy = (level >= LazyLevel);
+        const int lastPos = dataSizeBytes - MinMatch;
+
+        MatchFinder finder(data, dataSizeBytes, windowBits, params, allocator);
+
+        int anchor = 0; // Start of the pending literals.
+        int pos = 0;
+        while (pos <= lastPos)
+        {
+            Match match = finder.findAndInsert(pos);
+            if (match.length < MinMatch)
+            {
+                ++pos;
+                continue;
+            }
+
+            // Lazy matching: while the next position has a longer match, emit
+            // this byte as a literal and go with that one instead.
+            if (lazy)
+            {
+                while (match.length < params.niceLength && pos + 1 <= lastPos)
+                {
+                    const Match next = finder.findAndInsert(pos + 1);
+                    if (next.length <= match.length)
+                    {
+                        break;
+                    }
+                    match = next;
+                    ++pos;
+                }
+            }
+
+            out.appendSequence(data + anchor, pos - anchor, match);
+            pos += match.length;
+            anchor = pos;
+            finder.insertUpTo(pos);
+        }
+
+        out.appendLastLiterals(data + anchor, dataSizeBytes - anchor);
+    }
+
+    // ========================================================
+    // easyEncode() implementation:
+    // ========================================================
+
+    static bool validEncodeParams(const int level, const int windowBits, const Entropy entropy)
+    {
+        if (level < MinLevel || level > MaxLevel)
+        {
+            LZ77_ERROR("lz77::easyEncode(): Level must be between 1 and 9!");
+            return false;
+        }
+
+        if (windowBits < MinWindowBits || windowBits > MaxWindowBits)
+        {
+            LZ77_ERROR("lz77::easyEncode(): Window bits must be between 10 and 24!");
+            return false;
+        }
+
+        if (entropy != Entropy::None && entropy != Entropy::Huffman)
+        {
+            LZ77_ERROR("lz77::easyEncode(): Unknown entropy coding!");
+            return false;
+        }
+        return true;
+    }
+
+    static void writeHeader(std::uint8_t *output, const Method method, const int windowBits,
+                            const int uncompressedSizeBytes, const int sequenceCount)
+    {
+        output[0] = static_cast<std::uint8_t>(method);
+        output[1] = static_cast<std::uint8_t>(windowBits);
+        storeU32(output + 2, static_cast<std::uint32_t>(uncompressedSizeBytes));
+        storeU32(output + 6, static_cast<std::uint32_t>(sequenceCount));
+    }
+
+    // Writes one stream at output, Huffman coded if asked for and smaller.
+    // Returns the bytes written, or 0 if it didn't fit in capacityBytes.
+    static int writeStream(const std::uint8_t *stream, const int streamSizeBytes, const Entropy entropy,
+                           std::uint8_t *output, const int capacityBytes)
+    {
+        if (entropy == Entropy::Huffman && streamSizeBytes >= MinEntropyStreamSize)
+        {
+            // Only worth it if it beats the raw stream, header word included.
+            int capacity = capacityBytes - HuffmanStreamHeaderSize;
+            if (capacity > streamSizeBytes - (HuffmanStreamHeaderSize - StreamHeaderSize) - 1)
+            {
+                capacity = streamSizeBytes - (HuffmanStreamHeaderSize - StreamHeaderSize) - 1;
+            }
+
+            int codedBytes = 0;
+            int codedBits = 0;
+            if (capacity > 0 &&
+                huffman::easyEncode(stream, streamSizeBytes, output + HuffmanStreamHeaderSize, capacity,
+                                    &codedBytes, &codedBits, huffman::Format::Canonical,
+                                    huffman::DecodeTable::MaxPrimaryBits))
+            {
+                output[0] = static_cast<std::uint8_t>(Entropy::Huffman);
+                storeU32(output + 1, static_cast<std::uint32_t>(streamSizeBytes));
+                storeU32(output + 5, static_cast<std::uint32_t>(codedBits));
+                return HuffmanStreamHeaderSize + codedBytes;
+            }
+        }
+
+        if (StreamHeaderSize + streamSizeBytes > capacityBytes)
+        {
+            return 0;
+        }
+        output[0] = static_cast<std::uint8_t>(Entropy::None);
+        storeU32(output + 1, static_cast<std::uint32_t>(streamSizeBytes));
+        std::memcpy(output + StreamHeaderSize, stream, streamSizeBytes);
+        return StreamHeaderSize + streamSizeBytes;
+    }
+
+    // Codes the input to output, which holds up to capacityBytes. Returns the bytes
+    // written, or 0 if they didn't fit. Both easyEncode() overloads come here. A null
+    // output is allocated from the allocator instead, just big enough for the result.
+    static int encodeToBuffer(const std::uint8_t *uncompressed, const int uncompressedSizeBytes,
+                              std::uint8_t *&output, int capacityBytes, const int level,
+                              const int windowBits, const Entropy entropy, const Allocator &allocator)
+    {
+        // Worst case stream sizes: every sequence takes at least MinMatch bytes of input,
+        // and a length costs a byte plus one per 255 of its value.
+        const int maxSequences = uncompressedSizeBytes / MinMatch + 1;
+        const int offsetBytes = offsetBytesForWindow(windowBits);
+        const int maxLengthBytes = 2 * maxSequences + 2 * (uncompressedSizeBytes / 255);
+
+        SequenceStreams streams;
+        streams.streamCount = 2 + offsetBytes;
+        streams.sequenceCount = 0;
+
+        const std::size_t scratchSize = std::size_t(uncompressedSizeBytes) + maxLengthBytes +
+                                        std::size_t(offsetBytes) * maxSequences;
+        auto *scratch = static_cast<std::uint8_t *>(allocator.allocate(allocator.context, scratchSize));
+        streams.streams[0] = scratch;
+        streams.streams[1] = scratch + uncompressedSizeBytes;
+        for (int i = 2; i < streams.streamCount; ++i)
+        {
+            streams.streams[i] = scratch + uncompressedSizeBytes + maxLengthBytes + (i - 2) * maxSequences;
+        }
+        for (int i = 0; i < MaxStreams; ++i)
+        {
+            streams.sizes[i] = 0;
+        }
+
+        findSequences(uncompressed, uncompressedSizeBytes, level, windowBits, allocator, streams);
+
+        // Raw streams never grow under Huffman, so this is the most the sequences take.
+        std::int64_t sequencesSize = HeaderSize;
+        for (int i = 0; i < streams.streamCount; ++i)
+        {
+            sequencesSize += StreamHeaderSize + streams.sizes[i];
+        }
+
+        // Raw sequences only beat storing if this is smaller, Huffman coded ones might anyway.
+        const std::int64_t storedSize = HeaderSize + std::int64_t(uncompressedSizeBytes);
+        if (output == nullptr)
+        {
+            capacityBytes = static_cast<int>((sequencesSize < storedSize) ? sequencesSize : storedSize);
+            output = static_cast<std::uint8_t *>(allocator.allocate(allocator.context, capacityBytes));
+        }
+
+        int written = 0;
+        if (sequencesSize < storedSize || entropy == Entropy::Huffman)
+        {
+            // Anything not smaller than storing is no use.
+            const int sequencesCapacity = (capacityBytes < storedSize) ? capacityBytes : static_cast<int>(storedSize - 1);
+            if (sequencesCapacity >= HeaderSize)
+            {
+                written = HeaderSize;
+                for (int i = 0; i < streams.streamCount; ++i)
+                {
+                    const int streamBytes = writeStream(streams.streams[i], streams.sizes[i], entropy,
+                                                        output + written, sequencesCapacity - written);
+                    if (streamBytes == 0)
+                    {
+                        written = 0;
+                        break;
+                    }
+                    written += streamBytes;
+                }
+            }
+            if (written != 0)
+            {
+                writeHeader(output, Method::Sequences, windowBits, uncompressedSizeBytes, streams.sequenceCount);
+            }
+        }
+
+        if (written == 0 && storedSize <= capacityBytes)
+        {
+            writeHeader(output, Method::Stored, 0, uncompressedSizeBytes, 0);
+            std::memcpy(output + HeaderSize, uncompressed, uncompressedSizeBytes);
+            written = static_cast<int>(storedSize);
+        }
+
+        allocator.deallocate(allocator.context, scratch);
+        return written;
+    }
+
+    void easyEncode(const std::uint8_t *uncompressed, const int uncompressedSizeBytes,
+                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits,
+                    const int level, const int windowBits, const Entropy entropy, const Allocator &allocator)
+    {
+        if (uncompressed == nullptr || compressed == nullptr)
+        {
+            LZ77_ERROR("lz77::easyEncode(): Null data pointer(s)!");
+            return;
+        }
+
+        if (uncompressedSizeBytes <= 0 || compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
+        {
+            LZ77_ERROR("lz77::easyEncode(): Bad in/out sizes!");
+            return;
+        }
+
+        if (!validEncodeParams(level, windowBits, entropy))
+        {
+            return;
+        }
+
+        std::uint8_t *output = nullptr;
+        const int written = encodeToBuffer(uncompressed, uncompressedSizeBytes, output, 0,
+                                           level, windowBits, entropy, allocator);
+        assert(written != 0);
+
+        *compressedSizeBytes = written;
+        *compressedSizeBits = written * 8;
+        *compressed = output;
+    }
+
+    bool easyEncode(const std::uint8_t *uncompressed, const int uncompressedSizeBytes,
+                    std::uint8_t *compressed, const int compressedCapacityBytes,
+                    int *compressedSizeBytes, int *compressedSizeBits,
+                    const int level, const int windowBits, const Entropy entropy, const Allocator &allocator)
+    {
+        if (uncompressed == nullptr || compressed == nullptr)
+        {
+            LZ77_ERROR("lz77::easyEncode(): Null data pointer(s)!");
+            return false;
+        }
+
+        if (uncompressedSizeBytes <= 0 || compressedCapacityBytes <= 0 ||
+            compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
+        {
+            LZ77_ERROR("lz77::easyEncode(): Bad in/out sizes!");
+            return false;
+        }
+
+        if (!validEncodeParams(level, windowBits, entropy))
+        {
+            return false;
+        }
+
+        std::uint8_t *output = compressed;
+        const int written = encodeToBuffer(uncompressed, uncompressedSizeBytes, output, compressedCapacityBytes,
+                                           level, windowBits, entropy, allocator);
+        if (written == 0)
+        {
+            return false;
+        }
+
+        *compressedSizeBytes = written;
+        *compressedSizeBits = written * 8;
+        return true;
+    }
+
+    int maxCompressedSize(const int uncompressedSizeBytes)
+    {
+        // Sequences are only kept if smaller than the input, else it is stored.
+        const int n = (uncompressedSizeBytes > 0) ? uncompressedSizeBytes : 0;
+        return HeaderSize + n;
+    }
+
+    // ========================================================
+    // easyDecode() implementation:
+    // ========================================================
+
+    // Reads lengths back from the lengths stream.
+    struct LengthReader {
+        const std::uint8_t *lengths;
+        int size;
+        int pos;
+
+        // False at the end of the stream or if the length can't be right.
+        bool read(const int maxLength, int &length)
+        {
+            length = 0;
+            for (;;)
+            {
+                if (pos >= size)
+                {
+                    return false;
+                }
+                const int byte = lengths[pos++];
+                length += byte;
+                if (length > maxLength)
+                {
+                    return false;
+                }
+                if (byte != 255)
+                {
+                    return true;
+                }
+            }
+        }
+    };
+
+    // Copies a match of length bytes from distance back, which may overlap the output
+    // it makes. Whole words at a time when the source is at least a word behind and
+    // there's room for the overshoot, which the next sequence writes over anyway.
+    static void copyMatch(std::uint8_t *dest, const int distance, const int length, const int roomBytes)
+    {
+        const std::uint8_t *source = dest - distance;
+        if (distance >= 8 && length + 8 <= roomBytes)
+        {
+            for (int i = 0; i < length; i += 8)
+            {
+                std::memcpy(dest + i, source + i, 8);
+            }
+        }
+        else
+        {
+            for (int i = 0; i < length; ++i)
+            {
+                dest[i] = source[i];
+            }
+        }
+    }
+
+    // Records the first decoding problem in status, and reports it with
+    // LZ77_ERROR() too, unless decoding quietly for safeDecode().
+    static void decodeError(DecodeStatus &status, const bool reportErrors, const DecodeStatus problem, const char *const message)
+    {
+        if (status == DecodeStatus::Ok)
+        {
+            status = problem;
+        }
+        if (reportErrors)
+        {
+            LZ77_ERROR(message);
+        }
+    }
+
+    // Output cut short by the caller's buffer, or by the stream itself.
+    static DecodeStatus shortOutputProblem(const int uncompressedSizeBytes, const std::uint32_t originalSize)
+    {
+        return (std::uint32_t(uncompressedSizeBytes) < originalSize) ? DecodeStatus::OutputTooSmall : DecodeStatus::CorruptData;
+    }
+
+    // Shared by easyDecode() and safeDecode(), after the arguments were checked.
+    static int decodeSequences(const std::uint8_t *compressed, const int compressedSizeBytes,
+                               std::uint8_t *uncompressed, const int uncompressedSizeBytes,
+                               const Allocator &allocator, DecodeStatus &status, const bool reportErrors)
+    {
+        const auto method = static_cast<Method>(compressed[0]);
+        const int windowBits = compressed[1];
+        const std::uint32_t originalSize = loadU32(compressed + 2);
+        const std::uint32_t sequenceCount = loadU32(compressed + 6);
+
+        // Any bytes past uncompressedSizeBytes are dropped, for a partial output.
+        const int outputSize = (originalSize < std::uint32_t(uncompressedSizeBytes)) ?
+                               static_cast<int>(originalSize) : uncompressedSizeBytes;
+
+        if (method == Method::Stored)
+        {
+            const int available = compressedSizeBytes - HeaderSize;
+            const int bytes = (outputSize < available) ? outputSize : available;
+            std::memcpy(uncompressed, compressed + HeaderSize, bytes);
+            if (bytes < static_cast<int>(originalSize))
+            {
+                decodeError(status, reportErrors, shortOutputProblem(uncompressedSizeBytes, originalSize),
+                            "lz77::easyDecode(): Truncated stream or output buffer too small!");
+            }
+            return bytes;
+        }
+
+        // Every sequence but the last covers at least MinMatch bytes.
+        if (method != Method::Sequences || windowBits < MinWindowBits || windowBits > MaxWindowBits ||
+            originalSize > 0x7FFFFFFFu || sequenceCount == 0 || sequenceCount - 1 > originalSize / MinMatch)
+        {
+            decodeError(status, reportErrors, DecodeStatus::BadHeader, "lz77::easyDecode(): Bad stream header!");
+            return 0;
+        }
+
+        // Locate the streams. Huffman coded ones are decoded to scratch memory.
+        const int streamCount = 2 + offsetBytesForWindow(windowBits);
+        const std::uint8_t *streams[MaxStreams];
+        int sizes[MaxStreams];
+        const std::uint8_t *coded[MaxStreams] = {};
+        int codedBits[MaxStreams] = {};
+        std::size_t scratchSize = 0;
+
+        int pos = HeaderSize;
+        for (int i = 0; i < streamCount; ++i)
+        {
+            if (compressedSizeBytes - pos < StreamHeaderSize)
+            {
+                decodeError(status, reportErrors, DecodeStatus::CorruptData, "lz77::easyDecode(): Truncated stream!");
+                return 0;
+            }
+
+            const int coding = compressed[pos];
+            const std::uint32_t rawSize = loadU32(compressed + pos + 1);
+            if (rawSize > originalSize + 2 * sequenceCount + 2 || (coding != static_cast<int>(Entropy::None) &&
+                                                                  coding != static_cast<int>(Entropy::Huffman)))
+            {
+                decodeError(status, reportErrors, DecodeStatus::BadHeader, "lz77::easyDecode(): Bad stream header!");
+                return 0;
+            }
+            sizes[i] = static_cast<int>(rawSize);
+
+            int dataBytes = sizes[i];
+            if (coding == static_cast<int>(Entropy::Huffman))
+            {
+                if (compressedSizeBytes - pos < HuffmanStreamHeaderSize)
+                {
+                    decodeError(status, reportErrors, DecodeStatus::CorruptData, "lz77::easyDecode(): Truncated stream!");
+                    return 0;
+                }
+                const std::uint32_t bits = loadU32(compressed + pos + 5);
+                if (bits == 0 || bits > 0x7FFFFFF8u || rawSize == 0)
+                {
+                    decodeError(status, reportErrors, DecodeStatus::BadHeader, "lz77::easyDecode(): Bad stream header!");
+                    return 0;
+                }
+                codedBits[i] = static_cast<int>(bits);
+                dataBytes = static_cast<int>((bits + 7) / 8);
+                pos += HuffmanStreamHeaderSize;
+                coded[i] = compressed + pos;
+                scratchSize += rawSize;
+            }
+            else
+            {
+                pos += StreamHeaderSize;
+            }
+
+            if (compressedSizeBytes - pos < dataBytes)
+            {
+                decodeError(status, reportErrors, DecodeStatus::CorruptData, "lz77::easyDecode(): Truncated stream!");
+                return 0;
+            }
+            streams[i] = compressed + pos;
+            pos += dataBytes;
+        }
+
+        std::uint8_t *scratch = nullptr;
+        if (scratchSize != 0)
+        {
+            const huffman::Allocator huffmanAllocator = {allocator.allocate, allocator.deallocate, allocator.context};
+            scratch = static_cast<std::uint8_t *>(allocator.allocate(allocator.context, scratchSize));
+
+            std::uint8_t *next = scratch;
+            for (int i = 0; i < streamCount; ++i)
+            {
+                if (coded[i] == nullptr)
+                {
+                    continue;
+                }
+                // Quietly, so a bad stream is reported here rather than by HUFFMAN_ERROR().
+                const int codedBytes = (codedBits[i] + 7) / 8;
+                int huffmanBytes = 0;
+                if (huffman::safeDecode(coded[i], codedBytes, codedBits[i], next, sizes[i], &huffmanBytes,
+                                        huffmanAllocator) != huffman::DecodeStatus::Ok || huffmanBytes != sizes[i])
+                {
+                    allocator.deallocate(allocator.context, scratch);
+                    decodeError(status, reportErrors, DecodeStatus::CorruptData, "lz77::easyDecode(): Bad Huffman coded stream!");
+                    return 0;
+                }
+                streams[i] = next;
+                next += sizes[i];
+            }
+        }
+
+        // Offset streams hold one entry per sequence with a match.
+        bool valid = true;
+        for (int i = 2; i < streamCount; ++i)
+        {
+            valid = valid && (static_cast<std::uint32_t>(sizes[i]) == sequenceCount - 1);
+        }
+
+        // Replay the sequences:
+        const std::uint8_t *literals = streams[0];
+        int literalsLeft = sizes[0];
+        LengthReader lengths = { streams[1], sizes[1], 0 };
+        int bytesDecoded = 0;
+
+        for (std::uint32_t s = 0; valid && s < sequenceCount; ++s)
+        {
+            int literalCount;
+            if (!lengths.read(literalsLeft, literalCount))
+            {
+                valid = false;
+                break;
+            }
+
+            if (literalCount > outputSize - bytesDecoded)
+            {
+                std::memcpy(uncompressed + bytesDecoded, literals, outputSize - bytesDecoded);
+                bytesDecoded = outputSize;
+                break;
+            }
+            std::memcpy(uncompressed + bytesDecoded, literals, literalCount);
+            literals += literalCount;
+            literalsLeft -= literalCount;
+            bytesDecoded += literalCount;
+
+            if (s == sequenceCount - 1)
+            {
+                break;
+            }
+
+            int matchCount;
+            if (!lengths.read(static_cast<int>(originalSize), matchCount))
+            {
+                valid = false;
+                break;
+            }
+            matchCount += MinMatch;
+
+            int distance = 0;
+            for (int i = 2; i < streamCount; ++i)
+            {
+                distance |= streams[i][s] << ((i - 2) * 8);
+            }
+            if (distance == 0 || distance > bytesDecoded)
+            {
+                valid = false;
+                break;
+            }
+
+            if (matchCount > outputSize - bytesDecoded)
+            {
+                copyMatch(uncompressed + bytesDecoded, distance, outputSize - bytesDecoded, 0);
+                bytesDecoded = outputSize;
+                break;
+            }
+            copyMatch(uncompressed + bytesDecoded, distance, matchCount, outputSize - bytesDecoded);
+            bytesDecoded += matchCount;
+        }
+
+        if (scratch != nullptr)
+        {
+            allocator.deallocate(allocator.context, scratch);
+        }
+
+        if (!valid)
+        {
+            decodeError(status, reportErrors, DecodeStatus::CorruptData, "lz77::easyDecode(): Corrupt sequence data!");
+        }
+        else if (bytesDecoded != static_cast<int>(originalSize))
+        {
+            decodeError(status, reportErrors, shortOutputProblem(uncompressedSizeBytes, originalSize),
+                        "lz77::easyDecode(): Truncated stream or output buffer too small!");
+        }
+        return bytesDecoded;
+    }
+
+    int easyDecode(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
+                   std::uint8_t *uncompressed, const int uncompressedSizeBytes, const Allocator &allocator)
+    {
+        (void)compressedSizeBits; // Always whole bytes.
+
+        if (compressed == nullptr || uncompressed == nullptr)
+        {
+            LZ77_ERROR("lz77::easyDecode(): Null data pointer(s)!");
+            return 0;
+        }
+
+        if (compressedSizeBytes < HeaderSize || uncompressedSizeBytes <= 0)
+        {
+            LZ77_ERROR("lz77::easyDecode(): Bad in/out sizes!");
+            return 0;
+        }
+
+        DecodeStatus status = DecodeStatus::Ok;
+        return decodeSequences(compressed, compressedSizeBytes, uncompressed, uncompressedSizeBytes,
+                               allocator, status, true);
+    }
+
+    // ========================================================
+    // safeDecode() implementation:
+    // ========================================================
+
+    DecodeStatus safeDecode(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
+                            std::uint8_t *uncompressed, const int uncompressedSizeBytes, int *bytesDecoded,
+                            const Allocator &allocator)
+    {
+        (void)compressedSizeBits; // Always whole bytes.
+
+        if (bytesDecoded != nullptr)
+        {
+            *bytesDecoded = 0;
+        }
+        if (compressed == nullptr || uncompressed == nullptr || bytesDecoded == nullptr ||
+            compressedSizeBytes < HeaderSize || uncompressedSizeBytes <= 0)
+        {
+            return DecodeStatus::BadArguments;
+        }
+
+        DecodeStatus status = DecodeStatus::Ok;
+        *bytesDecoded = decodeSequences(compressed, compressedSizeBytes, uncompressed, uncompressedSizeBytes,
+                                        allocator, status, false);
+        return status;
+    }
+
+} // namespace lz77 {}
+
+// ================ End of implementation =================
+#endif // LZ77_IMPLEMENTATION
+// ================ End of implementation =================
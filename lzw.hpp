@@ -12,11 +12,14 @@
 // Lempel–Ziv–Welch (LZW) encoder/decoder.
 //
 // This is the compression scheme used by the GIF image format and the Unix 'compress' tool.
-// Main differences from this implementation is that End Of Input (EOI) and Clear Codes (CC)
-// are not stored in the output and the max code length in bits is 12, vs 16 in compress.
+// Main differences from this implementation is that End Of Input (EOI) and, by default,
+// Clear Codes (CC) are not stored in the output and the max code length in bits is 12,
+// vs 16 in compress. The max code length can be set anywhere from 9 to 16 bits.
 //
 // EOI is simply detected by the end of the data stream, while CC happens if the
-// dictionary gets filled. Data is written/read from bit streams, which handle
+// dictionary gets filled. With ResetPolicy::OnRatioDrop the full dictionary is kept
+// instead, and an explicit CC is only sent once the compression ratio starts to drop,
+// like compress does. Data is written/read from bit streams, which handle
 // byte-alignment for us in a transparent way.
 //
 // The decoder relies on the hardcoded data layout produced by the encoder, since
@@ -32,8 +35,18 @@
 // is filled (4096 items for a 12-bits dictionary), the whole thing is cleared and
 // the process starts over. This is the main reason why the encoder and the decoder
 // must match perfectly, since the lengths of the codes will not be specified with
-// the data itself.
+// the data itself. Non-default settings (code length or reset policy) are the only
+// exception; they are recorded in a single 9-bit header word ahead of the codes.
+//
+// LZW_ERROR() aborts by default. For untrusted input, such as on a server,
+// safeDecode() never calls it and returns an lzw::DecodeStatus instead. Either
+// way the decoder reads its codes from a 64-bit window that is refilled with one
+// bounds-checked read every few codes, rather than one checked read per code.
+//
+// Defining LZW_STATS adds per-thread counters and timings (see lzw::Stats), such as
+// dictionary probes and resets. Without it the hooks compile to nothing.
 
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 
@@ -65,6 +78,58 @@ namespace lzw {
 #define LZW_ERROR(message) ::lzw::fatalError(message)
 #endif // LZW_ERROR
 
+    // ========================================================
+    // struct Allocator:
+    // ========================================================
+
+    // Source of all the memory the library allocates. Objects keep a pointer
+    // to it, so it must outlive them. Memory handed to the user (e.g. by
+    // BitStreamWriter::release()) has to be freed with the same allocator.
+    struct Allocator {
+        void *(*allocate)(void *context, std::size_t sizeBytes);
+        void (*deallocate)(void *context, void *ptr);
+        void *context;
+    };
+
+    // Goes through LZW_MALLOC/LZW_MFREE.
+    const Allocator &defaultAllocator();
+
+#ifdef LZW_STATS
+
+    // ========================================================
+    // struct Stats:
+    // ========================================================
+
+    // Counters and times (in nanoseconds) of the calling thread. They add
+    // up over every call, streaming ones included, until resetStats().
+    // Only there with LZW_STATS defined.
+    struct Stats {
+        std::uint64_t encodeCalls;          // easyEncode() and StreamEncoder::encode() calls.
+        std::uint64_t encodedBytesIn;       // Uncompressed bytes encoded.
+        std::uint64_t encodedBytesOut;      // Compressed bytes produced.
+        std::uint64_t decodeCalls;          // easyDecode() and StreamDecoder::decode() calls.
+        std::uint64_t decodedBytesIn;
+        std::uint64_t decodedBytesOut;
+
+        std::uint64_t encodeNanos;
+        std::uint64_t decodeNanos;
+
+        std::uint64_t lookups;              // Dictionary::findIndex() calls on a sequence.
+        std::uint64_t hashProbes;           // Hash table slots they looked at, 1 per lookup at best.
+        std::uint64_t dictionaryResets;     // Dictionaries cleared, when full or on a ClearCode.
+        std::uint64_t clearCodes;           // ClearCodes written by ResetPolicy::OnRatioDrop encoders.
+
+        std::uint64_t bufferAllocations;    // BitStreamWriter buffers allocated, first or regrown.
+        std::uint64_t bufferGrowths;        // Of those, the ones that copied an old buffer over.
+        std::uint64_t bufferBytesAllocated;
+    };
+
+    const Stats &stats();
+
+    void resetStats();
+
+#endif // LZW_STATS
+
     // ========================================================
     // class BitStreamWriter:
     // ========================================================
@@ -80,6 +145,12 @@ namespace lzw {
 
         explicit BitStreamWriter(int initialSizeInBits, int growthGranularity = 2);
 
+        explicit BitStreamWriter(const Allocator &allocator, int initialSizeInBits = 8192, int growthGranularity = 2);
+
+        // Writes to a fixed-size external buffer, which is never grown or freed.
+        // Bits that don't fit are dropped and isOverflowed() becomes true.
+        BitStreamWriter(std::uint8_t *buffer, int bufferSizeBytes);
+
         void allocate(int bitsWanted);
 
         void setGranularity(int growthGranularity);
@@ -103,19 +174,27 @@ namespace lzw {
 
         const std::uint8_t *getBitStream() const;
 
+        bool isOverflowed() const { return overflowed; }
+
         ~BitStreamWriter();
 
     private:
         void internalInit();
 
-        static std::uint8_t *allocBytes(int bytesWanted, std::uint8_t *oldPtr, int oldSize);
+        bool reserveWord();
 
-        std::uint8_t *stream; // Growable buffer to store our bits. Heap allocated & owned by the class instance.
-        int bytesAllocated;   // Current size of heap-allocated stream buffer *in bytes*.
-        int granularity;      // Amount bytesAllocated multiplies by when auto-resizing in appendBit().
-        int currBytePos;      // Current byte being written to, from 0 to bytesAllocated-1.
-        int nextBitPos;       // Bit position within the current byte to access next. 0 to 7.
-        int numBitsWritten;   // Number of bits in use from the stream buffer, not including byte-rounding padding.
+        std::uint8_t *allocBytes(int bytesWanted, std::uint8_t *oldPtr, int oldSize) const;
+
+        const Allocator *allocator;
+        std::uint8_t *stream;    // Growable buffer to store our bits. Heap allocated & owned by the class instance, unless external.
+        std::uint64_t bitBuffer; // Bits from currBytePos onwards. Always mirrored to the stream with one 64-bit store.
+        bool external;           // Stream is a fixed-size user buffer.
+        bool overflowed;         // Ran out of room in the external buffer.
+        int bytesAllocated;      // Current size of heap-allocated stream buffer *in bytes*.
+        int granularity;         // Amount bytesAllocated multiplies by when auto-resizing in appendBit().
+        int currBytePos;         // Current byte being written to, from 0 to bytesAllocated-8.
+        int nextBitPos;          // Bit position within the current byte to access next. 0 to 7.
+        int numBitsWritten;      // Number of bits in use from the stream buffer, not including byte-rounding padding.
     };
 
     // ========================================================
@@ -135,6 +214,8 @@ namespace lzw {
 
         bool isEndOfStream() const;
 
+        int getBitsLeft() const { return sizeInBits - numBitsRead; }
+
         bool readNextBit(int &bitOut);
 
         std::uint64_t readBitsU64(int bitCount);
@@ -142,6 +223,8 @@ namespace lzw {
         void reset();
 
     private:
+        std::uint64_t loadWindow() const;
+
         const std::uint8_t *stream; // Pointer to the external bit stream. Not owned by the reader.
         const int sizeInBytes;      // Size of the stream *in bytes*. Might include padding.
         const int sizeInBits;       // Size of the stream *in bits*, padding *not* include.
@@ -155,11 +238,39 @@ namespace lzw {
     // ========================================================
 
     constexpr int Nil = -1;
-    constexpr int MaxDictBits = 12;
+    constexpr int MaxDictBits = 12;  // Default max code width. Streams without a header always use it.
+    constexpr int MaxDictBitsLimit = 16; // Widest code width that can be selected.
     constexpr int StartBits = 9;
     constexpr int FirstCode = (1 << (StartBits - 1));  // 256
     constexpr int MaxDictEntries = (1 << MaxDictBits); // 4096
 
+    // When to throw away a full dictionary and start over.
+    enum class ResetPolicy : std::uint8_t {
+        // Clear as soon as the dictionary fills up. The legacy behavior.
+        WhenFull = 0,
+
+        // Keep coding with the full dictionary and only clear it once the
+        // compression ratio starts to drop, like the Unix compress tool.
+        // The encoder signals the reset with ClearCode.
+        OnRatioDrop = 1
+    };
+
+    // Reserved code of ResetPolicy::OnRatioDrop streams, where sequences start at FirstCode + 1.
+    constexpr int ClearCode = FirstCode;
+
+    // The encoder re-checks the compression ratio after this many more input bytes.
+    constexpr int RatioCheckGap = 10000;
+
+    // Streams using other settings than MaxDictBits/ResetPolicy::WhenFull start with
+    // a 9-bit header word. Headerless streams start with a byte code (< 256) instead,
+    // so the decoder tells them apart by the top bit:
+    //
+    // +-----------------+-------------+------------+----------------+
+    // | HeaderFlag (b8) | reserved    | policy (b3)| max bits - 9   |
+    // +-----------------+-------------+------------+----------------+
+    //
+    constexpr int HeaderFlag = 0x100;
+
     class Dictionary final {
     public:
         struct Entry {
@@ -167,34 +278,193 @@ namespace lzw {
             int value;
         };
 
+        // No copy/assignment.
+        Dictionary(const Dictionary &) = delete;
+
+        Dictionary &operator=(const Dictionary &) = delete;
+
         // Dictionary entries 0-255 are always reserved to the byte/ASCII range.
         int size;
-        Entry entries[MaxDictEntries];
+        int maxEntries;         // 1 << maxDictBits.
+        int maxDictBits;        // Code width at which the dictionary is full.
+        int firstCode;          // First sequence entry; FirstCode or FirstCode + 1 if ClearCode is reserved.
+        ResetPolicy resetPolicy;
+        const Allocator *allocator;
+
+        // Sized to match maxDictBits, so narrow dictionaries stay small.
+        Entry *entries;
+
+        // Open-addressing hash table over the sequence entries (firstCode and up),
+        // keyed on (code, value). Each slot holds an index into entries[], or zero
+        // for an empty slot, since index zero is never a sequence. The decoder never
+        // calls findIndex(), so it can skip the table and its upkeep (null then).
+        std::uint16_t *hashTable;
+        int hashTableSize;
+
+        explicit Dictionary(int maxDictBits = MaxDictBits, ResetPolicy resetPolicy = ResetPolicy::WhenFull,
+                            bool withHashTable = true, const Allocator &allocator = defaultAllocator());
 
-        Dictionary();
+        ~Dictionary();
+
+        // Changes the settings and starts over with an empty dictionary.
+        // Used when they are only known after reading a stream header.
+        void configure(int maxDictBits, ResetPolicy resetPolicy);
 
         int findIndex(int code, int value) const;
 
         bool add(int code, int value);
 
         bool flush(int &codeBitsWidth);
+
+        bool isFull() const { return size == maxEntries; }
+
+        void clear(int &codeBitsWidth);
+
+    private:
+        int hashSlot(int code, int value) const;
+
+        void clearHashTable();
     };
 
     // ========================================================
     // easyEncode() / easyDecode():
     // ========================================================
 
-    // Quick LZW data compression. Output compressed data is heap allocated
-    // with LZW_MALLOC() and should be later freed with LZW_MFREE().
+    // Quick LZW data compression. Output compressed data is heap allocated from
+    // the given allocator, like the dictionary, and should be later freed with
+    // its deallocate(), which for the default allocator is LZW_MFREE().
+    // Codes grow up to maxDictBits (9 to MaxDictBitsLimit). The default settings
+    // produce a headerless stream, any other pick adds a 9-bit header word.
     void easyEncode(const std::uint8_t *uncompressed, int uncompressedSizeBytes,
-                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits);
+                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits,
+                    int maxDictBits = MaxDictBits, ResetPolicy resetPolicy = ResetPolicy::WhenFull,
+                    const Allocator &allocator = defaultAllocator());
+
+    // Same as above, but writes to a caller-provided buffer instead. The dictionary
+    // is the only allocation left. A buffer of maxCompressedSize() bytes always fits.
+    // Returns false if it didn't fit.
+    bool easyEncode(const std::uint8_t *uncompressed, int uncompressedSizeBytes,
+                    std::uint8_t *compressed, int compressedCapacityBytes,
+                    int *compressedSizeBytes, int *compressedSizeBits,
+                    int maxDictBits = MaxDictBits, ResetPolicy resetPolicy = ResetPolicy::WhenFull,
+                    const Allocator &allocator = defaultAllocator());
+
+    // Worst-case easyEncode() output size for any input of the given size.
+    int maxCompressedSize(int uncompressedSizeBytes, int maxDictBits = MaxDictBits);
 
     // Decompress back the output of easyEncode().
     // The uncompressed output buffer is assumed to be big enough to hold the uncompressed data,
     // if it happens to be smaller, the decoder will return a partial output and the return value
     // of this function will be less than uncompressedSizeBytes.
     int easyDecode(const std::uint8_t *compressed, int compressedSizeBytes, int compressedSizeBits,
-                   std::uint8_t *uncompressed, int uncompressedSizeBytes);
+                   std::uint8_t *uncompressed, int uncompressedSizeBytes,
+                   const Allocator &allocator = defaultAllocator());
+
+    // What went wrong decoding a stream, for safeDecode().
+    enum class DecodeStatus : std::uint8_t {
+        Ok,            // The whole stream decoded fine.
+        BadArguments,  // Null pointers or sizes out of range.
+        BadHeader,     // Unknown flags in the stream header word.
+        CorruptData,   // Invalid code, or a stream ending in the middle of one.
+        OutputTooSmall // The data didn't fit in the output buffer.
+    };
+
+    // Same as easyDecode(), but for untrusted input: LZW_ERROR() is never called,
+    // whatever the stream holds. Problems are returned instead, and *bytesDecoded
+    // gets the bytes written to uncompressed either way.
+    DecodeStatus safeDecode(const std::uint8_t *compressed, int compressedSizeBytes, int compressedSizeBits,
+                            std::uint8_t *uncompressed, int uncompressedSizeBytes, int *bytesDecoded,
+                            const Allocator &allocator = defaultAllocator());
+
+    // ========================================================
+    // Streaming API:
+    // ========================================================
+
+    // For inputs too big to hold in memory at once. Set nextIn/availIn and
+    // nextOut/availOut, then call encode()/decode() until the input is used up,
+    // refilling the buffers in between, same as zlib's z_stream. The calls
+    // advance the pointers and counters by however much they consumed/produced.
+    // The encoded bytes are the same as easyEncode() gives for the whole data.
+    struct StreamBuffers {
+        const std::uint8_t *nextIn = nullptr; // Next input byte.
+        std::size_t availIn = 0;              // Number of bytes available at nextIn.
+        std::uint64_t totalIn = 0;            // Total input bytes consumed so far.
+
+        std::uint8_t *nextOut = nullptr;      // Next output byte goes here.
+        std::size_t availOut = 0;             // Remaining free space at nextOut.
+        std::uint64_t totalOut = 0;           // Total output bytes produced so far.
+    };
+
+    enum class StreamStatus : std::uint8_t {
+        Ok,        // Progress made, or needs more input/output space to make any.
+        StreamEnd, // Finished; all the output has been written out.
+        Error      // Malformed input. The stream can't continue.
+    };
+
+    class StreamEncoder final : public StreamBuffers {
+    public:
+        // No copy/assignment.
+        StreamEncoder(const StreamEncoder &) = delete;
+
+        StreamEncoder &operator=(const StreamEncoder &) = delete;
+
+        explicit StreamEncoder(int maxDictBits = MaxDictBits, ResetPolicy resetPolicy = ResetPolicy::WhenFull,
+                               const Allocator &allocator = defaultAllocator());
+
+        // Pass finish = true once the last of the input has been supplied.
+        // Keep calling with more output space until it returns StreamEnd.
+        StreamStatus encode(bool finish);
+
+        // Bits written so far, not counting the final byte padding.
+        // Same as the compressedSizeBits easyEncode() returns.
+        std::uint64_t getBitCount() const { return bitsWritten; }
+
+    private:
+        void putBits(int num, int bitCount);
+
+        void flushBits();
+
+        Dictionary dictionary;
+        std::uint64_t bitBuffer;      // Bits not written out yet, LSB first.
+        int bitBufferCount;           // Number of bits in bitBuffer.
+        std::uint64_t bitsWritten;    // Total bits, including the ones still in bitBuffer.
+        std::uint64_t nextRatioCheck; // ResetPolicy::OnRatioDrop tracking, see easyEncode().
+        std::uint64_t bestRatio;
+        int code;
+        int codeBitsWidth;
+        bool finished; // Residual code and padding are in bitBuffer.
+    };
+
+    class StreamDecoder final : public StreamBuffers {
+    public:
+        // No copy/assignment.
+        StreamDecoder(const StreamDecoder &) = delete;
+
+        StreamDecoder &operator=(const StreamDecoder &) = delete;
+
+        // The settings are read from the stream itself.
+        explicit StreamDecoder(const Allocator &allocator = defaultAllocator());
+
+        ~StreamDecoder();
+
+        // Pass finish = true once the last of the input has been supplied.
+        // A decoded sequence is written out as output space allows, across calls.
+        StreamStatus decode(bool finish);
+
+    private:
+        bool fillBits(int bitCount);
+
+        Dictionary dictionary;
+        std::uint8_t *sequence; // Scratch for one sequence, filled back to front. Null until the header is read.
+        int sequencePos;        // Start of the bytes in sequence[] still to be output.
+        int sequenceEnd;        // End of sequence[], dictionary.maxEntries.
+        std::uint64_t bitBuffer;
+        int bitBufferCount;
+        int prevCode;
+        int prevFirstByte;
+        int codeBitsWidth;
+        bool failed;
+    };
 
 } // namespace lzw {}
 
@@ -217,9 +487,61 @@ namespace lzw {
 #include <cassert>
 #include <cstring>
 
+#ifdef LZW_STATS
+#include <chrono>
+#endif // LZW_STATS
+
 namespace lzw
 {
 
+    // ========================================================
+    // Stats:
+    // ========================================================
+
+#ifdef LZW_STATS
+
+    static thread_local Stats threadStats;
+
+    const Stats &stats()
+    {
+        return threadStats;
+    }
+
+    void resetStats()
+    {
+        threadStats = Stats();
+    }
+
+    // Adds the time until the end of its scope to a Stats field.
+    class StatTimer final
+    {
+    public:
+        explicit StatTimer(std::uint64_t &totalNanos)
+            : totalNanos(totalNanos), start(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~StatTimer()
+        {
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            totalNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        }
+
+    private:
+        std::uint64_t &totalNanos;
+        std::chrono::steady_clock::time_point start;
+    };
+
+#define LZW_STAT_ADD(field, amount) (threadStats.field += static_cast<std::uint64_t>(amount))
+#define LZW_STAT_TIMER(field) StatTimer field##Timer(threadStats.field)
+
+#else // !LZW_STATS
+
+#define LZW_STAT_ADD(field, amount) ((void)0)
+#define LZW_STAT_TIMER(field) ((void)0)
+
+#endif // LZW_STATS
+
     // ========================================================
 
     // Round up to the next power-of-two number, e.g. 37 => 64
@@ -235,6 +557,38 @@ namespace lzw
 
     // ========================================================
 
+    // Unaligned little-endian 64-bit memory access. The bit streams are
+    // LSB first, so on little-endian machines a word is just a memcpy.
+    static std::uint64_t loadU64(const std::uint8_t *ptr)
+    {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        std::uint64_t word = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            word |= std::uint64_t(ptr[i]) << (i * 8);
+        }
+        return word;
+#else
+        std::uint64_t word;
+        std::memcpy(&word, ptr, sizeof(word));
+        return word;
+#endif
+    }
+
+    static void storeU64(std::uint8_t *ptr, const std::uint64_t word)
+    {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        for (int i = 0; i < 8; ++i)
+        {
+            ptr[i] = static_cast<std::uint8_t>(word >> (i * 8));
+        }
+#else
+        std::memcpy(ptr, &word, sizeof(word));
+#endif
+    }
+
+    // ========================================================
+
 #ifdef LZW_USING_DEFAULT_ERROR_HANDLER
 
     // Prints a fatal error to stderr and aborts the process.
@@ -249,11 +603,32 @@ namespace lzw
 
 #endif // LZW_USING_DEFAULT_ERROR_HANDLER
 
+    // ========================================================
+    // Default allocator:
+    // ========================================================
+
+    static void *defaultAllocate(void *, const std::size_t sizeBytes)
+    {
+        return LZW_MALLOC(sizeBytes);
+    }
+
+    static void defaultDeallocate(void *, void *ptr)
+    {
+        LZW_MFREE(ptr);
+    }
+
+    const Allocator &defaultAllocator()
+    {
+        static const Allocator allocator = {&defaultAllocate, &defaultDeallocate, nullptr};
+        return allocator;
+    }
+
     // ========================================================
     // class BitStreamWriter:
     // ========================================================
 
     BitStreamWriter::BitStreamWriter()
+        : allocator(&defaultAllocator())
     {
         // 8192 bits for a start (1024 bytes). It will resize if needed.
         // Default granularity is 2.
@@ -262,23 +637,44 @@ namespace lzw
     }
 
     BitStreamWriter::BitStreamWriter(const int initialSizeInBits, const int growthGranularity)
+        : allocator(&defaultAllocator())
+    {
+        internalInit();
+        setGranularity(growthGranularity);
+        allocate(initialSizeInBits);
+    }
+
+    BitStreamWriter::BitStreamWriter(const Allocator &allocator, const int initialSizeInBits, const int growthGranularity)
+        : allocator(&allocator)
     {
         internalInit();
         setGranularity(growthGranularity);
         allocate(initialSizeInBits);
     }
 
+    BitStreamWriter::BitStreamWriter(std::uint8_t *buffer, const int bufferSizeBytes)
+        : allocator(&defaultAllocator())
+    {
+        internalInit();
+        stream = buffer;
+        bytesAllocated = (bufferSizeBytes > 0) ? bufferSizeBytes : 0;
+        external = true;
+    }
+
     BitStreamWriter::~BitStreamWriter()
     {
-        if (stream != nullptr)
+        if (stream != nullptr && !external)
         {
-            LZW_MFREE(stream);
+            allocator->deallocate(allocator->context, stream);
         }
     }
 
     void BitStreamWriter::internalInit()
     {
         stream = nullptr;
+        bitBuffer = 0;
+        external = false;
+        overflowed = false;
         bytesAllocated = 0;
         granularity = 2;
         currBytePos = 0;
@@ -300,9 +696,9 @@ namespace lzw
             bitsWanted = nextPowerOfTwo(bitsWanted);
         }
 
-        // We might already have the required count.
+        // We might already have the required count. External buffers never grow.
         const int sizeInBytes = bitsWanted / 8;
-        if (sizeInBytes <= bytesAllocated)
+        if (sizeInBytes <= bytesAllocated || external)
         {
             return;
         }
@@ -311,31 +707,76 @@ namespace lzw
         bytesAllocated = sizeInBytes;
     }
 
-    void BitStreamWriter::appendBit(const int bit)
+    bool BitStreamWriter::reserveWord()
     {
-        const std::uint32_t mask = std::uint32_t(1) << nextBitPos;
-        stream[currBytePos] = (stream[currBytePos] & ~mask) | (-bit & mask);
-        ++numBitsWritten;
-
-        if (++nextBitPos == 8)
+        // Every write stores a whole 64-bit word at currBytePos,
+        // so keep at least 8 bytes of room past it.
+        if (currBytePos + 8 > bytesAllocated)
         {
-            nextBitPos = 0;
-            if (++currBytePos == bytesAllocated)
+            if (external)
+            {
+                return false;
+            }
+            int bytesWanted = bytesAllocated * granularity;
+            if (bytesWanted < currBytePos + 8)
             {
-                allocate(bytesAllocated * granularity * 8);
+                bytesWanted = currBytePos + 8;
             }
+            allocate(bytesWanted * 8);
         }
+        return true;
     }
 
-    void BitStreamWriter::appendBitsU64(const std::uint64_t num, const int bitCount)
+    void BitStreamWriter::appendBit(const int bit)
+    {
+        appendBitsU64(static_cast<std::uint64_t>(bit & 1), 1);
+    }
+
+    void BitStreamWriter::appendBitsU64(std::uint64_t num, int bitCount)
     {
         assert(bitCount <= 64);
-        for (int b = 0; b < bitCount; ++b)
+
+        // A single word holds up to 7 bits of the current byte plus 56 new ones.
+        if (bitCount > 56)
+        {
+            appendBitsU64(num, 32);
+            num >>= 32;
+            bitCount -= 32;
+        }
+        if (bitCount <= 0)
+        {
+            return;
+        }
+
+        num &= (std::uint64_t(1) << bitCount) - 1;
+        if (reserveWord())
+        {
+            bitBuffer |= num << nextBitPos;
+            storeU64(stream + currBytePos, bitBuffer);
+        }
+        else
         {
-            const std::uint64_t mask = std::uint64_t(1) << b;
-            const int bit = !!(num & mask);
-            appendBit(bit);
+            // Near the end of an external buffer; store only the bytes touched.
+            const int bytesTouched = (nextBitPos + bitCount + 7) / 8;
+            if (overflowed || currBytePos + bytesTouched > bytesAllocated)
+            {
+                overflowed = true;
+                return;
+            }
+            bitBuffer |= num << nextBitPos;
+            for (int i = 0; i < bytesTouched; ++i)
+            {
+                stream[currBytePos + i] = static_cast<std::uint8_t>(bitBuffer >> (i * 8));
+            }
         }
+
+        // Move past the completed bytes:
+        nextBitPos += bitCount;
+        numBitsWritten += bitCount;
+        const int bytesDone = nextBitPos / 8;
+        currBytePos += bytesDone;
+        nextBitPos %= 8;
+        bitBuffer >>= (bytesDone * 8);
     }
 
 #ifndef LZW_NO_STD_STRING
@@ -409,15 +850,19 @@ namespace lzw
         return stream;
     }
 
-    std::uint8_t *BitStreamWriter::allocBytes(const int bytesWanted, std::uint8_t *oldPtr, const int oldSize)
+    std::uint8_t *BitStreamWriter::allocBytes(const int bytesWanted, std::uint8_t *oldPtr, const int oldSize) const
     {
-        std::uint8_t *newMemory = static_cast<std::uint8_t *>(LZW_MALLOC(bytesWanted));
+        LZW_STAT_ADD(bufferAllocations, 1);
+        LZW_STAT_ADD(bufferGrowths, oldPtr != nullptr);
+        LZW_STAT_ADD(bufferBytesAllocated, bytesWanted);
+
+        std::uint8_t *newMemory = static_cast<std::uint8_t *>(allocator->allocate(allocator->context, bytesWanted));
         std::memset(newMemory, 0, bytesWanted);
 
         if (oldPtr != nullptr)
         {
             std::memcpy(newMemory, oldPtr, oldSize);
-            LZW_MFREE(oldPtr);
+            allocator->deallocate(allocator->context, oldPtr);
         }
 
         return newMemory;
@@ -458,29 +903,53 @@ namespace lzw
         return true;
     }
 
-    std::uint64_t BitStreamReader::readBitsU64(const int bitCount)
+    std::uint64_t BitStreamReader::readBitsU64(int bitCount)
     {
         assert(bitCount <= 64);
 
-        std::uint64_t num = 0;
-        for (int b = 0; b < bitCount; ++b)
+        const int bitsLeft = sizeInBits - numBitsRead;
+        if (bitCount > bitsLeft)
         {
-            int bit;
-            if (!readNextBit(bit))
-            {
-                LZW_ERROR("Failed to read bits from stream! Unexpected end.");
-                break;
-            }
+            LZW_ERROR("Failed to read bits from stream! Unexpected end.");
+            bitCount = bitsLeft;
+        }
+        if (bitCount <= 0)
+        {
+            return 0;
+        }
 
-            // Based on a "Stanford bit-hack":
-            // http://graphics.stanford.edu/~seander/bithacks.html#ConditionalSetOrClearBitsWithoutBranching
-            const std::uint64_t mask = std::uint64_t(1) << b;
-            num = (num & ~mask) | (-bit & mask);
+        // A window covers 57 bits past the current bit position.
+        if (bitCount > 56)
+        {
+            const std::uint64_t low = readBitsU64(32);
+            return low | (readBitsU64(bitCount - 32) << 32);
         }
 
+        const std::uint64_t num = (loadWindow() >> nextBitPos) & ((std::uint64_t(1) << bitCount) - 1);
+        numBitsRead += bitCount;
+        nextBitPos += bitCount;
+        currBytePos += nextBitPos / 8;
+        nextBitPos %= 8;
         return num;
     }
 
+    std::uint64_t BitStreamReader::loadWindow() const
+    {
+        // Next 8 bytes starting at the current byte. Near the
+        // end gather what's left, with zeros for the rest.
+        if (currBytePos + 8 <= sizeInBytes)
+        {
+            return loadU64(stream + currBytePos);
+        }
+
+        std::uint64_t window = 0;
+        for (int i = 0; currBytePos + i < sizeInBytes; ++i)
+        {
+            window |= std::uint64_t(stream[currBytePos + i]) << (i * 8);
+        }
+        return window;
+    }
+
     void BitStreamReader::reset()
     {
         currBytePos = 0;
@@ -497,16 +966,89 @@ namespace lzw
     // class Dictionary:
     // ========================================================
 
-    Dictionary::Dictionary()
+    Dictionary::Dictionary(const int maxDictBits, const ResetPolicy resetPolicy, const bool withHashTable,
+                           const Allocator &allocator)
+        : size(0), maxEntries(0), maxDictBits(0), firstCode(FirstCode), resetPolicy(resetPolicy),
+          allocator(&allocator), entries(nullptr), hashTable(nullptr), hashTableSize(withHashTable ? 1 : 0)
+    {
+        configure(maxDictBits, resetPolicy);
+    }
+
+    Dictionary::~Dictionary()
+    {
+        allocator->deallocate(allocator->context, entries);
+        if (hashTable != nullptr)
+        {
+            allocator->deallocate(allocator->context, hashTable);
+        }
+    }
+
+    void Dictionary::configure(const int newMaxDictBits, const ResetPolicy newResetPolicy)
     {
-        // First 256 dictionary entries are reserved to the byte/ASCII
-        // range. Additional entries follow for the character sequences
-        // found in the input. Up to 4096 - 256 (MaxDictEntries - FirstCode).
-        size = FirstCode;
-        for (int i = 0; i < size; ++i)
+        assert(newMaxDictBits >= StartBits && newMaxDictBits <= MaxDictBitsLimit);
+
+        // Reallocate only if the width changes.
+        if (newMaxDictBits != maxDictBits)
+        {
+            if (entries != nullptr)
+            {
+                allocator->deallocate(allocator->context, entries);
+            }
+            maxDictBits = newMaxDictBits;
+            maxEntries = 1 << maxDictBits;
+
+            // First 256 dictionary entries are reserved to the byte/ASCII
+            // range. Additional entries follow for the character sequences
+            // found in the input. Up to maxEntries - firstCode of them.
+            entries = static_cast<Entry *>(allocator->allocate(allocator->context, maxEntries * sizeof(Entry)));
+            for (int i = 0; i < FirstCode; ++i)
+            {
+                entries[i].code = Nil;
+                entries[i].value = i;
+            }
+
+            if (hashTableSize != 0)
+            {
+                if (hashTable != nullptr)
+                {
+                    allocator->deallocate(allocator->context, hashTable);
+                }
+                hashTableSize = maxEntries * 2;
+                hashTable = static_cast<std::uint16_t *>(
+                    allocator->allocate(allocator->context, hashTableSize * sizeof(std::uint16_t)));
+            }
+        }
+
+        // ClearCode is not a sequence, but keep the entry sane.
+        resetPolicy = newResetPolicy;
+        if (resetPolicy == ResetPolicy::OnRatioDrop)
         {
-            entries[i].code = Nil;
-            entries[i].value = i;
+            entries[ClearCode].code = Nil;
+            entries[ClearCode].value = 0;
+            firstCode = FirstCode + 1;
+        }
+        else
+        {
+            firstCode = FirstCode;
+        }
+
+        // Not counted as a reset, unlike clear().
+        size = firstCode;
+        clearHashTable();
+    }
+
+    int Dictionary::hashSlot(const int code, const int value) const
+    {
+        // Fibonacci hashing of the (code, value) pair.
+        const std::uint32_t key = (static_cast<std::uint32_t>(code) << 8) | static_cast<std::uint32_t>(value);
+        return static_cast<int>((key * 2654435761u) >> 12) & (hashTableSize - 1);
+    }
+
+    void Dictionary::clearHashTable()
+    {
+        if (hashTable != nullptr)
+        {
+            std::memset(hashTable, 0, hashTableSize * sizeof(std::uint16_t));
         }
     }
 
@@ -516,28 +1058,43 @@ namespace lzw
         {
             return value;
         }
+        assert(hashTable != nullptr);
+        LZW_STAT_ADD(lookups, 1);
 
-        // Linear search for now.
-        // TODO: Worth optimizing with a proper hash-table?
-        for (int i = 0; i < size; ++i)
+        // Linear probing. The table is never more than half full, so chains stay short.
+        for (int slot = hashSlot(code, value);; slot = (slot + 1) & (hashTableSize - 1))
         {
-            if (entries[i].code == code && entries[i].value == value)
+            LZW_STAT_ADD(hashProbes, 1);
+            const int index = hashTable[slot];
+            if (index == 0)
+            {
+                return Nil;
+            }
+            if (entries[index].code == code && entries[index].value == value)
             {
-                return i;
+                return index;
             }
         }
-
-        return Nil;
     }
 
     bool Dictionary::add(const int code, const int value)
     {
-        if (size == MaxDictEntries)
+        if (size == maxEntries)
         {
             LZW_ERROR("Dictionary overflowed!");
             return false;
         }
 
+        if (hashTable != nullptr)
+        {
+            int slot = hashSlot(code, value);
+            while (hashTable[slot] != 0)
+            {
+                slot = (slot + 1) & (hashTableSize - 1);
+            }
+            hashTable[slot] = static_cast<std::uint16_t>(size);
+        }
+
         entries[size].code = code;
         entries[size].value = value;
         ++size;
@@ -548,45 +1105,58 @@ namespace lzw
     {
         if (size == (1 << codeBitsWidth))
         {
-            ++codeBitsWidth;
-            if (codeBitsWidth > MaxDictBits)
+            if (codeBitsWidth < maxDictBits)
+            {
+                ++codeBitsWidth;
+            }
+            else if (resetPolicy == ResetPolicy::WhenFull)
             {
                 // Clear the dictionary (except the first 256 byte entries).
-                codeBitsWidth = StartBits;
-                size = FirstCode;
+                clear(codeBitsWidth);
                 return true;
             }
+            // Else we keep going with a full dictionary until the encoder sends a ClearCode.
         }
         return false;
     }
 
+    void Dictionary::clear(int &codeBitsWidth)
+    {
+        LZW_STAT_ADD(dictionaryResets, 1);
+        codeBitsWidth = StartBits;
+        size = firstCode;
+        clearHashTable();
+    }
+
     // ========================================================
     // easyEncode() implementation:
     // ========================================================
 
-    void easyEncode(const std::uint8_t *uncompressed, int uncompressedSizeBytes,
-                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits)
+    // Codes the input to the bit stream. Both easyEncode() overloads do the same.
+    static void encodeCodes(const std::uint8_t *uncompressed, int uncompressedSizeBytes,
+                            const int maxDictBits, const ResetPolicy resetPolicy,
+                            Dictionary &dictionary, BitStreamWriter &bitStream)
     {
-        if (uncompressed == nullptr || compressed == nullptr)
-        {
-            LZW_ERROR("lzw::easyEncode(): Null data pointer(s)!");
-            return;
-        }
-
-        if (uncompressedSizeBytes <= 0 || compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
-        {
-            LZW_ERROR("lzw::easyEncode(): Bad in/out sizes!");
-            return;
-        }
+        LZW_STAT_TIMER(encodeNanos);
+        LZW_STAT_ADD(encodeCalls, 1);
+        LZW_STAT_ADD(encodedBytesIn, uncompressedSizeBytes);
 
         // LZW encoding context:
         int code = Nil;
         int codeBitsWidth = StartBits;
-        Dictionary dictionary;
 
-        // Output bit stream we write to. This will allocate
-        // memory as needed to accommodate the encoded data.
-        BitStreamWriter bitStream;
+        // Only non-default settings need to be spelled out.
+        if (maxDictBits != MaxDictBits || resetPolicy != ResetPolicy::WhenFull)
+        {
+            const int policyBit = (resetPolicy == ResetPolicy::OnRatioDrop) ? (1 << 3) : 0;
+            bitStream.appendBitsU64(HeaderFlag | policyBit | (maxDictBits - StartBits), StartBits);
+        }
+
+        // Compression ratio tracking for ResetPolicy::OnRatioDrop.
+        // Running totals since the start, same as compress(1).
+        const int bytesTotal = uncompressedSizeBytes;
+        std::uint64_t nextRatioCheck = RatioCheckGap;
+        std::uint64_t bestRatio = 0;
 
         for (; uncompressedSizeBytes > 0; --uncompressedSizeBytes, ++uncompressed)
         {
@@ -605,8 +1175,35 @@ namespace lzw
             // Flush it when full so we can restart the sequences.
             if (!dictionary.flush(codeBitsWidth))
             {
-                // There's still space for this sequence.
-                dictionary.add(code, value);
+                if (!dictionary.isFull())
+                {
+                    // There's still space for this sequence.
+                    dictionary.add(code, value);
+                }
+                else
+                {
+                    // Full dictionary under ResetPolicy::OnRatioDrop. Every so often see if the
+                    // ratio (input bytes per output bit, 16.16 fixed point) is still holding up.
+                    const std::uint64_t bytesIn = bytesTotal - uncompressedSizeBytes;
+                    if (bytesIn >= nextRatioCheck)
+                    {
+                        const std::uint64_t bitsOut = bitStream.getBitCount();
+                        const std::uint64_t ratio = (bytesIn << 16) / bitsOut;
+                        nextRatioCheck = bytesIn + RatioCheckGap;
+
+                        if (ratio > bestRatio)
+                        {
+                            bestRatio = ratio;
+                        }
+                        else
+                        {
+                            bitStream.appendBitsU64(ClearCode, codeBitsWidth);
+                            dictionary.clear(codeBitsWidth);
+                            LZW_STAT_ADD(clearCodes, 1);
+                            bestRatio = 0;
+                        }
+                    }
+                }
             }
             code = value;
         }
@@ -617,139 +1214,639 @@ namespace lzw
             bitStream.appendBitsU64(code, codeBitsWidth);
         }
 
+        LZW_STAT_ADD(encodedBytesOut, bitStream.getByteCount());
+    }
+
+    void easyEncode(const std::uint8_t *uncompressed, const int uncompressedSizeBytes,
+                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits,
+                    const int maxDictBits, const ResetPolicy resetPolicy, const Allocator &allocator)
+    {
+        if (uncompressed == nullptr || compressed == nullptr)
+        {
+            LZW_ERROR("lzw::easyEncode(): Null data pointer(s)!");
+            return;
+        }
+
+        if (uncompressedSizeBytes <= 0 || compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
+        {
+            LZW_ERROR("lzw::easyEncode(): Bad in/out sizes!");
+            return;
+        }
+
+        if (maxDictBits < StartBits || maxDictBits > MaxDictBitsLimit)
+        {
+            LZW_ERROR("lzw::easyEncode(): Max dictionary bits must be between 9 and 16!");
+            return;
+        }
+
+        Dictionary dictionary(maxDictBits, resetPolicy, /* withHashTable = */ true, allocator);
+
+        // Output bit stream we write to. This will allocate
+        // memory as needed to accommodate the encoded data.
+        BitStreamWriter bitStream(allocator);
+
+        encodeCodes(uncompressed, uncompressedSizeBytes, maxDictBits, resetPolicy, dictionary, bitStream);
+
         // Pass ownership of the compressed data buffer to the user pointer:
         *compressedSizeBytes = bitStream.getByteCount();
         *compressedSizeBits = bitStream.getBitCount();
         *compressed = bitStream.release();
     }
 
-    // ========================================================
-    // easyDecode() and helpers:
-    // ========================================================
-
-    static bool outputByte(int code, std::uint8_t *&output, int outputSizeBytes, int &bytesDecodedSoFar)
+    bool easyEncode(const std::uint8_t *uncompressed, const int uncompressedSizeBytes,
+                    std::uint8_t *compressed, const int compressedCapacityBytes,
+                    int *compressedSizeBytes, int *compressedSizeBits,
+                    const int maxDictBits, const ResetPolicy resetPolicy, const Allocator &allocator)
     {
-        if (bytesDecodedSoFar >= outputSizeBytes)
+        if (uncompressed == nullptr || compressed == nullptr)
+        {
+            LZW_ERROR("lzw::easyEncode(): Null data pointer(s)!");
+            return false;
+        }
+
+        if (uncompressedSizeBytes <= 0 || compressedCapacityBytes <= 0 ||
+            compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
+        {
+            LZW_ERROR("lzw::easyEncode(): Bad in/out sizes!");
+            return false;
+        }
+
+        if (maxDictBits < StartBits || maxDictBits > MaxDictBitsLimit)
+        {
+            LZW_ERROR("lzw::easyEncode(): Max dictionary bits must be between 9 and 16!");
+            return false;
+        }
+
+        Dictionary dictionary(maxDictBits, resetPolicy, /* withHashTable = */ true, allocator);
+        BitStreamWriter bitStream(compressed, compressedCapacityBytes);
+
+        encodeCodes(uncompressed, uncompressedSizeBytes, maxDictBits, resetPolicy, dictionary, bitStream);
+        if (bitStream.isOverflowed())
         {
-            LZW_ERROR("Decoder output buffer too small!");
             return false;
         }
 
-        assert(code >= 0 && code < 256);
-        *output++ = static_cast<std::uint8_t>(code);
-        ++bytesDecodedSoFar;
+        *compressedSizeBytes = bitStream.getByteCount();
+        *compressedSizeBits = bitStream.getBitCount();
         return true;
     }
 
-    static bool outputSequence(const Dictionary &dict, int code,
-                               std::uint8_t *&output, int outputSizeBytes,
-                               int &bytesDecodedSoFar, int &firstByte)
+    int maxCompressedSize(const int uncompressedSizeBytes, const int maxDictBits)
     {
-        // A sequence is stored backwards, so we have to write
-        // it to a temp then output the buffer in reverse.
-        int i = 0;
-        std::uint8_t sequence[MaxDictEntries];
-        do
+        // At most one code per input byte plus the residual one, and under
+        // ResetPolicy::OnRatioDrop a ClearCode per ratio check, all of them
+        // maxDictBits wide in the worst case. Then the optional header word.
+        const std::uint64_t n = (uncompressedSizeBytes > 0) ? uncompressedSizeBytes : 0;
+        const std::uint64_t codes = n + 1 + n / RatioCheckGap;
+        const int width = (maxDictBits > MaxDictBitsLimit) ? MaxDictBitsLimit : maxDictBits;
+        return static_cast<int>((StartBits + codes * width + 7) / 8);
+    }
+
+    // ========================================================
+    // easyDecode() and helpers:
+    // ========================================================
+
+    // Where the decoder last wrote each dictionary sequence. Every sequence is
+    // written out whole when its code is decoded, so repeating it later is a
+    // single memcpy from that earlier copy in the output buffer instead of a
+    // walk up the prefix chain. The first byte is output[offset].
+    struct SequenceRef {
+        int offset;
+        int length;
+    };
+
+    // Records the first decoding problem in status, and reports it with
+    // LZW_ERROR() too, unless decoding quietly for safeDecode().
+    static void decodeError(DecodeStatus &status, const bool reportErrors, const DecodeStatus problem, const char *const message)
+    {
+        if (status == DecodeStatus::Ok)
         {
-            assert(i < MaxDictEntries - 1 && code >= 0);
-            sequence[i++] = dict.entries[code].value;
-            code = dict.entries[code].code;
-        } while (code >= 0);
+            status = problem;
+        }
+        if (reportErrors)
+        {
+            LZW_ERROR(message);
+        }
+    }
 
-        firstByte = sequence[--i];
-        for (; i >= 0; --i)
+    // Appends the sequence for code to the output, followed by its first byte once
+    // more if repeatFirstByte is set (the code not in the dictionary yet case).
+    static bool outputSequence(const SequenceRef *sequences, const int code, const bool repeatFirstByte,
+                               std::uint8_t *output, const int outputSizeBytes, int &bytesDecodedSoFar,
+                               DecodeStatus &status, const bool reportErrors)
+    {
+        std::uint8_t *dest = output + bytesDecodedSoFar;
+        const int length = sequences[code].length;
+        const int totalLength = length + (repeatFirstByte ? 1 : 0);
+        const int bytesLeft = outputSizeBytes - bytesDecodedSoFar;
+
+        if (totalLength > bytesLeft)
         {
-            if (!outputByte(sequence[i], output, outputSizeBytes, bytesDecodedSoFar))
+            // Output whatever still fits, so the caller gets
+            // the longest partial output, then give up.
+            if (bytesLeft > 0)
             {
-                return false;
+                std::memmove(dest, output + sequences[code].offset, (length < bytesLeft) ? length : bytesLeft);
             }
+            bytesDecodedSoFar = outputSizeBytes;
+            decodeError(status, reportErrors, DecodeStatus::OutputTooSmall, "Decoder output buffer too small!");
+            return false;
         }
+
+        if (code < FirstCode)
+        {
+            dest[0] = static_cast<std::uint8_t>(code);
+        }
+        else
+        {
+            // Copy never overlaps, the source was written before bytesDecodedSoFar.
+            std::memcpy(dest, output + sequences[code].offset, length);
+        }
+
+        if (repeatFirstByte)
+        {
+            dest[length] = dest[0];
+        }
+        bytesDecodedSoFar += totalLength;
         return true;
     }
 
-    int easyDecode(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
-                   std::uint8_t *uncompressed, const int uncompressedSizeBytes)
+    // The decoding loop proper, shared by easyDecode() and safeDecode().
+    // Pointers and sizes must have been checked already.
+    static int decodeCodes(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
+                           std::uint8_t *uncompressed, const int uncompressedSizeBytes, const Allocator &allocator,
+                           DecodeStatus &status, const bool reportErrors)
     {
-        if (compressed == nullptr || uncompressed == nullptr)
+        LZW_STAT_TIMER(decodeNanos);
+        LZW_STAT_ADD(decodeCalls, 1);
+        LZW_STAT_ADD(decodedBytesIn, compressedSizeBytes);
+
+        BitStreamReader bitStream(compressed, compressedSizeBytes, compressedSizeBits);
+        if (bitStream.getBitsLeft() < StartBits)
         {
-            LZW_ERROR("lzw::easyDecode(): Null data pointer(s)!");
+            decodeError(status, reportErrors, DecodeStatus::CorruptData, "Failed to read bits from stream! Unexpected end.");
             return 0;
         }
 
-        if (compressedSizeBytes <= 0 || compressedSizeBits <= 0 || uncompressedSizeBytes <= 0)
+        // Streams with non-default settings start with a header word.
+        // Anything else is a byte code, which we'll read again below.
+        int maxDictBits = MaxDictBits;
+        ResetPolicy resetPolicy = ResetPolicy::WhenFull;
+        const int headerWord = static_cast<int>(bitStream.readBitsU64(StartBits));
+        if (headerWord & HeaderFlag)
         {
-            LZW_ERROR("lzw::easyDecode(): Bad in/out sizes!");
-            return 0;
+            maxDictBits = StartBits + (headerWord & 7);
+            resetPolicy = (headerWord & (1 << 3)) ? ResetPolicy::OnRatioDrop : ResetPolicy::WhenFull;
+            if ((headerWord & 0xF0) != 0)
+            {
+                decodeError(status, reportErrors, DecodeStatus::BadHeader, "lzw::easyDecode(): Unknown stream header flags!");
+                return 0;
+            }
+        }
+        else
+        {
+            bitStream.reset();
         }
 
         int code = Nil;
         int prevCode = Nil;
-        int firstByte = 0;
+        int prevOffset = 0;
         int bytesDecoded = 0;
         int codeBitsWidth = StartBits;
 
         // We'll reconstruct the dictionary based on the
         // bit stream codes. Unlike Huffman encoding, we
         // don't store the dictionary as a prefix to the data.
-        Dictionary dictionary;
-        BitStreamReader bitStream(compressed, compressedSizeBytes, compressedSizeBits);
+        Dictionary dictionary(maxDictBits, resetPolicy, /* withHashTable = */ false, allocator);
+
+        // Output position and length of each sequence. Byte codes are a single byte
+        // and never copied from the output, so only their length needs to be set.
+        SequenceRef *sequences = static_cast<SequenceRef *>(
+            allocator.allocate(allocator.context, dictionary.maxEntries * sizeof(SequenceRef)));
+        for (int i = 0; i < FirstCode; ++i)
+        {
+            sequences[i].offset = 0;
+            sequences[i].length = 1;
+        }
+
+        // Codes come out of a window of up to 64 bits. It's refilled with a single
+        // bounds-checked read when the next code might not fit in what's left, so
+        // the stream end is checked once every few codes instead of on each one.
+        // Codes never exceed 16 bits, so 48 more bits always fit in the window.
+        std::uint64_t window = 0;
+        int windowBits = 0;
 
         // We check to avoid an overflow of the user buffer.
         // If the buffer is smaller than the decompressed size,
-        // LZW_ERROR() is called. If that doesn't throw or
-        // terminate we break the loop and return the current
-        // decompression count.
-        while (!bitStream.isEndOfStream())
+        // the error is reported and we break the loop and
+        // return the current decompression count.
+        for (;;)
         {
-            assert(codeBitsWidth <= MaxDictBits);
-            code = static_cast<int>(bitStream.readBitsU64(codeBitsWidth));
+            assert(codeBitsWidth <= maxDictBits);
+            if (windowBits < codeBitsWidth)
+            {
+                const int bitsLeft = bitStream.getBitsLeft();
+                const int refillBits = (bitsLeft < 48) ? bitsLeft : 48;
+                window |= bitStream.readBitsU64(refillBits) << windowBits;
+                windowBits += refillBits;
+                if (windowBits < codeBitsWidth)
+                {
+                    if (windowBits != 0)
+                    {
+                        decodeError(status, reportErrors, DecodeStatus::CorruptData,
+                                    "Failed to read bits from stream! Unexpected end.");
+                    }
+                    break;
+                }
+            }
+            code = static_cast<int>(window & ((std::uint64_t(1) << codeBitsWidth) - 1));
+            window >>= codeBitsWidth;
+            windowBits -= codeBitsWidth;
 
+            if (code == ClearCode && resetPolicy == ResetPolicy::OnRatioDrop)
+            {
+                dictionary.clear(codeBitsWidth);
+                prevCode = Nil;
+                continue;
+            }
+
+            // Anything past the next free code (or any sequence after a reset) is garbage.
+            if (code > dictionary.size || (prevCode == Nil && code >= FirstCode))
+            {
+                decodeError(status, reportErrors, DecodeStatus::CorruptData, "lzw::easyDecode(): Invalid code in bit stream!");
+                break;
+            }
+
+            const int offset = bytesDecoded;
             if (prevCode == Nil)
             {
-                if (!outputByte(code, uncompressed,
-                                uncompressedSizeBytes, bytesDecoded))
+                if (!outputSequence(sequences, code, false, uncompressed,
+                                    uncompressedSizeBytes, bytesDecoded, status, reportErrors))
                 {
                     break;
                 }
-                firstByte = code;
                 prevCode = code;
+                prevOffset = offset;
                 continue;
             }
 
-            if (code >= dictionary.size)
+            // A code not in the dictionary yet can only be the previous
+            // sequence plus its own first byte, which is what we add next.
+            const bool isNewCode = (code == dictionary.size);
+            if (!outputSequence(sequences, isNewCode ? prevCode : code, isNewCode, uncompressed,
+                                uncompressedSizeBytes, bytesDecoded, status, reportErrors))
+            {
+                break;
+            }
+
+            // The new entry is the previous sequence extended by the first byte
+            // we just wrote, so it sits right where the previous one started.
+            if (!dictionary.isFull())
+            {
+                sequences[dictionary.size].offset = prevOffset;
+                sequences[dictionary.size].length = sequences[prevCode].length + 1;
+                dictionary.add(prevCode, uncompressed[offset]);
+            }
+            if (dictionary.flush(codeBitsWidth))
             {
-                if (!outputSequence(dictionary, prevCode, uncompressed,
-                                    uncompressedSizeBytes, bytesDecoded, firstByte))
+                prevCode = Nil;
+            }
+            else
+            {
+                prevCode = code;
+                prevOffset = offset;
+            }
+        }
+
+        allocator.deallocate(allocator.context, sequences);
+        LZW_STAT_ADD(decodedBytesOut, bytesDecoded);
+        return bytesDecoded;
+    }
+
+    int easyDecode(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
+                   std::uint8_t *uncompressed, const int uncompressedSizeBytes, const Allocator &allocator)
+    {
+        if (compressed == nullptr || uncompressed == nullptr)
+        {
+            LZW_ERROR("lzw::easyDecode(): Null data pointer(s)!");
+            return 0;
+        }
+
+        if (compressedSizeBytes <= 0 || compressedSizeBits <= 0 || uncompressedSizeBytes <= 0)
+        {
+            LZW_ERROR("lzw::easyDecode(): Bad in/out sizes!");
+            return 0;
+        }
+
+        DecodeStatus status = DecodeStatus::Ok;
+        return decodeCodes(compressed, compressedSizeBytes, compressedSizeBits, uncompressed, uncompressedSizeBytes,
+                           allocator, status, true);
+    }
+
+    // ========================================================
+    // safeDecode() implementation:
+    // ========================================================
+
+    DecodeStatus safeDecode(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
+                            std::uint8_t *uncompressed, const int uncompressedSizeBytes, int *bytesDecoded,
+                            const Allocator &allocator)
+    {
+        if (bytesDecoded != nullptr)
+        {
+            *bytesDecoded = 0;
+        }
+
+        // Sizes in bits and bytes must agree, so the bit reader never goes past the buffer.
+        if (compressed == nullptr || uncompressed == nullptr || bytesDecoded == nullptr ||
+            compressedSizeBytes <= 0 || compressedSizeBits <= 0 || uncompressedSizeBytes <= 0 ||
+            (compressedSizeBits + 7) / 8 > compressedSizeBytes)
+        {
+            return DecodeStatus::BadArguments;
+        }
+
+        DecodeStatus status = DecodeStatus::Ok;
+        *bytesDecoded = decodeCodes(compressed, compressedSizeBytes, compressedSizeBits, uncompressed,
+                                    uncompressedSizeBytes, allocator, status, false);
+        return status;
+    }
+
+    // ========================================================
+    // class StreamEncoder:
+    // ========================================================
+
+    StreamEncoder::StreamEncoder(const int maxDictBits, const ResetPolicy resetPolicy, const Allocator &allocator)
+        : dictionary((maxDictBits >= StartBits && maxDictBits <= MaxDictBitsLimit) ? maxDictBits : MaxDictBits, resetPolicy,
+                     /* withHashTable = */ true, allocator),
+          bitBuffer(0), bitBufferCount(0), bitsWritten(0), nextRatioCheck(RatioCheckGap), bestRatio(0),
+          code(Nil), codeBitsWidth(StartBits), finished(false)
+    {
+        if (maxDictBits < StartBits || maxDictBits > MaxDictBitsLimit)
+        {
+            LZW_ERROR("lzw::StreamEncoder: Max dictionary bits must be between 9 and 16!");
+        }
+
+        // Same header as easyEncode().
+        if (dictionary.maxDictBits != MaxDictBits || resetPolicy != ResetPolicy::WhenFull)
+        {
+            const int policyBit = (resetPolicy == ResetPolicy::OnRatioDrop) ? (1 << 3) : 0;
+            putBits(HeaderFlag | policyBit | (dictionary.maxDictBits - StartBits), StartBits);
+        }
+    }
+
+    void StreamEncoder::putBits(const int num, const int bitCount)
+    {
+        assert(bitBufferCount + bitCount <= 64);
+        bitBuffer |= static_cast<std::uint64_t>(num) << bitBufferCount;
+        bitBufferCount += bitCount;
+        bitsWritten += bitCount;
+    }
+
+    void StreamEncoder::flushBits()
+    {
+        while (bitBufferCount >= 8 && availOut != 0)
+        {
+            *nextOut++ = static_cast<std::uint8_t>(bitBuffer);
+            --availOut;
+            ++totalOut;
+            LZW_STAT_ADD(encodedBytesOut, 1);
+            bitBuffer >>= 8;
+            bitBufferCount -= 8;
+        }
+    }
+
+    StreamStatus StreamEncoder::encode(const bool finish)
+    {
+        LZW_STAT_TIMER(encodeNanos);
+        LZW_STAT_ADD(encodeCalls, 1);
+
+        for (;;)
+        {
+            flushBits();
+            if (bitBufferCount >= 8)
+            {
+                return StreamStatus::Ok; // Output buffer full.
+            }
+
+            if (finished)
+            {
+                return StreamStatus::StreamEnd;
+            }
+
+            if (availIn == 0)
+            {
+                if (!finish)
                 {
-                    break;
+                    return StreamStatus::Ok; // Needs more input.
                 }
-                if (!outputByte(firstByte, uncompressed,
-                                uncompressedSizeBytes, bytesDecoded))
+
+                // Residual code at the end, then pad to a whole byte.
+                if (code != Nil)
                 {
-                    break;
+                    putBits(code, codeBitsWidth);
                 }
+                bitBufferCount = (bitBufferCount + 7) & ~7;
+                finished = true;
+                continue;
             }
-            else
+
+            // Each input byte adds at most a code and a ClearCode, 32 bits,
+            // so go on until the bit buffer is half full before flushing.
+            while (availIn != 0 && bitBufferCount < 32)
             {
-                if (!outputSequence(dictionary, code, uncompressed,
-                                    uncompressedSizeBytes, bytesDecoded, firstByte))
+                const int value = *nextIn;
+                const int index = dictionary.findIndex(code, value);
+
+                if (index == Nil)
                 {
-                    break;
+                    // Same as easyEncode(), see there.
+                    putBits(code, codeBitsWidth);
+
+                    if (!dictionary.flush(codeBitsWidth))
+                    {
+                        if (!dictionary.isFull())
+                        {
+                            dictionary.add(code, value);
+                        }
+                        else if (totalIn >= nextRatioCheck)
+                        {
+                            nextRatioCheck = totalIn + RatioCheckGap;
+                            const std::uint64_t ratio = (totalIn << 16) / bitsWritten;
+                            if (ratio > bestRatio)
+                            {
+                                bestRatio = ratio;
+                            }
+                            else
+                            {
+                                putBits(ClearCode, codeBitsWidth);
+                                dictionary.clear(codeBitsWidth);
+                                LZW_STAT_ADD(clearCodes, 1);
+                                bestRatio = 0;
+                            }
+                        }
+                    }
+                    code = value;
                 }
+                else
+                {
+                    code = index;
+                }
+
+                ++nextIn;
+                --availIn;
+                ++totalIn;
+                LZW_STAT_ADD(encodedBytesIn, 1);
             }
+        }
+    }
 
-            dictionary.add(prevCode, firstByte);
-            if (dictionary.flush(codeBitsWidth))
+    // ========================================================
+    // class StreamDecoder:
+    // ========================================================
+
+    StreamDecoder::StreamDecoder(const Allocator &allocator)
+        : dictionary(MaxDictBits, ResetPolicy::WhenFull, /* withHashTable = */ false, allocator),
+          sequence(nullptr), sequencePos(0), sequenceEnd(0), bitBuffer(0), bitBufferCount(0),
+          prevCode(Nil), prevFirstByte(0), codeBitsWidth(StartBits), failed(false)
+    {
+    }
+
+    StreamDecoder::~StreamDecoder()
+    {
+        if (sequence != nullptr)
+        {
+            dictionary.allocator->deallocate(dictionary.allocator->context, sequence);
+        }
+    }
+
+    bool StreamDecoder::fillBits(const int bitCount)
+    {
+        while (bitBufferCount < bitCount && availIn != 0)
+        {
+            bitBuffer |= static_cast<std::uint64_t>(*nextIn++) << bitBufferCount;
+            bitBufferCount += 8;
+            --availIn;
+            ++totalIn;
+            LZW_STAT_ADD(decodedBytesIn, 1);
+        }
+        return bitBufferCount >= bitCount;
+    }
+
+    StreamStatus StreamDecoder::decode(const bool finish)
+    {
+        LZW_STAT_TIMER(decodeNanos);
+        LZW_STAT_ADD(decodeCalls, 1);
+
+        if (failed)
+        {
+            return StreamStatus::Error;
+        }
+
+        for (;;)
+        {
+            // Output what's left of the last sequence:
+            if (sequencePos != sequenceEnd)
             {
+                const std::size_t left = sequenceEnd - sequencePos;
+                const std::size_t count = (left < availOut) ? left : availOut;
+                std::memcpy(nextOut, sequence + sequencePos, count);
+                nextOut += count;
+                availOut -= count;
+                totalOut += count;
+                LZW_STAT_ADD(decodedBytesOut, count);
+                sequencePos += static_cast<int>(count);
+                if (sequencePos != sequenceEnd)
+                {
+                    return StreamStatus::Ok; // Output buffer full.
+                }
+            }
+
+            const int bitsWanted = (sequence == nullptr) ? StartBits : codeBitsWidth;
+            if (!fillBits(bitsWanted))
+            {
+                if (!finish)
+                {
+                    return StreamStatus::Ok; // Needs more input.
+                }
+                // Only the padding of the last byte may be left over.
+                failed = (bitBufferCount >= 8);
+                return failed ? StreamStatus::Error : StreamStatus::StreamEnd;
+            }
+
+            // Streams with non-default settings start with a header word.
+            // Anything else is a byte code, which stays in the bit buffer.
+            if (sequence == nullptr)
+            {
+                const int headerWord = static_cast<int>(bitBuffer & ((1 << StartBits) - 1));
+                if (headerWord & HeaderFlag)
+                {
+                    if ((headerWord & 0xF0) != 0)
+                    {
+                        failed = true;
+                        return StreamStatus::Error;
+                    }
+                    const ResetPolicy resetPolicy = (headerWord & (1 << 3)) ? ResetPolicy::OnRatioDrop : ResetPolicy::WhenFull;
+                    dictionary.configure(StartBits + (headerWord & 7), resetPolicy);
+                    bitBuffer >>= StartBits;
+                    bitBufferCount -= StartBits;
+                }
+                sequence = static_cast<std::uint8_t *>(
+                    dictionary.allocator->allocate(dictionary.allocator->context, dictionary.maxEntries));
+                sequencePos = sequenceEnd = dictionary.maxEntries;
+                continue;
+            }
+
+            const int code = static_cast<int>(bitBuffer & ((1u << codeBitsWidth) - 1));
+            bitBuffer >>= codeBitsWidth;
+            bitBufferCount -= codeBitsWidth;
+
+            if (code == ClearCode && dictionary.resetPolicy == ResetPolicy::OnRatioDrop)
+            {
+                dictionary.clear(codeBitsWidth);
                 prevCode = Nil;
+                continue;
             }
-            else
+
+            // Anything past the next free code (or any sequence after a reset) is garbage.
+            if (code > dictionary.size || (prevCode == Nil && code >= FirstCode))
+            {
+                failed = true;
+                return StreamStatus::Error;
+            }
+
+            // No output history to copy from here, so walk the prefix
+            // chain, writing the sequence back to front into the scratch.
+            sequencePos = sequenceEnd;
+            if (prevCode == Nil)
             {
+                sequence[--sequencePos] = static_cast<std::uint8_t>(code);
                 prevCode = code;
+                prevFirstByte = code;
+                continue;
             }
-        }
 
-        return bytesDecoded;
+            // A code not in the dictionary yet can only be the previous
+            // sequence plus its own first byte, which is what we add next.
+            int c = code;
+            if (code == dictionary.size)
+            {
+                sequence[--sequencePos] = static_cast<std::uint8_t>(prevFirstByte);
+                c = prevCode;
+            }
+            do
+            {
+                assert(sequencePos > 0);
+                sequence[--sequencePos] = static_cast<std::uint8_t>(dictionary.entries[c].value);
+                c = dictionary.entries[c].code;
+            } while (c >= 0);
+
+            const int firstByte = sequence[sequencePos];
+            if (!dictionary.isFull())
+            {
+                dictionary.add(prevCode, firstByte);
+            }
+            prevCode = dictionary.flush(codeBitsWidth) ? Nil : code;
+            prevFirstByte = firstByte;
+        }
     }
 
 } // namespace lzw {}
@@ -0,0 +1,748 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+// -------
+//  SETUP
+// -------
+// #define PIPELINE_IMPLEMENTATION in one source file before including
+// this file, then use pipeline.hpp as a normal header file elsewhere.
+//
+// pipeline.hpp doesn't include any codec header. The stages wrap whichever
+// codec stream classes you pass them, so include those headers as usual.
+//
+// ----------
+//  OVERVIEW
+// ----------
+// Chains codecs and transforms, RLE into Huffman or delta into Rice say, so the
+// data makes a single pass through memory. Each stage hands its output to the
+// next one in small chunks (DefaultChunkSize bytes) that stay in cache, instead
+// of every stage writing the whole intermediate result to a heap buffer for the
+// next to read back.
+//
+// Any codec StreamEncoder/StreamDecoder can be a stage, through EncodeStage or
+// DecodeStage. DeltaEncoder/DeltaDecoder and ShuffleEncoder/ShuffleDecoder are
+// transforms for numeric data, to put in front of a codec. A Pipeline is driven
+// like the codec streams themselves:
+//
+//   rle::StreamEncoder rle;
+//   huffman::StreamEncoder huff;
+//   pipeline::EncodeStage<rle::StreamEncoder> rleStage(rle);
+//   pipeline::EncodeStage<huffman::StreamEncoder> huffStage(huff);
+//
+//   pipeline::Pipeline chain;
+//   chain.add(rleStage);
+//   chain.add(huffStage);
+//   chain.nextIn = input;   chain.availIn = inputSize;
+//   chain.nextOut = output; chain.availOut = outputSize;
+//   while (chain.run(true) == pipeline::Status::Ok) { /* refill/drain */ }
+//
+// Decoding runs the matching decoders in reverse order. The output of a chain
+// is exactly what the codecs' streaming APIs would give if run one after the
+// other over the whole data.
+//
+// Memory for the chunk buffers is sourced from PIPELINE_MALLOC/PIPELINE_MFREE,
+// so you can override the macros to add custom memory management.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+// If you provide a custom malloc(), you must also provide a custom free().
+// Note: We never check PIPELINE_MALLOC's return for null. A custom implementation
+// should just abort with a fatal error if the program runs out of memory.
+#ifndef PIPELINE_MALLOC
+#define PIPELINE_MALLOC std::malloc
+#define PIPELINE_MFREE std::free
+#endif // PIPELINE_MALLOC
+
+namespace pipeline {
+
+// ========================================================
+
+// The default fatalError() function writes to stderr and aborts.
+#ifndef PIPELINE_ERROR
+
+    void fatalError(const char *message);
+
+#define PIPELINE_USING_DEFAULT_ERROR_HANDLER
+#define PIPELINE_ERROR(message) ::pipeline::fatalError(message)
+#endif // PIPELINE_ERROR
+
+    // ========================================================
+    // Stream buffers and status:
+    // ========================================================
+
+    // Same as the codecs' own StreamBuffers.
+    struct StreamBuffers {
+        const std::uint8_t *nextIn = nullptr; // Next input byte.
+        std::size_t availIn = 0;              // Number of bytes available at nextIn.
+        std::uint64_t totalIn = 0;            // Total input bytes consumed so far.
+
+        std::uint8_t *nextOut = nullptr;      // Next output byte goes here.
+        std::size_t availOut = 0;             // Remaining free space at nextOut.
+        std::uint64_t totalOut = 0;           // Total output bytes produced so far.
+    };
+
+    enum class Status : std::uint8_t {
+        Ok,        // Progress made, or needs more input/output space to make any.
+        StreamEnd, // Finished; all the output has been written out.
+        Error      // Malformed input. The stream can't continue.
+    };
+
+    // Bytes handed from one stage to the next at a time.
+    constexpr int DefaultChunkSize = 1 << 14;
+
+    // ========================================================
+    // class Stage:
+    // ========================================================
+
+    // One step of a Pipeline. process() consumes from and produces to the
+    // buffers like a codec stream's encode()/decode(), advancing them and
+    // adding what it consumed and produced to the totals.
+    class Stage {
+    public:
+        virtual ~Stage() = default;
+
+        // finish = true once the last of the input has been supplied.
+        virtual Status process(StreamBuffers &buffers, bool finish) = 0;
+    };
+
+    // Runs a codec's StreamEncoder. The stage only refers to the encoder, which must outlive it.
+    template <typename Encoder>
+    class EncodeStage final : public Stage {
+    public:
+        explicit EncodeStage(Encoder &encoder) : encoder(encoder) {}
+
+        Status process(StreamBuffers &buffers, bool finish) override;
+
+    private:
+        Encoder &encoder;
+    };
+
+    // Runs a codec's StreamDecoder.
+    template <typename Decoder>
+    class DecodeStage final : public Stage {
+    public:
+        explicit DecodeStage(Decoder &decoder) : decoder(decoder) {}
+
+        Status process(StreamBuffers &buffers, bool finish) override;
+
+    private:
+        Decoder &decoder;
+    };
+
+    // ========================================================
+    // Delta transform:
+    // ========================================================
+
+    // Replaces each little-endian value of valueBytes (1, 2 or 4) with its difference
+    // from the one before, mod 2^bits, the first one from zero. With zigzag the
+    // differences are mapped as signed, so 0, -1, 1, -2, ... become 0, 1, 2, 3, ...,
+    // and small changes of either sign give small values, as Rice wants them.
+    // Trailing bytes short of a whole value are passed through as they are.
+    class DeltaEncoder final : public Stage {
+    public:
+        explicit DeltaEncoder(int valueBytes = 1, bool zigzag = false);
+
+        Status process(StreamBuffers &buffers, bool finish) override;
+
+    private:
+        friend class DeltaDecoder;
+
+        Status run(StreamBuffers &buffers, bool finish, bool decode);
+
+        std::uint32_t transform(std::uint32_t value, bool decode);
+
+        std::uint32_t previous;
+        std::uint32_t mask;
+        int valueBytes;
+        bool zigzag;
+        std::uint8_t partial[4]; // Input value split between input chunks.
+        int partialBytes;
+        std::uint8_t pending[4]; // Output value while the output buffer is full.
+        int pendingPos;
+        int pendingEnd;
+    };
+
+    // Undoes a DeltaEncoder with the same settings.
+    class DeltaDecoder final : public Stage {
+    public:
+        explicit DeltaDecoder(int valueBytes = 1, bool zigzag = false) : delta(valueBytes, zigzag) {}
+
+        Status process(StreamBuffers &buffers, const bool finish) override { return delta.run(buffers, finish, true); }
+
+    private:
+        DeltaEncoder delta;
+    };
+
+    // ========================================================
+    // Byte shuffle transform:
+    // ========================================================
+
+    // Splits elements of elementBytes into byte planes: within each block of
+    // blockBytes (rounded down to whole elements), the first byte of every
+    // element comes first, then every second byte, and so on. The high bytes of
+    // numeric data then sit together, where a codec finds them very repetitive.
+    // A shorter last block is shuffled the same way, bytes short of a whole
+    // element are passed through.
+    class ShuffleEncoder final : public Stage {
+    public:
+        // No copy/assignment.
+        ShuffleEncoder(const ShuffleEncoder &) = delete;
+
+        ShuffleEncoder &operator=(const ShuffleEncoder &) = delete;
+
+        explicit ShuffleEncoder(int elementBytes, int blockBytes = DefaultChunkSize);
+
+        ~ShuffleEncoder();
+
+        Status process(StreamBuffers &buffers, bool finish) override;
+
+    private:
+        friend class ShuffleDecoder;
+
+        Status run(StreamBuffers &buffers, bool finish, bool decode);
+
+        void shuffleBlock(bool decode);
+
+        std::uint8_t *block;    // Input block being gathered.
+        std::uint8_t *shuffled; // Transformed block being written out.
+        int elementBytes;
+        int blockSize;
+        int blockUsed;
+        int shuffledPos;
+        int shuffledEnd;
+    };
+
+    // Undoes a ShuffleEncoder with the same settings.
+    class ShuffleDecoder final : public Stage {
+    public:
+        explicit ShuffleDecoder(int elementBytes, int blockBytes = DefaultChunkSize) : shuffle(elementBytes, blockBytes) {}
+
+        Status process(StreamBuffers &buffers, const bool finish) override { return shuffle.run(buffers, finish, true); }
+
+    private:
+        ShuffleEncoder shuffle;
+    };
+
+    // ========================================================
+    // class Pipeline:
+    // ========================================================
+
+    class Pipeline final : public StreamBuffers {
+    public:
+        static constexpr int MaxStages = 8;
+
+        // No copy/assignment.
+        Pipeline(const Pipeline &) = delete;
+
+        Pipeline &operator=(const Pipeline &) = delete;
+
+        explicit Pipeline(int chunkSizeBytes = DefaultChunkSize);
+
+        ~Pipeline();
+
+        // Appends a stage, which must outlive the pipeline. Data goes through
+        // the stages in the order they were added. Add them all before run().
+        void add(Stage &stage);
+
+        // Pass finish = true once the last of the input has been supplied.
+        // Keep calling with more output space until it returns StreamEnd.
+        Status run(bool finish);
+
+    private:
+        // Output of one stage not yet taken by the next, at data[start, end).
+        struct Chunk {
+            std::uint8_t *data;
+            std::size_t start;
+            std::size_t end;
+        };
+
+        Stage *stages[MaxStages];
+        Chunk chunks[MaxStages - 1]; // chunks[i] goes from stages[i] to stages[i + 1].
+        bool done[MaxStages];        // Stage returned StreamEnd.
+        int stageCount;
+        int chunkSize;
+        bool failed;
+    };
+
+    // ========================================================
+    // Stage templates:
+    // ========================================================
+
+    template <typename CodecStatus>
+    inline Status toStatus(const CodecStatus status)
+    {
+        return (status == CodecStatus::Ok) ? Status::Ok :
+               (status == CodecStatus::StreamEnd) ? Status::StreamEnd : Status::Error;
+    }
+
+    // Points the codec stream at the stage buffers, runs it and moves them on by as much.
+    template <typename Stream, typename Run>
+    inline Status runStream(Stream &stream, StreamBuffers &buffers, const Run &runStep)
+    {
+        stream.nextIn = buffers.nextIn;
+        stream.availIn = buffers.availIn;
+        stream.nextOut = buffers.nextOut;
+        stream.availOut = buffers.availOut;
+
+        const std::uint64_t totalIn = stream.totalIn;
+        const std::uint64_t totalOut = stream.totalOut;
+        const Status status = toStatus(runStep());
+
+        buffers.nextIn = stream.nextIn;
+        buffers.availIn = stream.availIn;
+        buffers.nextOut = stream.nextOut;
+        buffers.availOut = stream.availOut;
+        buffers.totalIn += stream.totalIn - totalIn;
+        buffers.totalOut += stream.totalOut - totalOut;
+        return status;
+    }
+
+    template <typename Encoder>
+    Status EncodeStage<Encoder>::process(StreamBuffers &buffers, const bool finish)
+    {
+        return runStream(encoder, buffers, [&]() { return encoder.encode(finish); });
+    }
+
+    template <typename Decoder>
+    Status DecodeStage<Decoder>::process(StreamBuffers &buffers, const bool finish)
+    {
+        return runStream(decoder, buffers, [&]() { return decoder.decode(finish); });
+    }
+
+} // namespace pipeline {}
+
+// ================== End of header file ==================
+#endif // PIPELINE_HPP
+// ================== End of header file ==================
+
+// ================================================================================================
+//
+//                                   Pipeline Implementation
+//
+// ================================================================================================
+
+#ifdef PIPELINE_IMPLEMENTATION
+
+#ifdef PIPELINE_USING_DEFAULT_ERROR_HANDLER
+#include <cstdio> // For the default error handler
+#endif            // PIPELINE_USING_DEFAULT_ERROR_HANDLER
+
+#include <cassert>
+#include <cstring>
+
+namespace pipeline
+{
+
+    // ========================================================
+
+#ifdef PIPELINE_USING_DEFAULT_ERROR_HANDLER
+
+    // Prints a fatal error to stderr and aborts the process.
+    // This is the default method used by PIPELINE_ERROR(), but
+    // you can override the macro to use other error handling
+    // mechanisms, such as C++ exceptions.
+    void fatalError(const char *const message)
+    {
+        std::fprintf(stderr, "Pipeline error: %s\n", message);
+        std::abort();
+    }
+
+#endif // PIPELINE_USING_DEFAULT_ERROR_HANDLER
+
+    // ========================================================
+    // class DeltaEncoder:
+    // ========================================================
+
+    DeltaEncoder::DeltaEncoder(const int valueBytes, const bool zigzag)
+        : previous(0)
+        , mask(0)
+        , valueBytes(valueBytes)
+        , zigzag(zigzag)
+        , partial()
+        , partialBytes(0)
+        , pending()
+        , pendingPos(0)
+        , pendingEnd(0)
+    {
+        if (valueBytes != 1 && valueBytes != 2 && valueBytes != 4)
+        {
+            PIPELINE_ERROR("DeltaEncoder: Values must be 1, 2 or 4 bytes!");
+            this->valueBytes = 1;
+        }
+        mask = (this->valueBytes == 4) ? 0xFFFFFFFFu : (1u << (this->valueBytes * 8)) - 1;
+    }
+
+    Status DeltaEncoder::process(StreamBuffers &buffers, const bool finish)
+    {
+        return run(buffers, finish, false);
+    }
+
+    std::uint32_t DeltaEncoder::transform(const std::uint32_t value, const bool decode)
+    {
+        const int signBit = valueBytes * 8 - 1;
+        if (decode)
+        {
+            // Zigzag back to two's complement, then add to the previous value.
+            const std::uint32_t delta = zigzag ? ((value >> 1) ^ (0u - (value & 1))) : value;
+            previous = (previous + delta) & mask;
+            return previous;
+        }
+
+        const std::uint32_t delta = (value - previous) & mask;
+        previous = value;
+        if (!zigzag)
+        {
+            return delta;
+        }
+        const std::uint32_t sign = 0u - ((delta >> signBit) & 1);
+        return ((delta << 1) ^ sign) & mask;
+    }
+
+    Status DeltaEncoder::run(StreamBuffers &buffers, const bool finish, const bool decode)
+    {
+        for (;;)
+        {
+            // Drain a value left over from the last call first.
+            while (pendingPos != pendingEnd && buffers.availOut != 0)
+            {
+                *buffers.nextOut++ = pending[pendingPos++];
+                --buffers.availOut;
+                ++buffers.totalOut;
+            }
+            if (pendingPos != pendingEnd)
+            {
+                return Status::Ok;
+            }
+
+            // Whole values straight from input to output.
+            if (partialBytes == 0)
+            {
+                std::size_t count = (buffers.availIn < buffers.availOut) ? buffers.availIn : buffers.availOut;
+                count /= valueBytes;
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    std::uint32_t value = 0;
+                    for (int b = 0; b < valueBytes; ++b)
+                    {
+                        value |= std::uint32_t(buffers.nextIn[b]) << (b * 8);
+                    }
+                    value = transform(value, decode);
+                    for (int b = 0; b < valueBytes; ++b)
+                    {
+                        buffers.nextOut[b] = static_cast<std::uint8_t>(value >> (b * 8));
+                    }
+                    buffers.nextIn += valueBytes;
+                    buffers.nextOut += valueBytes;
+                }
+                const std::size_t bytes = count * valueBytes;
+                buffers.availIn -= bytes;
+                buffers.totalIn += bytes;
+                buffers.availOut -= bytes;
+                buffers.totalOut += bytes;
+            }
+
+            if (buffers.availIn == 0)
+            {
+                if (!finish)
+                {
+                    return Status::Ok;
+                }
+
+                // A partial value at the very end goes out as is.
+                if (partialBytes != 0)
+                {
+                    std::memcpy(pending, partial, partialBytes);
+                    pendingPos = 0;
+                    pendingEnd = partialBytes;
+                    partialBytes = 0;
+                    continue;
+                }
+                return Status::StreamEnd;
+            }
+
+            // A value straddling input chunks, or too little output space for a
+            // whole one: gather it byte by byte and go through pending[].
+            if (buffers.availOut == 0 && partialBytes == 0)
+            {
+                return Status::Ok;
+            }
+            partial[partialBytes++] = *buffers.nextIn++;
+            --buffers.availIn;
+            ++buffers.totalIn;
+            if (partialBytes == valueBytes)
+            {
+                std::uint32_t value = 0;
+                for (int b = 0; b < valueBytes; ++b)
+                {
+                    value |= std::uint32_t(partial[b]) << (b * 8);
+                }
+                value = transform(value, decode);
+                for (int b = 0; b < valueBytes; ++b)
+                {
+                    pending[b] = static_cast<std::uint8_t>(value >> (b * 8));
+                }
+                pendingPos = 0;
+                pendingEnd = valueBytes;
+                partialBytes = 0;
+            }
+        }
+    }
+
+    // ========================================================
+    // class ShuffleEncoder:
+    // ========================================================
+
+    ShuffleEncoder::ShuffleEncoder(const int elementBytes, const int blockBytes)
+        : block(nullptr)
+        , shuffled(nullptr)
+        , elementBytes(elementBytes)
+        , blockSize(0)
+        , blockUsed(0)
+        , shuffledPos(0)
+        , shuffledEnd(0)
+    {
+        if (elementBytes < 1 || blockBytes < elementBytes)
+        {
+            PIPELINE_ERROR("ShuffleEncoder: Bad element or block size!");
+            this->elementBytes = 1;
+        }
+        blockSize = (blockBytes > this->elementBytes) ? blockBytes - blockBytes % this->elementBytes : this->elementBytes;
+        block = static_cast<std::uint8_t *>(PIPELINE_MALLOC(blockSize));
+        shuffled = static_cast<std::uint8_t *>(PIPELINE_MALLOC(blockSize));
+    }
+
+    ShuffleEncoder::~ShuffleEncoder()
+    {
+        PIPELINE_MFREE(block);
+        PIPELINE_MFREE(shuffled);
+    }
+
+    Status ShuffleEncoder::process(StreamBuffers &buffers, const bool finish)
+    {
+        return run(buffers, finish, false);
+    }
+
+    void ShuffleEncoder::shuffleBlock(const bool decode)
+    {
+        const int elementCount = blockUsed / elementBytes;
+        const int wholeBytes = elementCount * elementBytes;
+        for (int e = 0; e < elementCount; ++e)
+        {
+            for (int b = 0; b < elementBytes; ++b)
+            {
+                const int elementPos = e * elementBytes + b;
+                const int planePos = b * elementCount + e;
+                if (decode)
+                {
+                    shuffled[elementPos] = block[planePos];
+                }
+                else
+                {
+                    shuffled[planePos] = block[elementPos];
+                }
+            }
+        }
+        std::memcpy(shuffled + wholeBytes, block + wholeBytes, blockUsed - wholeBytes);
+
+        shuffledPos = 0;
+        shuffledEnd = blockUsed;
+        blockUsed = 0;
+    }
+
+    Status ShuffleEncoder::run(StreamBuffers &buffers, const bool finish, const bool decode)
+    {
+        for (;;)
+        {
+            if (shuffledPos != shuffledEnd)
+            {
+                const std::size_t left = shuffledEnd - shuffledPos;
+                const std::size_t count = (left < buffers.availOut) ? left : buffers.availOut;
+                std::memcpy(buffers.nextOut, shuffled + shuffledPos, count);
+                buffers.nextOut += count;
+                buffers.availOut -= count;
+                buffers.totalOut += count;
+                shuffledPos += static_cast<int>(count);
+                if (shuffledPos != shuffledEnd)
+                {
+                    return Status::Ok;
+                }
+            }
+
+            const std::size_t room = blockSize - blockUsed;
+            const std::size_t count = (buffers.availIn < room) ? buffers.availIn : room;
+            std::memcpy(block + blockUsed, buffers.nextIn, count);
+            buffers.nextIn += count;
+            buffers.availIn -= count;
+            buffers.totalIn += count;
+            blockUsed += static_cast<int>(count);
+
+            if (blockUsed == blockSize || (finish && buffers.availIn == 0 && blockUsed != 0))
+            {
+                shuffleBlock(decode);
+                continue;
+            }
+            return (finish && buffers.availIn == 0) ? Status::StreamEnd : Status::Ok;
+        }
+    }
+
+    // ========================================================
+    // class Pipeline:
+    // ========================================================
+
+    Pipeline::Pipeline(const int chunkSizeBytes)
+        : stages()
+        , chunks()
+        , done()
+        , stageCount(0)
+        , chunkSize(chunkSizeBytes)
+        , failed(false)
+    {
+        if (chunkSize < 64)
+        {
+            PIPELINE_ERROR("Pipeline: Chunk size must be at least 64 bytes!");
+            chunkSize = DefaultChunkSize;
+        }
+    }
+
+    Pipeline::~Pipeline()
+    {
+        for (int i = 0; i + 1 < stageCount; ++i)
+        {
+            PIPELINE_MFREE(chunks[i].data);
+        }
+    }
+
+    void Pipeline::add(Stage &stage)
+    {
+        if (stageCount == MaxStages)
+        {
+            PIPELINE_ERROR("Pipeline: Too many stages!");
+            return;
+        }
+
+        if (stageCount != 0)
+        {
+            Chunk &chunk = chunks[stageCount - 1];
+            chunk.data = static_cast<std::uint8_t *>(PIPELINE_MALLOC(chunkSize));
+            chunk.start = 0;
+            chunk.end = 0;
+        }
+        stages[stageCount] = &stage;
+        done[stageCount] = false;
+        ++stageCount;
+    }
+
+    Status Pipeline::run(const bool finish)
+    {
+        if (failed)
+        {
+            return Status::Error;
+        }
+
+        if (stageCount == 0)
+        {
+            PIPELINE_ERROR("Pipeline: No stages!");
+            return Status::Error;
+        }
+
+        // Keep passing chunks down the chain until no stage can move.
+        for (;;)
+        {
+            bool progress = false;
+            for (int i = 0; i < stageCount; ++i)
+            {
+                if (done[i])
+                {
+                    continue;
+                }
+
+                StreamBuffers buffers;
+                if (i == 0)
+                {
+                    buffers.nextIn = nextIn;
+                    buffers.availIn = availIn;
+                }
+                else
+                {
+                    const Chunk &input = chunks[i - 1];
+                    buffers.nextIn = input.data + input.start;
+                    buffers.availIn = input.end - input.start;
+                }
+
+                if (i == stageCount - 1)
+                {
+                    buffers.nextOut = nextOut;
+                    buffers.availOut = availOut;
+                }
+                else
+                {
+                    // Move what's left to the front, so the stage gets all the room there is.
+                    Chunk &output = chunks[i];
+                    if (output.start != 0)
+                    {
+                        std::memmove(output.data, output.data + output.start, output.end - output.start);
+                        output.end -= output.start;
+                        output.start = 0;
+                    }
+                    buffers.nextOut = output.data + output.end;
+                    buffers.availOut = chunkSize - output.end;
+                }
+
+                // A stage gets finish once the one before it is done and its output is all in the chunk.
+                const bool stageFinish = (i == 0) ? finish : done[i - 1];
+                const Status status = stages[i]->process(buffers, stageFinish);
+
+                const std::size_t consumed = static_cast<std::size_t>(buffers.totalIn);
+                const std::size_t produced = static_cast<std::size_t>(buffers.totalOut);
+                if (i == 0)
+                {
+                    nextIn += consumed;
+                    availIn -= consumed;
+                    totalIn += consumed;
+                }
+                else
+                {
+                    chunks[i - 1].start += consumed;
+                }
+
+                if (i == stageCount - 1)
+                {
+                    nextOut += produced;
+                    availOut -= produced;
+                    totalOut += produced;
+                }
+                else
+                {
+                    chunks[i].end += produced;
+                }
+
+                if (status == Status::Error)
+                {
+                    failed = true;
+                    return Status::Error;
+                }
+                if (status == Status::StreamEnd)
+                {
+                    done[i] = true;
+                    progress = true;
+                }
+                progress = progress || consumed != 0 || produced != 0;
+            }
+
+            if (done[stageCount - 1])
+            {
+                return Status::StreamEnd;
+            }
+            if (!progress)
+            {
+                return Status::Ok;
+            }
+        }
+    }
+
+} // namespace pipeline {}
+
+// ================ End of implementation =================
+#endif // PIPELINE_IMPLEMENTATION
+// ================ End of implementation =================
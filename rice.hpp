@@ -1,8 +1,10 @@
 #ifndef RICE_HPP
 #define RICE_HPP
 
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <type_traits>
 
 // If you provide a custom malloc(), you must also provide a custom free().
 // Note: We never check RICE_MALLOC's return for null. A custom implementation
@@ -25,6 +27,22 @@ namespace rice {
 #define RICE_ERROR(message) ::rice::fatalError(message)
 #endif // RICE_ERROR
 
+    // ========================================================
+    // struct Allocator:
+    // ========================================================
+
+    // Source of the memory an Encoder allocates. The encoder keeps a pointer
+    // to it, so it must outlive it. Memory handed to the user by release()
+    // has to be freed with the same allocator.
+    struct Allocator {
+        void *(*allocate)(void *context, std::size_t sizeBytes);
+        void (*deallocate)(void *context, void *ptr);
+        void *context;
+    };
+
+    // Goes through RICE_MALLOC/RICE_MFREE.
+    const Allocator &defaultAllocator();
+
     // ========================================================
     // class Encoder:
     // ========================================================
@@ -40,8 +58,22 @@ namespace rice {
 
         explicit Encoder(int initialSizeInBits, int growthGranularity = 2);
 
+        explicit Encoder(const Allocator &allocator, int initialSizeInBits = 8192, int growthGranularity = 2);
+
+        // Writes to a fixed-size external buffer, which is never grown or freed.
+        // Bits that don't fit are dropped and isOverflowed() becomes true.
+        Encoder(std::uint8_t *buffer, int bufferSizeBytes);
+
         void encodeByte(int value, int KBits);
 
+        // Codes count bytes, all with the same K. Picks the kernel built for that K
+        // once, rather than working with a runtime K on every byte.
+        void encodeBytes(const std::uint8_t *values, int count, int KBits);
+
+        // A value of a valueBits wide integer. Quotients of EscapeQuotient and up are
+        // written as that many 1s followed by the raw value, LSB first.
+        void encodeValue(std::uint32_t value, int KBits, int valueBits);
+
         void writeKBitsWord(std::uint32_t KBits, int bitCount);
 
         void appendBit(int bit);
@@ -50,6 +82,9 @@ namespace rice {
 
         static int findBestKBits(const std::uint8_t *input, int inSizeBytes, int KBitsMax, int *outBestSizeBits);
 
+        // Same for encodeValue(), for values of valueBits bits. K goes up to valueBits - 1.
+        static int findBestValueKBits(const std::uint32_t *input, int count, int valueBits, int *outBestSizeBits);
+
         int getByteCount() const;
 
         int getBitCount() const;
@@ -62,27 +97,50 @@ namespace rice {
 
         std::uint8_t *release();
 
+        bool isOverflowed() const { return overflowed; }
+
         ~Encoder();
 
     private:
+        template <int KBits>
+        void encodeBytesK(const std::uint8_t *values, int count);
+
         void internalInit();
 
-        static int nextPowerOfTwo(int num);
+        bool reserveWord();
 
-        static std::uint8_t *allocBytes(int bytesWanted, std::uint8_t *oldPtr, int oldSize);
+        void appendBitsU64(std::uint64_t num, int bitCount);
+
+        static int nextPowerOfTwo(int num);
 
-        std::uint8_t *stream; // Growable buffer to store our bits. Heap allocated & owned by the class instance.
-        int bytesAllocated;   // Current size of heap-allocated stream buffer *in bytes*.
-        int granularity;      // Amount bytesAllocated multiplies by when auto-resizing in appendBit().
-        int currBytePos;      // Current byte being written to, from 0 to bytesAllocated-1.
-        int nextBitPos;       // Bit position within the current byte to access next. 0 to 7.
-        int numBitsWritten;   // Number of bits in use from the stream buffer, not including byte-rounding padding.
+        std::uint8_t *allocBytes(int bytesWanted, std::uint8_t *oldPtr, int oldSize) const;
+
+        const Allocator *allocator;
+        std::uint8_t *stream;    // Growable buffer to store our bits. Heap allocated & owned by the class instance, unless external.
+        std::uint64_t bitBuffer; // Bits from currBytePos onwards. Always mirrored to the stream with one 64-bit store.
+        bool external;           // Stream is a fixed-size user buffer.
+        bool overflowed;         // Ran out of room in the external buffer.
+        int bytesAllocated;      // Current size of heap-allocated stream buffer *in bytes*.
+        int granularity;         // Amount bytesAllocated multiplies by when auto-resizing in appendBit().
+        int currBytePos;         // Current byte being written to, from 0 to bytesAllocated-8.
+        int nextBitPos;          // Bit position within the current byte to access next. 0 to 7.
+        int numBitsWritten;      // Number of bits in use from the stream buffer, not including byte-rounding padding.
     };
 
     // ========================================================
     // class Decoder:
     // ========================================================
 
+    // What went wrong decoding a stream, for safeDecode() and Decoder::getStatus().
+    // Rice streams don't store their value count, the caller asks for as many values
+    // as it expects, so there is no output too small case, only a short stream.
+    enum class DecodeStatus : std::uint8_t {
+        Ok,           // All the values asked for decoded fine.
+        BadArguments, // Null pointers or sizes out of range.
+        BadHeader,    // Bad K or extended header, or values of another size.
+        CorruptData   // Bad block K, impossible code, or the stream ended early.
+    };
+
     class Decoder final {
     public:
         // No copy/assignment.
@@ -92,7 +150,9 @@ namespace rice {
 
         Decoder(const Encoder &encoder);
 
-        Decoder(const std::uint8_t *encodedData, int encodedSizeBytes, int encodedSizeBits);
+        // With reportErrors false, problems are only recorded in getStatus(),
+        // RICE_ERROR() is never called. For untrusted input, see safeDecode().
+        Decoder(const std::uint8_t *encodedData, int encodedSizeBytes, int encodedSizeBits, bool reportErrors = true);
 
         void reset();
 
@@ -100,37 +160,215 @@ namespace rice {
 
         int readKBitsWord(int bitCount);
 
+        // Decodes up to count values, all coded with the same K. Returns how many it
+        // got, fewer if the stream ended. Decodes from a 64-bit window where it can,
+        // with a kernel built for each K, picked once per call.
+        int readValues(int KBits, std::uint8_t *output, int count);
+
+        // Same for codes written by Encoder::encodeValue(), escapes included.
+        int readValues(int KBits, int valueBits, std::uint32_t *output, int count);
+
         int getByteCount() const { return sizeInBytes; }
 
         int getBitCount() const { return sizeInBits; }
 
+        int getBitsRead() const { return numBitsRead; }
+
         const std::uint8_t *getBitStream() const { return stream; }
 
+        // First problem found decoding, if any.
+        DecodeStatus getStatus() const { return status; }
+
+        // Records a problem, and reports it with RICE_ERROR() unless reportErrors is off.
+        void fail(DecodeStatus problem, const char *message);
+
     private:
+        template <int KBits>
+        int readValuesK(std::uint8_t *output, int count);
+
+        std::uint64_t loadWindow() const;
+
         const std::uint8_t *stream; // Pointer to the external bit stream. Not owned by the reader.
         const int sizeInBytes;      // Size of the stream *in bytes*. Might include padding.
         const int sizeInBits;       // Size of the stream *in bits*, padding *not* include.
         int currBytePos;            // Current byte being read in the stream.
         int nextBitPos;             // Bit position within the current byte to access next. 0 to 7.
         int numBitsRead;            // Total bits read from the stream so far. Never includes byte-rounding padding.
+        bool reportErrors;          // Call RICE_ERROR() on problems, besides recording them in status.
+        DecodeStatus status;        // First problem found, if any.
     };
 
     // ========================================================
     // easyEncode() / easyDecode():
     // ========================================================
 
-    // Quick Rice data compression. Output compressed data is heap allocated
-    // with RICE_MALLOC() and should be later freed with RICE_MFREE().
+    // Block sizes for a per-block K, in values. Must be a power of two in this range.
+    constexpr int MinBlockSize = 64;
+    constexpr int MaxBlockSize = 4096;
+
+    // A K field of this value starts an extended header instead of naming the K.
+    constexpr int ExtendedHeaderTag = 15;
+
+    // Longest unary quotient of a 16 or 32-bit value. Larger ones are escaped.
+    constexpr int EscapeQuotient = 16;
+
+    // Stream layout: a 4-bit K (0 to 8), then the codes, all with that K.
+    // With a blockSize, the 4 bits are ExtendedHeaderTag, followed by 4 bits
+    // of log2(blockSize), a zigzag bit, a delta bit and 2 bits of value width:
+    // 0 for bytes, 1 for 16-bit and 2 for 32-bit values. Then each block is a
+    // K of its own, 4 bits for bytes and 5 for wider values, and its codes.
+    //
+    // Delta codes each value as the difference from the one before it (mod 2^bits),
+    // zigzag maps values as signed, so small values of either sign get short
+    // codes: 0, -1, 1, -2, ... become 0, 1, 2, 3, ... Combined, they suit
+    // slowly changing signals, like audio or sensor samples.
+
+    // Quick Rice data compression. Output compressed data is heap allocated from
+    // the given allocator and should be later freed with its deallocate(), which
+    // for the default allocator is RICE_MFREE().
+    // blockSize = 0 codes the whole input with a single K. Zigzag and delta need a blockSize.
     void easyEncode(const std::uint8_t *uncompressed, int uncompressedSizeBytes,
-                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits);
+                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits,
+                    int blockSize = 0, bool zigzag = false, bool delta = false,
+                    const Allocator &allocator = defaultAllocator());
+
+    // Same as above, but writes to a caller-provided buffer instead, making no allocations.
+    // A buffer of maxCompressedSize() bytes always fits. Returns false if it didn't fit.
+    bool easyEncode(const std::uint8_t *uncompressed, int uncompressedSizeBytes,
+                    std::uint8_t *compressed, int compressedCapacityBytes,
+                    int *compressedSizeBytes, int *compressedSizeBits,
+                    int blockSize = 0, bool zigzag = false, bool delta = false);
 
-    // Decompress back the output of easyEncode().
+    // Worst-case easyEncode() output size for any input of the given size.
+    int maxCompressedSize(int uncompressedSizeBytes, int blockSize = 0);
+
+    // Decompress back the output of easyEncode(), either layout.
     // The uncompressed output buffer is assumed to be big enough to hold the uncompressed data,
     // if it happens to be smaller, the decoder will return a partial output and the return value
     // of this function will be less than uncompressedSizeBytes.
     int easyDecode(const std::uint8_t *compressed, int compressedSizeBytes, int compressedSizeBits,
                    std::uint8_t *uncompressed, int uncompressedSizeBytes);
 
+    // Same as easyDecode(), but for untrusted input: RICE_ERROR() is never called,
+    // whatever the stream holds. Problems are returned instead, and *bytesDecoded
+    // gets the bytes written to uncompressed either way.
+    DecodeStatus safeDecode(const std::uint8_t *compressed, int compressedSizeBytes, int compressedSizeBits,
+                            std::uint8_t *uncompressed, int uncompressedSizeBytes, int *bytesDecoded);
+
+    // ========================================================
+    // easyEncodeValues() / easyDecodeValues():
+    // ========================================================
+
+    // Rice coding of 16 or 32-bit integers, for time series, posting lists and such.
+    // T is std::uint16_t, std::int16_t, std::uint32_t or std::int32_t. Always the
+    // per-block layout, see above, with zigzag on by default for signed types.
+    // Quotients over EscapeQuotient are escaped, so no value takes more than
+    // EscapeQuotient plus its own size in bits. Output is freed with the allocator's
+    // deallocate(), RICE_MFREE() for the default one.
+    template <typename T>
+    void easyEncodeValues(const T *values, int valueCount,
+                          std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits,
+                          int blockSize = 256, bool zigzag = std::is_signed<T>::value, bool delta = false,
+                          const Allocator &allocator = defaultAllocator());
+
+    // Caller-provided buffer version. Returns false if it didn't fit.
+    template <typename T>
+    bool easyEncodeValues(const T *values, int valueCount,
+                          std::uint8_t *compressed, int compressedCapacityBytes,
+                          int *compressedSizeBytes, int *compressedSizeBits,
+                          int blockSize = 256, bool zigzag = std::is_signed<T>::value, bool delta = false);
+
+    // Worst-case easyEncodeValues() output size.
+    template <typename T>
+    int maxCompressedSizeValues(int valueCount, int blockSize = 256);
+
+    // Returns the number of values decoded, less than valueCount if the stream
+    // ended early, or 0 if it wasn't written by easyEncodeValues() for this T's size.
+    template <typename T>
+    int easyDecodeValues(const std::uint8_t *compressed, int compressedSizeBytes, int compressedSizeBits,
+                         T *values, int valueCount);
+
+    // Never calls RICE_ERROR(), see safeDecode().
+    template <typename T>
+    DecodeStatus safeDecodeValues(const std::uint8_t *compressed, int compressedSizeBytes, int compressedSizeBits,
+                                  T *values, int valueCount, int *valuesDecoded);
+
+    // ========================================================
+    // Streaming API:
+    // ========================================================
+
+    // For inputs too big to hold in memory at once. Set nextIn/availIn and
+    // nextOut/availOut, then call encode()/decode() until the input is used up,
+    // refilling the buffers in between, same as zlib's z_stream. The calls
+    // advance the pointers and counters by however much they consumed/produced.
+    struct StreamBuffers {
+        const std::uint8_t *nextIn = nullptr; // Next input byte.
+        std::size_t availIn = 0;              // Number of bytes available at nextIn.
+        std::uint64_t totalIn = 0;            // Total input bytes consumed so far.
+
+        std::uint8_t *nextOut = nullptr;      // Next output byte goes here.
+        std::size_t availOut = 0;             // Remaining free space at nextOut.
+        std::uint64_t totalOut = 0;           // Total output bytes produced so far.
+    };
+
+    enum class StreamStatus : std::uint8_t {
+        Ok,        // Progress made, or needs more input/output space to make any.
+        StreamEnd, // Finished; all the output has been written out.
+        Error      // Malformed input. The stream can't continue.
+    };
+
+    // easyEncode() picks K from the whole input, which a stream can't do, so it's
+    // given up front here (see Encoder::findBestKBits() over a sample). The output
+    // is the same as easyEncode() would give had it picked the same K.
+    class StreamEncoder final : public StreamBuffers {
+    public:
+        explicit StreamEncoder(int KBits);
+
+        // Pass finish = true once the last of the input has been supplied.
+        // Keep calling with more output space until it returns StreamEnd.
+        StreamStatus encode(bool finish);
+
+        // Bits written so far, not counting the final byte padding.
+        // Same as the compressedSizeBits easyEncode() returns.
+        std::uint64_t getBitCount() const { return bitsWritten; }
+
+    private:
+        void putBits(std::uint64_t num, int bitCount);
+
+        void flushBits();
+
+        std::uint64_t bitBuffer;   // Bits not written out yet, LSB first.
+        int bitBufferCount;        // Number of bits in bitBuffer.
+        std::uint64_t bitsWritten; // Total bits, including the ones still in bitBuffer.
+        int KBits;
+        int onesLeft;              // Quotient bits of a code too long to go in at once.
+        std::uint32_t tail;        // Terminating 0 and remainder of that code.
+        int tailBits;
+        bool finished;             // Padding is in bitBuffer.
+    };
+
+    // Rice streams don't mark their end, so the decoder must be told how many values
+    // there are, like the output size passed to easyDecode(). K is read from the stream.
+    // Only single-K streams; the per-block layout from a blockSize is an Error here.
+    class StreamDecoder final : public StreamBuffers {
+    public:
+        explicit StreamDecoder(std::uint64_t valueCount);
+
+        // Pass finish = true once the last of the input has been supplied.
+        StreamStatus decode(bool finish);
+
+    private:
+        bool fillBits(int bitCount);
+
+        std::uint64_t bitBuffer;
+        int bitBufferCount;
+        std::uint64_t valuesLeft;
+        int KBits;      // -1 until read from the stream.
+        int quotient;   // Unary bits of the current value read so far.
+        bool inUnary;   // Still reading the current value's quotient.
+        bool failed;
+    };
+
 } // namespace rice {}
 
 // ================== End of header file ==================
@@ -150,12 +388,95 @@ namespace rice {
 #endif            // RICE_USING_DEFAULT_ERROR_HANDLER
 
 #include <cassert>
+#include <cstring>
 
 namespace rice
 {
 
     // ========================================================
 
+    // Unaligned little-endian 64-bit memory access. The bit streams are
+    // LSB first, so on little-endian machines a word is just a memcpy.
+    static std::uint64_t loadU64(const std::uint8_t *ptr)
+    {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        std::uint64_t word = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            word |= std::uint64_t(ptr[i]) << (i * 8);
+        }
+        return word;
+#else
+        std::uint64_t word;
+        std::memcpy(&word, ptr, sizeof(word));
+        return word;
+#endif
+    }
+
+    static void storeU64(std::uint8_t *ptr, const std::uint64_t word)
+    {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        for (int i = 0; i < 8; ++i)
+        {
+            ptr[i] = static_cast<std::uint8_t>(word >> (i * 8));
+        }
+#else
+        std::memcpy(ptr, &word, sizeof(word));
+#endif
+    }
+
+    // The remainder is stored MSB first, while the bit stream
+    // words are LSB first, so it gets mirrored on the way in/out.
+    static std::uint32_t reverseBits(std::uint32_t num, const int bitCount)
+    {
+        if (bitCount <= 0)
+        {
+            return 0;
+        }
+
+        // Swap halves, then quarters, and so on down to single bits.
+        num = ((num >> 1) & 0x55555555u) | ((num & 0x55555555u) << 1);
+        num = ((num >> 2) & 0x33333333u) | ((num & 0x33333333u) << 2);
+        num = ((num >> 4) & 0x0F0F0F0Fu) | ((num & 0x0F0F0F0Fu) << 4);
+        num = ((num >> 8) & 0x00FF00FFu) | ((num & 0x00FF00FFu) << 8);
+        num = (num >> 16) | (num << 16);
+        return num >> (32 - bitCount);
+    }
+
+    // reverseBits() for the remainder of a byte code, with K known at compile
+    // time. K is at most 8, so only the low byte needs swapping.
+    template <int KBits>
+    static std::uint32_t reverseRemainder(std::uint32_t num)
+    {
+        static_assert(KBits >= 0 && KBits <= 8, "Byte codes have a K from 0 to 8!");
+        if (KBits == 0)
+        {
+            return 0;
+        }
+
+        num = ((num >> 1) & 0x55u) | ((num & 0x55u) << 1);
+        num = ((num >> 2) & 0x33u) | ((num & 0x33u) << 2);
+        num = ((num >> 4) & 0x0Fu) | ((num & 0x0Fu) << 4);
+        return num >> (8 - KBits);
+    }
+
+    static int countTrailingZeros(std::uint64_t num)
+    {
+        assert(num != 0);
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(num);
+#else
+        int count = 0;
+        for (; (num & 1) == 0; num >>= 1)
+        {
+            ++count;
+        }
+        return count;
+#endif
+    }
+
+    // ========================================================
+
 #ifdef RICE_USING_DEFAULT_ERROR_HANDLER
 
     // Prints a fatal error to stderr and aborts the process.
@@ -170,11 +491,32 @@ namespace rice
 
 #endif // RICE_USING_DEFAULT_ERROR_HANDLER
 
+    // ========================================================
+    // Default allocator:
+    // ========================================================
+
+    static void *defaultAllocate(void *, const std::size_t sizeBytes)
+    {
+        return RICE_MALLOC(sizeBytes);
+    }
+
+    static void defaultDeallocate(void *, void *ptr)
+    {
+        RICE_MFREE(ptr);
+    }
+
+    const Allocator &defaultAllocator()
+    {
+        static const Allocator allocator = {&defaultAllocate, &defaultDeallocate, nullptr};
+        return allocator;
+    }
+
     // ========================================================
     // class Encoder:
     // ========================================================
 
     Encoder::Encoder()
+        : allocator(&defaultAllocator())
     {
         // 8192 bits for a start (1024 bytes). It will resize if needed.
         // Default granularity is 2.
@@ -183,23 +525,44 @@ namespace rice
     }
 
     Encoder::Encoder(const int initialSizeInBits, const int growthGranularity)
+        : allocator(&defaultAllocator())
+    {
+        internalInit();
+        setGranularity(growthGranularity);
+        allocate(initialSizeInBits);
+    }
+
+    Encoder::Encoder(const Allocator &allocator, const int initialSizeInBits, const int growthGranularity)
+        : allocator(&allocator)
     {
         internalInit();
         setGranularity(growthGranularity);
         allocate(initialSizeInBits);
     }
 
+    Encoder::Encoder(std::uint8_t *buffer, const int bufferSizeBytes)
+        : allocator(&defaultAllocator())
+    {
+        internalInit();
+        stream = buffer;
+        bytesAllocated = (bufferSizeBytes > 0) ? bufferSizeBytes : 0;
+        external = true;
+    }
+
     Encoder::~Encoder()
     {
-        if (stream != nullptr)
+        if (stream != nullptr && !external)
         {
-            RICE_MFREE(stream);
+            allocator->deallocate(allocator->context, stream);
         }
     }
 
     void Encoder::internalInit()
     {
         stream = nullptr;
+        bitBuffer = 0;
+        external = false;
+        overflowed = false;
         bytesAllocated = 0;
         granularity = 2;
         currBytePos = 0;
@@ -210,20 +573,68 @@ namespace rice
     void Encoder::encodeByte(const int value, const int KBits)
     {
         const int m = 1 << KBits;
-        const int q = value / m;
+        int q = value / m;
 
         // Write the quotient code (q 1 bits followed by a terminating 0)
-        for (int i = 0; i < q; ++i)
+        for (; q >= 32; q -= 32)
+        {
+            appendBitsU64(0xFFFFFFFF, 32);
+        }
+        appendBitsU64((std::uint64_t(1) << q) - 1, q + 1);
+
+        // Write the reminder (last k bits of the value), MSB first:
+        appendBitsU64(reverseBits(static_cast<std::uint32_t>(value & (m - 1)), KBits), KBits);
+    }
+
+    template <int KBits>
+    void Encoder::encodeBytesK(const std::uint8_t *values, const int count)
+    {
+        constexpr std::uint32_t RemainderMask = (1u << KBits) - 1;
+
+        for (int i = 0; i < count; ++i)
         {
-            appendBit(1);
+            // The quotient's 1s, its terminating 0 and then the remainder,
+            // in a single write unless the quotient alone is very long.
+            const int q = values[i] >> KBits;
+            if (q + 1 + KBits > 56)
+            {
+                encodeByte(values[i], KBits);
+                continue;
+            }
+            const std::uint64_t remainder = reverseRemainder<KBits>(values[i] & RemainderMask);
+            appendBitsU64(((std::uint64_t(1) << q) - 1) | (remainder << (q + 1)), q + 1 + KBits);
         }
-        appendBit(0);
+    }
+
+    void Encoder::encodeBytes(const std::uint8_t *values, const int count, const int KBits)
+    {
+        assert(KBits >= 0 && KBits <= 8);
+
+        using Kernel = void (Encoder::*)(const std::uint8_t *, int);
+        static const Kernel kernels[9] = {
+            &Encoder::encodeBytesK<0>, &Encoder::encodeBytesK<1>, &Encoder::encodeBytesK<2>,
+            &Encoder::encodeBytesK<3>, &Encoder::encodeBytesK<4>, &Encoder::encodeBytesK<5>,
+            &Encoder::encodeBytesK<6>, &Encoder::encodeBytesK<7>, &Encoder::encodeBytesK<8>
+        };
+        (this->*kernels[KBits])(values, count);
+    }
+
+    void Encoder::encodeValue(const std::uint32_t value, const int KBits, const int valueBits)
+    {
+        assert(KBits >= 0 && KBits < valueBits && valueBits <= 32);
+        const std::uint32_t q = value >> KBits;
 
-        // Write the reminder (last k bits of the value)
-        for (int i = KBits - 1; i >= 0; i--)
+        if (q >= static_cast<std::uint32_t>(EscapeQuotient))
         {
-            appendBit((value >> i) & 1);
+            appendBitsU64((std::uint64_t(1) << EscapeQuotient) - 1, EscapeQuotient);
+            appendBitsU64(value, valueBits);
+            return;
         }
+
+        // Same code as encodeByte() otherwise.
+        appendBitsU64((std::uint64_t(1) << q) - 1, static_cast<int>(q) + 1);
+        const std::uint32_t remainderMask = static_cast<std::uint32_t>((std::uint64_t(1) << KBits) - 1);
+        appendBitsU64(reverseBits(value & remainderMask, KBits), KBits);
     }
 
     int Encoder::computeCodeLength(const int value, const int KBits)
@@ -238,53 +649,191 @@ namespace rice
         assert(input != nullptr);
         assert(outBestSizeBits != nullptr);
 
+
+
+        if (inSizeBytes < 256)
+        {
+            std::uint32_t quotientSums[9] = {};
+            for (int i = 0; i < inSizeBytes; ++i)
+            {
+                for (int k = 0; k <= 8; ++k)
+                {
+                    quotientSums[k] += input[i] >> k;
+                }
+            }
+
+            int bestKBits = 0;
+            std::uint32_t bestSize = 0;
+            for (int k = 0; k <= KBitsMax && k <= 8; ++k)
+            {
+                const std::uint32_t outputSize = static_cast<std::uint32_t>(inSizeBytes) * (1 + k) + quotientSums[k];
+                if (k == 0 || outputSize < bestSize)
+                {
+                    bestSize = outputSize;
+                    bestKBits = k;
+                }
+            }
+
+            *outBestSizeBits = static_cast<int>(bestSize);
+            return bestKBits;
+        }
+
+        // One pass to build a histogram of the byte values. Four interleaved
+        // sub-histograms, so runs of the same byte don't stall on one counter.
+        std::uint32_t counts[4][256] = {};
+        int i = 0;
+        for (; i + 4 <= inSizeBytes; i += 4)
+        {
+            ++counts[0][input[i + 0]];
+            ++counts[1][input[i + 1]];
+            ++counts[2][input[i + 2]];
+            ++counts[3][input[i + 3]];
+        }
+        for (; i < inSizeBytes; ++i)
+        {
+            ++counts[0][input[i]];
+        }
+
+        std::uint64_t histogram[256];
+        for (int v = 0; v < 256; ++v)
+        {
+            histogram[v] = std::uint64_t(counts[0][v]) + counts[1][v] + counts[2][v] + counts[3][v];
+        }
+
+        // The code length of a value only depends on K, see computeCodeLength(),
+        // so each K's total output size comes straight from the histogram.
+        int bestKBits = 0;
+        std::uint64_t bestSize = 0;
+
+        for (int k = 0; k <= KBitsMax; ++k)
+        {
+            std::uint64_t outputSize = 0;
+            for (int v = 0; v < 256; ++v)
+            {
+                outputSize += histogram[v] * static_cast<std::uint64_t>(computeCodeLength(v, k));
+            }
+
+            if (k == 0 || outputSize < bestSize)
+            {
+                bestSize = outputSize;
+                bestKBits = k;
+            }
+        }
+
+        *outBestSizeBits = static_cast<int>(bestSize);
+        return bestKBits;
+    }
+
+    int Encoder::findBestValueKBits(const std::uint32_t *input, const int count, const int valueBits, int *outBestSizeBits)
+    {
+        assert(input != nullptr);
+        assert(outBestSizeBits != nullptr);
+
+        // A K past the bit length of the largest value just adds bits to every code.
+        std::uint32_t allBits = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            allBits |= input[i];
+        }
+        int KBitsMax = 0;
+        while (KBitsMax < valueBits - 1 && (allBits >> KBitsMax) > 1)
+        {
+            ++KBitsMax;
+        }
+
+        const std::uint32_t escapeBits = EscapeQuotient + valueBits;
         int bestKBits = 0;
-        int bestSize = 0;
+        std::uint64_t bestSize = 0;
 
         for (int k = 0; k <= KBitsMax; ++k)
         {
-            int outputSize = 0;
-            for (int i = 0; i < inSizeBytes; ++i)
+            std::uint64_t outputSize = 0;
+            for (int i = 0; i < count; ++i)
             {
-                outputSize += computeCodeLength(input[i], k);
+                const std::uint32_t q = input[i] >> k;
+                outputSize += (q < static_cast<std::uint32_t>(EscapeQuotient)) ? (q + 1 + k) : escapeBits;
             }
 
-            if (bestSize == 0 || outputSize < bestSize)
+            if (k == 0 || outputSize < bestSize)
             {
                 bestSize = outputSize;
                 bestKBits = k;
             }
         }
 
-        *outBestSizeBits = bestSize;
+        *outBestSizeBits = static_cast<int>(bestSize);
         return bestKBits;
     }
 
     void Encoder::writeKBitsWord(const std::uint32_t KBits, const int bitCount)
     {
         assert(bitCount <= 32);
-        for (int b = 0; b < bitCount; ++b)
+        appendBitsU64(KBits, bitCount);
+    }
+
+    void Encoder::appendBit(const int bit)
+    {
+        appendBitsU64(static_cast<std::uint64_t>(bit & 1), 1);
+    }
+
+    bool Encoder::reserveWord()
+    {
+        // Every write stores a whole 64-bit word at currBytePos,
+        // so keep at least 8 bytes of room past it.
+        if (currBytePos + 8 > bytesAllocated)
         {
-            const std::uint32_t mask = std::uint32_t(1) << b;
-            const int bit = !!(KBits & mask);
-            appendBit(bit);
+            if (external)
+            {
+                return false;
+            }
+            int bytesWanted = bytesAllocated * granularity;
+            if (bytesWanted < currBytePos + 8)
+            {
+                bytesWanted = currBytePos + 8;
+            }
+            allocate(bytesWanted * 8);
         }
+        return true;
     }
 
-    void Encoder::appendBit(const int bit)
+    void Encoder::appendBitsU64(std::uint64_t num, const int bitCount)
     {
-        const std::uint32_t mask = std::uint32_t(1) << nextBitPos;
-        stream[currBytePos] = (stream[currBytePos] & ~mask) | (-bit & mask);
-        ++numBitsWritten;
+        // A single word holds up to 7 bits of the current byte plus 56 new ones.
+        assert(bitCount <= 56);
+        if (bitCount <= 0)
+        {
+            return;
+        }
 
-        if (++nextBitPos == 8)
+        num &= (std::uint64_t(1) << bitCount) - 1;
+        if (reserveWord())
         {
-            nextBitPos = 0;
-            if (++currBytePos == bytesAllocated)
+            bitBuffer |= num << nextBitPos;
+            storeU64(stream + currBytePos, bitBuffer);
+        }
+        else
+        {
+            // Near the end of an external buffer; store only the bytes touched.
+            const int bytesTouched = (nextBitPos + bitCount + 7) / 8;
+            if (overflowed || currBytePos + bytesTouched > bytesAllocated)
+            {
+                overflowed = true;
+                return;
+            }
+            bitBuffer |= num << nextBitPos;
+            for (int i = 0; i < bytesTouched; ++i)
             {
-                allocate(bytesAllocated * granularity * 8);
+                stream[currBytePos + i] = static_cast<std::uint8_t>(bitBuffer >> (i * 8));
             }
         }
+
+        // Move past the completed bytes:
+        nextBitPos += bitCount;
+        numBitsWritten += bitCount;
+        const int bytesDone = nextBitPos / 8;
+        currBytePos += bytesDone;
+        nextBitPos %= 8;
+        bitBuffer >>= (bytesDone * 8);
     }
 
     int Encoder::getByteCount() const
@@ -335,9 +884,9 @@ namespace rice
             bitsWanted = nextPowerOfTwo(bitsWanted);
         }
 
-        // We might already have the required count.
+        // We might already have the required count. External buffers never grow.
         const int sizeInBytes = bitsWanted / 8;
-        if (sizeInBytes <= bytesAllocated)
+        if (sizeInBytes <= bytesAllocated || external)
         {
             return;
         }
@@ -346,15 +895,15 @@ namespace rice
         bytesAllocated = sizeInBytes;
     }
 
-    std::uint8_t *Encoder::allocBytes(const int bytesWanted, std::uint8_t *oldPtr, const int oldSize)
+    std::uint8_t *Encoder::allocBytes(const int bytesWanted, std::uint8_t *oldPtr, const int oldSize) const
     {
-        std::uint8_t *newMemory = static_cast<std::uint8_t *>(RICE_MALLOC(bytesWanted));
+        std::uint8_t *newMemory = static_cast<std::uint8_t *>(allocator->allocate(allocator->context, bytesWanted));
         std::memset(newMemory, 0, bytesWanted);
 
         if (oldPtr != nullptr)
         {
             std::memcpy(newMemory, oldPtr, oldSize);
-            RICE_MFREE(oldPtr);
+            allocator->deallocate(allocator->context, oldPtr);
         }
 
         return newMemory;
@@ -379,12 +928,26 @@ namespace rice
     {
     }
 
-    Decoder::Decoder(const std::uint8_t *encodedData, const int encodedSizeBytes, const int encodedSizeBits)
-        : stream(encodedData), sizeInBytes(encodedSizeBytes), sizeInBits(encodedSizeBits)
+    Decoder::Decoder(const std::uint8_t *encodedData, const int encodedSizeBytes, const int encodedSizeBits,
+                     const bool reportErrors)
+        : stream(encodedData), sizeInBytes(encodedSizeBytes), sizeInBits(encodedSizeBits),
+          reportErrors(reportErrors), status(DecodeStatus::Ok)
     {
         reset();
     }
 
+    void Decoder::fail(const DecodeStatus problem, const char *const message)
+    {
+        if (status == DecodeStatus::Ok)
+        {
+            status = problem;
+        }
+        if (reportErrors)
+        {
+            RICE_ERROR(message);
+        }
+    }
+
     void Decoder::reset()
     {
         currBytePos = 0;
@@ -411,74 +974,668 @@ namespace rice
         return true;
     }
 
-    int Decoder::readKBitsWord(const int bitCount)
+    int Decoder::readKBitsWord(int bitCount)
     {
         assert(bitCount <= 32);
 
-        std::uint32_t num = 0;
-        for (int b = 0; b < bitCount; ++b)
+        const int bitsLeft = sizeInBits - numBitsRead;
+        if (bitCount > bitsLeft)
         {
-            int bit;
-            if (!readNextBit(bit))
-            {
-                RICE_ERROR("Failed to read bits from stream! Unexpected end.");
-                break;
-            }
-
-            // Based on a "Stanford bit-hack":
-            // http://graphics.stanford.edu/~seander/bithacks.html#ConditionalSetOrClearBitsWithoutBranching
-            const std::uint32_t mask = std::uint32_t(1) << b;
-            num = (num & ~mask) | (-bit & mask);
+            fail(DecodeStatus::CorruptData, "Failed to read bits from stream! Unexpected end.");
+            bitCount = bitsLeft;
+        }
+        if (bitCount <= 0)
+        {
+            return 0;
         }
 
+        const std::uint64_t num = (loadWindow() >> nextBitPos) & ((std::uint64_t(1) << bitCount) - 1);
+        numBitsRead += bitCount;
+        nextBitPos += bitCount;
+        currBytePos += nextBitPos / 8;
+        nextBitPos %= 8;
         return static_cast<int>(num);
     }
 
-    // ========================================================
-    // easyEncode() implementation:
-    // ========================================================
-
-    void easyEncode(const std::uint8_t *uncompressed, const int uncompressedSizeBytes,
-                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits)
+    template <int KBits>
+    int Decoder::readValuesK(std::uint8_t *output, const int count)
     {
-        if (uncompressed == nullptr || compressed == nullptr)
-        {
-            RICE_ERROR("rice::easyEncode(): Null data pointer(s)!");
-            return;
-        }
+        constexpr std::uint32_t RemainderMask = (1u << KBits) - 1;
+        constexpr int MaxQuotient = 255 >> KBits; // No byte has a larger one.
 
-        if (uncompressedSizeBytes <= 0 || compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
+        int valuesDecoded = 0;
+        while (valuesDecoded < count)
         {
-            RICE_ERROR("rice::easyEncode(): Bad in/out sizes!");
-            return;
-        }
+            // Fast path: at least 57 bits of a whole window are ours. The quotient
+            // is the run of ones at the bottom, so a ctz of the inverse gets it at
+            // once. Keep decoding codes out of the same window while they fit.
+            if (currBytePos + 8 <= sizeInBytes)
+            {
+                std::uint64_t window = loadU64(stream + currBytePos) >> nextBitPos;
+                int windowBits = 64 - nextBitPos;
+                if (windowBits > sizeInBits - numBitsRead)
+                {
+                    windowBits = sizeInBits - numBitsRead;
+                }
 
-        // Do up to 8 passes to try finding the best K number of bits for the encoding.
-        int minCompressedBitSize;
-        const int KBits = Encoder::findBestKBits(uncompressed, uncompressedSizeBytes, 8, &minCompressedBitSize);
+                int bitsUsed = 0;
+                while (valuesDecoded < count && ~window != 0)
+                {
+                    const int q = countTrailingZeros(~window);
+                    const int codeBits = q + 1 + KBits;
+                    if (bitsUsed + codeBits > windowBits || q > MaxQuotient)
+                    {
+                        break; // The slow path fails a code that's too long.
+                    }
+
+                    const std::uint32_t remainder = static_cast<std::uint32_t>((window >> q) >> 1) & RemainderMask;
+                    output[valuesDecoded++] = static_cast<std::uint8_t>((q << KBits) + reverseRemainder<KBits>(remainder));
+
+                    window = (codeBits < 64) ? (window >> codeBits) : 0;
+                    bitsUsed += codeBits;
+                }
 
-        Encoder bitStreamEncoder(minCompressedBitSize);
+                if (bitsUsed != 0)
+                {
+                    numBitsRead += bitsUsed;
+                    nextBitPos += bitsUsed;
+                    currBytePos += nextBitPos / 8;
+                    nextBitPos %= 8;
+                    continue;
+                }
+            }
 
-        // The decoder needs to know the number of bits we've used.
-        // Since the max is 8, we only need up to 4 bits for that.
-        bitStreamEncoder.writeKBitsWord(KBits, 4);
+            // Slow path, a bit at a time: end of the stream, or a code longer than the window.
+            int q = 0;
+            int bit = 0;
 
-        // Encode each byte of the input:
-        for (int b = 0; b < uncompressedSizeBytes; ++b)
-        {
-            bitStreamEncoder.encodeByte(uncompressed[b], KBits);
+            // Reconstruct q:
+            for (;;)
+            {
+                if (!readNextBit(bit))
+                {
+                    fail(DecodeStatus::CorruptData, "Failed to read bits from stream! Unexpected end.");
+                    return valuesDecoded;
+                }
+                if (bit == 0)
+                {
+                    break;
+                }
+                if (++q > MaxQuotient)
+                {
+                    fail(DecodeStatus::CorruptData, "Rice code too long for a byte in bit stream!");
+                    return valuesDecoded;
+                }
+            }
+
+            // Reconstruct the remainder, stored MSB first:
+            if (sizeInBits - numBitsRead < KBits)
+            {
+                fail(DecodeStatus::CorruptData, "Failed to read bits from stream! Unexpected end.");
+                return valuesDecoded;
+            }
+            const int remainder = static_cast<int>(reverseRemainder<KBits>(readKBitsWord(KBits)));
+            output[valuesDecoded++] = static_cast<std::uint8_t>((q << KBits) + remainder);
         }
 
-        // Pass ownership of the compressed data buffer to the user pointer:
-        *compressedSizeBytes = bitStreamEncoder.getByteCount();
+        return valuesDecoded;
+    }
+
+    int Decoder::readValues(const int KBits, std::uint8_t *output, const int count)
+    {
+        assert(KBits >= 0 && KBits <= 8);
+
+        using Kernel = int (Decoder::*)(std::uint8_t *, int);
+        static const Kernel kernels[9] = {
+            &Decoder::readValuesK<0>, &Decoder::readValuesK<1>, &Decoder::readValuesK<2>,
+            &Decoder::readValuesK<3>, &Decoder::readValuesK<4>, &Decoder::readValuesK<5>,
+            &Decoder::readValuesK<6>, &Decoder::readValuesK<7>, &Decoder::readValuesK<8>
+        };
+        return (this->*kernels[KBits])(output, count);
+    }
+
+    int Decoder::readValues(const int KBits, const int valueBits, std::uint32_t *output, const int count)
+    {
+        assert(KBits >= 0 && KBits < valueBits && valueBits <= 32);
+        const std::uint32_t remainderMask = static_cast<std::uint32_t>((std::uint64_t(1) << KBits) - 1);
+        const std::uint64_t valueMask = (std::uint64_t(1) << valueBits) - 1;
+
+        // The longest code, an escape, is EscapeQuotient + 32 bits, so
+        // any whole one fits in the 57+ bits of a window past nextBitPos.
+        int valuesDecoded = 0;
+        while (valuesDecoded < count)
+        {
+            const std::uint64_t window = loadWindow() >> nextBitPos;
+            int windowBits = 64 - nextBitPos;
+            if (windowBits > sizeInBits - numBitsRead)
+            {
+                windowBits = sizeInBits - numBitsRead;
+            }
+
+            int q = (~window != 0) ? countTrailingZeros(~window) : 64;
+            int codeBits;
+            std::uint32_t value;
+
+            if (q >= EscapeQuotient)
+            {
+                codeBits = EscapeQuotient + valueBits;
+                value = static_cast<std::uint32_t>((window >> EscapeQuotient) & valueMask);
+            }
+            else
+            {
+                codeBits = q + 1 + KBits;
+                const std::uint32_t remainder = static_cast<std::uint32_t>(window >> (q + 1)) & remainderMask;
+                value = (static_cast<std::uint32_t>(q) << KBits) + reverseBits(remainder, KBits);
+            }
+
+            if (codeBits > windowBits)
+            {
+                fail(DecodeStatus::CorruptData, "Failed to read bits from stream! Unexpected end.");
+                return valuesDecoded;
+            }
+
+            output[valuesDecoded++] = value;
+            numBitsRead += codeBits;
+            nextBitPos += codeBits;
+            currBytePos += nextBitPos / 8;
+            nextBitPos %= 8;
+        }
+
+        return valuesDecoded;
+    }
+
+    std::uint64_t Decoder::loadWindow() const
+    {
+        // Next 8 bytes starting at the current byte. Near the
+        // end gather what's left, with zeros for the rest.
+        if (currBytePos + 8 <= sizeInBytes)
+        {
+            return loadU64(stream + currBytePos);
+        }
+
+        std::uint64_t window = 0;
+        for (int i = 0; currBytePos + i < sizeInBytes; ++i)
+        {
+            window |= std::uint64_t(stream[currBytePos + i]) << (i * 8);
+        }
+        return window;
+    }
+
+    // ========================================================
+    // Per-block K helpers:
+    // ========================================================
+
+    static bool checkBlockOptions(const int blockSize, const bool zigzag, const bool delta)
+    {
+        if (blockSize == 0)
+        {
+            if (zigzag || delta)
+            {
+                RICE_ERROR("rice::easyEncode(): Zigzag and delta need a blockSize!");
+                return false;
+            }
+            return true;
+        }
+
+        if (blockSize < MinBlockSize || blockSize > MaxBlockSize || (blockSize & (blockSize - 1)) != 0)
+        {
+            RICE_ERROR("rice::easyEncode(): blockSize must be 0 or a power of two from 64 to 4096!");
+            return false;
+        }
+        return true;
+    }
+
+    static int log2BlockSize(const int blockSize)
+    {
+        int log2Size = 0;
+        while ((1 << log2Size) < blockSize)
+        {
+            ++log2Size;
+        }
+        return log2Size;
+    }
+
+    static std::uint8_t zigzagEncode(const std::uint8_t value)
+    {
+        return static_cast<std::uint8_t>((value << 1) ^ -(value >> 7));
+    }
+
+    static std::uint8_t zigzagDecode(const std::uint8_t value)
+    {
+        return static_cast<std::uint8_t>((value >> 1) ^ -(value & 1));
+    }
+
+    static void writeExtendedHeader(Encoder &encoder, const int blockSize, const bool zigzag,
+                                    const bool delta, const int widthCode)
+    {
+        encoder.writeKBitsWord(ExtendedHeaderTag, 4);
+        encoder.writeKBitsWord(log2BlockSize(blockSize), 4);
+        encoder.writeKBitsWord(zigzag ? 1 : 0, 1);
+        encoder.writeKBitsWord(delta ? 1 : 0, 1);
+        encoder.writeKBitsWord(widthCode, 2);
+    }
+
+    // Everything after the ExtendedHeaderTag. False if it's malformed.
+    static bool readExtendedHeader(Decoder &decoder, int *blockSize, bool *zigzag, bool *delta, int *widthCode)
+    {
+        if (decoder.getBitCount() - decoder.getBitsRead() < 8)
+        {
+            return false;
+        }
+
+        *blockSize = 1 << decoder.readKBitsWord(4);
+        *zigzag = decoder.readKBitsWord(1) != 0;
+        *delta = decoder.readKBitsWord(1) != 0;
+        *widthCode = decoder.readKBitsWord(2);
+        return *blockSize >= MinBlockSize && *blockSize <= MaxBlockSize;
+    }
+
+    // ========================================================
+    // Per-block K search:
+    // ========================================================
+
+    // Scoring every K on every block costs several times more than coding it. But the
+    // output size is convex in K: a code is 1 + K bits plus the quotient, and one more
+    // bit of K never saves more quotient bits than the one before did. So start from
+    // the K the block's mean suggests, about log2(mean) for geometric values, and step
+    // while the size drops. That is two or three cheap passes over a block in cache,
+    // and the same K as a full scan, ties going to the smaller K.
+    //
+    // Escapes break that for wider values: going down a K can push a large value over
+    // EscapeQuotient, so the size jumps and the walk would stop short. Their start is
+    // estimated for every K instead, from the count and sum of the values of each bit
+    // length, which tells exactly which ones escape and the quotients to within one.
+
+    static int log2Floor(std::uint64_t value)
+    {
+        int log2Value = 0;
+        while (value > 1)
+        {
+            value >>= 1;
+            ++log2Value;
+        }
+        return log2Value;
+    }
+
+    static int bitLength(const std::uint32_t value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return (value != 0) ? 32 - __builtin_clz(value) : 0;
+#else
+        return (value != 0) ? log2Floor(value) + 1 : 0;
+#endif
+    }
+
+    static std::uint32_t blockCodeBits(const std::uint8_t *values, const int count, const int KBits)
+    {
+        std::uint32_t quotientSum = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            quotientSum += values[i] >> KBits;
+        }
+        return static_cast<std::uint32_t>(count) * (1 + KBits) + quotientSum;
+    }
+
+    static std::uint64_t valueBlockCodeBits(const std::uint32_t *values, const int count, const int KBits,
+                                            const int valueBits)
+    {
+        const std::uint32_t escapeBits = EscapeQuotient + valueBits;
+        std::uint64_t outputSize = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            const std::uint32_t q = values[i] >> KBits;
+            outputSize += (q < static_cast<std::uint32_t>(EscapeQuotient)) ? (q + 1 + KBits) : escapeBits;
+        }
+        return outputSize;
+    }
+
+    // Walks from startK towards the smallest codeBits(k) in [0, KBitsMax].
+    template <typename CodeBits>
+    static int descendKBits(int startK, const int KBitsMax, const CodeBits &codeBits)
+    {
+        int KBits = (startK < KBitsMax) ? startK : KBitsMax;
+        auto size = codeBits(KBits);
+        bool movedDown = false;
+        while (KBits > 0)
+        {
+            const auto smaller = codeBits(KBits - 1);
+            if (smaller > size)
+            {
+                break;
+            }
+            --KBits;
+            size = smaller;
+            movedDown = true;
+        }
+        while (!movedDown && KBits < KBitsMax)
+        {
+            const auto larger = codeBits(KBits + 1);
+            if (larger >= size)
+            {
+                break;
+            }
+            ++KBits;
+            size = larger;
+        }
+        return KBits;
+    }
+
+    static int findBlockKBits(const std::uint8_t *values, const int count)
+    {
+        std::uint32_t sum = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            sum += values[i];
+        }
+        return descendKBits(log2Floor(sum / count), 8, [&](const int KBits)
+        {
+            return blockCodeBits(values, count, KBits);
+        });
+    }
+
+    static int findValueBlockKBits(const std::uint32_t *values, const int count, const int valueBits)
+    {
+        // A value escapes once its quotient reaches EscapeQuotient, a power of two.
+        constexpr int escapeLengthOverK = 4;
+        static_assert((1 << escapeLengthOverK) == EscapeQuotient, "Escapes must start at a bit length");
+
+        std::uint32_t lengthCounts[33] = {};
+        std::uint64_t lengthSums[33] = {};
+        for (int i = 0; i < count; ++i)
+        {
+            const int length = bitLength(values[i]);
+            ++lengthCounts[length];
+            lengthSums[length] += values[i];
+        }
+
+        const std::uint64_t escapeBits = EscapeQuotient + valueBits;
+        int startK = 0;
+        std::uint64_t bestEstimate = 0;
+        for (int k = 0; k < valueBits; ++k)
+        {
+            std::uint64_t estimate = 0;
+            for (int length = 0; length <= valueBits; ++length)
+            {
+                estimate += (length > k + escapeLengthOverK) ? lengthCounts[length] * escapeBits :
+                            lengthCounts[length] * std::uint64_t(1 + k) + (lengthSums[length] >> k);
+            }
+            if (k == 0 || estimate < bestEstimate)
+            {
+                bestEstimate = estimate;
+                startK = k;
+            }
+        }
+
+        return descendKBits(startK, valueBits - 1, [&](const int KBits)
+        {
+            return valueBlockCodeBits(values, count, KBits, valueBits);
+        });
+    }
+
+    static void encodeBlocks(Encoder &encoder, const std::uint8_t *input, const int inSizeBytes,
+                             const int blockSize, const bool zigzag, const bool delta)
+    {
+        writeExtendedHeader(encoder, blockSize, zigzag, delta, 0);
+
+        std::uint8_t mapped[MaxBlockSize];
+        std::uint8_t previous = 0;
+
+        for (int start = 0; start < inSizeBytes; start += blockSize)
+        {
+            const int count = (inSizeBytes - start < blockSize) ? (inSizeBytes - start) : blockSize;
+            const std::uint8_t *values = input + start;
+
+            if (zigzag || delta)
+            {
+                for (int i = 0; i < count; ++i)
+                {
+                    std::uint8_t value = values[i];
+                    if (delta)
+                    {
+                        const std::uint8_t current = value;
+                        value = static_cast<std::uint8_t>(current - previous);
+                        previous = current;
+                    }
+                    mapped[i] = zigzag ? zigzagEncode(value) : value;
+                }
+                values = mapped;
+            }
+
+            const int KBits = findBlockKBits(values, count);
+
+            encoder.writeKBitsWord(KBits, 4);
+            encoder.encodeBytes(values, count, KBits);
+
+            if (encoder.isOverflowed())
+            {
+                return; // Output won't be used, stop early.
+            }
+        }
+    }
+
+    // ========================================================
+    // easyEncode() implementation:
+    // ========================================================
+
+    void easyEncode(const std::uint8_t *uncompressed, const int uncompressedSizeBytes,
+                    std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits,
+                    const int blockSize, const bool zigzag, const bool delta, const Allocator &allocator)
+    {
+        if (uncompressed == nullptr || compressed == nullptr)
+        {
+            RICE_ERROR("rice::easyEncode(): Null data pointer(s)!");
+            return;
+        }
+
+        if (uncompressedSizeBytes <= 0 || compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
+        {
+            RICE_ERROR("rice::easyEncode(): Bad in/out sizes!");
+            return;
+        }
+
+        if (!checkBlockOptions(blockSize, zigzag, delta))
+        {
+            return;
+        }
+
+        if (blockSize != 0)
+        {
+            Encoder blockEncoder(allocator, maxCompressedSize(uncompressedSizeBytes, blockSize) * 8);
+            encodeBlocks(blockEncoder, uncompressed, uncompressedSizeBytes, blockSize, zigzag, delta);
+
+            *compressedSizeBytes = blockEncoder.getByteCount();
+            *compressedSizeBits = blockEncoder.getBitCount();
+            *compressed = blockEncoder.release();
+            return;
+        }
+
+        // Find the best K number of bits for the encoding, up to 8.
+        int minCompressedBitSize;
+        const int KBits = Encoder::findBestKBits(uncompressed, uncompressedSizeBytes, 8, &minCompressedBitSize);
+
+        Encoder bitStreamEncoder(allocator, minCompressedBitSize);
+
+        // The decoder needs to know the number of bits we've used.
+        // Since the max is 8, we only need up to 4 bits for that.
+        bitStreamEncoder.writeKBitsWord(KBits, 4);
+
+        // Encode each byte of the input:
+        bitStreamEncoder.encodeBytes(uncompressed, uncompressedSizeBytes, KBits);
+
+        // Pass ownership of the compressed data buffer to the user pointer:
+        *compressedSizeBytes = bitStreamEncoder.getByteCount();
         *compressedSizeBits = bitStreamEncoder.getBitCount();
         *compressed = bitStreamEncoder.release();
     }
 
+    bool easyEncode(const std::uint8_t *uncompressed, const int uncompressedSizeBytes,
+                    std::uint8_t *compressed, const int compressedCapacityBytes,
+                    int *compressedSizeBytes, int *compressedSizeBits,
+                    const int blockSize, const bool zigzag, const bool delta)
+    {
+        if (uncompressed == nullptr || compressed == nullptr)
+        {
+            RICE_ERROR("rice::easyEncode(): Null data pointer(s)!");
+            return false;
+        }
+
+        if (uncompressedSizeBytes <= 0 || compressedCapacityBytes <= 0 ||
+            compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
+        {
+            RICE_ERROR("rice::easyEncode(): Bad in/out sizes!");
+            return false;
+        }
+
+        if (!checkBlockOptions(blockSize, zigzag, delta))
+        {
+            return false;
+        }
+
+        if (blockSize != 0)
+        {
+            Encoder blockEncoder(compressed, compressedCapacityBytes);
+            encodeBlocks(blockEncoder, uncompressed, uncompressedSizeBytes, blockSize, zigzag, delta);
+            if (blockEncoder.isOverflowed())
+            {
+                return false;
+            }
+
+            *compressedSizeBytes = blockEncoder.getByteCount();
+            *compressedSizeBits = blockEncoder.getBitCount();
+            return true;
+        }
+
+        int minCompressedBitSize;
+        const int KBits = Encoder::findBestKBits(uncompressed, uncompressedSizeBytes, 8, &minCompressedBitSize);
+
+        // The best K is known upfront, and with it the exact output size.
+        if (4 + minCompressedBitSize > compressedCapacityBytes * 8)
+        {
+            return false;
+        }
+
+        Encoder bitStreamEncoder(compressed, compressedCapacityBytes);
+        bitStreamEncoder.writeKBitsWord(KBits, 4);
+        bitStreamEncoder.encodeBytes(uncompressed, uncompressedSizeBytes, KBits);
+        assert(!bitStreamEncoder.isOverflowed());
+
+        *compressedSizeBytes = bitStreamEncoder.getByteCount();
+        *compressedSizeBits = bitStreamEncoder.getBitCount();
+        return true;
+    }
+
+    int maxCompressedSize(const int uncompressedSizeBytes, const int blockSize)
+    {
+        // K = 8 codes every byte in 9 bits, and that's always a candidate. Plus the K header.
+        const std::uint64_t n = (uncompressedSizeBytes > 0) ? uncompressedSizeBytes : 0;
+        if (blockSize <= 0)
+        {
+            return static_cast<int>((4 + 9 * n + 7) / 8);
+        }
+
+        // Extended header, then a K per block.
+        const std::uint64_t blockCount = (n + blockSize - 1) / blockSize;
+        return static_cast<int>((12 + 4 * blockCount + 9 * n + 7) / 8);
+    }
+
     // ========================================================
     // easyDecode() implementation:
     // ========================================================
 
+    static int decodeBlocks(Decoder &bitStreamDecoder, std::uint8_t *uncompressed, const int uncompressedSizeBytes)
+    {
+        int blockSize, widthCode;
+        bool zigzag, delta;
+        if (!readExtendedHeader(bitStreamDecoder, &blockSize, &zigzag, &delta, &widthCode))
+        {
+            bitStreamDecoder.fail(DecodeStatus::BadHeader, "rice::easyDecode(): Bad extended header!");
+            return 0;
+        }
+        if (widthCode != 0)
+        {
+            bitStreamDecoder.fail(DecodeStatus::BadHeader, "rice::easyDecode(): Not a byte stream, use easyDecodeValues()!");
+            return 0;
+        }
+
+        std::uint8_t previous = 0;
+        int bytesDecoded = 0;
+
+        while (bytesDecoded < uncompressedSizeBytes)
+        {
+            const int remaining = uncompressedSizeBytes - bytesDecoded;
+            const int count = (remaining < blockSize) ? remaining : blockSize;
+
+            if (bitStreamDecoder.getBitCount() - bitStreamDecoder.getBitsRead() < 4)
+            {
+                bitStreamDecoder.fail(DecodeStatus::CorruptData, "Failed to read bits from stream! Unexpected end.");
+                break;
+            }
+            const int KBits = bitStreamDecoder.readKBitsWord(4);
+            if (KBits > 8)
+            {
+                bitStreamDecoder.fail(DecodeStatus::CorruptData, "rice::easyDecode(): Bad block K!");
+                break;
+            }
+
+            std::uint8_t *values = uncompressed + bytesDecoded;
+            const int decoded = bitStreamDecoder.readValues(KBits, values, count);
+
+            if (zigzag || delta)
+            {
+                for (int i = 0; i < decoded; ++i)
+                {
+                    std::uint8_t value = zigzag ? zigzagDecode(values[i]) : values[i];
+                    if (delta)
+                    {
+                        value = static_cast<std::uint8_t>(previous + value);
+                        previous = value;
+                    }
+                    values[i] = value;
+                }
+            }
+
+            bytesDecoded += decoded;
+            if (decoded < count)
+            {
+                break;
+            }
+        }
+
+        return bytesDecoded;
+    }
+
+    // Either layout, after the decoder was set up. Shared by easyDecode() and safeDecode().
+    static int decodeBytes(Decoder &bitStreamDecoder, std::uint8_t *uncompressed, const int uncompressedSizeBytes)
+    {
+        // KBits word length is fixed to 4 bits.
+        if (bitStreamDecoder.getBitCount() < 4)
+        {
+            bitStreamDecoder.fail(DecodeStatus::BadHeader, "Failed to read bits from stream! Unexpected end.");
+            return 0;
+        }
+        const int KBits = bitStreamDecoder.readKBitsWord(4);
+        if (KBits == ExtendedHeaderTag)
+        {
+            return decodeBlocks(bitStreamDecoder, uncompressed, uncompressedSizeBytes);
+        }
+        if (KBits > 8)
+        {
+            bitStreamDecoder.fail(DecodeStatus::BadHeader, "rice::easyDecode(): Bad K in stream header!");
+            return 0;
+        }
+
+        return bitStreamDecoder.readValues(KBits, uncompressed, uncompressedSizeBytes);
+    }
+
+    // Sizes in bits and bytes must agree, so the decoder never reads past the buffer.
+    static bool safeSizesOk(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
+                            const void *uncompressed, const int uncompressedCount, const int *decodedCount)
+    {
+        return compressed != nullptr && uncompressed != nullptr && decodedCount != nullptr &&
+               compressedSizeBytes > 0 && compressedSizeBits > 0 && uncompressedCount > 0 &&
+               (compressedSizeBits + 7) / 8 <= compressedSizeBytes;
+    }
+
     int easyDecode(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
                    std::uint8_t *uncompressed, const int uncompressedSizeBytes)
     {
@@ -495,45 +1652,516 @@ namespace rice
         }
 
         Decoder bitStreamDecoder(compressed, compressedSizeBytes, compressedSizeBits);
+        return decodeBytes(bitStreamDecoder, uncompressed, uncompressedSizeBytes);
+    }
 
-        // KBits word length is fixed to 4 bits.
-        const int KBits = bitStreamDecoder.readKBitsWord(4);
-        const int m = 1 << KBits;
+    DecodeStatus safeDecode(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
+                            std::uint8_t *uncompressed, const int uncompressedSizeBytes, int *bytesDecoded)
+    {
+        if (bytesDecoded != nullptr)
+        {
+            *bytesDecoded = 0;
+        }
+        if (!safeSizesOk(compressed, compressedSizeBytes, compressedSizeBits, uncompressed, uncompressedSizeBytes, bytesDecoded))
+        {
+            return DecodeStatus::BadArguments;
+        }
 
-        int bytesDecoded = 0;
+        Decoder bitStreamDecoder(compressed, compressedSizeBytes, compressedSizeBits, false);
+        *bytesDecoded = decodeBytes(bitStreamDecoder, uncompressed, uncompressedSizeBytes);
+        return bitStreamDecoder.getStatus();
+    }
+
+    // ========================================================
+    // easyEncodeValues() / easyDecodeValues() implementation:
+    // ========================================================
+
+    template <typename T>
+    static void encodeValueBlocks(Encoder &encoder, const T *input, const int valueCount,
+                                  const int blockSize, const bool zigzag, const bool delta)
+    {
+        constexpr int valueBits = sizeof(T) * 8;
+        constexpr std::uint32_t valueMask = static_cast<std::uint32_t>((std::uint64_t(1) << valueBits) - 1);
+        using UnsignedT = typename std::make_unsigned<T>::type;
+
+        writeExtendedHeader(encoder, blockSize, zigzag, delta, (valueBits == 16) ? 1 : 2);
+
+        std::uint32_t mapped[MaxBlockSize];
+        std::uint32_t previous = 0;
+
+        for (int start = 0; start < valueCount; start += blockSize)
+        {
+            const int count = (valueCount - start < blockSize) ? (valueCount - start) : blockSize;
+            for (int i = 0; i < count; ++i)
+            {
+                std::uint32_t value = static_cast<UnsignedT>(input[start + i]);
+                if (delta)
+                {
+                    const std::uint32_t current = value;
+                    value = (current - previous) & valueMask;
+                    previous = current;
+                }
+                if (zigzag)
+                {
+                    const std::uint32_t sign = value >> (valueBits - 1);
+                    value = ((value << 1) ^ (0u - sign)) & valueMask;
+                }
+                mapped[i] = value;
+            }
+
+            const int KBits = findValueBlockKBits(mapped, count, valueBits);
+
+            encoder.writeKBitsWord(KBits, 5);
+            for (int i = 0; i < count; ++i)
+            {
+                encoder.encodeValue(mapped[i], KBits, valueBits);
+            }
+
+            if (encoder.isOverflowed())
+            {
+                return; // Output won't be used, stop early.
+            }
+        }
+    }
+
+    template <typename T>
+    static bool checkValueOptions(const T *values, const int valueCount, const void *compressed,
+                                  const int *compressedSizeBytes, const int *compressedSizeBits, const int blockSize)
+    {
+        static_assert(sizeof(T) == 2 || sizeof(T) == 4, "rice::easyEncodeValues() takes 16 or 32-bit integers");
+
+        if (values == nullptr || compressed == nullptr)
+        {
+            RICE_ERROR("rice::easyEncodeValues(): Null data pointer(s)!");
+            return false;
+        }
+
+        if (valueCount <= 0 || compressedSizeBytes == nullptr || compressedSizeBits == nullptr)
+        {
+            RICE_ERROR("rice::easyEncodeValues(): Bad in/out sizes!");
+            return false;
+        }
+
+        if (blockSize == 0)
+        {
+            RICE_ERROR("rice::easyEncodeValues(): Needs a blockSize!");
+            return false;
+        }
+        return checkBlockOptions(blockSize, false, false);
+    }
+
+    template <typename T>
+    void easyEncodeValues(const T *values, const int valueCount,
+                          std::uint8_t **compressed, int *compressedSizeBytes, int *compressedSizeBits,
+                          const int blockSize, const bool zigzag, const bool delta, const Allocator &allocator)
+    {
+        if (!checkValueOptions(values, valueCount, compressed, compressedSizeBytes, compressedSizeBits, blockSize))
+        {
+            return;
+        }
+
+        Encoder bitStreamEncoder(allocator, maxCompressedSizeValues<T>(valueCount, blockSize) * 8);
+        encodeValueBlocks(bitStreamEncoder, values, valueCount, blockSize, zigzag, delta);
+
+        *compressedSizeBytes = bitStreamEncoder.getByteCount();
+        *compressedSizeBits = bitStreamEncoder.getBitCount();
+        *compressed = bitStreamEncoder.release();
+    }
+
+    template <typename T>
+    bool easyEncodeValues(const T *values, const int valueCount,
+                          std::uint8_t *compressed, const int compressedCapacityBytes,
+                          int *compressedSizeBytes, int *compressedSizeBits,
+                          const int blockSize, const bool zigzag, const bool delta)
+    {
+        if (!checkValueOptions(values, valueCount, compressed, compressedSizeBytes, compressedSizeBits, blockSize))
+        {
+            return false;
+        }
+
+        if (compressedCapacityBytes <= 0)
+        {
+            RICE_ERROR("rice::easyEncodeValues(): Bad in/out sizes!");
+            return false;
+        }
+
+        Encoder bitStreamEncoder(compressed, compressedCapacityBytes);
+        encodeValueBlocks(bitStreamEncoder, values, valueCount, blockSize, zigzag, delta);
+        if (bitStreamEncoder.isOverflowed())
+        {
+            return false;
+        }
+
+        *compressedSizeBytes = bitStreamEncoder.getByteCount();
+        *compressedSizeBits = bitStreamEncoder.getBitCount();
+        return true;
+    }
+
+    template <typename T>
+    int maxCompressedSizeValues(const int valueCount, const int blockSize)
+    {
+        // K = bits - 1 codes any value in bits + 1, and that's always a candidate.
+        constexpr std::uint64_t valueBits = sizeof(T) * 8;
+        const std::uint64_t n = (valueCount > 0) ? valueCount : 0;
+        const std::uint64_t blockCount = (blockSize > 0) ? (n + blockSize - 1) / blockSize : n;
+        return static_cast<int>((12 + 5 * blockCount + (valueBits + 1) * n + 7) / 8);
+    }
+
+    // Everything after the pointer and size checks, shared by easyDecodeValues() and safeDecodeValues().
+    template <typename T>
+    static int decodeValueBlocks(Decoder &bitStreamDecoder, T *values, const int valueCount)
+    {
+        constexpr int valueBits = sizeof(T) * 8;
+        constexpr std::uint32_t valueMask = static_cast<std::uint32_t>((std::uint64_t(1) << valueBits) - 1);
+        using UnsignedT = typename std::make_unsigned<T>::type;
+
+        int blockSize, widthCode;
+        bool zigzag, delta;
+        if (bitStreamDecoder.getBitCount() < 4 || bitStreamDecoder.readKBitsWord(4) != ExtendedHeaderTag ||
+            !readExtendedHeader(bitStreamDecoder, &blockSize, &zigzag, &delta, &widthCode) ||
+            widthCode != ((valueBits == 16) ? 1 : 2))
+        {
+            bitStreamDecoder.fail(DecodeStatus::BadHeader, "rice::easyDecodeValues(): Bad header, or values of another size!");
+            return 0;
+        }
+
+        std::uint32_t decoded[MaxBlockSize];
+        std::uint32_t previous = 0;
+        int valuesDecoded = 0;
+
+        while (valuesDecoded < valueCount)
+        {
+            const int remaining = valueCount - valuesDecoded;
+            const int count = (remaining < blockSize) ? remaining : blockSize;
+
+            if (bitStreamDecoder.getBitCount() - bitStreamDecoder.getBitsRead() < 5)
+            {
+                bitStreamDecoder.fail(DecodeStatus::CorruptData, "Failed to read bits from stream! Unexpected end.");
+                break;
+            }
+            const int KBits = bitStreamDecoder.readKBitsWord(5);
+            if (KBits >= valueBits)
+            {
+                bitStreamDecoder.fail(DecodeStatus::CorruptData, "rice::easyDecodeValues(): Bad block K!");
+                break;
+            }
+
+            const int got = bitStreamDecoder.readValues(KBits, valueBits, decoded, count);
+            for (int i = 0; i < got; ++i)
+            {
+                std::uint32_t value = decoded[i];
+                if (zigzag)
+                {
+                    value = ((value >> 1) ^ (0u - (value & 1))) & valueMask;
+                }
+                if (delta)
+                {
+                    value = (previous + value) & valueMask;
+                    previous = value;
+                }
+                values[valuesDecoded + i] = static_cast<T>(static_cast<UnsignedT>(value));
+            }
+
+            valuesDecoded += got;
+            if (got < count)
+            {
+                break;
+            }
+        }
+
+        return valuesDecoded;
+    }
+
+    template <typename T>
+    int easyDecodeValues(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
+                         T *values, const int valueCount)
+    {
+        static_assert(sizeof(T) == 2 || sizeof(T) == 4, "rice::easyDecodeValues() takes 16 or 32-bit integers");
+
+        if (compressed == nullptr || values == nullptr)
+        {
+            RICE_ERROR("rice::easyDecodeValues(): Null data pointer(s)!");
+            return 0;
+        }
+
+        if (compressedSizeBytes <= 0 || compressedSizeBits <= 0 || valueCount <= 0)
+        {
+            RICE_ERROR("rice::easyDecodeValues(): Bad in/out sizes!");
+            return 0;
+        }
+
+        Decoder bitStreamDecoder(compressed, compressedSizeBytes, compressedSizeBits);
+        return decodeValueBlocks(bitStreamDecoder, values, valueCount);
+    }
+
+    template <typename T>
+    DecodeStatus safeDecodeValues(const std::uint8_t *compressed, const int compressedSizeBytes, const int compressedSizeBits,
+                                  T *values, const int valueCount, int *valuesDecoded)
+    {
+        static_assert(sizeof(T) == 2 || sizeof(T) == 4, "rice::safeDecodeValues() takes 16 or 32-bit integers");
+
+        if (valuesDecoded != nullptr)
+        {
+            *valuesDecoded = 0;
+        }
+        if (!safeSizesOk(compressed, compressedSizeBytes, compressedSizeBits, values, valueCount, valuesDecoded))
+        {
+            return DecodeStatus::BadArguments;
+        }
+
+        Decoder bitStreamDecoder(compressed, compressedSizeBytes, compressedSizeBits, false);
+        *valuesDecoded = decodeValueBlocks(bitStreamDecoder, values, valueCount);
+        return bitStreamDecoder.getStatus();
+    }
+
+    template void easyEncodeValues<std::uint16_t>(const std::uint16_t *, int, std::uint8_t **, int *, int *, int, bool, bool,
+                                                  const Allocator &);
+    template void easyEncodeValues<std::int16_t>(const std::int16_t *, int, std::uint8_t **, int *, int *, int, bool, bool,
+                                                  const Allocator &);
+    template void easyEncodeValues<std::uint32_t>(const std::uint32_t *, int, std::uint8_t **, int *, int *, int, bool, bool,
+                                                  const Allocator &);
+    template void easyEncodeValues<std::int32_t>(const std::int32_t *, int, std::uint8_t **, int *, int *, int, bool, bool,
+                                                  const Allocator &);
+    template bool easyEncodeValues<std::uint16_t>(const std::uint16_t *, int, std::uint8_t *, int, int *, int *, int, bool, bool);
+    template bool easyEncodeValues<std::int16_t>(const std::int16_t *, int, std::uint8_t *, int, int *, int *, int, bool, bool);
+    template bool easyEncodeValues<std::uint32_t>(const std::uint32_t *, int, std::uint8_t *, int, int *, int *, int, bool, bool);
+    template bool easyEncodeValues<std::int32_t>(const std::int32_t *, int, std::uint8_t *, int, int *, int *, int, bool, bool);
+    template int maxCompressedSizeValues<std::uint16_t>(int, int);
+    template int maxCompressedSizeValues<std::int16_t>(int, int);
+    template int maxCompressedSizeValues<std::uint32_t>(int, int);
+    template int maxCompressedSizeValues<std::int32_t>(int, int);
+    template int easyDecodeValues<std::uint16_t>(const std::uint8_t *, int, int, std::uint16_t *, int);
+    template int easyDecodeValues<std::int16_t>(const std::uint8_t *, int, int, std::int16_t *, int);
+    template int easyDecodeValues<std::uint32_t>(const std::uint8_t *, int, int, std::uint32_t *, int);
+    template int easyDecodeValues<std::int32_t>(const std::uint8_t *, int, int, std::int32_t *, int);
+    template DecodeStatus safeDecodeValues<std::uint16_t>(const std::uint8_t *, int, int, std::uint16_t *, int, int *);
+    template DecodeStatus safeDecodeValues<std::int16_t>(const std::uint8_t *, int, int, std::int16_t *, int, int *);
+    template DecodeStatus safeDecodeValues<std::uint32_t>(const std::uint8_t *, int, int, std::uint32_t *, int, int *);
+    template DecodeStatus safeDecodeValues<std::int32_t>(const std::uint8_t *, int, int, std::int32_t *, int, int *);
+
+    // ========================================================
+    // class StreamEncoder:
+    // ========================================================
+
+    StreamEncoder::StreamEncoder(const int KBits)
+        : bitBuffer(0), bitBufferCount(0), bitsWritten(0), KBits(KBits),
+          onesLeft(0), tail(0), tailBits(0), finished(false)
+    {
+        if (KBits < 0 || KBits > 8)
+        {
+            RICE_ERROR("rice::StreamEncoder: KBits must be between 0 and 8!");
+            this->KBits = (KBits < 0) ? 0 : 8;
+        }
+
+        // The decoder needs to know the number of bits we've used.
+        putBits(static_cast<std::uint64_t>(this->KBits), 4);
+    }
+
+    void StreamEncoder::putBits(const std::uint64_t num, const int bitCount)
+    {
+        assert(bitBufferCount + bitCount <= 64);
+        if (bitCount <= 0)
+        {
+            return;
+        }
+        bitBuffer |= num << bitBufferCount;
+        bitBufferCount += bitCount;
+        bitsWritten += bitCount;
+    }
+
+    void StreamEncoder::flushBits()
+    {
+        while (bitBufferCount >= 8 && availOut != 0)
+        {
+            *nextOut++ = static_cast<std::uint8_t>(bitBuffer);
+            --availOut;
+            ++totalOut;
+            bitBuffer >>= 8;
+            bitBufferCount -= 8;
+        }
+    }
+
+    StreamStatus StreamEncoder::encode(const bool finish)
+    {
         for (;;)
         {
-            int q = 0;
-            int bit = 0;
+            flushBits();
+            if (bitBufferCount >= 8)
+            {
+                return StreamStatus::Ok; // Output buffer full.
+            }
 
-            // Reconstruct q:
-            while (bitStreamDecoder.readNextBit(bit) && (bit == 1))
+            // Rest of a long code, a piece at a time:
+            if (onesLeft > 0)
+            {
+                const int count = (onesLeft < 32) ? onesLeft : 32;
+                putBits((std::uint64_t(1) << count) - 1, count);
+                onesLeft -= count;
+                continue;
+            }
+            if (tailBits > 0)
             {
-                ++q;
+                putBits(tail, tailBits);
+                tailBits = 0;
+                continue;
+            }
+
+            if (finished)
+            {
+                return StreamStatus::StreamEnd;
+            }
+
+            if (availIn == 0)
+            {
+                if (!finish)
+                {
+                    return StreamStatus::Ok; // Needs more input.
+                }
+                bitBufferCount = (bitBufferCount + 7) & ~7;
+                finished = true;
+                continue;
             }
 
-            // Reconstruct the remainder:
-            int value = m * q;
-            for (int i = KBits - 1; i >= 0; i--)
+            // q 1 bits, a terminating 0, then the remainder MSB first, same as Encoder::encodeByte().
+            while (availIn != 0)
             {
-                if (!bitStreamDecoder.readNextBit(bit))
+                const int value = *nextIn;
+                const int q = value >> KBits;
+                const std::uint64_t remainder = reverseBits(static_cast<std::uint32_t>(value & ((1 << KBits) - 1)), KBits);
+                const int codeLength = q + 1 + KBits;
+
+                if (bitBufferCount + codeLength > 56)
                 {
-                    RICE_ERROR("Failed to read bits from stream! Unexpected end.");
-                    return bytesDecoded;
+                    if (bitBufferCount < 8)
+                    {
+                        // Doesn't fit even in an empty buffer; split it up.
+                        onesLeft = q;
+                        tail = static_cast<std::uint32_t>(remainder << 1);
+                        tailBits = 1 + KBits;
+                        ++nextIn;
+                        --availIn;
+                        ++totalIn;
+                    }
+                    break;
                 }
-                value = value | (bit << i);
+
+                putBits(((std::uint64_t(1) << q) - 1) | (remainder << (q + 1)), codeLength);
+                ++nextIn;
+                --availIn;
+                ++totalIn;
             }
+        }
+    }
 
-            *uncompressed++ = static_cast<std::uint8_t>(value);
-            bytesDecoded++;
+    // ========================================================
+    // class StreamDecoder:
+    // ========================================================
 
-            if (bytesDecoded == uncompressedSizeBytes)
+    StreamDecoder::StreamDecoder(const std::uint64_t valueCount)
+        : bitBuffer(0), bitBufferCount(0), valuesLeft(valueCount),
+          KBits(-1), quotient(0), inUnary(true), failed(false)
+    {
+    }
+
+    bool StreamDecoder::fillBits(const int bitCount)
+    {
+        // Byte at a time, so we never consume input past the end of the stream.
+        while (bitBufferCount < bitCount && availIn != 0)
+        {
+            bitBuffer |= static_cast<std::uint64_t>(*nextIn++) << bitBufferCount;
+            bitBufferCount += 8;
+            --availIn;
+            ++totalIn;
+        }
+        return bitBufferCount >= bitCount;
+    }
+
+    StreamStatus StreamDecoder::decode(const bool finish)
+    {
+        if (failed)
+        {
+            return StreamStatus::Error;
+        }
+
+        // If we run out of input now, it better not be the end.
+        const StreamStatus needsInput = finish ? StreamStatus::Error : StreamStatus::Ok;
+
+        // KBits word length is fixed to 4 bits.
+        if (KBits < 0)
+        {
+            if (!fillBits(4))
             {
-                break; // Decompress buffer is full.
+                failed = finish;
+                return needsInput;
+            }
+            KBits = static_cast<int>(bitBuffer & 0xF);
+            bitBuffer >>= 4;
+            bitBufferCount -= 4;
+
+            // Per-block K streams (ExtendedHeaderTag) are easyDecode() only.
+            if (KBits > 8)
+            {
+                failed = true;
+                return StreamStatus::Error;
             }
         }
 
-        return bytesDecoded;
+        while (valuesLeft != 0)
+        {
+            if (availOut == 0)
+            {
+                return StreamStatus::Ok; // Output buffer full.
+            }
+
+            // Reconstruct q:
+            while (inUnary)
+            {
+                if (!fillBits(1))
+                {
+                    failed = finish;
+                    return needsInput;
+                }
+                // All of the buffered ones at once. Bits past bitBufferCount are 0.
+                int ones = countTrailingZeros(~bitBuffer);
+                if (ones > bitBufferCount)
+                {
+                    ones = bitBufferCount;
+                }
+                quotient += ones;
+                if (quotient > (255 >> KBits))
+                {
+                    failed = true; // No byte has a larger quotient.
+                    return StreamStatus::Error;
+                }
+                bitBuffer >>= ones;
+                bitBufferCount -= ones;
+                if (bitBufferCount > 0)
+                {
+                    // Skip the terminating 0.
+                    bitBuffer >>= 1;
+                    --bitBufferCount;
+                    inUnary = false;
+                }
+            }
+
+            // Reconstruct the remainder, stored MSB first:
+            if (!fillBits(KBits))
+            {
+                failed = finish;
+                return needsInput;
+            }
+            const std::uint32_t remainder = reverseBits(static_cast<std::uint32_t>(bitBuffer & ((1u << KBits) - 1)), KBits);
+            bitBuffer >>= KBits;
+            bitBufferCount -= KBits;
+
+            *nextOut++ = static_cast<std::uint8_t>((quotient << KBits) + static_cast<int>(remainder));
+            --availOut;
+            ++totalOut;
+            --valuesLeft;
+            quotient = 0;
+            inUnary = true;
+        }
+        return StreamStatus::StreamEnd;
     }
 
 } // namespace rice {}
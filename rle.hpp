@@ -8,15 +8,169 @@
 //
 // RLE_WORD_SIZE_16 #define controls the size of the RLE word/count.
 // If not defined, use 8-bits count.
+//
+// The encoder looks for the end of each run with SSE2/AVX2 or NEON
+// compares when the compiler targets them, and 8 bytes at a time
+// otherwise. #define RLE_NO_SIMD to always use the portable path.
 
+#include <cstddef>
 #include <cstdint>
 
 namespace rle {
 
-    // RLE encode/decode raw bytes:
-    int easyEncode(const std::uint8_t *input, int inSizeBytes, std::uint8_t *output, int outSizeBytes);
+//
+// #define RLE_WORD_SIZE_16
+// 16-bits run-length word allows for very long sequences,
+// but is also very inefficient if the run-lengths are generally
+// short. Byte-size words are used if this is not defined.
+//
+#ifdef RLE_WORD_SIZE_16
+    using RleWord = std::uint16_t;
+    constexpr RleWord MaxRunLength = RleWord(0xFFFF); // Max run length: 65535 => 4 bytes.
+#else                                                 // !RLE_WORD_SIZE_16
+    using RleWord = std::uint8_t;
+    constexpr RleWord MaxRunLength = RleWord(0xFF); // Max run length: 255 => 2 bytes.
+#endif                                                // RLE_WORD_SIZE_16
+
+    // Each run is stored as a (count, byte) pair.
+    constexpr int PairSizeBytes = sizeof(RleWord) + sizeof(std::uint8_t);
+
+    enum class Format : std::uint8_t {
+        // Every run, even of a single byte, is a (count, byte) pair.
+        // Incompressible data grows by PairSizeBytes times.
+        Legacy,
+
+        // PackBits packets, made of a signed control byte n and then either:
+        //   0 to 127:    n + 1 literal bytes, copied as-is;
+        //   -1 to -127:  one byte, repeated 1 - n times;
+        //   -128:        nothing, skipped by the decoder.
+        // Doesn't depend on RLE_WORD_SIZE_16. Worst case is n + n/128 rounded up.
+        PackBits
+    };
+
+    constexpr int MaxLiteralRun = 128;
+    constexpr int MaxRepeatRun = 128;
+
+    // RLE encode/decode raw bytes. Return the output size, or -1 if it didn't fit.
+    int easyEncode(const std::uint8_t *input, int inSizeBytes, std::uint8_t *output, int outSizeBytes,
+                   Format format = Format::Legacy);
+
+    // Also returns -1 for malformed input.
+    int easyDecode(const std::uint8_t *input, int inSizeBytes, std::uint8_t *output, int outSizeBytes,
+                   Format format = Format::Legacy);
+
+    // Worst-case easyEncode() output size for any input of the given size (no runs at all).
+    int maxCompressedSize(int inSizeBytes, Format format = Format::Legacy);
+
+    // ========================================================
+    // Element runs:
+    // ========================================================
+
+    // Count type for Encoder/Decoder that stores run lengths as LEB128 varints,
+    // so short runs take a single byte and long runs never have to be split.
+    struct VarintCount {};
+
+    // RLE over ElemT elements (std::uint8_t to std::uint64_t) instead of bytes, with a CountT
+    // count (std::uint8_t, std::uint16_t, std::uint32_t or VarintCount) picked at runtime
+    // rather than by RLE_WORD_SIZE_16. Runs are (count, element) pairs; counts are stored
+    // little-endian, elements as they are in memory. Encoder<std::uint8_t, RleWord> gives
+    // the same bytes as Format::Legacy on little-endian machines.
+    //
+    // Only the combinations above are instantiated. Sizes are in elements on the ElemT side.
+    template <typename ElemT, typename CountT>
+    class Encoder final {
+    public:
+        // Returns the encoded size in bytes, or -1 if it didn't fit.
+        static int encode(const ElemT *input, int elemCount, std::uint8_t *output, int outSizeBytes);
+
+        // Size encode() would output, without writing anything.
+        static int encodedSize(const ElemT *input, int elemCount);
 
-    int easyDecode(const std::uint8_t *input, int inSizeBytes, std::uint8_t *output, int outSizeBytes);
+        // Worst case, no runs at all.
+        static int maxCompressedSize(int elemCount);
+    };
+
+    template <typename ElemT, typename CountT>
+    class Decoder final {
+    public:
+        // Returns the number of elements decoded, or -1 if they didn't fit or the input is malformed.
+        static int decode(const std::uint8_t *input, int inSizeBytes, ElemT *output, int outElemCount);
+    };
+
+    // Tagged easy API. easyEncodeTagged() tries every element size that divides the input
+    // size with every count type, keeps the smallest output and prefixes it with a tag byte:
+    //
+    // +----------------+----------------+-----------------+-------------------------+
+    // | reserved (b5-7)| stored (b4)    | count (b2-3)    | log2 element size (b0-1)|
+    // +----------------+----------------+-----------------+-------------------------+
+    //
+    // Count is 0 for 8 bits, 1 for 16, 2 for 32 and 3 for varints. Reserved bits are zero.
+    // If no run encoding is smaller than the input, the input is copied as is after a
+    // tag of just the stored bit, so the output is never more than one byte bigger.
+    int easyEncodeTagged(const std::uint8_t *input, int inSizeBytes, std::uint8_t *output, int outSizeBytes);
+
+    // Returns the decoded size in bytes, or -1.
+    int easyDecodeTagged(const std::uint8_t *input, int inSizeBytes, std::uint8_t *output, int outSizeBytes);
+
+    // Worst-case easyEncodeTagged() output size: the tag plus a stored copy of the input.
+    int maxCompressedSizeTagged(int inSizeBytes);
+
+    // ========================================================
+    // Streaming API:
+    // ========================================================
+
+    // For inputs too big to hold in memory at once. Set nextIn/availIn and
+    // nextOut/availOut, then call encode()/decode() until the input is used up,
+    // refilling the buffers in between, same as zlib's z_stream. The calls
+    // advance the pointers and counters by however much they consumed/produced.
+    // Output is the same as easyEncode()/easyDecode() over the whole data, in Format::Legacy.
+    struct StreamBuffers {
+        const std::uint8_t *nextIn = nullptr; // Next input byte.
+        std::size_t availIn = 0;              // Number of bytes available at nextIn.
+        std::uint64_t totalIn = 0;            // Total input bytes consumed so far.
+
+        std::uint8_t *nextOut = nullptr;      // Next output byte goes here.
+        std::size_t availOut = 0;             // Remaining free space at nextOut.
+        std::uint64_t totalOut = 0;           // Total output bytes produced so far.
+    };
+
+    enum class StreamStatus : std::uint8_t {
+        Ok,        // Progress made, or needs more input/output space to make any.
+        StreamEnd, // Finished; all the output has been written out.
+        Error      // Malformed input. The stream can't continue.
+    };
+
+    class StreamEncoder final : public StreamBuffers {
+    public:
+        StreamEncoder();
+
+        // Pass finish = true once the last of the input has been supplied.
+        // Keep calling with more output space until it returns StreamEnd.
+        StreamStatus encode(bool finish);
+
+    private:
+        bool flushPending();
+
+        std::uint8_t pending[PairSizeBytes]; // Last pair while the output buffer is full.
+        int pendingBytes;                    // Bytes of pending[] not written yet.
+        int runLength;                       // Current run. Zero before the first input byte.
+        std::uint8_t runByte;
+    };
+
+    class StreamDecoder final : public StreamBuffers {
+    public:
+        StreamDecoder();
+
+        // Pass finish = true once the last of the input has been supplied.
+        // A run is expanded as output space allows, across calls.
+        StreamStatus decode(bool finish);
+
+    private:
+        std::uint8_t pair[PairSizeBytes]; // Pair split between input chunks.
+        int pairBytes;                    // Bytes gathered in pair[] so far.
+        int runLeft;                      // Bytes of the current run left to output.
+        std::uint8_t runByte;
+    };
 
 } // namespace rle {}
 
@@ -32,29 +186,123 @@ namespace rle {
 
 #ifdef RLE_IMPLEMENTATION
 
+#include <cstring>
+
+#ifndef RLE_NO_SIMD
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RLE_USE_AVX2
+#endif // __AVX2__
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RLE_USE_SSE2
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !(defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__))
+#include <arm_neon.h>
+#define RLE_USE_NEON
+#endif // SSE2/NEON
+#endif // RLE_NO_SIMD
+
 namespace rle
 {
 
-//
-// #define RLE_WORD_SIZE_16
-// 16-bits run-length word allows for very long sequences,
-// but is also very inefficient if the run-lengths are generally
-// short. Byte-size words are used if this is not defined.
-//
-#ifdef RLE_WORD_SIZE_16
-    using RleWord = std::uint16_t;
-    constexpr RleWord MaxRunLength = RleWord(0xFFFF); // Max run length: 65535 => 4 bytes.
-#else                                                 // !RLE_WORD_SIZE_16
-    using RleWord = std::uint8_t;
-    constexpr RleWord MaxRunLength = RleWord(0xFF); // Max run length: 255 => 2 bytes.
-#endif                                                // RLE_WORD_SIZE_16
+    // ========================================================
+
+#if defined(RLE_USE_SSE2) || defined(RLE_USE_NEON)
+    // Index of the lowest set bit. num must not be zero.
+    static int countTrailingZeros(std::uint64_t num)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(num);
+#else
+        int count = 0;
+        for (; (num & 1) == 0; num >>= 1)
+        {
+            ++count;
+        }
+        return count;
+#endif
+    }
+#endif // RLE_USE_SSE2 || RLE_USE_NEON
+
+    // First byte in [ptr, end) that doesn't match the 8-byte pattern, repeated from ptr on, or end if
+    // they all do. Compares a whole vector of bytes at a time, then finds the mismatch in the mask.
+    static const std::uint8_t *findPatternEnd(const std::uint8_t *ptr, const std::uint8_t *const end,
+                                              const std::uint8_t (&pattern)[8])
+    {
+        const std::uint8_t *const begin = ptr;
+        std::uint64_t patternWord;
+        std::memcpy(&patternWord, pattern, sizeof(patternWord));
+
+#if defined(RLE_USE_AVX2)
+        const __m256i pattern32 = _mm256_set1_epi64x(static_cast<long long>(patternWord));
+        for (; end - ptr >= 32; ptr += 32)
+        {
+            const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr));
+            const std::uint32_t equal = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, pattern32)));
+            if (equal != 0xFFFFFFFFu)
+            {
+                return ptr + countTrailingZeros(~equal);
+            }
+        }
+#endif // RLE_USE_AVX2
+
+#if defined(RLE_USE_SSE2)
+        const __m128i pattern16 = _mm_set1_epi64x(static_cast<long long>(patternWord));
+        for (; end - ptr >= 16; ptr += 16)
+        {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+            const std::uint32_t equal = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, pattern16)));
+            if (equal != 0xFFFFu)
+            {
+                return ptr + countTrailingZeros(~equal);
+            }
+        }
+#elif defined(RLE_USE_NEON)
+        const uint8x16_t pattern16 = vreinterpretq_u8_u64(vdupq_n_u64(patternWord));
+        for (; end - ptr >= 16; ptr += 16)
+        {
+            // No movemask on NEON; narrowing the compare result gives 4 bits per byte instead.
+            const uint8x16_t equal = vceqq_u8(vld1q_u8(ptr), pattern16);
+            const std::uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+            if (mask != ~std::uint64_t(0))
+            {
+                return ptr + countTrailingZeros(~mask) / 4;
+            }
+        }
+#else  // Portable
+        for (; end - ptr >= 8; ptr += 8)
+        {
+            std::uint64_t bytes;
+            std::memcpy(&bytes, ptr, sizeof(bytes));
+            if (bytes != patternWord)
+            {
+                break; // Mismatch is in these 8 bytes.
+            }
+        }
+#endif // RLE_USE_SSE2/RLE_USE_NEON
+
+        // The loops above step by multiples of 8, so the pattern lines up with begin.
+        while (ptr != end && *ptr == pattern[(ptr - begin) & 7])
+        {
+            ++ptr;
+        }
+        return ptr;
+    }
+
+    // First byte in [ptr, end) that is not runByte, or end if the run goes all the way.
+    static const std::uint8_t *findRunEnd(const std::uint8_t *ptr, const std::uint8_t *const end, const std::uint8_t runByte)
+    {
+        std::uint8_t pattern[8];
+        std::memset(pattern, runByte, sizeof(pattern));
+        return findPatternEnd(ptr, end, pattern);
+    }
 
     // ========================================================
 
     template <typename T>
     static int writeData(std::uint8_t *&output, const T val)
     {
-        *reinterpret_cast<T *>(output) = val;
+        std::memcpy(output, &val, sizeof(T));
         output += sizeof(T);
         return sizeof(T);
     }
@@ -62,63 +310,112 @@ namespace rle
     template <typename T>
     static void readData(const std::uint8_t *&input, T &val)
     {
-        val = *reinterpret_cast<const T *>(input);
+        std::memcpy(&val, input, sizeof(T));
         input += sizeof(T);
     }
 
     // ========================================================
 
-    int easyEncode(const std::uint8_t *input, const int inSizeBytes, std::uint8_t *output, const int outSizeBytes)
+    static int encodeLegacy(const std::uint8_t *input, const int inSizeBytes, std::uint8_t *output, const int outSizeBytes)
     {
-        if (input == nullptr || output == nullptr)
-        {
-            return -1;
-        }
-        if (inSizeBytes <= 0 || outSizeBytes <= 0)
-        {
-            return -1;
-        }
-
         int bytesWritten = 0;
-        RleWord rleCount = 0;
-        std::uint8_t rleByte = *input;
+        const std::uint8_t *const inputEnd = input + inSizeBytes;
 
-        for (int i = 0; i < inSizeBytes; ++i, ++rleCount)
+        while (input != inputEnd)
         {
-            const std::uint8_t b = *input++;
+            const std::uint8_t rleByte = *input;
+            const std::uint8_t *const runEnd = findRunEnd(input + 1, inputEnd, rleByte);
+            std::ptrdiff_t runLength = runEnd - input;
+            input = runEnd;
 
-            // Output when we hit the end of a sequence or the max size of a RLE word:
-            if (b != rleByte || rleCount == MaxRunLength)
+            // Runs longer than the max size of a RLE word take several pairs:
+            while (runLength > 0)
             {
                 if ((bytesWritten + sizeof(RleWord) + sizeof(std::uint8_t)) > static_cast<unsigned>(outSizeBytes))
                 {
                     // Can't fit anymore data! Stop with an error.
                     return -1;
                 }
+                const RleWord rleCount = static_cast<RleWord>((runLength < MaxRunLength) ? runLength : MaxRunLength);
                 bytesWritten += writeData(output, rleCount);
                 bytesWritten += writeData(output, rleByte);
-                rleCount = 0;
-                rleByte = b;
+                runLength -= rleCount;
             }
         }
 
-        // Residual count at the end:
-        if (rleCount != 0)
+        return bytesWritten;
+    }
+
+    // Writes [literals, end) as literal packets. Returns false if they don't fit.
+    static bool writeLiterals(const std::uint8_t *literals, const std::uint8_t *const end,
+                              std::uint8_t *&output, const std::uint8_t *const outputEnd)
+    {
+        while (literals != end)
         {
-            if ((bytesWritten + sizeof(RleWord) + sizeof(std::uint8_t)) > static_cast<unsigned>(outSizeBytes))
+            const std::ptrdiff_t left = end - literals;
+            const int count = static_cast<int>((left < MaxLiteralRun) ? left : MaxLiteralRun);
+            if (outputEnd - output < 1 + count)
             {
-                return -1; // No more space! Output not complete.
+                return false;
             }
-            bytesWritten += writeData(output, rleCount);
-            bytesWritten += writeData(output, rleByte);
+            *output++ = static_cast<std::uint8_t>(count - 1);
+            std::memcpy(output, literals, count);
+            output += count;
+            literals += count;
         }
-
-        return bytesWritten;
+        return true;
     }
 
-    // ========================================================
+    static int encodePackBits(const std::uint8_t *input, const int inSizeBytes, std::uint8_t *output, const int outSizeBytes)
+    {
+        std::uint8_t *const outputStart = output;
+        const std::uint8_t *const outputEnd = output + outSizeBytes;
+        const std::uint8_t *const inputEnd = input + inSizeBytes;
+        const std::uint8_t *literals = input; // Start of the literal span not written yet.
+
+        while (input != inputEnd)
+        {
+            const std::uint8_t runByte = *input;
+            const std::uint8_t *const runEnd = findRunEnd(input + 1, inputEnd, runByte);
+            std::ptrdiff_t runLength = runEnd - input;
+
+            // A pair of bytes is only worth a repeat packet if it doesn't split a literal span.
+            if (runLength < 3 && !(runLength == 2 && literals == input))
+            {
+                input = runEnd;
+                continue;
+            }
+
+            if (!writeLiterals(literals, input, output, outputEnd))
+            {
+                return -1;
+            }
+            while (runLength >= 2)
+            {
+                if (outputEnd - output < 2)
+                {
+                    return -1;
+                }
+                const int count = static_cast<int>((runLength < MaxRepeatRun) ? runLength : MaxRepeatRun);
+                *output++ = static_cast<std::uint8_t>(1 - count);
+                *output++ = runByte;
+                runLength -= count;
+            }
+
+            // A single byte left over from splitting starts the next literal span.
+            input = runEnd;
+            literals = runEnd - runLength;
+        }
+
+        if (!writeLiterals(literals, inputEnd, output, outputEnd))
+        {
+            return -1;
+        }
+        return static_cast<int>(output - outputStart);
+    }
 
-    int easyDecode(const std::uint8_t *input, const int inSizeBytes, std::uint8_t *output, const int outSizeBytes)
+    int easyEncode(const std::uint8_t *input, const int inSizeBytes, std::uint8_t *output, const int outSizeBytes,
+                   const Format format)
     {
         if (input == nullptr || output == nullptr)
         {
@@ -129,30 +426,652 @@ namespace rle
             return -1;
         }
 
+        return (format == Format::PackBits) ? encodePackBits(input, inSizeBytes, output, outSizeBytes)
+                                            : encodeLegacy(input, inSizeBytes, output, outSizeBytes);
+    }
+
+    // ========================================================
+
+    int maxCompressedSize(const int inSizeBytes, const Format format)
+    {
+        if (inSizeBytes <= 0)
+        {
+            return 0;
+        }
+        if (format == Format::PackBits)
+        {
+            return inSizeBytes + (inSizeBytes + MaxLiteralRun - 1) / MaxLiteralRun;
+        }
+        return inSizeBytes * PairSizeBytes;
+    }
+
+    static int decodeLegacy(const std::uint8_t *input, const int inSizeBytes, std::uint8_t *output, const int outSizeBytes)
+    {
         int bytesWritten = 0;
         RleWord rleCount = 0;
         std::uint8_t rleByte = 0;
 
-        for (int i = 0; i < inSizeBytes; i += sizeof(rleCount) + sizeof(rleByte))
+        for (int i = 0; i < inSizeBytes; i += PairSizeBytes)
         {
+            if (inSizeBytes - i < PairSizeBytes)
+            {
+                return -1; // Input ends in the middle of a pair.
+            }
             readData(input, rleCount);
             readData(input, rleByte);
 
             // Replicate the RLE packet.
-            while (rleCount--)
+            if (rleCount > outSizeBytes - bytesWritten)
+            {
+                // Reached end of output and we are not done yet, stop with an error.
+                return -1;
+            }
+            std::memset(output, rleByte, rleCount);
+            output += rleCount;
+            bytesWritten += rleCount;
+        }
+
+        return bytesWritten;
+    }
+
+    static int decodePackBits(const std::uint8_t *input, const int inSizeBytes, std::uint8_t *output, const int outSizeBytes)
+    {
+        const std::uint8_t *const inputEnd = input + inSizeBytes;
+        int bytesWritten = 0;
+
+        while (input != inputEnd)
+        {
+            const int control = static_cast<std::int8_t>(*input++);
+            if (control >= 0)
             {
-                *output++ = rleByte;
-                if (++bytesWritten == outSizeBytes && rleCount != 0)
+                const int count = control + 1;
+                if (inputEnd - input < count || count > outSizeBytes - bytesWritten)
+                {
+                    return -1; // Truncated literals, or no room for them.
+                }
+                std::memcpy(output + bytesWritten, input, count);
+                input += count;
+                bytesWritten += count;
+            }
+            else if (control != -128)
+            {
+                const int count = 1 - control;
+                if (input == inputEnd || count > outSizeBytes - bytesWritten)
                 {
-                    // Reached end of output and we are not done yet, stop with an error.
                     return -1;
                 }
+                std::memset(output + bytesWritten, *input++, count);
+                bytesWritten += count;
             }
         }
 
         return bytesWritten;
     }
 
+    int easyDecode(const std::uint8_t *input, const int inSizeBytes, std::uint8_t *output, const int outSizeBytes,
+                   const Format format)
+    {
+        if (input == nullptr || output == nullptr)
+        {
+            return -1;
+        }
+        if (inSizeBytes <= 0 || outSizeBytes <= 0)
+        {
+            return -1;
+        }
+
+        return (format == Format::PackBits) ? decodePackBits(input, inSizeBytes, output, outSizeBytes)
+                                            : decodeLegacy(input, inSizeBytes, output, outSizeBytes);
+    }
+
+    // ========================================================
+    // Element runs:
+    // ========================================================
+
+    // Run length fields. Runs longer than maxRun() take several pairs.
+    template <typename CountT>
+    struct CountCodec {
+        static constexpr int Tag = (sizeof(CountT) == 1) ? 0 : (sizeof(CountT) == 2) ? 1 : 2; // In the tag byte.
+
+        static std::int64_t maxRun() { return static_cast<CountT>(~CountT(0)); }
+
+        static int size(std::int64_t) { return sizeof(CountT); }
+
+        static void write(std::uint8_t *&output, const std::int64_t count)
+        {
+            for (std::size_t i = 0; i < sizeof(CountT); ++i)
+            {
+                *output++ = static_cast<std::uint8_t>(count >> (i * 8));
+            }
+        }
+
+        static bool read(const std::uint8_t *&input, const std::uint8_t *const end, std::int64_t &count)
+        {
+            if (end - input < static_cast<std::ptrdiff_t>(sizeof(CountT)))
+            {
+                return false;
+            }
+            count = 0;
+            for (std::size_t i = 0; i < sizeof(CountT); ++i)
+            {
+                count |= std::int64_t(*input++) << (i * 8);
+            }
+            return true;
+        }
+    };
+
+    template <>
+    struct CountCodec<VarintCount> {
+        static constexpr int Tag = 3;
+
+        static std::int64_t maxRun() { return 0x7FFFFFFF; }
+
+        static int size(std::int64_t count)
+        {
+            int bytes = 1;
+            for (; count >= 0x80; count >>= 7)
+            {
+                ++bytes;
+            }
+            return bytes;
+        }
+
+        static void write(std::uint8_t *&output, std::int64_t count)
+        {
+            for (; count >= 0x80; count >>= 7)
+            {
+                *output++ = static_cast<std::uint8_t>(count | 0x80);
+            }
+            *output++ = static_cast<std::uint8_t>(count);
+        }
+
+        static bool read(const std::uint8_t *&input, const std::uint8_t *const end, std::int64_t &count)
+        {
+            count = 0;
+            for (int shift = 0; shift < 35; shift += 7)
+            {
+                if (input == end)
+                {
+                    return false;
+                }
+                const std::uint8_t b = *input++;
+                count |= std::int64_t(b & 0x7F) << shift;
+                if ((b & 0x80) == 0)
+                {
+                    return count <= maxRun();
+                }
+            }
+            return false; // Longer than any count we write.
+        }
+    };
+
+    // Number of elements from ptr on that are the same as the one at ptr. end is at an element boundary.
+    template <typename ElemT>
+    static std::int64_t elementRunLength(const std::uint8_t *const ptr, const std::uint8_t *const end)
+    {
+        std::uint8_t pattern[8];
+        for (int i = 0; i < 8; ++i)
+        {
+            pattern[i] = ptr[i % sizeof(ElemT)];
+        }
+        const std::uint8_t *const runEnd = findPatternEnd(ptr + sizeof(ElemT), end, pattern);
+        return (runEnd - ptr) / static_cast<std::ptrdiff_t>(sizeof(ElemT));
+    }
+
+    // Output size for each count type in the order of the tag byte, without writing anything.
+    template <typename ElemT>
+    static void measureRuns(const std::uint8_t *input, const int elemCount, std::int64_t (&sizes)[4])
+    {
+        const std::uint8_t *const end = input + std::size_t(elemCount) * sizeof(ElemT);
+        const std::int64_t elemBytes = sizeof(ElemT);
+        const std::int64_t max8 = CountCodec<std::uint8_t>::maxRun();
+        const std::int64_t max16 = CountCodec<std::uint16_t>::maxRun();
+        const std::int64_t max32 = CountCodec<std::uint32_t>::maxRun();
+
+        sizes[0] = sizes[1] = sizes[2] = sizes[3] = 0;
+        while (input != end)
+        {
+            const std::int64_t runLength = elementRunLength<ElemT>(input, end);
+            input += runLength * elemBytes;
+
+            sizes[0] += (runLength + max8 - 1) / max8 * (1 + elemBytes);
+            sizes[1] += (runLength + max16 - 1) / max16 * (2 + elemBytes);
+            sizes[2] += (runLength + max32 - 1) / max32 * (4 + elemBytes);
+            sizes[3] += CountCodec<VarintCount>::size(runLength) + elemBytes;
+        }
+    }
+
+    template <typename ElemT, typename CountT>
+    static int encodeElements(const std::uint8_t *input, const int elemCount, std::uint8_t *output, const int outSizeBytes)
+    {
+        using Count = CountCodec<CountT>;
+        constexpr std::ptrdiff_t ElemBytes = sizeof(ElemT);
+
+        const std::uint8_t *const end = input + std::size_t(elemCount) * ElemBytes;
+        std::uint8_t *const outputStart = output;
+        std::uint8_t *const outputEnd = output + outSizeBytes;
+
+        while (input != end)
+        {
+            std::int64_t runLength = elementRunLength<ElemT>(input, end);
+            const std::uint8_t *const element = input;
+            input += runLength * ElemBytes;
+
+            while (runLength > 0)
+            {
+                const std::int64_t count = (runLength < Count::maxRun()) ? runLength : Count::maxRun();
+                if (outputEnd - output < Count::size(count) + ElemBytes)
+                {
+                    return -1;
+                }
+                Count::write(output, count);
+                std::memcpy(output, element, ElemBytes);
+                output += ElemBytes;
+                runLength -= count;
+            }
+        }
+
+        return static_cast<int>(output - outputStart);
+    }
+
+    template <typename ElemT, typename CountT>
+    static int decodeElements(const std::uint8_t *input, const int inSizeBytes, std::uint8_t *output, const int outElemCount)
+    {
+        constexpr std::ptrdiff_t ElemBytes = sizeof(ElemT);
+        const std::uint8_t *const end = input + inSizeBytes;
+        std::int64_t elemsWritten = 0;
+
+        while (input != end)
+        {
+            std::int64_t count;
+            if (!CountCodec<CountT>::read(input, end, count) || end - input < ElemBytes)
+            {
+                return -1; // Input ends in the middle of a pair.
+            }
+            if (count > outElemCount - elemsWritten)
+            {
+                return -1;
+            }
+
+            std::uint8_t *dest = output + elemsWritten * ElemBytes;
+            if (ElemBytes == 1)
+            {
+                std::memset(dest, *input, static_cast<std::size_t>(count));
+            }
+            else
+            {
+                for (std::int64_t i = 0; i < count; ++i, dest += ElemBytes)
+                {
+                    std::memcpy(dest, input, ElemBytes);
+                }
+            }
+            input += ElemBytes;
+            elemsWritten += count;
+        }
+
+        return static_cast<int>(elemsWritten);
+    }
+
+    template <typename ElemT, typename CountT>
+    int Encoder<ElemT, CountT>::encode(const ElemT *input, const int elemCount, std::uint8_t *output, const int outSizeBytes)
+    {
+        if (input == nullptr || output == nullptr)
+        {
+            return -1;
+        }
+        if (elemCount <= 0 || outSizeBytes <= 0)
+        {
+            return -1;
+        }
+
+        return encodeElements<ElemT, CountT>(reinterpret_cast<const std::uint8_t *>(input), elemCount, output, outSizeBytes);
+    }
+
+    template <typename ElemT, typename CountT>
+    int Encoder<ElemT, CountT>::encodedSize(const ElemT *input, const int elemCount)
+    {
+        if (input == nullptr || elemCount <= 0)
+        {
+            return 0;
+        }
+
+        std::int64_t sizes[4];
+        measureRuns<ElemT>(reinterpret_cast<const std::uint8_t *>(input), elemCount, sizes);
+        return static_cast<int>(sizes[CountCodec<CountT>::Tag]);
+    }
+
+    template <typename ElemT, typename CountT>
+    int Encoder<ElemT, CountT>::maxCompressedSize(const int elemCount)
+    {
+        return (elemCount > 0) ? elemCount * static_cast<int>(CountCodec<CountT>::size(1) + sizeof(ElemT)) : 0;
+    }
+
+    template <typename ElemT, typename CountT>
+    int Decoder<ElemT, CountT>::decode(const std::uint8_t *input, const int inSizeBytes, ElemT *output, const int outElemCount)
+    {
+        if (input == nullptr || output == nullptr)
+        {
+            return -1;
+        }
+        if (inSizeBytes <= 0 || outElemCount <= 0)
+        {
+            return -1;
+        }
+
+        return decodeElements<ElemT, CountT>(input, inSizeBytes, reinterpret_cast<std::uint8_t *>(output), outElemCount);
+    }
+
+    template class Encoder<std::uint8_t, std::uint8_t>;
+    template class Encoder<std::uint8_t, std::uint16_t>;
+    template class Encoder<std::uint8_t, std::uint32_t>;
+    template class Encoder<std::uint8_t, VarintCount>;
+    template class Encoder<std::uint16_t, std::uint8_t>;
+    template class Encoder<std::uint16_t, std::uint16_t>;
+    template class Encoder<std::uint16_t, std::uint32_t>;
+    template class Encoder<std::uint16_t, VarintCount>;
+    template class Encoder<std::uint32_t, std::uint8_t>;
+    template class Encoder<std::uint32_t, std::uint16_t>;
+    template class Encoder<std::uint32_t, std::uint32_t>;
+    template class Encoder<std::uint32_t, VarintCount>;
+    template class Encoder<std::uint64_t, std::uint8_t>;
+    template class Encoder<std::uint64_t, std::uint16_t>;
+    template class Encoder<std::uint64_t, std::uint32_t>;
+    template class Encoder<std::uint64_t, VarintCount>;
+
+    template class Decoder<std::uint8_t, std::uint8_t>;
+    template class Decoder<std::uint8_t, std::uint16_t>;
+    template class Decoder<std::uint8_t, std::uint32_t>;
+    template class Decoder<std::uint8_t, VarintCount>;
+    template class Decoder<std::uint16_t, std::uint8_t>;
+    template class Decoder<std::uint16_t, std::uint16_t>;
+    template class Decoder<std::uint16_t, std::uint32_t>;
+    template class Decoder<std::uint16_t, VarintCount>;
+    template class Decoder<std::uint32_t, std::uint8_t>;
+    template class Decoder<std::uint32_t, std::uint16_t>;
+    template class Decoder<std::uint32_t, std::uint32_t>;
+    template class Decoder<std::uint32_t, VarintCount>;
+    template class Decoder<std::uint64_t, std::uint8_t>;
+    template class Decoder<std::uint64_t, std::uint16_t>;
+    template class Decoder<std::uint64_t, std::uint32_t>;
+    template class Decoder<std::uint64_t, VarintCount>;
+
+    // ========================================================
+    // easyEncodeTagged() / easyDecodeTagged():
+    // ========================================================
+
+    // Tag of an input copied as is. The other fields are zero.
+    static constexpr int StoredTag = 0x10;
+
+    // Indexed by the tag byte fields, log2 element size then count type.
+    using MeasureFunc = void (*)(const std::uint8_t *, int, std::int64_t (&)[4]);
+    using EncodeFunc = int (*)(const std::uint8_t *, int, std::uint8_t *, int);
+    using DecodeFunc = int (*)(const std::uint8_t *, int, std::uint8_t *, int);
+
+    static const MeasureFunc measureFuncs[4] = {
+        &measureRuns<std::uint8_t>, &measureRuns<std::uint16_t>, &measureRuns<std::uint32_t>, &measureRuns<std::uint64_t>
+    };
+
+    static const EncodeFunc encodeFuncs[4][4] = {
+        { &encodeElements<std::uint8_t, std::uint8_t>, &encodeElements<std::uint8_t, std::uint16_t>,
+          &encodeElements<std::uint8_t, std::uint32_t>, &encodeElements<std::uint8_t, VarintCount> },
+        { &encodeElements<std::uint16_t, std::uint8_t>, &encodeElements<std::uint16_t, std::uint16_t>,
+          &encodeElements<std::uint16_t, std::uint32_t>, &encodeElements<std::uint16_t, VarintCount> },
+        { &encodeElements<std::uint32_t, std::uint8_t>, &encodeElements<std::uint32_t, std::uint16_t>,
+          &encodeElements<std::uint32_t, std::uint32_t>, &encodeElements<std::uint32_t, VarintCount> },
+        { &encodeElements<std::uint64_t, std::uint8_t>, &encodeElements<std::uint64_t, std::uint16_t>,
+          &encodeElements<std::uint64_t, std::uint32_t>, &encodeElements<std::uint64_t, VarintCount> }
+    };
+
+    static const DecodeFunc decodeFuncs[4][4] = {
+        { &decodeElements<std::uint8_t, std::uint8_t>, &decodeElements<std::uint8_t, std::uint16_t>,
+          &decodeElements<std::uint8_t, std::uint32_t>, &decodeElements<std::uint8_t, VarintCount> },
+        { &decodeElements<std::uint16_t, std::uint8_t>, &decodeElements<std::uint16_t, std::uint16_t>,
+          &decodeElements<std::uint16_t, std::uint32_t>, &decodeElements<std::uint16_t, VarintCount> },
+        { &decodeElements<std::uint32_t, std::uint8_t>, &decodeElements<std::uint32_t, std::uint16_t>,
+          &decodeElements<std::uint32_t, std::uint32_t>, &decodeElements<std::uint32_t, VarintCount> },
+        { &decodeElements<std::uint64_t, std::uint8_t>, &decodeElements<std::uint64_t, std::uint16_t>,
+          &decodeElements<std::uint64_t, std::uint32_t>, &decodeElements<std::uint64_t, VarintCount> }
+    };
+
+    int easyEncodeTagged(const std::uint8_t *input, const int inSizeBytes, std::uint8_t *output, const int outSizeBytes)
+    {
+        if (input == nullptr || output == nullptr)
+        {
+            return -1;
+        }
+        if (inSizeBytes <= 0 || outSizeBytes <= 0)
+        {
+            return -1;
+        }
+
+        // Find the smallest output. Ties keep the narrower element and count.
+        int bestElemLog2 = 0;
+        int bestCount = 0;
+        std::int64_t bestSize = -1;
+        for (int elemLog2 = 0; elemLog2 < 4; ++elemLog2)
+        {
+            if ((inSizeBytes & ((1 << elemLog2) - 1)) != 0)
+            {
+                continue;
+            }
+
+            std::int64_t sizes[4];
+            measureFuncs[elemLog2](input, inSizeBytes >> elemLog2, sizes);
+            for (int count = 0; count < 4; ++count)
+            {
+                if (bestSize < 0 || sizes[count] < bestSize)
+                {
+                    bestSize = sizes[count];
+                    bestElemLog2 = elemLog2;
+                    bestCount = count;
+                }
+            }
+        }
+
+        // Run-free data would expand, so store it instead.
+        if (bestSize >= inSizeBytes)
+        {
+            if (1 + inSizeBytes > outSizeBytes)
+            {
+                return -1;
+            }
+            output[0] = static_cast<std::uint8_t>(StoredTag);
+            std::memcpy(output + 1, input, inSizeBytes);
+            return 1 + inSizeBytes;
+        }
+
+        if (1 + bestSize > outSizeBytes)
+        {
+            return -1;
+        }
+
+        output[0] = static_cast<std::uint8_t>((bestCount << 2) | bestElemLog2);
+        const int encodedBytes = encodeFuncs[bestElemLog2][bestCount](input, inSizeBytes >> bestElemLog2,
+                                                                      output + 1, outSizeBytes - 1);
+        return (encodedBytes < 0) ? -1 : 1 + encodedBytes;
+    }
+
+    int easyDecodeTagged(const std::uint8_t *input, const int inSizeBytes, std::uint8_t *output, const int outSizeBytes)
+    {
+        if (input == nullptr || output == nullptr)
+        {
+            return -1;
+        }
+        if (inSizeBytes <= 0 || outSizeBytes <= 0)
+        {
+            return -1;
+        }
+
+        const int tag = input[0];
+        if (tag == StoredTag)
+        {
+            const int storedBytes = inSizeBytes - 1;
+            if (storedBytes > outSizeBytes)
+            {
+                return -1;
+            }
+            std::memcpy(output, input + 1, storedBytes);
+            return storedBytes;
+        }
+        if ((tag & 0xF0) != 0)
+        {
+            return -1; // Reserved bits set, or stored with other fields.
+        }
+
+        const int elemLog2 = tag & 3;
+        const int elemsDecoded = decodeFuncs[elemLog2][(tag >> 2) & 3](input + 1, inSizeBytes - 1,
+                                                                       output, outSizeBytes >> elemLog2);
+        return (elemsDecoded < 0) ? -1 : (elemsDecoded << elemLog2);
+    }
+
+    int maxCompressedSizeTagged(const int inSizeBytes)
+    {
+        return (inSizeBytes > 0) ? 1 + inSizeBytes : 0;
+    }
+
+    // ========================================================
+    // class StreamEncoder:
+    // ========================================================
+
+    StreamEncoder::StreamEncoder()
+        : pendingBytes(0), runLength(0), runByte(0)
+    {
+    }
+
+    bool StreamEncoder::flushPending()
+    {
+        while (pendingBytes > 0)
+        {
+            if (availOut == 0)
+            {
+                return false;
+            }
+            *nextOut++ = pending[PairSizeBytes - pendingBytes];
+            --availOut;
+            ++totalOut;
+            --pendingBytes;
+        }
+        return true;
+    }
+
+    StreamStatus StreamEncoder::encode(const bool finish)
+    {
+        for (;;)
+        {
+            if (!flushPending())
+            {
+                return StreamStatus::Ok; // Output buffer full.
+            }
+
+            if (availIn == 0)
+            {
+                break;
+            }
+
+            if (runLength == 0)
+            {
+                runByte = *nextIn;
+            }
+
+            // Extend the current run as far as the input chunk goes:
+            const std::size_t room = MaxRunLength - runLength;
+            const std::size_t count = (room < availIn) ? room : availIn;
+            const std::size_t i = static_cast<std::size_t>(findRunEnd(nextIn, nextIn + count, runByte) - nextIn);
+            runLength += static_cast<int>(i);
+            nextIn += i;
+            availIn -= i;
+            totalIn += i;
+
+            // Output when we hit the end of a sequence or the max size of a RLE word:
+            if (availIn != 0)
+            {
+                const RleWord rleCount = static_cast<RleWord>(runLength);
+                std::memcpy(pending, &rleCount, sizeof(RleWord));
+                pending[sizeof(RleWord)] = runByte;
+                pendingBytes = PairSizeBytes;
+                runLength = 0;
+            }
+        }
+
+        if (!finish)
+        {
+            return StreamStatus::Ok; // Needs more input.
+        }
+
+        // Residual count at the end:
+        if (runLength != 0)
+        {
+            const RleWord rleCount = static_cast<RleWord>(runLength);
+            std::memcpy(pending, &rleCount, sizeof(RleWord));
+            pending[sizeof(RleWord)] = runByte;
+            pendingBytes = PairSizeBytes;
+            runLength = 0;
+
+            if (!flushPending())
+            {
+                return StreamStatus::Ok;
+            }
+        }
+        return StreamStatus::StreamEnd;
+    }
+
+    // ========================================================
+    // class StreamDecoder:
+    // ========================================================
+
+    StreamDecoder::StreamDecoder()
+        : pairBytes(0), runLeft(0), runByte(0)
+    {
+    }
+
+    StreamStatus StreamDecoder::decode(const bool finish)
+    {
+        for (;;)
+        {
+            // Replicate the RLE packet.
+            if (runLeft > 0)
+            {
+                const std::size_t count = (static_cast<std::size_t>(runLeft) < availOut) ? runLeft : availOut;
+                if (count == 0)
+                {
+                    return StreamStatus::Ok; // Output buffer full.
+                }
+                std::memset(nextOut, runByte, count);
+                nextOut += count;
+                availOut -= count;
+                totalOut += count;
+                runLeft -= static_cast<int>(count);
+                continue;
+            }
+
+            if (availIn == 0)
+            {
+                if (!finish)
+                {
+                    return StreamStatus::Ok; // Needs more input.
+                }
+                // A pair cut short means the input was truncated.
+                return (pairBytes == 0) ? StreamStatus::StreamEnd : StreamStatus::Error;
+            }
+
+            // Gather the next (count, byte) pair, which might straddle input chunks:
+            while (pairBytes < PairSizeBytes && availIn != 0)
+            {
+                pair[pairBytes++] = *nextIn++;
+                --availIn;
+                ++totalIn;
+            }
+            if (pairBytes == PairSizeBytes)
+            {
+                RleWord rleCount;
+                std::memcpy(&rleCount, pair, sizeof(RleWord));
+                runByte = pair[sizeof(RleWord)];
+                runLeft = rleCount;
+                pairBytes = 0;
+            }
+        }
+    }
+
 } // namespace rle {}
 
 // ================ End of implementation =================